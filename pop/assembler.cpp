@@ -8,21 +8,131 @@
 #endif
 
 #include <pop/assembler.hpp>
+#include <pop/constants.hpp>
 #include <pop/error.hpp>
+#include <pop/fusion.hpp>
+#include <pop/image.hpp>
+#include <cstdint>
 #include <iostream>
+#include <set>
 #include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace Pop
 {
 
 void assemble(ModulePtr &mod, std::ostream &out)
+{
+	auto ops = transform(mod);
+	fuse_instructions(ops);
+	assemble(ops, out);
+}
+
+// moves the value of each literal into the pool, leaving a PUSH_CONST of
+// it in its place, except for ints small enough to be pushed directly
+static void pool_constants(InstructionList &ops, ConstantPool &pool)
+{
+	for (auto &op : ops)
+	{
+		Uint32 index;
+		switch (op->code)
+		{
+			case OpCode::OP_PUSH_INT:
+			{
+				auto value = static_cast<PushInt *>(op.get())->value;
+				if (value >= INT32_MIN && value <= INT32_MAX)
+					continue;
+				index = pool.add_int(value);
+				break;
+			}
+			case OpCode::OP_PUSH_FLOAT:
+				index =
+				    pool.add_float(static_cast<PushFloat *>(op.get())->value);
+				break;
+			case OpCode::OP_PUSH_STRING:
+				index = pool.add_string(
+				    static_cast<PushString *>(op.get())->value);
+				break;
+			default:
+				continue;
+		}
+		auto line = op->line;
+		op = mkop<PushConst>(index, pool.constants[index].repr(), op->addr);
+		op->line = line;
+	}
+}
+
+// the globals the code defines and the ones it uses, leaving out those it
+// defines itself
+static void find_globals(const InstructionList &ops,
+                         std::set<std::string> &exports,
+                         std::set<std::string> &imports)
+{
+	for (auto &op : ops)
+	{
+		switch (op->code)
+		{
+			case OpCode::OP_BIND:
+				exports.insert(static_cast<Bind *>(op.get())->name);
+				break;
+			case OpCode::OP_LOAD_GLOBAL:
+				imports.insert(static_cast<LoadGlobal *>(op.get())->name);
+				break;
+			case OpCode::OP_STORE_GLOBAL:
+				imports.insert(static_cast<StoreGlobal *>(op.get())->name);
+				break;
+			case OpCode::OP_CALL_SYMBOL:
+			case OpCode::OP_TAIL_CALL_SYMBOL:
+				imports.insert(static_cast<CallSymbol *>(op.get())->name);
+				break;
+			case OpCode::OP_ADD_SYMBOL_INT:
+			case OpCode::OP_SUB_SYMBOL_INT:
+			case OpCode::OP_EQ_SYMBOL_INT:
+			case OpCode::OP_NE_SYMBOL_INT:
+			case OpCode::OP_GT_SYMBOL_INT:
+			case OpCode::OP_GE_SYMBOL_INT:
+			case OpCode::OP_LT_SYMBOL_INT:
+			case OpCode::OP_LE_SYMBOL_INT:
+				imports.insert(static_cast<SymbolIntOp *>(op.get())->name);
+				break;
+			default:
+				break;
+		}
+	}
+	for (auto &name : exports)
+		imports.erase(name);
+}
+
+static std::string symbol_list(const std::set<std::string> &names,
+                               const std::vector<std::string> &symbols)
+{
+	std::unordered_map<std::string, Uint32> index_of;
+	for (Uint32 i = 0; i < symbols.size(); i++)
+		index_of.emplace(symbols[i], i);
+	std::stringstream list;
+	CodeBuffer buf(list);
+	buf.put_u32(names.size());
+	for (auto &name : names)
+		buf.put_u32(index_of.at(name));
+	return list.str();
+}
+
+void assemble(InstructionList &input, std::ostream &out)
 {
 	LabelMap labels;
 	InstructionList ops;
+	ConstantPool pool;
 	CodeAddr offset = 0;
+	// the index of the op each label is at
+	std::unordered_map<std::string, size_t> label_ops;
+
+	pool_constants(input, pool);
 
-	// first pass to resolve then drop labels
-	for (auto &op : transform(mod))
+	// first pass to drop labels, placing them where they'd be if every op
+	// took as many bytes as it can
+	for (auto &op : input)
 	{
 		if (op->code == OpCode::OP_LABEL)
 		{
@@ -34,6 +144,7 @@ void assemble(ModulePtr &mod, std::ostream &out)
 				ss << "multiple labels named '" << name << "'";
 				throw RuntimeError(ss.str());
 			}
+			label_ops.emplace(name, ops.size());
 		}
 		else
 		{
@@ -42,12 +153,73 @@ void assemble(ModulePtr &mod, std::ostream &out)
 		}
 	}
 
-	// second pass to generate byte code
-	std::stringstream bcout;
-	CodeBuffer bcbuf(bcout);
+	std::set<std::string> exports, imports;
+	find_globals(ops, exports, imports);
+
+	// lay the code out, starting with every op as big as it can be, then
+	// sizing each for the distances in the last layout until nothing moves,
+	// the distances can only shrink so the code settles after a few passes
+	std::vector<CodeAddr> starts(ops.size() + 1), next(ops.size() + 1);
+	for (size_t i = 0; i < ops.size(); i++)
+		starts[i + 1] = starts[i] + ops[i]->size();
+	for (bool moved = true; moved;)
+	{
+		std::stringstream scratch;
+		CodeBuffer sizer(scratch);
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			sizer.offset = starts[i];
+			ops[i]->codegen(sizer, labels);
+			next[i + 1] = next[i] + (sizer.offset - starts[i]);
+		}
+		moved = (next != starts);
+		std::swap(starts, next);
+		for (auto &label : label_ops)
+			labels[label.first] = starts[label.second];
+	}
+
+	// then generate the byte code for that layout
+	std::stringstream code;
+	CodeBuffer codebuf(code);
 	for (auto &op : ops)
-		op->codegen(bcbuf, labels);
-	out << bcout.str();
+		op->codegen(codebuf, labels);
+
+	// note where each line starts
+	std::stringstream lines;
+	CodeBuffer linebuf(lines);
+	std::vector<std::pair<CodeAddr, Uint32>> line_starts;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		auto line = ops[i]->line;
+		if (line != 0 &&
+		    (line_starts.empty() || line_starts.back().second != line))
+			line_starts.emplace_back(starts[i], line);
+	}
+	linebuf.put_u32(line_starts.size());
+	for (auto &start : line_starts)
+		linebuf.put_u32(start.first).put_u32(start.second);
+
+	std::stringstream constants, symbols, relocs;
+	CodeBuffer constbuf(constants), symbuf(symbols), relocbuf(relocs);
+	pool.codegen(constbuf);
+	symbuf.put_u32(codebuf.symbols.size());
+	for (auto &name : codebuf.symbols)
+		symbuf.put_string(name);
+	relocbuf.put_u32(codebuf.relocations.size());
+	for (auto &reloc : codebuf.relocations)
+		relocbuf.put_u8(Uint8(reloc.kind)).put_u32(reloc.offset);
+
+	ImageWriter image;
+	image.add_section(SectionKind::CODE, code.str());
+	image.add_section(SectionKind::CONSTANTS, constants.str());
+	image.add_section(SectionKind::SYMBOLS, symbols.str());
+	image.add_section(SectionKind::LINES, lines.str());
+	image.add_section(SectionKind::RELOCS, relocs.str());
+	image.add_section(SectionKind::EXPORTS,
+	                  symbol_list(exports, codebuf.symbols));
+	image.add_section(SectionKind::IMPORTS,
+	                  symbol_list(imports, codebuf.symbols));
+	image.write(out);
 }
 
 // namespace Pop
@@ -18,6 +18,7 @@ namespace Pop
 {
 
 void assemble(ModulePtr &mod, std::ostream &out);
+void assemble(InstructionList &ops, std::ostream &out);
 
 // namespace Pop
 }
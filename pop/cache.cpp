@@ -0,0 +1,126 @@
+// cache.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/cache.hpp>
+#include <pop/error.hpp>
+#include <pop/format.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "unknown"
+#endif
+
+namespace Pop
+{
+
+static Uint64 hash_bytes(Uint64 hash, const std::string &bytes)
+{
+	for (auto ch : bytes)
+	{
+		hash ^= Uint8(ch);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// makes the directory and any missing parents
+static bool make_dirs(const std::string &path)
+{
+	struct stat st;
+	if (::stat(path.c_str(), &st) == 0)
+		return S_ISDIR(st.st_mode);
+	auto slash = path.rfind('/');
+	if (slash != path.npos && slash > 0 && !make_dirs(path.substr(0, slash)))
+		return false;
+	return ::mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+CodeCache::CodeCache(const std::string &dir) : dir(dir)
+{
+}
+
+std::string CodeCache::default_dir()
+{
+	if (auto dir = std::getenv("POP_CACHE_DIR"))
+		return dir;
+	if (auto dir = std::getenv("XDG_CACHE_HOME"))
+		return std::string(dir) + "/pop";
+	if (auto home = std::getenv("HOME"))
+		return std::string(home) + "/.cache/pop";
+	return "";
+}
+
+std::string CodeCache::key(const std::string &source, unsigned int opt_level)
+{
+	// images from another compiler version may not even be readable
+	auto version = format("pop %s image %u -O%u\n", PACKAGE_VERSION,
+	                      unsigned(IMAGE_VERSION), opt_level);
+	auto hash = hash_bytes(14695981039346656037ull, version);
+	hash = hash_bytes(hash, source);
+	return format("%016llx", static_cast<unsigned long long>(hash));
+}
+
+std::string CodeCache::path_of(const std::string &key) const
+{
+	return dir + "/" + key + ".pbc";
+}
+
+std::unique_ptr<MappedFile> CodeCache::find(const std::string &key) const
+{
+	auto path = path_of(key);
+	if (dir.empty() || ::access(path.c_str(), R_OK) != 0)
+		return nullptr;
+	try
+	{
+		std::unique_ptr<MappedFile> file(new MappedFile(path));
+		Image image(file->data(), file->size());
+		return file;
+	}
+	catch (RuntimeError &)
+	{
+		// damaged or from an incompatible compiler, it gets replaced
+		return nullptr;
+	}
+}
+
+bool CodeCache::store(const std::string &key, const std::string &image) const
+{
+	if (dir.empty() || !make_dirs(dir))
+		return false;
+	auto path = path_of(key);
+	auto tmp_path = format("%s.%ld.tmp", path.c_str(), long(::getpid()));
+	int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	size_t written = 0;
+	while (written < image.size())
+	{
+		auto n = ::write(fd, image.data() + written, image.size() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		written += size_t(n);
+	}
+	if (::close(fd) != 0 || written != image.size() ||
+	    std::rename(tmp_path.c_str(), path.c_str()) != 0)
+	{
+		std::remove(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+// namespace Pop
+}
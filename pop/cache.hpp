@@ -0,0 +1,56 @@
+// cache.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_CACHE_HPP
+#define POP_CACHE_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/image.hpp>
+#include <pop/optimizer.hpp>
+#include <memory>
+#include <string>
+
+namespace Pop
+{
+
+// A directory of images compiled from sources, each named for a hash of
+// the source text, the compiler version and the optimization level.
+// Whether a cached image can be used depends only on those, not on file
+// times or on the source's directory being writable.
+class CodeCache
+{
+public:
+	// the directory doesn't need to exist until something is stored
+	CodeCache(const std::string &dir);
+
+	// $POP_CACHE_DIR, else "pop" in $XDG_CACHE_HOME or ~/.cache, or an
+	// empty string if none of those are set
+	static std::string default_dir();
+
+	// the key the image compiled from the source is stored under
+	static std::string key(const std::string &source,
+	                       unsigned int opt_level = DEFAULT_OPT_LEVEL);
+
+	// the cached image, or null if there isn't a valid one
+	std::unique_ptr<MappedFile> find(const std::string &key) const;
+
+	// stores the image, written to a temporary file and then renamed into
+	// place so a partial image is never found, returns false if it
+	// couldn't be stored
+	bool store(const std::string &key, const std::string &image) const;
+
+private:
+	std::string dir;
+
+	std::string path_of(const std::string &key) const;
+};
+
+// namespace Pop
+}
+
+#endif // POP_CACHE_HPP
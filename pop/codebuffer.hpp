@@ -10,54 +10,97 @@
 #error "Invalid individual include, include only the <pop/pop.hpp> header"
 #endif
 
+#include <pop/endian.hpp>
 #include <pop/types.hpp>
 #include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace Pop
 {
 
+// Operands other than the opcode and the odd byte are LEB128 encoded,
+// seven bits per byte from the least significant, with the top bit set on
+// all but the last byte. Numbers which can be negative are sign-extended
+// from the last byte's second-highest bit (SLEB128).
+
+// the number of bytes the value takes as a ULEB128
+static inline size_t uleb_size(Uint64 v)
+{
+	size_t n = 1;
+	while (v >= 0x80)
+	{
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+// the number of bytes the value takes as a SLEB128
+static inline size_t sleb_size(Int64 v)
+{
+	size_t n = 1;
+	while (v < -0x40 || v >= 0x40)
+	{
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+// the most bytes an index or count up to a u32 takes
+static constexpr size_t MAX_INDEX_SIZE = 5;
+// the most bytes a relative code address takes
+static constexpr size_t MAX_TARGET_SIZE = (sizeof(CodeAddr) * 8 + 7) / 7;
+
+// What an operand refers to, for the linker to fix up when the code is
+// moved into another image
+enum class RelocKind : Uint8
+{
+	ADDRESS,  // an SLEB128 code address, relative to where it's stored
+	SYMBOL,   // a ULEB128 index into the SYMBOLS section
+	CONSTANT, // a ULEB128 index into the CONSTANTS section
+};
+
+struct Relocation
+{
+	RelocKind kind;
+	Uint32 offset; // of the operand in the code
+};
+
 class CodeBuffer
 {
 public:
 	std::ostream &out;
+	Uint32 offset;                    // number of bytes put so far
+	std::vector<std::string> symbols; // the names put_symbol() refers to
+	std::vector<Relocation> relocations;
 
-	CodeBuffer(std::ostream &out) : out(out)
+	CodeBuffer(std::ostream &out) : out(out), offset(0)
 	{
 	}
 
 	CodeBuffer &put_u8(Uint8 b)
 	{
 		out.write(reinterpret_cast<const char *>(&b), 1);
+		offset++;
 		return *this;
 	}
 
 	CodeBuffer &put_u16(Uint16 v)
 	{
-		put_u8((v >> 8) & 0xFF);
-		put_u8(v & 0xFF);
-		return *this;
+		return put_le(v);
 	}
 
 	CodeBuffer &put_u32(Uint32 v)
 	{
-		put_u8((v >> 24) & 0xFF);
-		put_u8((v >> 16) & 0xFF);
-		put_u8((v >> 8) & 0xFF);
-		put_u8(v & 0xFF);
-		return *this;
+		return put_le(v);
 	}
 
 	CodeBuffer &put_u64(Uint64 v)
 	{
-		put_u8((v >> 56ull) & 0xFFull);
-		put_u8((v >> 48ull) & 0xFFull);
-		put_u8((v >> 40ull) & 0xFFull);
-		put_u8((v >> 32ull) & 0xFFull);
-		put_u8((v >> 24ull) & 0xFFull);
-		put_u8((v >> 16ull) & 0xFFull);
-		put_u8((v >> 8ull) & 0xFFull);
-		put_u8(v & 0xFFull);
-		return *this;
+		return put_le(v);
 	}
 
 	CodeBuffer &put_s64(Int64 v)
@@ -95,21 +138,74 @@ public:
 			return put_u64(v);
 	}
 
-	CodeBuffer &put_ident(const std::string &v)
+	CodeBuffer &put_uleb(Uint64 v)
 	{
-		put_u8(v.size());
-		for (auto ch : v)
-			put_u8(ch);
-		return *this;
+		while (v >= 0x80)
+		{
+			put_u8(Uint8(v & 0x7F) | 0x80);
+			v >>= 7;
+		}
+		return put_u8(Uint8(v));
+	}
+
+	CodeBuffer &put_sleb(Int64 v)
+	{
+		while (v < -0x40 || v >= 0x40)
+		{
+			put_u8(Uint8(v & 0x7F) | 0x80);
+			v >>= 7; // arithmetic, so the sign is kept
+		}
+		return put_u8(Uint8(v & 0x7F));
+	}
+
+	// puts the address of code as the distance to it from here, so it
+	// doesn't change when the code around it is moved
+	CodeBuffer &put_target(CodeAddr v)
+	{
+		relocations.push_back(Relocation{ RelocKind::ADDRESS, offset });
+		return put_sleb(Int64(v) - Int64(offset));
+	}
+
+	// puts the index of the name in symbols, adding it if it's new
+	CodeBuffer &put_symbol(const std::string &name)
+	{
+		relocations.push_back(Relocation{ RelocKind::SYMBOL, offset });
+		auto found = symbol_index.find(name);
+		if (found != symbol_index.end())
+			return put_uleb(found->second);
+		Uint32 index = symbols.size();
+		symbols.push_back(name);
+		symbol_index.emplace(name, index);
+		return put_uleb(index);
+	}
+
+	// puts the index of a constant in the pool
+	CodeBuffer &put_constant(Uint32 index)
+	{
+		relocations.push_back(Relocation{ RelocKind::CONSTANT, offset });
+		return put_uleb(index);
 	}
 
 	CodeBuffer &put_string(const std::string &v)
 	{
-		put_u32(v.size());
-		for (auto ch : v)
-			put_u8(ch);
+		put_uleb(v.size());
+		out.write(v.data(), v.size());
+		offset += v.size();
 		return *this;
 	}
+
+private:
+	template <class T>
+	CodeBuffer &put_le(T v)
+	{
+		Uint8 bytes[sizeof(T)];
+		store_le(bytes, v);
+		out.write(reinterpret_cast<const char *>(bytes), sizeof(bytes));
+		offset += sizeof(bytes);
+		return *this;
+	}
+
+	std::unordered_map<std::string, Uint32> symbol_index;
 };
 
 // namespace Pop
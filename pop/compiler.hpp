@@ -11,7 +11,11 @@
 #endif
 
 #include <pop/assembler.hpp>
+#include <pop/fusion.hpp>
+#include <pop/optimizer.hpp>
 #include <pop/parser.hpp>
+#include <pop/peephole.hpp>
+#include <pop/ssa.hpp>
 #include <pop/transformer.hpp>
 #include <iostream>
 #include <string>
@@ -19,11 +23,41 @@
 namespace Pop
 {
 
+// The ops a module compiles to, before they're fused. From level 1 the
+// AST is simplified first (see optimize()) and from level 2 the ops are
+// too (see optimize_peephole()), adding what that did to stats if given.
+// Level 3 also runs the standard passes over each function in SSA form
+// (see optimize_ssa()) and simplifies what they leave again.
+inline InstructionList compile_ops(ModulePtr &mod,
+                                   unsigned int opt_level = DEFAULT_OPT_LEVEL,
+                                   PeepholeStats *stats = nullptr)
+{
+	optimize(mod, opt_level);
+	auto ops = transform(mod);
+	if (opt_level >= 2)
+	{
+		auto peephole = optimize_peephole(ops);
+		if (opt_level >= 3)
+		{
+			auto passes = Ssa::PassManager::standard();
+			optimize_ssa(ops, passes);
+			peephole += optimize_peephole(ops);
+		}
+		if (stats)
+			*stats += peephole;
+	}
+	return ops;
+}
+
 inline void compile(std::istream &inp, const std::string &inp_name,
-                    std::ostream &out)
+                    std::ostream &out,
+                    unsigned int opt_level = DEFAULT_OPT_LEVEL,
+                    PeepholeStats *stats = nullptr)
 {
 	auto mod = parse(inp, inp_name.c_str());
-	assemble(mod, out);
+	auto ops = compile_ops(mod, opt_level, stats);
+	fuse_instructions(ops);
+	assemble(ops, out);
 }
 
 inline void compile(std::istream &inp, std::ostream &out)
@@ -32,7 +66,8 @@ inline void compile(std::istream &inp, std::ostream &out)
 }
 
 inline void ccompile(std::istream &inp, const std::string &inp_name,
-                     std::ostream &out)
+                     std::ostream &out,
+                     unsigned int opt_level = DEFAULT_OPT_LEVEL)
 {
 	out << "#include <pop/pop.hpp>\n"
 	       "\n"
@@ -40,7 +75,7 @@ inline void ccompile(std::istream &inp, const std::string &inp_name,
 	       "{\n"
 	       "\tINIT_VM();\n";
 	auto mod = parse(inp, inp_name.c_str());
-	auto ops = transform(mod);
+	auto ops = compile_ops(mod, opt_level);
 	for (auto &op : ops)
 		op->ccodegen(out);
 	out << "\tEXIT_VM();\n"
@@ -0,0 +1,104 @@
+// constants.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/constants.hpp>
+#include <pop/error.hpp>
+#include <cstring>
+#include <sstream>
+
+namespace Pop
+{
+
+std::string Constant::repr() const
+{
+	std::stringstream ss;
+	switch (kind)
+	{
+		case ConstKind::INT:
+			ss << int_value;
+			break;
+		case ConstKind::FLOAT:
+			ss << float_value;
+			break;
+		case ConstKind::STRING:
+			ss << "\"" << string_value << "\"";
+			break;
+	}
+	return ss.str();
+}
+
+Uint32 ConstantPool::add_int(Int64 value)
+{
+	auto found = ints.find(value);
+	if (found != ints.end())
+		return found->second;
+	Constant constant(ConstKind::INT);
+	constant.int_value = value;
+	auto index = add(std::move(constant));
+	ints.emplace(value, index);
+	return index;
+}
+
+Uint32 ConstantPool::add_float(Float64 value)
+{
+	Uint64 bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	auto found = floats.find(bits);
+	if (found != floats.end())
+		return found->second;
+	Constant constant(ConstKind::FLOAT);
+	constant.float_value = value;
+	auto index = add(std::move(constant));
+	floats.emplace(bits, index);
+	return index;
+}
+
+Uint32 ConstantPool::add_string(const std::string &value)
+{
+	auto found = strings.find(value);
+	if (found != strings.end())
+		return found->second;
+	Constant constant(ConstKind::STRING);
+	constant.string_value = value;
+	auto index = add(std::move(constant));
+	strings.emplace(value, index);
+	return index;
+}
+
+Uint32 ConstantPool::add(Constant &&constant)
+{
+	if (constants.size() >= Uint32(-1))
+		throw RuntimeError("too many constants");
+	constants.push_back(std::move(constant));
+	return Uint32(constants.size() - 1);
+}
+
+void ConstantPool::codegen(CodeBuffer &buf) const
+{
+	buf.put_u32(constants.size());
+	for (auto &constant : constants)
+	{
+		buf.put_u8(Uint8(constant.kind));
+		switch (constant.kind)
+		{
+			case ConstKind::INT:
+				buf.put_s64(constant.int_value);
+				break;
+			case ConstKind::FLOAT:
+				buf.put_f64(constant.float_value);
+				break;
+			case ConstKind::STRING:
+				buf.put_string(constant.string_value);
+				break;
+		}
+	}
+}
+
+// namespace Pop
+}
@@ -0,0 +1,72 @@
+// constants.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_CONSTANTS_HPP
+#define POP_CONSTANTS_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/codebuffer.hpp>
+#include <pop/types.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Pop
+{
+
+enum class ConstKind : Uint8
+{
+	INT,
+	FLOAT,
+	STRING,
+};
+
+struct Constant
+{
+	ConstKind kind;
+	Int64 int_value;
+	Float64 float_value;
+	std::string string_value;
+
+	Constant(ConstKind kind)
+	    : kind(kind), int_value(0), float_value(0)
+	{
+	}
+
+	// the literal as it would be listed
+	std::string repr() const;
+};
+
+// The literals of a program, each stored only once, which PUSH_CONST
+// refers to by index. It's the CONSTANTS section of an image, a u32 count
+// followed by each constant's ConstKind byte and its value (an s64, an
+// f64, or a ULEB128 length and that many bytes).
+class ConstantPool
+{
+public:
+	std::vector<Constant> constants;
+
+	// the index of the constant, adding it if it isn't in the pool yet
+	Uint32 add_int(Int64 value);
+	Uint32 add_float(Float64 value);
+	Uint32 add_string(const std::string &value);
+
+	void codegen(CodeBuffer &buf) const;
+
+private:
+	std::unordered_map<Int64, Uint32> ints;
+	std::unordered_map<Uint64, Uint32> floats; // by bits, so -0.0 stays
+	std::unordered_map<std::string, Uint32> strings;
+
+	Uint32 add(Constant &&constant);
+};
+
+// namespace Pop
+}
+
+#endif // POP_CONSTANTS_HPP
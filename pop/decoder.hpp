@@ -10,9 +10,12 @@
 #error "Invalid individual include, include only the <pop/pop.hpp> header"
 #endif
 
+#include <pop/endian.hpp>
+#include <pop/error.hpp>
 #include <pop/opcodes.hpp>
 #include <pop/types.hpp>
 #include <cassert>
+#include <cstring>
 #include <string>
 
 namespace Pop
@@ -34,7 +37,8 @@ struct Decoder
 	template <class T>
 	inline T read_byte_as()
 	{
-		assert(*ip < len);
+		if (*ip >= len)
+			throw RuntimeError("truncated operand");
 		return static_cast<T>(code[(*ip)++]);
 	}
 
@@ -45,11 +49,7 @@ struct Decoder
 
 	CodeAddr read_addr()
 	{
-		// FIXME: make this a compile-time check
-		if (sizeof(CodeAddr) == 4)
-			return read_u32();
-		else
-			return read_u64();
+		return read_le<CodeAddr>();
 	}
 
 	Uint8 read_u8()
@@ -59,24 +59,17 @@ struct Decoder
 
 	Uint16 read_u16()
 	{
-		return (read_byte_as<Uint16>() << 8) | read_byte_as<Uint16>();
+		return read_le<Uint16>();
 	}
 
 	Uint32 read_u32()
 	{
-		return (read_byte_as<Uint32>() << 24) | (read_byte_as<Uint32>() << 16) |
-		       (read_byte_as<Uint32>() << 8) | read_byte_as<Uint32>();
+		return read_le<Uint32>();
 	}
 
 	Uint64 read_u64()
 	{
-		return (read_byte_as<Uint64>() << 56ULL) |
-		       (read_byte_as<Uint64>() << 48ULL) |
-		       (read_byte_as<Uint64>() << 40ULL) |
-		       (read_byte_as<Uint64>() << 32ULL) |
-		       (read_byte_as<Uint64>() << 24ULL) |
-		       (read_byte_as<Uint64>() << 16ULL) |
-		       (read_byte_as<Uint64>() << 8ULL) | read_byte_as<Uint64>();
+		return read_le<Uint64>();
 	}
 
 	Int64 read_s64()
@@ -84,46 +77,90 @@ struct Decoder
 		return static_cast<Int64>(read_u64());
 	}
 
-	Float32 read_f32()
+	// LEB128 operands aren't a fixed size, so these check each byte is
+	// there, throwing a RuntimeError if it isn't
+	Uint64 read_uleb()
 	{
-		union
+		// most operands fit in a byte
+		if (*ip < len && code[*ip] < 0x80)
+			return code[(*ip)++];
+		Uint64 v = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7)
 		{
-			Uint32 i;
-			Float32 f;
-		} v;
-		v.i = read_u32();
-		return v.f;
+			auto byte = read_leb_byte();
+			v |= Uint64(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return v;
+		}
+		throw RuntimeError("over-long LEB128 operand");
 	}
 
-	Float64 read_f64()
+	Int64 read_sleb()
 	{
-		union
+		if (*ip < len && code[*ip] < 0x80)
 		{
-			Uint64 i;
-			Float64 f;
-		} v;
-		v.i = read_u64();
-		return v.f;
+			Int64 byte = code[(*ip)++];
+			return (byte & 0x40) ? byte - 0x80 : byte;
+		}
+		Uint64 v = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7)
+		{
+			auto byte = read_leb_byte();
+			v |= Uint64(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+			{
+				if ((byte & 0x40) && shift + 7 < 64)
+					v |= ~Uint64(0) << (shift + 7);
+				return static_cast<Int64>(v);
+			}
+		}
+		throw RuntimeError("over-long LEB128 operand");
+	}
+
+	Float32 read_f32()
+	{
+		auto i = read_u32();
+		Float32 f;
+		std::memcpy(&f, &i, sizeof(f));
+		return f;
+	}
+
+	Float64 read_f64()
+	{
+		auto i = read_u64();
+		Float64 f;
+		std::memcpy(&f, &i, sizeof(f));
+		return f;
 	}
 
 	std::string read_string()
 	{
-		std::string s;
-		auto len = read_u32();
-		s.reserve(len);
-		for (auto i = 0u; i < len; i++)
-			s += read_byte_as<char>();
+		auto len = read_uleb();
+		if (len > this->len - *ip)
+			throw RuntimeError("truncated string");
+		std::string s(reinterpret_cast<const char *>(code + *ip), len);
+		*ip += len;
 		return s;
 	}
 
-	std::string read_name()
+private:
+	// one load whatever the alignment, instead of a read for each byte,
+	// after checking the whole operand is there
+	template <class T>
+	T read_le()
+	{
+		if (*ip > len || sizeof(T) > len - *ip)
+			throw RuntimeError("truncated operand");
+		auto v = load_le<T>(code + *ip);
+		*ip += sizeof(T);
+		return v;
+	}
+
+	Uint8 read_leb_byte()
 	{
-		std::string s;
-		auto len = read_u8();
-		s.reserve(len);
-		for (auto i = 0u; i < len; i++)
-			s += read_byte_as<char>();
-		return s;
+		if (*ip >= len)
+			throw RuntimeError("truncated LEB128 operand");
+		return code[(*ip)++];
 	}
 };
 
@@ -7,11 +7,16 @@
 #include <pop/config.h>
 #endif
 
+#include <pop/constants.hpp>
 #include <pop/disassembler.hpp>
+#include <pop/endian.hpp>
 #include <pop/format.hpp>
+#include <pop/image.hpp>
 #include <pop/opcodes.hpp>
+#include <iterator>
 #include <string>
 #include <sstream>
+#include <vector>
 
 namespace Pop
 {
@@ -19,6 +24,7 @@ namespace Pop
 struct ByteCodeReader
 {
 	std::istream &inp;
+	std::vector<std::string> symbols;
 
 	ByteCodeReader(std::istream &inp) : inp(inp)
 	{
@@ -32,34 +38,17 @@ struct ByteCodeReader
 
 	Uint16 read_u16(CodeAddr &addr)
 	{
-		Uint16 v = 0;
-		v |= Uint16(read_u8(addr)) << 8;
-		v |= Uint16(read_u8(addr));
-		return v;
+		return read_le<Uint16>(addr);
 	}
 
 	Uint32 read_u32(CodeAddr &addr)
 	{
-		Uint32 v = 0;
-		v |= Uint32(read_u8(addr)) << 24;
-		v |= Uint32(read_u8(addr)) << 16;
-		v |= Uint32(read_u8(addr)) << 8;
-		v |= Uint32(read_u8(addr));
-		return v;
+		return read_le<Uint32>(addr);
 	}
 
 	Uint64 read_u64(CodeAddr &addr)
 	{
-		Uint64 v = 0;
-		v |= Uint64(read_u8(addr)) << 56ull;
-		v |= Uint64(read_u8(addr)) << 48ull;
-		v |= Uint64(read_u8(addr)) << 40ull;
-		v |= Uint64(read_u8(addr)) << 32ull;
-		v |= Uint64(read_u8(addr)) << 24ull;
-		v |= Uint64(read_u8(addr)) << 16ull;
-		v |= Uint64(read_u8(addr)) << 8ull;
-		v |= Uint64(read_u8(addr));
-		return v;
+		return read_le<Uint64>(addr);
 	}
 
 	Int64 read_s64(CodeAddr &addr)
@@ -67,6 +56,15 @@ struct ByteCodeReader
 		return static_cast<Int64>(read_u64(addr));
 	}
 
+	template <class T>
+	T read_le(CodeAddr &addr)
+	{
+		Uint8 bytes[sizeof(T)] = {};
+		inp.read(reinterpret_cast<char *>(bytes), sizeof(bytes));
+		addr += sizeof(bytes);
+		return load_le<T>(bytes);
+	}
+
 	Float32 read_f32(CodeAddr &addr)
 	{
 		union
@@ -89,32 +87,58 @@ struct ByteCodeReader
 		return v.f;
 	}
 
-	CodeAddr read_addr(CodeAddr &addr)
+	Uint64 read_uleb(CodeAddr &addr)
 	{
-		if (sizeof(CodeAddr) == 4)
-			return read_u32(addr);
-		else
-			return read_u64(addr);
+		Uint64 v = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7)
+		{
+			auto byte = read_u8(addr);
+			v |= Uint64(byte & 0x7F) << shift;
+			if (!(byte & 0x80) || !inp)
+				break;
+		}
+		return v;
+	}
+
+	Int64 read_sleb(CodeAddr &addr)
+	{
+		Uint64 v = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7)
+		{
+			auto byte = read_u8(addr);
+			v |= Uint64(byte & 0x7F) << shift;
+			if (!(byte & 0x80) || !inp)
+			{
+				if ((byte & 0x40) && shift + 7 < 64)
+					v |= ~Uint64(0) << (shift + 7);
+				break;
+			}
+		}
+		return static_cast<Int64>(v);
+	}
+
+	// reads the distance to a target, returning its address
+	CodeAddr read_target(CodeAddr &addr)
+	{
+		auto from = Int64(addr);
+		return CodeAddr(from + read_sleb(addr));
 	}
 
 	std::string read_string(CodeAddr &addr)
 	{
-		Uint32 len = read_u32(addr);
+		auto len = read_uleb(addr);
 		std::string s;
-		s.reserve(len);
-		for (Uint32 i = 0; i < len; i++)
+		for (Uint64 i = 0; i < len && inp; i++)
 			s += char(read_u8(addr));
 		return s;
 	}
 
-	std::string read_name(CodeAddr &addr)
+	std::string read_symbol(CodeAddr &addr)
 	{
-		Uint8 len = read_u8(addr);
-		std::string s;
-		s.reserve(len);
-		for (Uint8 i = 0; i < len; i++)
-			s += char(read_u8(addr));
-		return s;
+		auto index = read_uleb(addr);
+		if (index < symbols.size())
+			return symbols[index];
+		return "invalid";
 	}
 
 	OpCode read_op(CodeAddr &addr)
@@ -128,12 +152,66 @@ static inline std::string format_addr(CodeAddr addr)
 	return format("0x%08X", addr);
 }
 
+static std::string section_contents(const Image &image, SectionKind kind)
+{
+	auto section = image.section(kind);
+	return std::string(reinterpret_cast<const char *>(section.data),
+	                   section.size);
+}
+
+static void read_symbols(ByteCodeReader &reader)
+{
+	CodeAddr addr = 0;
+	auto count = reader.read_u32(addr);
+	for (Uint32 i = 0; i < count && reader.inp; i++)
+		reader.symbols.push_back(reader.read_string(addr));
+}
+
+static void read_constants(ByteCodeReader &reader, ConstantPool &pool)
+{
+	CodeAddr addr = 0;
+	auto count = reader.read_u32(addr);
+	for (Uint32 i = 0; i < count && reader.inp; i++)
+	{
+		Constant constant(ConstKind(reader.read_u8(addr)));
+		switch (constant.kind)
+		{
+			case ConstKind::INT:
+				constant.int_value = reader.read_s64(addr);
+				break;
+			case ConstKind::FLOAT:
+				constant.float_value = reader.read_f64(addr);
+				break;
+			case ConstKind::STRING:
+				constant.string_value = reader.read_string(addr);
+				break;
+		}
+		pool.constants.push_back(std::move(constant));
+	}
+}
+
 void disassemble(std::istream &inp, InstructionList &out)
 {
-	ByteCodeReader reader(inp);
+	std::string bytes{ std::istreambuf_iterator<char>(inp),
+		               std::istreambuf_iterator<char>() };
+	Image image(reinterpret_cast<const Uint8 *>(bytes.data()), bytes.size());
+
+	std::istringstream symbols(section_contents(image, SectionKind::SYMBOLS));
+	ByteCodeReader symbol_reader(symbols);
+	read_symbols(symbol_reader);
+
+	std::istringstream constants(
+	    section_contents(image, SectionKind::CONSTANTS));
+	ByteCodeReader constant_reader(constants);
+	ConstantPool pool;
+	read_constants(constant_reader, pool);
+
+	std::istringstream code(section_contents(image, SectionKind::CODE));
+	ByteCodeReader reader(code);
+	reader.symbols = std::move(symbol_reader.symbols);
 	bool done = false;
-	CodeAddr addr = 0;
-	while (!done)
+	CodeAddr addr = 0; // relative to the code section
+	while (!done && code.peek() != std::char_traits<char>::eof())
 	{
 		CodeAddr op_addr = addr;
 		auto op = reader.read_op(addr);
@@ -150,31 +228,54 @@ void disassemble(std::istream &inp, InstructionList &out)
 				out.push_back(mkop<Print>(op_addr));
 				break;
 			case OpCode::OP_OPEN_SCOPE:
-				out.push_back(mkop<OpenScope>(op_addr));
+				out.push_back(
+				    mkop<OpenScope>(reader.read_uleb(addr), op_addr));
 				break;
 			case OpCode::OP_CLOSE_SCOPE:
 				out.push_back(mkop<CloseScope>(op_addr));
 				break;
 			case OpCode::OP_BIND:
-				out.push_back(mkop<Bind>(reader.read_name(addr), op_addr));
+				out.push_back(mkop<Bind>(reader.read_symbol(addr), op_addr));
+				break;
+			case OpCode::OP_LOAD_GLOBAL:
+				out.push_back(
+				    mkop<LoadGlobal>(reader.read_symbol(addr), op_addr));
 				break;
+			case OpCode::OP_STORE_GLOBAL:
+				out.push_back(
+				    mkop<StoreGlobal>(reader.read_symbol(addr), op_addr));
+				break;
+			case OpCode::OP_LOAD_LOCAL:
+			case OpCode::OP_STORE_LOCAL:
+				out.push_back(
+				    mkop<LocalOp>(op, reader.read_uleb(addr), op_addr));
+				break;
+			case OpCode::OP_LOAD_UPVALUE:
+			case OpCode::OP_STORE_UPVALUE:
+			{
+				auto depth = reader.read_u8(addr);
+				auto slot = reader.read_uleb(addr);
+				out.push_back(mkop<UpvalueOp>(op, depth, slot, op_addr));
+				break;
+			}
 			case OpCode::OP_CALL:
-				out.push_back(mkop<Call>(reader.read_u8(addr), op_addr));
+			case OpCode::OP_TAIL_CALL:
+				out.push_back(mkop<Call>(op, reader.read_u8(addr), op_addr));
 				break;
 			case OpCode::OP_RETURN:
 				out.push_back(mkop<Return>(op_addr));
 				break;
 			case OpCode::OP_JUMP:
 				out.push_back(
-				    mkop<Jump>(format_addr(reader.read_addr(addr)), op_addr));
+				    mkop<Jump>(format_addr(reader.read_target(addr)), op_addr));
 				break;
 			case OpCode::OP_JUMP_TRUE:
 				out.push_back(mkop<JumpTrue>(
-				    format_addr(reader.read_addr(addr)), op_addr));
+				    format_addr(reader.read_target(addr)), op_addr));
 				break;
 			case OpCode::OP_JUMP_FALSE:
 				out.push_back(mkop<JumpFalse>(
-				    format_addr(reader.read_addr(addr)), op_addr));
+				    format_addr(reader.read_target(addr)), op_addr));
 				break;
 			case OpCode::OP_POP_TOP:
 				out.push_back(mkop<PopTop>(op_addr));
@@ -188,32 +289,30 @@ void disassemble(std::istream &inp, InstructionList &out)
 			case OpCode::OP_PUSH_FALSE:
 				out.push_back(mkop<PushFalse>(op_addr));
 				break;
-			case OpCode::OP_PUSH_INT:
-				out.push_back(mkop<PushInt>(reader.read_s64(addr), op_addr));
-				break;
-			case OpCode::OP_PUSH_FLOAT:
-				out.push_back(mkop<PushFloat>(reader.read_f64(addr), op_addr));
-				break;
-			case OpCode::OP_PUSH_STRING:
-				out.push_back(
-				    mkop<PushString>(reader.read_string(addr), op_addr));
+			case OpCode::OP_PUSH_CONST:
+			{
+				auto index = reader.read_uleb(addr);
+				auto value = (index < pool.constants.size())
+				                 ? pool.constants[index].repr()
+				                 : std::string("invalid");
+				out.push_back(mkop<PushConst>(index, value, op_addr));
 				break;
-			case OpCode::OP_PUSH_SYMBOL:
-				out.push_back(
-				    mkop<PushSymbol>(reader.read_name(addr), op_addr));
+			}
+			case OpCode::OP_PUSH_INT:
+				out.push_back(mkop<PushInt>(reader.read_sleb(addr), op_addr));
 				break;
 			case OpCode::OP_PUSH_LIST:
-				out.push_back(mkop<PushList>(reader.read_u32(addr), op_addr));
+				out.push_back(mkop<PushList>(reader.read_uleb(addr), op_addr));
 				break;
 			case OpCode::OP_PUSH_DICT:
-				out.push_back(mkop<PushDict>(reader.read_u32(addr), op_addr));
+				out.push_back(mkop<PushDict>(reader.read_uleb(addr), op_addr));
 				break;
 			case OpCode::OP_PUSH_SLICE:
 				out.push_back(mkop<PushSlice>(op_addr));
 				break;
 			case OpCode::OP_PUSH_FUNCTION:
 				out.push_back(mkop<PushFunction>(
-				    format_addr(reader.read_addr(addr)), op_addr));
+				    format_addr(reader.read_target(addr)), op_addr));
 				break;
 			case OpCode::OP_INDEX:
 				out.push_back(mkop<Index>(op_addr));
@@ -263,6 +362,54 @@ void disassemble(std::istream &inp, InstructionList &out)
 			case OpCode::OP_BIT_NOT:
 				out.push_back(mkop<UnOp>(op, op_addr));
 				break;
+			case OpCode::OP_ADD_SYMBOL_INT:
+			case OpCode::OP_SUB_SYMBOL_INT:
+			case OpCode::OP_EQ_SYMBOL_INT:
+			case OpCode::OP_NE_SYMBOL_INT:
+			case OpCode::OP_GT_SYMBOL_INT:
+			case OpCode::OP_GE_SYMBOL_INT:
+			case OpCode::OP_LT_SYMBOL_INT:
+			case OpCode::OP_LE_SYMBOL_INT:
+			{
+				auto name = reader.read_symbol(addr);
+				auto value = reader.read_sleb(addr);
+				out.push_back(mkop<SymbolIntOp>(op, name, value, op_addr));
+				break;
+			}
+			case OpCode::OP_ADD_LOCAL_INT:
+			case OpCode::OP_SUB_LOCAL_INT:
+			case OpCode::OP_EQ_LOCAL_INT:
+			case OpCode::OP_NE_LOCAL_INT:
+			case OpCode::OP_GT_LOCAL_INT:
+			case OpCode::OP_GE_LOCAL_INT:
+			case OpCode::OP_LT_LOCAL_INT:
+			case OpCode::OP_LE_LOCAL_INT:
+			{
+				auto slot = reader.read_uleb(addr);
+				auto value = reader.read_sleb(addr);
+				out.push_back(mkop<LocalIntOp>(op, slot, value, op_addr));
+				break;
+			}
+			case OpCode::OP_EQ_JUMP_FALSE:
+			case OpCode::OP_NE_JUMP_FALSE:
+			case OpCode::OP_GT_JUMP_FALSE:
+			case OpCode::OP_GE_JUMP_FALSE:
+			case OpCode::OP_LT_JUMP_FALSE:
+			case OpCode::OP_LE_JUMP_FALSE:
+				out.push_back(mkop<CompareJump>(
+				    op, format_addr(reader.read_target(addr)), op_addr));
+				break;
+			case OpCode::OP_CALL_SYMBOL:
+			case OpCode::OP_TAIL_CALL_SYMBOL:
+			{
+				auto name = reader.read_symbol(addr);
+				auto nargs = reader.read_u8(addr);
+				out.push_back(mkop<CallSymbol>(op, name, nargs, op_addr));
+				break;
+			}
+			case OpCode::OP_PRINT_POP:
+				out.push_back(mkop<PrintPop>(op_addr));
+				break;
 			default:
 				break;
 		}
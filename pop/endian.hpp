@@ -0,0 +1,70 @@
+// endian.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_ENDIAN_HPP
+#define POP_ENDIAN_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/types.hpp>
+#include <cstring>
+
+namespace Pop
+{
+
+// Numbers in images are little-endian, so on most hosts they're loaded
+// as they are, and on big-endian ones their bytes are swapped as they're
+// loaded and stored.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static inline Uint16 to_le(Uint16 v)
+{
+	return __builtin_bswap16(v);
+}
+static inline Uint32 to_le(Uint32 v)
+{
+	return __builtin_bswap32(v);
+}
+static inline Uint64 to_le(Uint64 v)
+{
+	return __builtin_bswap64(v);
+}
+#else
+static inline Uint16 to_le(Uint16 v)
+{
+	return v;
+}
+static inline Uint32 to_le(Uint32 v)
+{
+	return v;
+}
+static inline Uint64 to_le(Uint64 v)
+{
+	return v;
+}
+#endif
+
+// reads a number from anywhere, however it's aligned
+template <class T>
+static inline T load_le(const Uint8 *p)
+{
+	T v;
+	std::memcpy(&v, p, sizeof(v));
+	return to_le(v);
+}
+
+template <class T>
+static inline void store_le(Uint8 *p, T v)
+{
+	v = to_le(v);
+	std::memcpy(p, &v, sizeof(v));
+}
+
+// namespace Pop
+}
+
+#endif // POP_ENDIAN_HPP
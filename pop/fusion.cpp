@@ -0,0 +1,221 @@
+// fusion.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/fusion.hpp>
+#include <algorithm>
+#include <vector>
+
+namespace Pop
+{
+
+static OpCode symbol_int_opcode(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_ADD:
+			return OpCode::OP_ADD_SYMBOL_INT;
+		case OpCode::OP_SUB:
+			return OpCode::OP_SUB_SYMBOL_INT;
+		case OpCode::OP_EQ:
+			return OpCode::OP_EQ_SYMBOL_INT;
+		case OpCode::OP_NE:
+			return OpCode::OP_NE_SYMBOL_INT;
+		case OpCode::OP_GT:
+			return OpCode::OP_GT_SYMBOL_INT;
+		case OpCode::OP_GE:
+			return OpCode::OP_GE_SYMBOL_INT;
+		case OpCode::OP_LT:
+			return OpCode::OP_LT_SYMBOL_INT;
+		case OpCode::OP_LE:
+			return OpCode::OP_LE_SYMBOL_INT;
+		default:
+			return OpCode::OP_LABEL;
+	}
+}
+
+static OpCode local_int_opcode(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_ADD:
+			return OpCode::OP_ADD_LOCAL_INT;
+		case OpCode::OP_SUB:
+			return OpCode::OP_SUB_LOCAL_INT;
+		case OpCode::OP_EQ:
+			return OpCode::OP_EQ_LOCAL_INT;
+		case OpCode::OP_NE:
+			return OpCode::OP_NE_LOCAL_INT;
+		case OpCode::OP_GT:
+			return OpCode::OP_GT_LOCAL_INT;
+		case OpCode::OP_GE:
+			return OpCode::OP_GE_LOCAL_INT;
+		case OpCode::OP_LT:
+			return OpCode::OP_LT_LOCAL_INT;
+		case OpCode::OP_LE:
+			return OpCode::OP_LE_LOCAL_INT;
+		default:
+			return OpCode::OP_LABEL;
+	}
+}
+
+static OpCode compare_jump_opcode(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_EQ:
+			return OpCode::OP_EQ_JUMP_FALSE;
+		case OpCode::OP_NE:
+			return OpCode::OP_NE_JUMP_FALSE;
+		case OpCode::OP_GT:
+			return OpCode::OP_GT_JUMP_FALSE;
+		case OpCode::OP_GE:
+			return OpCode::OP_GE_JUMP_FALSE;
+		case OpCode::OP_LT:
+			return OpCode::OP_LT_JUMP_FALSE;
+		case OpCode::OP_LE:
+			return OpCode::OP_LE_JUMP_FALSE;
+		default:
+			return OpCode::OP_LABEL;
+	}
+}
+
+template <class T>
+static inline T &as(InstructionPtr &op)
+{
+	return *static_cast<T *>(op.get());
+}
+
+void fuse_instructions(InstructionList &ops)
+{
+	InstructionList fused;
+	fused.reserve(ops.size());
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		auto left = ops.size() - i;
+		auto code = ops[i]->code;
+
+		if (left >= 3 && code == OpCode::OP_PUSH_INT &&
+		    ops[i + 1]->code == OpCode::OP_LOAD_GLOBAL)
+		{
+			auto fused_code = symbol_int_opcode(ops[i + 2]->code);
+			if (fused_code != OpCode::OP_LABEL)
+			{
+				fused.push_back(mkop<SymbolIntOp>(
+				    fused_code, as<LoadGlobal>(ops[i + 1]).name,
+				    as<PushInt>(ops[i]).value));
+				fused.back()->line = ops[i]->line;
+				i += 2;
+				continue;
+			}
+		}
+
+		if (left >= 3 && code == OpCode::OP_PUSH_INT &&
+		    ops[i + 1]->code == OpCode::OP_LOAD_LOCAL)
+		{
+			auto fused_code = local_int_opcode(ops[i + 2]->code);
+			if (fused_code != OpCode::OP_LABEL)
+			{
+				fused.push_back(mkop<LocalIntOp>(
+				    fused_code, as<LocalOp>(ops[i + 1]).slot,
+				    as<PushInt>(ops[i]).value));
+				fused.back()->line = ops[i]->line;
+				i += 2;
+				continue;
+			}
+		}
+
+		if (left >= 2 && ops[i + 1]->code == OpCode::OP_JUMP_FALSE)
+		{
+			auto fused_code = compare_jump_opcode(code);
+			if (fused_code != OpCode::OP_LABEL)
+			{
+				fused.push_back(mkop<CompareJump>(
+				    fused_code, as<JumpFalse>(ops[i + 1]).label));
+				fused.back()->line = ops[i]->line;
+				i += 1;
+				continue;
+			}
+		}
+
+		if (left >= 2 && code == OpCode::OP_LOAD_GLOBAL &&
+		    (ops[i + 1]->code == OpCode::OP_CALL ||
+		     ops[i + 1]->code == OpCode::OP_TAIL_CALL))
+		{
+			auto fused_code = (ops[i + 1]->code == OpCode::OP_CALL)
+			                      ? OpCode::OP_CALL_SYMBOL
+			                      : OpCode::OP_TAIL_CALL_SYMBOL;
+			fused.push_back(mkop<CallSymbol>(fused_code,
+			                                 as<LoadGlobal>(ops[i]).name,
+			                                 as<Call>(ops[i + 1]).nargs));
+			fused.back()->line = ops[i]->line;
+			i += 1;
+			continue;
+		}
+
+		if (left >= 2 && code == OpCode::OP_PRINT &&
+		    ops[i + 1]->code == OpCode::OP_POP_TOP)
+		{
+			fused.push_back(mkop<PrintPop>());
+			fused.back()->line = ops[i]->line;
+			i += 1;
+			continue;
+		}
+
+		fused.push_back(std::move(ops[i]));
+	}
+	ops = std::move(fused);
+}
+
+void SequenceStats::count(const InstructionList &ops)
+{
+	std::string prev1, prev2;
+	for (auto &op : ops)
+	{
+		if (op->code == OpCode::OP_LABEL)
+		{
+			// control can enter here from elsewhere
+			prev1.clear();
+			prev2.clear();
+			continue;
+		}
+		std::string name(op->name());
+		if (!prev1.empty())
+			pairs[prev1 + " " + name]++;
+		if (!prev2.empty())
+			triples[prev2 + " " + prev1 + " " + name]++;
+		prev2 = prev1;
+		prev1 = name;
+	}
+}
+
+static void report_counts(std::ostream &out, const char *title,
+                          const std::map<std::string, size_t> &counts,
+                          size_t limit)
+{
+	std::vector<std::pair<std::string, size_t>> sorted(counts.begin(),
+	                                                   counts.end());
+	std::stable_sort(sorted.begin(), sorted.end(),
+	                 [](const std::pair<std::string, size_t> &a,
+	                    const std::pair<std::string, size_t> &b) {
+		                 return a.second > b.second;
+		             });
+	out << title << ":\n";
+	for (size_t i = 0; i < sorted.size() && i < limit; i++)
+		out << format("%8zu  %s\n", sorted[i].second, sorted[i].first.c_str());
+}
+
+void SequenceStats::report(std::ostream &out, size_t limit) const
+{
+	report_counts(out, "pairs", pairs, limit);
+	out << "\n";
+	report_counts(out, "triples", triples, limit);
+}
+
+// namespace Pop
+}
@@ -0,0 +1,49 @@
+// fusion.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_FUSION_HPP
+#define POP_FUSION_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/instructions.hpp>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace Pop
+{
+
+// Rewrites common instruction sequences emitted by the Transformer into
+// single superinstructions before assembly:
+//
+//   PUSH_INT k; LOAD_GLOBAL x; <op>   ->  <op>_SYMBOL_INT x k
+//   PUSH_INT k; LOAD_LOCAL s; <op>    ->  <op>_LOCAL_INT s k
+//   <cmp>; JUMP_FALSE l               ->  <cmp>_JUMP_FALSE l
+//   LOAD_GLOBAL f; CALL n             ->  CALL_SYMBOL f n
+//   LOAD_GLOBAL f; TAIL_CALL n        ->  TAIL_CALL_SYMBOL f n
+//   PRINT; POP_TOP                    ->  PRINT_POP
+//
+// Sequences are never fused across a label since something might jump
+// into the middle of them.
+void fuse_instructions(InstructionList &ops);
+
+// Counts how often each pair and triple of opcodes occurs in instruction
+// lists, to find out which sequences are worth fusing.
+struct SequenceStats
+{
+	std::map<std::string, size_t> pairs;
+	std::map<std::string, size_t> triples;
+
+	void count(const InstructionList &ops);
+	void report(std::ostream &out, size_t limit = 20) const;
+};
+
+// namespace Pop
+}
+
+#endif // POP_FUSION_HPP
@@ -0,0 +1,343 @@
+// gc.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/format.hpp>
+#include <pop/gc.hpp>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <new>
+
+namespace Pop
+{
+
+static thread_local Heap *current_heap = nullptr;
+static thread_local Heap::Generation current_generation =
+    Heap::Generation::OLD;
+
+// the last allocation made in a nursery, so the Value constructed there
+// knows that it's young
+static thread_local void *young_allocation = nullptr;
+
+// nursery allocations are rounded up to keep everything aligned
+static constexpr size_t NURSERY_ALIGN = alignof(std::max_align_t);
+
+static size_t align_up(size_t size)
+{
+	return (size + NURSERY_ALIGN - 1) & ~(NURSERY_ALIGN - 1);
+}
+
+Value::Value(ValueType type, ValueFlag flags) : type(type), flags(flags)
+{
+	if (this == young_allocation)
+	{
+		set_flag(ValueFlag::YOUNG);
+		young_allocation = nullptr;
+	}
+}
+
+// copies are only made by relocate(), which never allocates in a nursery
+Value::Value(const Value &other) : Value(other.type)
+{
+}
+
+void *Value::operator new(size_t size)
+{
+	// Values always start at the start of their object, there's only ever
+	// single non-virtual inheritance from Value
+	if (current_heap)
+		return current_heap->allocate(size, current_generation);
+	return ::operator new(size);
+}
+
+// only ever called by the heap a value belongs to, with it current
+void Value::operator delete(void *ptr, size_t size)
+{
+	if (current_heap)
+		current_heap->deallocate(ptr, size);
+	else
+		::operator delete(ptr);
+}
+
+void Value::remember()
+{
+	if (current_heap)
+		current_heap->remember(this);
+}
+
+// Dict and Env keys are hashed by value, except lists and dicts which
+// hash by identity, so a map with a young key is rebuilt rather than
+// having its keys changed in place.
+static void forward_map(Heap &heap, ValueMap &map)
+{
+	bool young_keys = false;
+	for (auto &pair : map)
+	{
+		heap.forward(pair.second);
+		if (pair.first.is_young())
+			young_keys = true;
+	}
+	if (!young_keys)
+		return;
+	ValueMap moved;
+	moved.reserve(map.size());
+	for (auto &pair : map)
+	{
+		auto key = pair.first;
+		heap.forward(key);
+		moved.emplace(key, pair.second);
+	}
+	map.swap(moved);
+}
+
+void List::scavenge(Heap &heap)
+{
+	for (auto &elem : elements)
+		heap.forward(elem);
+}
+
+void Dict::scavenge(Heap &heap)
+{
+	forward_map(heap, table);
+}
+
+void Slice::scavenge(Heap &heap)
+{
+	heap.forward(start);
+	heap.forward(stop);
+	heap.forward(step);
+}
+
+void Env::scavenge(Heap &heap)
+{
+	forward_map(heap, table);
+	for (auto &slot : slots)
+		heap.forward(slot);
+	heap.forward(parent);
+}
+
+void Object::scavenge(Heap &heap)
+{
+	forward_map(heap, members);
+	heap.forward(env);
+}
+
+void Function::scavenge(Heap &heap)
+{
+	heap.forward(env);
+}
+
+Heap::Scope::Scope(Heap &heap, Generation generation)
+    : previous(current_heap), previous_generation(current_generation)
+{
+	current_heap = &heap;
+	current_generation = generation;
+}
+
+Heap::Scope::~Scope()
+{
+	current_heap = previous;
+	current_generation = previous_generation;
+}
+
+// bound to a reference by std::max(), so needs defining under C++14
+constexpr size_t Heap::MIN_THRESHOLD;
+
+Heap::Heap(size_t nursery_size)
+    : nursery_begin(nullptr), nursery_top(nullptr), nursery_end(nullptr),
+      nursery_full(false), threshold(MIN_THRESHOLD)
+{
+	resize_nursery(nursery_size);
+}
+
+Heap::~Heap()
+{
+	Scope scope(*this);
+	empty_nursery();
+	::operator delete(nursery_begin);
+	for (auto value : objects)
+		delete value;
+}
+
+void Heap::resize_nursery(size_t nursery_size)
+{
+	assert(nursery_top == nursery_begin);
+	::operator delete(nursery_begin);
+	nursery_begin = nursery_top = nursery_end = nullptr;
+	if (nursery_size > 0)
+	{
+		nursery_begin = static_cast<char *>(::operator new(nursery_size));
+		nursery_top = nursery_begin;
+		nursery_end = nursery_begin + nursery_size;
+	}
+}
+
+Heap *Heap::current()
+{
+	return current_heap;
+}
+
+void *Heap::allocate(size_t size, Generation generation)
+{
+	if (generation == Generation::YOUNG && nursery_begin)
+	{
+		auto needed = sizeof(NurseryHeader) + align_up(size);
+		if (needed <= size_t(nursery_end - nursery_top))
+		{
+			auto header = reinterpret_cast<NurseryHeader *>(nursery_top);
+			header->size = Uint32(needed);
+			header->abandoned = false;
+			header->forward = nullptr;
+			nursery_top += needed;
+			stats_.allocated++;
+			stats_.allocated_bytes += size;
+			stats_.young_allocated++;
+			young_allocation = header + 1;
+			return young_allocation;
+		}
+		// it'll be emptied at the next safepoint, until then fall back
+		// to the old generation
+		nursery_full = true;
+	}
+	auto ptr = pool_.allocate(size);
+	add(static_cast<Value *>(ptr), size);
+	// constructors store into values without a write barrier, so values
+	// which should have been young may well refer to young ones
+	if (generation == Generation::YOUNG)
+		remembered.push_back(static_cast<Value *>(ptr));
+	return ptr;
+}
+
+void Heap::deallocate(void *ptr, size_t size)
+{
+	// a value in the nursery is only ever freed like this when its
+	// constructor throws, the memory itself is reclaimed by emptying it
+	if (in_nursery(ptr))
+		reinterpret_cast<NurseryHeader *>(ptr)[-1].abandoned = true;
+	else
+		pool_.deallocate(ptr, size);
+}
+
+void Heap::add(Value *value, size_t size)
+{
+	objects.push_back(value);
+	stats_.allocated++;
+	stats_.allocated_bytes += size;
+	stats_.peak_live = std::max(stats_.peak_live, objects.size());
+}
+
+void Heap::remember(Value *value)
+{
+	value->set_flag(ValueFlag::REMEMBERED);
+	remembered.push_back(value);
+}
+
+Value *Heap::promote(Value *value)
+{
+	auto header = reinterpret_cast<NurseryHeader *>(value) - 1;
+	if (!header->forward)
+	{
+		header->forward = value->relocate();
+		promoted.push_back(header->forward);
+	}
+	return header->forward;
+}
+
+void Heap::scavenge_young()
+{
+	for (auto value : remembered)
+	{
+		value->clear_flag(ValueFlag::REMEMBERED);
+		value->scavenge(*this);
+	}
+	remembered.clear();
+
+	// promoting a value can promote more, which are added to the end
+	for (size_t i = 0; i < promoted.size(); i++)
+		promoted[i]->scavenge(*this);
+	stats_.promoted += promoted.size();
+	promoted.clear();
+
+	// everything left in the nursery is either garbage or the moved-from
+	// husk of a promoted value
+	empty_nursery();
+	stats_.minor_collections++;
+}
+
+void Heap::empty_nursery()
+{
+	for (auto ptr = nursery_begin; ptr < nursery_top;)
+	{
+		auto header = reinterpret_cast<NurseryHeader *>(ptr);
+		if (!header->abandoned)
+			reinterpret_cast<Value *>(header + 1)->~Value();
+		ptr += header->size;
+	}
+	nursery_top = nursery_begin;
+	nursery_full = false;
+}
+
+size_t Heap::sweep()
+{
+	size_t kept = 0;
+	for (auto value : objects)
+	{
+		if (value->is_marked())
+		{
+			value->clear_mark();
+			objects[kept++] = value;
+		}
+		else
+		{
+			delete value;
+		}
+	}
+	auto freed = objects.size() - kept;
+	objects.resize(kept);
+
+	// let the heap grow to twice what survived before collecting again
+	threshold = std::max(MIN_THRESHOLD, kept * 2);
+
+	stats_.collections++;
+	stats_.freed += freed;
+	return freed;
+}
+
+double Heap::now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Heap::record_pause(double seconds)
+{
+	stats_.total_pause += seconds;
+	stats_.max_pause = std::max(stats_.max_pause, seconds);
+}
+
+void Heap::report(std::ostream &out) const
+{
+	out << format("gc: %zu minor and %zu major collections, %.3f ms total "
+	              "pause, %.3f ms max\n",
+	              stats_.minor_collections, stats_.collections,
+	              stats_.total_pause * 1000.0, stats_.max_pause * 1000.0);
+	out << format("gc: %zu objects (%zu bytes) allocated, %zu in the "
+	              "nursery\n",
+	              stats_.allocated, stats_.allocated_bytes,
+	              stats_.young_allocated);
+	out << format("gc: %zu promoted, %zu freed by major collections\n",
+	              stats_.promoted, stats_.freed);
+	out << format("gc: %zu objects live, %zu at peak\n", objects.size(),
+	              stats_.peak_live);
+	pool_.report(out);
+}
+
+// namespace Pop
+}
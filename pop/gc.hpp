@@ -0,0 +1,211 @@
+// gc.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_GC_HPP
+#define POP_GC_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/pool.hpp>
+#include <pop/types.hpp>
+#include <pop/value.hpp>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+namespace Pop
+{
+
+struct HeapStats
+{
+	size_t collections;       // major (mark and sweep) collections
+	size_t minor_collections; // nursery collections
+	size_t allocated;         // objects ever allocated
+	size_t allocated_bytes;   // bytes ever allocated
+	size_t young_allocated;   // objects allocated in the nursery
+	size_t promoted;          // young objects moved to the old generation
+	size_t freed;             // old objects freed by major collections
+	size_t peak_live;         // most old objects alive at once
+	double total_pause;       // seconds spent collecting
+	double max_pause;         // longest single collection in seconds
+
+	HeapStats()
+	    : collections(0), minor_collections(0), allocated(0),
+	      allocated_bytes(0), young_allocated(0), promoted(0), freed(0),
+	      peak_live(0), total_pause(0), max_pause(0)
+	{
+	}
+};
+
+// Owns every Value allocated while the heap is current (see Heap::Scope).
+// Values in the old generation are allocated from the heap's own Pool.
+//
+// Young values are bump allocated in a fixed size nursery. When it fills up
+// the next collection moves the young values which are still reachable
+// into the old generation (promoting everything that survives a single
+// minor collection) and throws the rest of the nursery away at once. Old
+// values are only freed by a mark and sweep of the whole heap once enough
+// have been promoted since the last one.
+//
+// The heap doesn't know the roots, its owner updates them with forward()
+// and marks them with TValue::trace() when asked to by collect(). Old
+// values which have had a young one stored into them are found through the
+// remembered set filled by Value::write_barrier().
+class Heap
+{
+public:
+	// collections aren't worth doing for fewer live objects than this
+	static constexpr size_t MIN_THRESHOLD = 8192;
+	// bytes, small enough to stay in cache
+	static constexpr size_t NURSERY_SIZE = 256 * 1024;
+
+	enum class Generation
+	{
+		OLD,
+		YOUNG,
+	};
+
+	// Makes a heap the one new Values are allocated in, in the given
+	// generation, for as long as the scope exists.
+	class Scope
+	{
+	public:
+		Scope(Heap &heap, Generation generation = Generation::OLD);
+		~Scope();
+
+	private:
+		Heap *previous;
+		Generation previous_generation;
+	};
+
+	// a nursery_size of 0 allocates every value in the old generation
+	Heap(size_t nursery_size = NURSERY_SIZE);
+	~Heap();
+
+	Heap(const Heap &) = delete;
+	Heap &operator=(const Heap &) = delete;
+
+	// the heap new Values are added to, if any
+	static Heap *current();
+
+	// replaces the nursery, which must be empty, 0 turns it off
+	void resize_nursery(size_t nursery_size);
+
+	// allocates old values with plain operator new from now on, see
+	// Pool::disable()
+	void disable_pool()
+	{
+		pool_.disable();
+	}
+
+	void *allocate(size_t size, Generation generation);
+	void deallocate(void *ptr, size_t size);
+	void remember(Value *value);
+
+	bool in_nursery(const void *ptr) const
+	{
+		return (ptr >= nursery_begin && ptr < nursery_end);
+	}
+
+	// whether the nursery is full or enough has been promoted since the
+	// last major collection for another one to be worthwhile
+	bool should_collect() const
+	{
+		return nursery_full || objects.size() >= threshold;
+	}
+
+	// Calls forward_roots() to move the young values out of the nursery
+	// and, when it's time for a major collection, mark_roots() before
+	// freeing every old object it didn't mark. Must only be called when
+	// everything that's still needed is reachable from the roots.
+	template <class ForwardRoots, class MarkRoots>
+	void collect(ForwardRoots forward_roots, MarkRoots mark_roots)
+	{
+		auto start = now();
+		collect_young(forward_roots);
+		if (objects.size() >= threshold)
+		{
+			mark_roots();
+			sweep();
+		}
+		record_pause(now() - start);
+	}
+
+	// updates a reference to a young value to where it's been moved,
+	// moving it first if nothing else has
+	void forward(TValue &slot)
+	{
+		if (slot.is_young())
+			slot = promote(slot.as_ptr());
+	}
+	template <class T>
+	void forward(T *&ptr)
+	{
+		if (ptr && ptr->is_young())
+			ptr = static_cast<T *>(promote(ptr));
+	}
+
+	// old objects, the nursery is empty after each collection
+	size_t live() const
+	{
+		return objects.size();
+	}
+
+	const HeapStats &stats() const
+	{
+		return stats_;
+	}
+
+	const Pool &pool() const
+	{
+		return pool_;
+	}
+
+	void report(std::ostream &out) const;
+
+private:
+	// precedes every value in the nursery so it can be walked
+	struct NurseryHeader
+	{
+		Uint32 size; // including the header
+		bool abandoned;
+		Value *forward; // where it's been moved to
+	};
+
+	static double now();
+	void add(Value *value, size_t size);
+	Value *promote(Value *value);
+	template <class ForwardRoots>
+	void collect_young(ForwardRoots forward_roots)
+	{
+		if (nursery_top == nursery_begin)
+			return;
+		Scope scope(*this, Generation::OLD);
+		forward_roots();
+		scavenge_young();
+	}
+	void scavenge_young();
+	void empty_nursery();
+	size_t sweep();
+	void record_pause(double seconds);
+
+	Pool pool_; // old values
+	std::vector<Value *> objects;
+	std::vector<Value *> remembered;
+	std::vector<Value *> promoted; // not scavenged yet
+	char *nursery_begin;
+	char *nursery_top;
+	char *nursery_end;
+	bool nursery_full;
+	size_t threshold;
+	HeapStats stats_;
+};
+
+// namespace Pop
+}
+
+#endif // POP_GC_HPP
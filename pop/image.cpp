@@ -0,0 +1,158 @@
+// image.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/codebuffer.hpp>
+#include <pop/decoder.hpp>
+#include <pop/error.hpp>
+#include <pop/image.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Pop
+{
+
+static const Uint8 IMAGE_MAGIC[4] = { 'P', 'O', 'P', 0x1A };
+static constexpr size_t HEADER_SIZE = 12;
+static constexpr size_t SECTION_ENTRY_SIZE = 12;
+
+static Uint32 checksum(const Uint8 *data, size_t size)
+{
+	Uint32 hash = 2166136261u;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+Image::Image(const Uint8 *data, size_t size) : bytes(data), len(size)
+{
+	for (auto &section : sections)
+		section = Section{ nullptr, 0 };
+
+	if (size < HEADER_SIZE ||
+	    std::memcmp(data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+		throw RuntimeError("not a bytecode image");
+	if (size > CodeAddr(-1))
+		throw RuntimeError("bytecode image is too big");
+
+	CodeAddr ip = sizeof(IMAGE_MAGIC);
+	Decoder dec(&ip, data, CodeAddr(size));
+	auto version = dec.read_u16();
+	if (version != IMAGE_VERSION)
+	{
+		std::stringstream ss;
+		ss << "unsupported bytecode image version '" << version
+		   << "', expected '" << IMAGE_VERSION << "'";
+		throw RuntimeError(ss.str());
+	}
+	auto count = dec.read_u16();
+	auto sum = dec.read_u32();
+	if (sum != checksum(data + HEADER_SIZE, size - HEADER_SIZE))
+		throw RuntimeError("corrupt bytecode image, checksum mismatch");
+	if (count * SECTION_ENTRY_SIZE > size - HEADER_SIZE)
+		throw RuntimeError("corrupt bytecode image, truncated section table");
+
+	for (Uint16 i = 0; i < count; i++)
+	{
+		auto kind = dec.read_u32();
+		auto offset = dec.read_u32();
+		auto length = dec.read_u32();
+		if (offset > size || length > size - offset)
+		{
+			std::stringstream ss;
+			ss << "corrupt bytecode image, section '" << kind
+			   << "' is out of bounds";
+			throw RuntimeError(ss.str());
+		}
+		if (kind < NUM_SECTION_KINDS)
+			sections[kind] = Section{ data + offset, length };
+	}
+}
+
+void ImageWriter::add_section(SectionKind kind, std::string contents)
+{
+	sections.emplace_back(kind, std::move(contents));
+}
+
+void ImageWriter::write(std::ostream &out) const
+{
+	std::stringstream body;
+	CodeBuffer bodybuf(body);
+	size_t offset = HEADER_SIZE + sections.size() * SECTION_ENTRY_SIZE;
+	for (auto &section : sections)
+	{
+		bodybuf.put_u32(Uint32(section.first));
+		bodybuf.put_u32(offset);
+		bodybuf.put_u32(section.second.size());
+		offset += section.second.size();
+	}
+	if (offset > CodeAddr(-1))
+		throw RuntimeError("bytecode image is too big");
+	for (auto &section : sections)
+		body << section.second;
+
+	auto contents = body.str();
+	CodeBuffer buf(out);
+	for (auto byte : IMAGE_MAGIC)
+		buf.put_u8(byte);
+	buf.put_u16(IMAGE_VERSION);
+	buf.put_u16(sections.size());
+	buf.put_u32(checksum(reinterpret_cast<const Uint8 *>(contents.data()),
+	                     contents.size()));
+	out << contents;
+}
+
+MappedFile::MappedFile(const std::string &filename) : addr(nullptr), len(0)
+{
+	auto fail = [&filename](const char *what) {
+		std::stringstream ss;
+		ss << "failed to " << what << " '" << filename
+		   << "': " << std::strerror(errno);
+		throw RuntimeError(ss.str());
+	};
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		fail("open");
+	struct stat st;
+	if (::fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		fail("stat");
+	}
+	len = size_t(st.st_size);
+	if (len > 0)
+	{
+		addr = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED)
+		{
+			addr = nullptr;
+			::close(fd);
+			fail("map");
+		}
+	}
+	// the mapping stays valid without the descriptor
+	::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (addr)
+		::munmap(addr, len);
+}
+
+// namespace Pop
+}
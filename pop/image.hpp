@@ -0,0 +1,139 @@
+// image.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_IMAGE_HPP
+#define POP_IMAGE_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/types.hpp>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Pop
+{
+
+// Bytecode images (.pbc files) start with a 12 byte header:
+//
+//   magic     4 bytes, "POP" followed by 0x1A
+//   version   u16, IMAGE_VERSION of the compiler that wrote it
+//   count     u16, number of entries in the section table
+//   checksum  u32, FNV-1a of everything following the header
+//
+// which is followed by the section table, a (u32 kind, u32 offset, u32
+// size) entry for each section with offsets from the start of the image,
+// then the sections themselves. Numbers are little-endian, see endian.hpp.
+//
+//   CODE       the instructions, their operands are described in
+//              codebuffer.hpp, targets are relative so it can be moved
+//   CONSTANTS  the literals, see ConstantPool
+//   SYMBOLS    u32 count, then each name as a ULEB128 length and its bytes
+//   LINES      u32 count, then (u32 address, u32 line) pairs in address
+//              order, each address is where code for that line starts
+//   RELOCS     u32 count, then (u8 RelocKind, u32 offset) pairs, one for
+//              each operand in the code the linker has to fix up
+//   EXPORTS    u32 count, then the u32 symbol index of each global the
+//              module defines
+//   IMPORTS    u32 count, then the u32 symbol index of each global the
+//              module uses without defining it
+//
+// Sections of kinds this version doesn't know are ignored.
+static constexpr Uint16 IMAGE_VERSION = 4;
+
+enum class SectionKind : Uint32
+{
+	CODE,
+	CONSTANTS,
+	SYMBOLS,
+	LINES,
+	RELOCS,
+	EXPORTS,
+	IMPORTS,
+};
+
+static constexpr size_t NUM_SECTION_KINDS = size_t(SectionKind::IMPORTS) + 1;
+
+struct Section
+{
+	const Uint8 *data;
+	Uint32 size;
+};
+
+// A bytecode image in memory. The data isn't copied, it has to outlive
+// the Image.
+class Image
+{
+public:
+	// checks the header, checksum and section table, throwing a
+	// RuntimeError if the data isn't a valid image
+	Image(const Uint8 *data, size_t size);
+
+	// the contents of the section, empty if the image doesn't have one
+	Section section(SectionKind kind) const
+	{
+		return sections[size_t(kind)];
+	}
+
+	const Uint8 *data() const
+	{
+		return bytes;
+	}
+	size_t size() const
+	{
+		return len;
+	}
+
+private:
+	const Uint8 *bytes;
+	size_t len;
+	Section sections[NUM_SECTION_KINDS];
+};
+
+// Puts sections together into an image
+class ImageWriter
+{
+public:
+	void add_section(SectionKind kind, std::string contents);
+	void write(std::ostream &out) const;
+
+private:
+	std::vector<std::pair<SectionKind, std::string>> sections;
+};
+
+// A whole file mapped read-only into memory, so an image can be loaded
+// straight from the page cache instead of being read and copied
+class MappedFile
+{
+public:
+	// throws a RuntimeError if the file can't be mapped
+	MappedFile(const std::string &filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	const Uint8 *data() const
+	{
+		return static_cast<const Uint8 *>(addr);
+	}
+	size_t size() const
+	{
+		return len;
+	}
+
+private:
+	void *addr;
+	size_t len;
+};
+
+// namespace Pop
+}
+
+#endif // POP_IMAGE_HPP
@@ -33,8 +33,13 @@ struct Instruction
 {
 	OpCode code;
 	CodeAddr addr;
+	Uint32 line; // of the source it was generated from, 0 if unknown
 	static constexpr size_t addr_size = sizeof(CodeAddr);
 
+	virtual ~Instruction()
+	{
+	}
+
 	virtual void list(std::ostream &out)
 	{
 		out << "\t" << name() << "\n";
@@ -45,6 +50,9 @@ struct Instruction
 		out << format("0x%08X:\t%s\n", addr, name());
 	}
 
+	// the most bytes of code the op takes, which is exact unless it has a
+	// symbol index or a code address, whose size the assembler only knows
+	// once the code is laid out
 	virtual size_t size() const
 	{
 		return 1;
@@ -67,7 +75,7 @@ struct Instruction
 
 protected:
 	Instruction(OpCode code, CodeAddr addr = CodeAddr(-1))
-	    : code(code), addr(addr)
+	    : code(code), addr(addr), line(0)
 	{
 	}
 };
@@ -123,11 +131,34 @@ struct Print final : public Instruction
 	}
 };
 
+// starts a function's frame with room for its locals
 struct OpenScope final : public Instruction
 {
-	OpenScope(CodeAddr addr = CodeAddr(-1))
-	    : Instruction(OpCode::OP_OPEN_SCOPE, addr)
+	Uint16 nslots;
+	OpenScope(Uint16 nslots, CodeAddr addr = CodeAddr(-1))
+	    : Instruction(OpCode::OP_OPEN_SCOPE, addr), nslots(nslots)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\tOPEN_SCOPE " << nslots << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\tOPEN_SCOPE %u\n", addr, unsigned(nslots));
+	}
+	virtual size_t size() const override final
+	{
+		return 1 + uleb_size(nslots);
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
+		Instruction::codegen(buf, labels);
+		buf.put_uleb(nslots);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\tOPEN_SCOPE(" << nslots << ");\n";
 	}
 };
 
@@ -156,14 +187,12 @@ struct Bind final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 2 + name.size(); // opcode + length as byte + each byte
+		return 1 + MAX_INDEX_SIZE; // opcode + symbol index, at most
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_u8(name.size());
-		for (auto ch : name)
-			buf.put_u8(ch);
+		buf.put_symbol(name);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -171,20 +200,150 @@ struct Bind final : public Instruction
 	}
 };
 
+struct LoadGlobal final : public Instruction
+{
+	std::string name;
+	LoadGlobal(const std::string &name, CodeAddr addr = CodeAddr(-1))
+	    : Instruction(OpCode::OP_LOAD_GLOBAL, addr), name(name)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\tLOAD_GLOBAL " << name << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\tLOAD_GLOBAL %s\n", addr, name.c_str());
+	}
+	virtual size_t size() const override final
+	{
+		return 1 + MAX_INDEX_SIZE; // opcode + symbol index, at most
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_symbol(name);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\tLOAD_GLOBAL(" << name << ");\n";
+	}
+};
+
+struct StoreGlobal final : public Instruction
+{
+	std::string name;
+	StoreGlobal(const std::string &name, CodeAddr addr = CodeAddr(-1))
+	    : Instruction(OpCode::OP_STORE_GLOBAL, addr), name(name)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\tSTORE_GLOBAL " << name << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\tSTORE_GLOBAL %s\n", addr, name.c_str());
+	}
+	virtual size_t size() const override final
+	{
+		return 1 + MAX_INDEX_SIZE; // opcode + symbol index, at most
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_symbol(name);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\tSTORE_GLOBAL(" << name << ");\n";
+	}
+};
+
+// LOAD_LOCAL or STORE_LOCAL of a slot in the current function's frame
+struct LocalOp final : public Instruction
+{
+	Uint16 slot;
+	LocalOp(OpCode code, Uint16 slot, CodeAddr addr = CodeAddr(-1))
+	    : Instruction(code, addr), slot(slot)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\t" << name() << " " << slot << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\t%s %u\n", addr, name(), unsigned(slot));
+	}
+	virtual size_t size() const override final
+	{
+		return 1 + uleb_size(slot);
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_uleb(slot);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\t" << name() << "(" << slot << ");\n";
+	}
+};
+
+// LOAD_UPVALUE or STORE_UPVALUE of a slot in the frame of an enclosing
+// function, depth frames out from the current one
+struct UpvalueOp final : public Instruction
+{
+	Uint8 depth;
+	Uint16 slot;
+	UpvalueOp(OpCode code, Uint8 depth, Uint16 slot,
+	          CodeAddr addr = CodeAddr(-1))
+	    : Instruction(code, addr), depth(depth), slot(slot)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\t" << name() << " " << unsigned(depth) << " " << slot
+		    << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\t%s %u %u\n", addr, name(), unsigned(depth),
+		              unsigned(slot));
+	}
+	virtual size_t size() const override final
+	{
+		return 2 + uleb_size(slot); // opcode + 1-byte depth + slot
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_u8(depth);
+		buf.put_uleb(slot);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\t" << name() << "(" << unsigned(depth) << ", " << slot
+		    << ");\n";
+	}
+};
+
+// CALL, or TAIL_CALL which returns what the callee does
 struct Call final : public Instruction
 {
 	unsigned int nargs;
-	Call(unsigned int nargs, CodeAddr addr = CodeAddr(-1))
-	    : Instruction(OpCode::OP_CALL, addr), nargs(nargs)
+	Call(OpCode code, unsigned int nargs, CodeAddr addr = CodeAddr(-1))
+	    : Instruction(code, addr), nargs(nargs)
 	{
 	}
 	virtual void list(std::ostream &out) override final
 	{
-		out << "\tCALL " << nargs << "\n";
+		out << "\t" << name() << " " << nargs << "\n";
 	}
 	virtual void dis(std::ostream &out) const override final
 	{
-		out << format("0x%08X:\tCALL %u\n", addr, nargs);
+		out << format("0x%08X:\t%s %u\n", addr, name(), nargs);
 	}
 	virtual size_t size() const override final
 	{
@@ -197,7 +356,7 @@ struct Call final : public Instruction
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
-		out << "\tCALL(" << nargs << ");\n";
+		out << "\t" << name() << "(" << nargs << ");\n";
 	}
 };
 
@@ -225,12 +384,13 @@ struct Jump final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 1 + sizeof(CodeAddr);
+		// opcode + distance to the target, at most
+		return 1 + MAX_TARGET_SIZE;
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_addr(labels[label]);
+		buf.put_target(labels[label]);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -255,12 +415,13 @@ struct JumpTrue final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 1 + sizeof(CodeAddr);
+		// opcode + distance to the target, at most
+		return 1 + MAX_TARGET_SIZE;
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_addr(labels[label]);
+		buf.put_target(labels[label]);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -285,12 +446,13 @@ struct JumpFalse final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 1 + sizeof(CodeAddr);
+		// opcode + distance to the target, at most
+		return 1 + MAX_TARGET_SIZE;
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_addr(labels[label]);
+		buf.put_target(labels[label]);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -329,6 +491,9 @@ struct PushFalse final : public Instruction
 	}
 };
 
+// PushFloat and PushString are replaced by a PushConst of their value when
+// they're assembled, as is PushInt unless its value fits in 32 bits, see
+// assemble()
 struct PushInt final : public Instruction
 {
 	long long int value;
@@ -346,12 +511,12 @@ struct PushInt final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 1 + sizeof(Int64);
+		return 1 + sleb_size(value);
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_s64(value);
+		buf.put_sleb(value);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -406,7 +571,8 @@ struct PushString final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 5 + value.size(); // opcode + 4-byte length + each byte
+		// opcode + length + each byte
+		return 1 + uleb_size(value.size()) + value.size();
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
@@ -419,33 +585,37 @@ struct PushString final : public Instruction
 	}
 };
 
-struct PushSymbol final : public Instruction
+// pushes a constant from the pool, value is how it's listed
+struct PushConst final : public Instruction
 {
-	std::string name;
-	PushSymbol(const std::string &name, CodeAddr addr = CodeAddr(-1))
-	    : Instruction(OpCode::OP_PUSH_SYMBOL, addr), name(name)
+	Uint32 index;
+	std::string value;
+	PushConst(Uint32 index, const std::string &value,
+	          CodeAddr addr = CodeAddr(-1))
+	    : Instruction(OpCode::OP_PUSH_CONST, addr), index(index), value(value)
 	{
 	}
 	virtual void list(std::ostream &out) override final
 	{
-		out << "\tPUSH_SYMBOL " << name << "\n";
+		out << "\tPUSH_CONST " << index << " (" << value << ")\n";
 	}
 	virtual void dis(std::ostream &out) const override final
 	{
-		out << format("0x%08X:\tPUSH_SYMBOL %s\n", addr, name.c_str());
+		out << format("0x%08X:\tPUSH_CONST %u (%s)\n", addr, index,
+		              value.c_str());
 	}
 	virtual size_t size() const override final
 	{
-		return 2 + name.size(); // opcode + length as byte + each byte
+		return 1 + uleb_size(index);
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_ident(name);
+		buf.put_constant(index);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
-		out << "\tPUSH_SYMBOL(" << name << ");\n";
+		out << "\tPUSH_CONST(" << index << ");\n";
 	}
 };
 
@@ -466,12 +636,12 @@ struct PushList final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 5; // opcode + 4-byte length
+		return 1 + uleb_size(len);
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_u32(len);
+		buf.put_uleb(len);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -496,12 +666,12 @@ struct PushDict final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 5; // opcode + 4-byte length
+		return 1 + uleb_size(len);
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_u32(len);
+		buf.put_uleb(len);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -534,12 +704,12 @@ struct PushFunction final : public Instruction
 	}
 	virtual size_t size() const override final
 	{
-		return 5; // opcode + 4-byte address
+		return 1 + MAX_TARGET_SIZE; // opcode + distance to it, at most
 	}
 	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
 	{
 		Instruction::codegen(buf, labels);
-		buf.put_addr(labels[name]);
+		buf.put_target(labels[name]);
 	}
 	virtual void ccodegen(std::ostream &out) const override final
 	{
@@ -575,6 +745,163 @@ struct BinOp final : public Instruction
 	}
 };
 
+//
+// Superinstructions, see fusion.hpp
+//
+
+// <binop> between the value bound to a symbol and an integer literal
+struct SymbolIntOp final : public Instruction
+{
+	std::string name;
+	long long int value;
+	SymbolIntOp(OpCode code, const std::string &name, long long int value,
+	            CodeAddr addr = CodeAddr(-1))
+	    : Instruction(code, addr), name(name), value(value)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\t" << Instruction::name() << " " << name << " " << value
+		    << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\t%s %s %lld\n", addr, Instruction::name(),
+		              name.c_str(), value);
+	}
+	virtual size_t size() const override final
+	{
+		// opcode + symbol index (at most) + integer
+		return 1 + MAX_INDEX_SIZE + sleb_size(value);
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_symbol(name);
+		buf.put_sleb(value);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\t" << Instruction::name() << "(" << name << ", " << value
+		    << "ULL);\n";
+	}
+};
+
+// <binop> between a local and an integer literal
+struct LocalIntOp final : public Instruction
+{
+	Uint16 slot;
+	long long int value;
+	LocalIntOp(OpCode code, Uint16 slot, long long int value,
+	           CodeAddr addr = CodeAddr(-1))
+	    : Instruction(code, addr), slot(slot), value(value)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\t" << name() << " " << slot << " " << value << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\t%s %u %lld\n", addr, name(), unsigned(slot),
+		              value);
+	}
+	virtual size_t size() const override final
+	{
+		return 1 + uleb_size(slot) + sleb_size(value);
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_uleb(slot);
+		buf.put_sleb(value);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\t" << name() << "(" << slot << ", " << value << "ULL);\n";
+	}
+};
+
+// <comparison> followed by a JUMP_FALSE on its result
+struct CompareJump final : public Instruction
+{
+	std::string label;
+	CompareJump(OpCode code, const std::string &label,
+	            CodeAddr addr = CodeAddr(-1))
+	    : Instruction(code, addr), label(label)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\t" << name() << " " << label << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\t%s %s\n", addr, name(), label.c_str());
+	}
+	virtual size_t size() const override final
+	{
+		// opcode + distance to the target, at most
+		return 1 + MAX_TARGET_SIZE;
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_target(labels[label]);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\t" << name() << "(" << label << ");\n";
+	}
+};
+
+// LOAD_GLOBAL followed by a CALL of the value it pushed
+struct CallSymbol final : public Instruction
+{
+	std::string name;
+	unsigned int nargs;
+	CallSymbol(OpCode code, const std::string &name, unsigned int nargs,
+	           CodeAddr addr = CodeAddr(-1))
+	    : Instruction(code, addr), name(name), nargs(nargs)
+	{
+	}
+	virtual void list(std::ostream &out) override final
+	{
+		out << "\t" << Instruction::name() << " " << name << " " << nargs
+		    << "\n";
+	}
+	virtual void dis(std::ostream &out) const override final
+	{
+		out << format("0x%08X:\t%s %s %u\n", addr, Instruction::name(),
+		              name.c_str(), nargs);
+	}
+	virtual size_t size() const override final
+	{
+		// opcode + symbol index (at most) + 1-byte argument count
+		return 2 + MAX_INDEX_SIZE;
+	}
+	virtual void codegen(CodeBuffer &buf, LabelMap &labels) const override final
+	{
+		Instruction::codegen(buf, labels);
+		buf.put_symbol(name);
+		buf.put_u8(nargs);
+	}
+	virtual void ccodegen(std::ostream &out) const override final
+	{
+		out << "\t" << Instruction::name() << "(" << name << ", " << nargs
+		    << ");\n";
+	}
+};
+
+// PRINT with its (null) result discarded by a POP_TOP
+struct PrintPop final : public Instruction
+{
+	PrintPop(CodeAddr addr = CodeAddr(-1))
+	    : Instruction(OpCode::OP_PRINT_POP, addr)
+	{
+	}
+};
+
 template <class T, class... Args>
 static inline InstructionPtr mkop(Args &&... args)
 {
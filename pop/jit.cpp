@@ -0,0 +1,2165 @@
+// jit.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/error.hpp>
+#include <pop/jit.hpp>
+#include <pop/verifier.hpp>
+#include <pop/vm.hpp>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Pop
+{
+
+CodeBlock::CodeBlock(const std::vector<Uint8> &code) : addr(nullptr), len(0)
+{
+	auto page = size_t(::sysconf(_SC_PAGESIZE));
+	len = (code.size() + page - 1) / page * page;
+	addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+	              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+	{
+		addr = nullptr;
+		std::stringstream ss;
+		ss << "failed to map code memory: " << std::strerror(errno);
+		throw RuntimeError(ss.str());
+	}
+	std::memcpy(addr, code.data(), code.size());
+	if (::mprotect(addr, len, PROT_READ | PROT_EXEC) != 0)
+	{
+		std::stringstream ss;
+		ss << "failed to protect code memory: " << std::strerror(errno);
+		::munmap(addr, len);
+		addr = nullptr;
+		throw RuntimeError(ss.str());
+	}
+}
+
+CodeBlock::~CodeBlock()
+{
+	if (addr)
+		::munmap(addr, len);
+}
+
+Jit::Jit() : enabled(true), hot_calls(HOT_CALLS), hot_loops(HOT_LOOPS)
+{
+}
+
+Jit::~Jit()
+{
+}
+
+void Jit::reset()
+{
+	entries.clear();
+	loops.clear();
+	blocks.clear();
+}
+
+void Jit::rethrow()
+{
+	auto e = error;
+	error = nullptr;
+	std::rethrow_exception(e);
+}
+
+#ifdef POP_JIT
+
+//
+// Helpers
+//
+// What the templates call for everything they don't do inline. They all
+// take the op being run and work on the VM with the stack and env as the
+// native code left them, catching anything thrown so it's never unwound
+// through native frames. When they fail they leave state.ip at the op.
+//
+
+static CodeAddr index_of(VM &vm, const DecodedOp *op)
+{
+	return CodeAddr(op - vm.program->ops.data());
+}
+
+// runs f on the VM, false if it threw
+template <class F>
+static bool guarded(JitState *s, const DecodedOp *op, F f)
+{
+	auto &vm = *s->vm;
+	vm.stack.sp = s->sp;
+	auto ok = true;
+	try
+	{
+		f(vm, op);
+	}
+	catch (...)
+	{
+		vm.jit.fail();
+		s->ip = index_of(vm, op);
+		ok = false;
+	}
+	s->sp = vm.stack.sp;
+	s->slots = vm.env->slots.data();
+	return ok;
+}
+
+// once control has moved to vm.ip, collects the garbage, then returns the
+// native code to go on with, or nullptr to exit to the interpreter
+static void *carry_on(JitState *s, VM &vm, void *code)
+{
+	if (vm.heap.should_collect())
+		vm.collect_garbage();
+	s->sp = vm.stack.sp;
+	s->slots = vm.env->slots.data();
+	if (!vm.running || vm.paused)
+		code = nullptr;
+	if (!code)
+		s->ip = vm.ip;
+	return code;
+}
+
+static void *transfer_failed(JitState *s, VM &vm, const DecodedOp *op)
+{
+	vm.jit.fail();
+	s->ip = index_of(vm, op);
+	s->sp = vm.stack.sp;
+	return nullptr;
+}
+
+static void *call_helper(JitState *s, const DecodedOp *op)
+{
+	auto &vm = *s->vm;
+	vm.stack.sp = s->sp;
+	try
+	{
+		auto callee = (op->code == OpCode::OP_CALL) ? vm.pop()
+		                                            : vm.lookup(op->name);
+		vm.ip = index_of(vm, op) + 1;
+		vm.call(callee, op->count);
+		vm.frames.top[-1].native = s->resume;
+		return carry_on(s, vm, vm.jit.enter(vm, vm.ip));
+	}
+	catch (...)
+	{
+		return transfer_failed(s, vm, op);
+	}
+}
+
+static void *tail_call_helper(JitState *s, const DecodedOp *op)
+{
+	auto &vm = *s->vm;
+	vm.stack.sp = s->sp;
+	try
+	{
+		auto callee = (op->code == OpCode::OP_TAIL_CALL)
+		                  ? vm.pop()
+		                  : vm.lookup(op->name);
+		vm.ip = index_of(vm, op);
+		// the interpreter goes on with a call which kept the frame's Env,
+		// compiled code only starts at the entry
+		if (vm.tail_call(callee, op->count))
+			return carry_on(s, vm, nullptr);
+		return carry_on(s, vm, vm.jit.enter(vm, vm.ip));
+	}
+	catch (...)
+	{
+		return transfer_failed(s, vm, op);
+	}
+}
+
+static void *return_helper(JitState *s, const DecodedOp *)
+{
+	auto &vm = *s->vm;
+	vm.stack.sp = s->sp;
+	auto &frame = vm.frames.pop();
+	vm.ip = frame.ip;
+	vm.env = frame.env;
+	return carry_on(s, vm, frame.native);
+}
+
+// at the target of a backward jump, false if the VM has to stop there
+static bool check_helper(JitState *s, const DecodedOp *target)
+{
+	auto &vm = *s->vm;
+	vm.stack.sp = s->sp;
+	if (vm.heap.should_collect())
+	{
+		vm.collect_garbage();
+		s->slots = vm.env->slots.data();
+	}
+	if (!vm.running || vm.paused)
+	{
+		s->ip = index_of(vm, target);
+		return false;
+	}
+	return true;
+}
+
+static bool open_scope_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.env = new Env(vm.env, op->slot);
+	});
+}
+
+static bool close_scope_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *) {
+		vm.env = vm.env->parent;
+	});
+}
+
+static bool print_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		std::cout << vm.pop()._repr_() << std::endl;
+		if (op->code == OpCode::OP_PRINT)
+			vm.push(TValue()); // print() is an expression
+	});
+}
+
+static bool bind_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.globals->define(op->name, vm.pop());
+	});
+}
+
+static bool load_global_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.push(vm.lookup(op->name));
+	});
+}
+
+static bool store_global_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.store(op->name, vm.pop());
+	});
+}
+
+static bool store_local_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.env->set_slot(op->slot, vm.pop());
+	});
+}
+
+static bool load_upvalue_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.push(vm.env->outer(op->depth)->slots[op->slot]);
+	});
+}
+
+static bool store_upvalue_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.env->outer(op->depth)->set_slot(op->slot, vm.pop());
+	});
+}
+
+static bool push_list_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		auto list = new List();
+		for (auto i = 0u; i < op->count; i++)
+			list->append(vm.pop());
+		vm.push(list);
+	});
+}
+
+static bool push_dict_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		auto dict = new Dict();
+		for (auto i = 0u; i < op->count; i++)
+		{
+			auto key = vm.pop();
+			auto value = vm.pop();
+			dict->insert(key, value);
+		}
+		vm.push(dict);
+	});
+}
+
+static bool push_slice_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *) {
+		auto start = vm.pop();
+		auto stop = vm.pop();
+		auto step = vm.pop();
+		vm.push_new<Slice>(start, stop, step);
+	});
+}
+
+static bool push_function_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		vm.push_new<Function>(op->target, vm.env);
+	});
+}
+
+static bool postinc_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		if (op->code == OpCode::OP_IP_POSTINC)
+			vm.stack.top()._preinc_();
+		else
+			vm.stack.top()._predec_();
+	});
+}
+
+typedef TValue (TValue::*BinaryOperator)(TValue) const;
+typedef TValue (TValue::*UnaryOperator)() const;
+
+template <BinaryOperator fn>
+static bool binop_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *) {
+		auto left = vm.pop();
+		auto right = vm.pop();
+		vm.push((left.*fn)(right));
+	});
+}
+
+template <UnaryOperator fn>
+static bool unop_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *) {
+		auto left = vm.pop();
+		vm.push((left.*fn)());
+	});
+}
+
+template <BinaryOperator fn>
+static bool symbol_int_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		auto left = vm.lookup(op->name);
+		vm.push((left.*fn)(TValue::make_int(op->int_value)));
+	});
+}
+
+template <BinaryOperator fn>
+static bool local_int_helper(JitState *s, const DecodedOp *op)
+{
+	return guarded(s, op, [](VM &vm, const DecodedOp *op) {
+		auto left = vm.env->slots[op->slot];
+		vm.push((left.*fn)(TValue::make_int(op->int_value)));
+	});
+}
+
+// 1 if the compare-and-jump jumps, 0 if not, -1 if it threw
+template <BinaryOperator fn>
+static int compare_jump_helper(JitState *s, const DecodedOp *op)
+{
+	auto jump = false;
+	auto ok = guarded(s, op, [&jump](VM &vm, const DecodedOp *) {
+		auto left = vm.pop();
+		auto right = vm.pop();
+		jump = (left.*fn)(right)._not_();
+	});
+	return ok ? jump : -1;
+}
+
+// 1 if the value just popped by the native code is true, 0 if not, -1 if
+// finding out threw
+static int truth_helper(JitState *s, const DecodedOp *op)
+{
+	auto truth = false;
+	auto ok = guarded(s, op, [&truth](VM &vm, const DecodedOp *) {
+		truth = !vm.stack.sp[0]._not_();
+	});
+	return ok ? truth : -1;
+}
+
+typedef bool (*OpHelper)(JitState *, const DecodedOp *);
+typedef int (*BranchHelper)(JitState *, const DecodedOp *);
+
+// the helper doing the whole of an op which doesn't transfer control, or
+// nullptr if the op has to be done inline or by the interpreter
+static OpHelper op_helper(OpCode code)
+{
+// an op and its quickened forms all have the same helper
+#define JIT_BINARY(code, fnc) \
+	case OpCode::OP_##code:   \
+		return binop_helper<&TValue::_##fnc##_>;
+#define JIT_UNARY(code, fnc) \
+	case OpCode::OP_##code:  \
+		return unop_helper<&TValue::_##fnc##_>;
+#define JIT_NUMERIC(code, fnc)            \
+	case OpCode::OP_##code##_INT_INT:     \
+	case OpCode::OP_##code##_FLOAT_FLOAT: \
+		JIT_BINARY(code, fnc)
+#define JIT_VARIABLE_INT(code, fnc)                   \
+	case OpCode::OP_##code##_SYMBOL_INT:              \
+		return symbol_int_helper<&TValue::_##fnc##_>; \
+	case OpCode::OP_##code##_LOCAL_INT:               \
+		return local_int_helper<&TValue::_##fnc##_>;
+#define JIT_COMPARE(code, fnc)              \
+	case OpCode::OP_##code##_STRING_STRING: \
+		JIT_NUMERIC(code, fnc)              \
+		JIT_VARIABLE_INT(code, fnc)
+
+	switch (code)
+	{
+		case OpCode::OP_PRINT:
+		case OpCode::OP_PRINT_POP:
+			return print_helper;
+		case OpCode::OP_OPEN_SCOPE:
+			return open_scope_helper;
+		case OpCode::OP_CLOSE_SCOPE:
+			return close_scope_helper;
+		case OpCode::OP_BIND:
+			return bind_helper;
+		case OpCode::OP_LOAD_GLOBAL:
+			return load_global_helper;
+		case OpCode::OP_STORE_GLOBAL:
+			return store_global_helper;
+		case OpCode::OP_STORE_LOCAL:
+			return store_local_helper;
+		case OpCode::OP_LOAD_UPVALUE:
+			return load_upvalue_helper;
+		case OpCode::OP_STORE_UPVALUE:
+			return store_upvalue_helper;
+		case OpCode::OP_PUSH_LIST:
+			return push_list_helper;
+		case OpCode::OP_PUSH_DICT:
+			return push_dict_helper;
+		case OpCode::OP_PUSH_SLICE:
+			return push_slice_helper;
+		case OpCode::OP_PUSH_FUNCTION:
+			return push_function_helper;
+		case OpCode::OP_IP_POSTINC:
+		case OpCode::OP_IP_POSTDEC:
+			return postinc_helper;
+		case OpCode::OP_ADD_STRING_STRING:
+			// clang-format off
+		JIT_NUMERIC(ADD, add)
+		JIT_VARIABLE_INT(ADD, add)
+		JIT_NUMERIC(SUB, sub)
+		JIT_VARIABLE_INT(SUB, sub)
+		JIT_NUMERIC(MUL, mul)
+		JIT_COMPARE(EQ, eq)
+		JIT_COMPARE(NE, ne)
+		JIT_COMPARE(GT, gt)
+		JIT_COMPARE(GE, ge)
+		JIT_COMPARE(LT, lt)
+		JIT_COMPARE(LE, le)
+		JIT_BINARY(DIV, div)
+		JIT_BINARY(MOD, mod)
+		JIT_BINARY(POW, pow)
+		JIT_UNARY(POS, pos)
+		JIT_UNARY(NEG, neg)
+		JIT_BINARY(LOG_AND, log_and)
+		JIT_BINARY(LOG_OR, log_or)
+		JIT_UNARY(LOG_NOT, log_not)
+		JIT_BINARY(BIT_AND, bit_and)
+		JIT_BINARY(BIT_OR, bit_or)
+		JIT_BINARY(BIT_XOR, bit_xor)
+		JIT_UNARY(BIT_NOT, bit_not)
+		JIT_BINARY(LEFT_SHIFT, lshift)
+		JIT_BINARY(RIGHT_SHIFT, rshift)
+		JIT_BINARY(IP_ADD, add)
+		JIT_BINARY(IP_SUB, sub)
+		JIT_BINARY(IP_MUL, mul)
+		JIT_BINARY(IP_DIV, div)
+		JIT_BINARY(IP_MOD, mod)
+		JIT_BINARY(IP_POW, pow)
+		JIT_BINARY(IP_AND, bit_and)
+		JIT_BINARY(IP_OR, bit_or)
+		JIT_BINARY(IP_XOR, bit_xor)
+		JIT_BINARY(IP_LEFT, lshift)
+		JIT_BINARY(IP_RIGHT, rshift)
+		JIT_UNARY(IP_PREINC, preinc)
+		JIT_UNARY(IP_PREDEC, predec)
+		// clang-format on
+		default:
+			return nullptr;
+	}
+
+#undef JIT_BINARY
+#undef JIT_UNARY
+#undef JIT_NUMERIC
+#undef JIT_VARIABLE_INT
+#undef JIT_COMPARE
+}
+
+// the helper of a compare-and-jump, nullptr for any other op
+static BranchHelper branch_helper(OpCode code)
+{
+#define JIT_COMPARE_JUMP(code, fnc)                     \
+	case OpCode::OP_##code##_JUMP_FALSE:                \
+	case OpCode::OP_##code##_JUMP_FALSE_INT_INT:        \
+	case OpCode::OP_##code##_JUMP_FALSE_FLOAT_FLOAT:    \
+		return compare_jump_helper<&TValue::_##fnc##_>;
+
+	switch (code)
+	{
+		// clang-format off
+		JIT_COMPARE_JUMP(EQ, eq)
+		JIT_COMPARE_JUMP(NE, ne)
+		JIT_COMPARE_JUMP(GT, gt)
+		JIT_COMPARE_JUMP(GE, ge)
+		JIT_COMPARE_JUMP(LT, lt)
+		JIT_COMPARE_JUMP(LE, le)
+		// clang-format on
+		default:
+			return nullptr;
+	}
+
+#undef JIT_COMPARE_JUMP
+}
+
+// records a trace of the loop at state.ip and returns its native code to
+// go on with, or nullptr to exit to the interpreter, see Jit::record()
+static void *record_helper(JitState *s, const DecodedOp *)
+{
+	return s->vm->jit.record(s);
+}
+
+//
+// Code generation
+//
+
+enum Reg : Uint8
+{
+	RAX = 0,
+	RCX = 1,
+	RDX = 2,
+};
+
+enum Cond : Uint8
+{
+	CC_O = 0x0,
+	CC_B = 0x2,
+	CC_AE = 0x3,
+	CC_E = 0x4,
+	CC_NE = 0x5,
+	CC_BE = 0x6,
+	CC_A = 0x7,
+	CC_NP = 0xB,
+	CC_L = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G = 0xF,
+};
+
+// the condition which holds when cc doesn't
+static Cond negate(Cond cc)
+{
+	return Cond(cc ^ 1);
+}
+
+// Machine code being put together, with labels which can be jumped to
+// before they're bound.
+class X64Code
+{
+public:
+	typedef size_t Label;
+
+	std::vector<Uint8> code;
+
+	Label label()
+	{
+		labels.push_back(size_t(UNBOUND));
+		return labels.size() - 1;
+	}
+	void bind(Label l)
+	{
+		labels[l] = code.size();
+	}
+
+	void emit(std::initializer_list<Uint8> bytes)
+	{
+		code.insert(code.end(), bytes);
+	}
+	void imm32(Uint32 value)
+	{
+		for (int i = 0; i < 32; i += 8)
+			code.push_back(Uint8(value >> i));
+	}
+	void imm64(Uint64 value)
+	{
+		for (int i = 0; i < 64; i += 8)
+			code.push_back(Uint8(value >> i));
+	}
+	// a 32-bit displacement from the end of itself to l
+	void rel32(Label l)
+	{
+		fixups.emplace_back(code.size(), l);
+		imm32(0);
+	}
+
+	void jmp(Label l)
+	{
+		emit({ 0xE9 });
+		rel32(l);
+	}
+	void jcc(Cond cc, Label l)
+	{
+		emit({ 0x0F, Uint8(0x80 | cc) });
+		rel32(l);
+	}
+
+	// the code with every jump patched, all the labels must be bound
+	std::vector<Uint8> finish()
+	{
+		for (auto &fixup : fixups)
+		{
+			auto target = labels[fixup.second];
+			assert(target != UNBOUND);
+			auto rel = Uint32(target - (fixup.first + 4));
+			for (int i = 0; i < 4; i++)
+				code[fixup.first + i] = Uint8(rel >> (i * 8));
+		}
+		return code;
+	}
+
+private:
+	static constexpr size_t UNBOUND = size_t(-1);
+	std::vector<size_t> labels;
+	std::vector<std::pair<size_t, Label>> fixups;
+};
+
+// offsets into JitState which the code addresses off r12
+static constexpr Uint8 STATE_SP = offsetof(JitState, sp);
+static constexpr Uint8 STATE_SLOTS = offsetof(JitState, slots);
+static constexpr Uint8 STATE_RESUME = offsetof(JitState, resume);
+static constexpr Uint8 STATE_IP = offsetof(JitState, ip);
+
+static Uint64 address(const void *ptr)
+{
+	return Uint64(reinterpret_cast<std::uintptr_t>(ptr));
+}
+
+template <class F>
+static Uint64 helper(F *fn)
+{
+	return Uint64(reinterpret_cast<std::uintptr_t>(fn));
+}
+// Leaves native code, writing the stack's top back for Jit::run()
+static void emit_exit(X64Code &as)
+{
+	as.emit({ 0x49, 0x89, 0x5C, 0x24, STATE_SP }); // mov [r12+sp], rbx
+	as.emit({ 0x41, 0x5D });                       // pop r13
+	as.emit({ 0x41, 0x5C });                       // pop r12
+	as.emit({ 0x5B });                             // pop rbx
+	as.emit({ 0xC3 });                             // ret
+}
+
+// Native code is entered with (JitState *state, void *code). While it
+// runs rbx holds the stack's top, r12 the state and r13 the current env's
+// slots, all three callee saved so they survive the helpers. The three
+// pushes leave the stack 16 byte aligned for calling them.
+static std::vector<Uint8> trampoline_code()
+{
+	X64Code as;
+	as.emit({ 0x53 });                         // push rbx
+	as.emit({ 0x41, 0x54 });                   // push r12
+	as.emit({ 0x41, 0x55 });                   // push r13
+	as.emit({ 0x49, 0x89, 0xFC });             // mov r12, rdi
+	as.emit({ 0x49, 0x8B, 0x5C, 0x24, STATE_SP }); // mov rbx, [r12+sp]
+	as.emit({ 0x4D, 0x8B, 0x6C, 0x24, STATE_SLOTS }); // mov r13, [r12+slots]
+	as.emit({ 0xFF, 0xE6 });                   // jmp rsi
+	return as.finish();
+}
+
+// The code a loop runs when it's just become hot, it records a trace of
+// the next iteration and goes on with the trace's native code.
+static std::vector<Uint8> recorder_code()
+{
+	X64Code as;
+	auto exit = as.label();
+	as.emit({ 0x4C, 0x89, 0xE7 }); // mov rdi, r12
+	as.emit({ 0x48, 0xB8 });       // mov rax, imm64
+	as.imm64(helper(record_helper));
+	as.emit({ 0xFF, 0xD0 });                       // call rax
+	as.emit({ 0x49, 0x8B, 0x5C, 0x24, STATE_SP }); // mov rbx, [r12+sp]
+	// mov r13, [r12+slots]
+	as.emit({ 0x4D, 0x8B, 0x6C, 0x24, STATE_SLOTS });
+	as.emit({ 0x48, 0x85, 0xC0 }); // test rax, rax
+	as.jcc(CC_E, exit);
+	as.emit({ 0xFF, 0xE0 }); // jmp rax
+	as.bind(exit);
+	emit_exit(as);
+	return as.finish();
+}
+
+// The pieces of machine code both compilers put their templates together
+// from. Slow paths are deferred into cold, to be emitted after the rest so
+// the fast paths fall through.
+class Emitter
+{
+public:
+	Emitter(const DecodedOpList &ops) : ops(ops), exit_label(as.label())
+	{
+	}
+
+protected:
+	typedef X64Code::Label Label;
+
+	const DecodedOpList &ops;
+	X64Code as;
+	Label exit_label; // where code exits, with state.ip already set
+	std::vector<std::function<void()>> cold;
+
+	// the code with its slow paths (which can defer more of them) and exit
+	std::vector<Uint8> finish()
+	{
+		for (size_t i = 0; i < cold.size(); i++)
+		{
+			auto emit_cold = std::move(cold[i]);
+			emit_cold();
+		}
+		as.bind(exit_label);
+		emit_exit(as);
+		return as.finish();
+	}
+
+	void push_rax()
+	{
+		as.emit({ 0x48, 0x89, 0x03 });       // mov [rbx], rax
+		as.emit({ 0x48, 0x83, 0xC3, 0x08 }); // add rbx, 8
+	}
+	void drop(Uint8 count)
+	{
+		as.emit({ 0x48, 0x83, 0xEB, Uint8(count * 8) }); // sub rbx, count*8
+	}
+	// left operand (the top) into rax, right operand into rcx
+	void load_operands()
+	{
+		as.emit({ 0x48, 0x8B, 0x43, 0xF8 }); // mov rax, [rbx-8]
+		as.emit({ 0x48, 0x8B, 0x4B, 0xF0 }); // mov rcx, [rbx-16]
+	}
+	// replaces both operands with rax
+	void store_result()
+	{
+		as.emit({ 0x48, 0x89, 0x43, 0xF0 }); // mov [rbx-16], rax
+		drop(1);
+	}
+	void mov_imm64(Reg reg, Uint64 value)
+	{
+		as.emit({ 0x48, Uint8(0xB8 | reg) }); // mov reg, imm64
+		as.imm64(value);
+	}
+	void load_slot(Uint16 slot)
+	{
+		as.emit({ 0x49, 0x8B, 0x85 }); // mov rax, [r13+disp32]
+		as.imm32(Uint32(slot) * 8);
+	}
+	void store_slot(Uint16 slot)
+	{
+		as.emit({ 0x49, 0x89, 0x85 }); // mov [r13+disp32], rax
+		as.imm32(Uint32(slot) * 8);
+	}
+	// jumps to l unless the tag of reg is tag
+	void check_tag(Reg reg, Uint64 tag, Label l)
+	{
+		as.emit({ 0x48, 0x89, Uint8(0xC2 | (reg << 3)) }); // mov rdx, reg
+		as.emit({ 0x48, 0xC1, 0xEA, 0x30 });               // shr rdx, 48
+		as.emit({ 0x81, 0xFA });                           // cmp edx, imm32
+		as.imm32(Uint32(tag >> 48));
+		as.jcc(CC_NE, l);
+	}
+	// jumps to l unless reg is a Float
+	void check_float(Reg reg, Label l)
+	{
+		mov_imm64(RDX, TValue::TAG_NULL);
+		as.emit({ 0x48, 0x39, Uint8(0xD0 | reg) }); // cmp reg, rdx
+		as.jcc(CC_AE, l);
+	}
+	// sign extends the 48-bit payload of an Int
+	void unbox_int(Reg reg)
+	{
+		as.emit({ 0x48, 0xC1, Uint8(0xE0 | reg), 0x10 }); // shl reg, 16
+		as.emit({ 0x48, 0xC1, Uint8(0xF8 | reg), 0x10 }); // sar reg, 16
+	}
+	// boxes the Int in rax, jumping to l if it's too big to be immediate
+	void box_int(Label l)
+	{
+		as.emit({ 0x48, 0x89, 0xC2 });       // mov rdx, rax
+		as.emit({ 0x48, 0xC1, 0xE2, 0x10 }); // shl rdx, 16
+		as.emit({ 0x48, 0xC1, 0xFA, 0x10 }); // sar rdx, 16
+		as.emit({ 0x48, 0x39, 0xC2 });       // cmp rdx, rax
+		as.jcc(CC_NE, l);
+		as.emit({ 0x48, 0xC1, 0xE0, 0x10 }); // shl rax, 16
+		as.emit({ 0x48, 0xC1, 0xE8, 0x10 }); // shr rax, 16
+		mov_imm64(RDX, TValue::TAG_INT);
+		as.emit({ 0x48, 0x09, 0xD0 }); // or rax, rdx
+	}
+	// rax = a Bool of whether cc holds
+	void box_bool(Cond cc)
+	{
+		as.emit({ 0x0F, Uint8(0x90 | cc), 0xC2 }); // setcc dl
+		as.emit({ 0x0F, 0xB6, 0xD2 });             // movzx edx, dl
+		mov_imm64(RAX, TValue::TAG_BOOL);
+		as.emit({ 0x48, 0x09, 0xD0 }); // or rax, rdx
+	}
+	void load_floats()
+	{
+		as.emit({ 0x66, 0x48, 0x0F, 0x6E, 0xC0 }); // movq xmm0, rax
+		as.emit({ 0x66, 0x48, 0x0F, 0x6E, 0xC9 }); // movq xmm1, rcx
+	}
+	// compares xmm0 and xmm1 for cc, which is A or AE, swapped for < and <=
+	void compare_floats(bool swapped)
+	{
+		if (swapped)
+			as.emit({ 0x66, 0x0F, 0x2E, 0xC8 }); // ucomisd xmm1, xmm0
+		else
+			as.emit({ 0x66, 0x0F, 0x2E, 0xC1 }); // ucomisd xmm0, xmm1
+	}
+
+	// Calls a helper with the op, with the stack written back before and
+	// the stack and slots reloaded after. The result is in rax.
+	void invoke(Uint64 fn, const DecodedOp &op)
+	{
+		as.emit({ 0x49, 0x89, 0x5C, 0x24, STATE_SP }); // mov [r12+sp], rbx
+		as.emit({ 0x4C, 0x89, 0xE7 });                 // mov rdi, r12
+		as.emit({ 0x48, 0xBE });                       // mov rsi, imm64
+		as.imm64(address(&op));
+		mov_imm64(RAX, fn);
+		as.emit({ 0xFF, 0xD0 });                       // call rax
+		as.emit({ 0x49, 0x8B, 0x5C, 0x24, STATE_SP }); // mov rbx, [r12+sp]
+		// mov r13, [r12+slots]
+		as.emit({ 0x4D, 0x8B, 0x6C, 0x24, STATE_SLOTS });
+	}
+	// a helper returning false when the code has to exit
+	void invoke_checked(Uint64 fn, const DecodedOp &op)
+	{
+		invoke(fn, op);
+		as.emit({ 0x84, 0xC0 }); // test al, al
+		as.jcc(CC_E, exit_label);
+	}
+	// a helper returning the code to go on with, or nullptr to exit
+	void invoke_transfer(Uint64 fn, const DecodedOp &op)
+	{
+		invoke(fn, op);
+		as.emit({ 0x48, 0x85, 0xC0 }); // test rax, rax
+		as.jcc(CC_E, exit_label);
+		as.emit({ 0xFF, 0xE0 }); // jmp rax
+	}
+
+	// leaves the native code for the interpreter to carry on at index
+	void exit_at(CodeAddr index)
+	{
+		as.emit({ 0x41, 0xC7, 0x44, 0x24, STATE_IP }); // mov [r12+ip], imm32
+		as.imm32(index);
+		as.jmp(exit_label);
+	}
+
+	void push_value(TValue value)
+	{
+		mov_imm64(RAX, value.bits);
+		push_rax();
+	}
+
+	void load_local(const DecodedOp &op)
+	{
+		load_slot(op.slot);
+		push_rax();
+	}
+
+	// jumps to l if rax is a pointer, which has to go through the write
+	// barrier to be stored
+	void check_not_ptr(Label l)
+	{
+		as.emit({ 0x48, 0x89, 0xC2 });       // mov rdx, rax
+		as.emit({ 0x48, 0xC1, 0xEA, 0x30 }); // shr rdx, 48
+		as.emit({ 0x81, 0xFA });             // cmp edx, imm32
+		as.imm32(Uint32(TValue::TAG_PTR >> 48));
+		as.jcc(CC_E, l);
+	}
+
+	void store_local(const DecodedOp &op, Label slow)
+	{
+		as.emit({ 0x48, 0x8B, 0x43, 0xF8 }); // mov rax, [rbx-8]
+		check_not_ptr(slow);
+		store_slot(op.slot);
+		drop(1);
+	}
+
+	// globals are never removed, so where their values are doesn't change
+	void load_global(const TValue *global)
+	{
+		mov_imm64(RAX, address(global));
+		as.emit({ 0x48, 0x8B, 0x00 }); // mov rax, [rax]
+	}
+	void store_global(const TValue *global)
+	{
+		mov_imm64(RDX, address(global));
+		as.emit({ 0x48, 0x89, 0x02 }); // mov [rdx], rax
+	}
+
+	// Loads both operands as Ints, jumping to slow if the ones checked
+	// aren't immediate Ints
+	void int_operands(Label slow, bool check_left = true,
+	                  bool check_right = true)
+	{
+		load_operands();
+		if (check_left)
+			check_tag(RAX, TValue::TAG_INT, slow);
+		if (check_right)
+			check_tag(RCX, TValue::TAG_INT, slow);
+		unbox_int(RAX);
+		unbox_int(RCX);
+	}
+	void float_operands(Label slow, bool check_left = true,
+	                    bool check_right = true)
+	{
+		load_operands();
+		if (check_left)
+			check_float(RAX, slow);
+		if (check_right)
+			check_float(RCX, slow);
+		load_floats();
+	}
+
+	// replaces the Int operands with their sum, difference or product,
+	// jumping to slow if it isn't an immediate Int
+	void int_arith(OpCode code, Label slow)
+	{
+		switch (code)
+		{
+			case OpCode::OP_ADD:
+				as.emit({ 0x48, 0x01, 0xC8 }); // add rax, rcx
+				break;
+			case OpCode::OP_SUB:
+				as.emit({ 0x48, 0x29, 0xC8 }); // sub rax, rcx
+				break;
+			default:
+				as.emit({ 0x48, 0x0F, 0xAF, 0xC1 }); // imul rax, rcx
+				as.jcc(CC_O, slow);
+				break;
+		}
+		box_int(slow);
+		store_result();
+	}
+	void int_compare(Cond cc)
+	{
+		as.emit({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+		box_bool(cc);
+		store_result();
+	}
+	void float_arith(OpCode code)
+	{
+		switch (code)
+		{
+			case OpCode::OP_ADD:
+				as.emit({ 0xF2, 0x0F, 0x58, 0xC1 }); // addsd xmm0, xmm1
+				break;
+			case OpCode::OP_SUB:
+				as.emit({ 0xF2, 0x0F, 0x5C, 0xC1 }); // subsd xmm0, xmm1
+				break;
+			default:
+				as.emit({ 0xF2, 0x0F, 0x59, 0xC1 }); // mulsd xmm0, xmm1
+				break;
+		}
+		as.emit({ 0x66, 0x48, 0x0F, 0x7E, 0xC0 }); // movq rax, xmm0
+		// NaNs all have to be the canonical one
+		as.emit({ 0x66, 0x0F, 0x2E, 0xC0 }); // ucomisd xmm0, xmm0
+		as.emit({ 0x7B, 0x0A });             // jnp past the mov
+		mov_imm64(RAX, TValue::CANONICAL_NAN);
+		store_result();
+	}
+	void float_compare(Cond cc, bool swapped)
+	{
+		compare_floats(swapped);
+		box_bool(cc);
+		store_result();
+	}
+
+	// pushes the result of the value in rax and the op's immediate Int
+	// constant, jumping to slow if the value isn't an immediate Int (when
+	// it's checked) or an add or subtract overflows
+	void int_constant(const DecodedOp &op, OpCode code, Cond cc, Label slow,
+	                  bool check = true)
+	{
+		if (check)
+			check_tag(RAX, TValue::TAG_INT, slow);
+		unbox_int(RAX);
+		mov_imm64(RCX, Uint64(op.int_value));
+		switch (code)
+		{
+			case OpCode::OP_ADD:
+				as.emit({ 0x48, 0x01, 0xC8 }); // add rax, rcx
+				box_int(slow);
+				break;
+			case OpCode::OP_SUB:
+				as.emit({ 0x48, 0x29, 0xC8 }); // sub rax, rcx
+				box_int(slow);
+				break;
+			default:
+				as.emit({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+				box_bool(cc);
+				break;
+		}
+		push_rax();
+	}
+};
+
+// Translates the ops of one function, the ones reachable from its entry
+// without going through another function.
+class Translator : public Emitter
+{
+public:
+	Translator(VM &vm, CodeAddr entry)
+	    : Emitter(vm.program->ops), entry(entry), included(ops.size(), false),
+	      labels(ops.size())
+	{
+	}
+
+	std::vector<Uint8> translate()
+	{
+		find_ops();
+		for (CodeAddr i = 0; i < ops.size(); i++)
+		{
+			if (included[i])
+				labels[i] = as.label();
+		}
+		for (CodeAddr i = 0; i < ops.size(); i++)
+		{
+			if (!included[i])
+				continue;
+			as.bind(labels[i]);
+			translate(i);
+		}
+		return finish();
+	}
+
+private:
+	CodeAddr entry;
+	std::vector<bool> included;
+	std::vector<Label> labels;
+
+	static bool has_template(OpCode code)
+	{
+		switch (code)
+		{
+			case OpCode::OP_HALT:
+			case OpCode::OP_IP_ASSIGN:
+			case OpCode::OP_INDEX:
+			case OpCode::OP_MEMBER:
+				return false;
+			default:
+				return Uint8(code) < Uint8(OpCode::OP_PUSH_FLOAT);
+		}
+	}
+
+	// every op the function can get to, ops without a template end a path
+	void find_ops()
+	{
+		std::vector<CodeAddr> work{ entry };
+		while (!work.empty())
+		{
+			auto i = work.back();
+			work.pop_back();
+			if (included[i])
+				continue;
+			included[i] = true;
+			auto &op = ops[i];
+			if (!has_template(op.code))
+				continue;
+			switch (op.code)
+			{
+				case OpCode::OP_JUMP:
+					work.push_back(op.target);
+					break;
+				case OpCode::OP_RETURN:
+				case OpCode::OP_TAIL_CALL:
+				case OpCode::OP_TAIL_CALL_SYMBOL:
+					break;
+				default:
+					if (op.code == OpCode::OP_JUMP_TRUE ||
+					    op.code == OpCode::OP_JUMP_FALSE ||
+					    branch_helper(op.code))
+					{
+						work.push_back(op.target);
+					}
+					work.push_back(i + 1);
+					break;
+			}
+		}
+	}
+
+	// a helper returning 1 to jump to target, 0 to go to the next op and
+	// -1 to exit
+	void invoke_branch(Uint64 fn, CodeAddr index, CodeAddr target)
+	{
+		invoke(fn, ops[index]);
+		as.emit({ 0x85, 0xC0 }); // test eax, eax
+		as.jcc(CC_L, exit_label);
+		branch(CC_NE, index, target);
+		as.jmp(labels[index + 1]);
+	}
+
+	// Jumps to the op at target when cc holds (or always, for jmp). The
+	// VM is checked at backward jumps, so loops can be paused and their
+	// garbage collected.
+	void branch(Cond cc, CodeAddr index, CodeAddr target)
+	{
+		if (target > index)
+		{
+			as.jcc(cc, labels[target]);
+			return;
+		}
+		auto check = as.label();
+		as.jcc(cc, check);
+		defer_check(check, target);
+	}
+	void jump(CodeAddr index, CodeAddr target)
+	{
+		if (target > index)
+		{
+			as.jmp(labels[target]);
+			return;
+		}
+		auto check = as.label();
+		as.jmp(check);
+		defer_check(check, target);
+	}
+	void defer_check(Label check, CodeAddr target)
+	{
+		cold.push_back([this, check, target]() {
+			as.bind(check);
+			invoke_checked(helper(check_helper), ops[target]);
+			as.jmp(labels[target]);
+		});
+	}
+
+	// the op's slow path, which calls its helper to do the whole op
+	Label slow_path(CodeAddr index)
+	{
+		auto slow = as.label();
+		cold.push_back([this, slow, index]() {
+			as.bind(slow);
+			invoke_checked(helper(op_helper(ops[index].code)), ops[index]);
+			as.jmp(labels[index + 1]);
+		});
+		return slow;
+	}
+	Label slow_branch(CodeAddr index)
+	{
+		auto slow = as.label();
+		cold.push_back([this, slow, index]() {
+			as.bind(slow);
+			invoke_branch(helper(branch_helper(ops[index].code)), index,
+			              ops[index].target);
+		});
+		return slow;
+	}
+
+	//
+	// Templates
+	//
+
+	// pops a value and jumps to the target if its truth is jump_if, Bools
+	// are tested inline
+	void jump_truth(CodeAddr index, bool jump_if)
+	{
+		auto &op = ops[index];
+		auto slow = as.label();
+		auto is_true = as.label();
+		as.emit({ 0x48, 0x8B, 0x43, 0xF8 }); // mov rax, [rbx-8]
+		drop(1);
+		mov_imm64(RDX, TValue::make_bool(true).bits);
+		as.emit({ 0x48, 0x39, 0xD0 }); // cmp rax, rdx
+		as.jcc(CC_E, is_true);
+		mov_imm64(RDX, TValue::make_bool(false).bits);
+		as.emit({ 0x48, 0x39, 0xD0 }); // cmp rax, rdx
+		as.jcc(CC_NE, slow);
+		if (jump_if)
+			as.jmp(labels[index + 1]);
+		else
+			jump(index, op.target);
+		as.bind(is_true);
+		if (jump_if)
+			jump(index, op.target);
+		else
+			as.jmp(labels[index + 1]);
+		cold.push_back([this, slow, index, jump_if]() {
+			as.bind(slow);
+			invoke(helper(truth_helper), ops[index]);
+			as.emit({ 0x85, 0xC0 }); // test eax, eax
+			as.jcc(CC_L, exit_label);
+			branch(jump_if ? CC_NE : CC_E, index, ops[index].target);
+			as.jmp(labels[index + 1]);
+		});
+	}
+
+	// Int and Float arithmetic and compares are done inline, falling back
+	// to the helper when the operands aren't both immediate Ints or both
+	// Floats
+	void numeric_arith(CodeAddr index, OpCode code, bool floats)
+	{
+		auto slow = slow_path(index);
+		if (floats)
+		{
+			float_operands(slow);
+			float_arith(code);
+			return;
+		}
+		int_operands(slow);
+		int_arith(code, slow);
+	}
+	void int_compare(CodeAddr index, Cond cc)
+	{
+		int_operands(slow_path(index));
+		Emitter::int_compare(cc);
+	}
+	void float_compare(CodeAddr index, Cond cc, bool swapped)
+	{
+		float_operands(slow_path(index));
+		Emitter::float_compare(cc, swapped);
+	}
+	void int_compare_jump(CodeAddr index, Cond cc)
+	{
+		int_operands(slow_branch(index));
+		drop(2);
+		as.emit({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+		branch(negate(cc), index, ops[index].target);
+	}
+	void float_compare_jump(CodeAddr index, Cond cc, bool swapped)
+	{
+		float_operands(slow_branch(index));
+		drop(2);
+		compare_floats(swapped);
+		branch(negate(cc), index, ops[index].target);
+	}
+
+	// a local and an Int constant, done inline when both are immediate
+	void local_int(CodeAddr index, OpCode code, Cond cc)
+	{
+		auto &op = ops[index];
+		if (!TValue::make_int(op.int_value).is_small_int())
+		{
+			invoke_checked(helper(op_helper(op.code)), op);
+			return;
+		}
+		load_slot(op.slot);
+		int_constant(op, code, cc, slow_path(index));
+	}
+
+	void translate(CodeAddr index)
+	{
+		auto &op = ops[index];
+
+// the templates of generic ops and their quickened forms are the same
+#define JIT_ARITH(code)                                 \
+	case OpCode::OP_##code:                             \
+	case OpCode::OP_##code##_INT_INT:                   \
+		numeric_arith(index, OpCode::OP_##code, false); \
+		break;                                          \
+	case OpCode::OP_##code##_FLOAT_FLOAT:               \
+		numeric_arith(index, OpCode::OP_##code, true);  \
+		break;
+#define JIT_COMPARE(code, cc, float_cc, swapped)               \
+	case OpCode::OP_##code:                                    \
+	case OpCode::OP_##code##_INT_INT:                          \
+		int_compare(index, cc);                                \
+		break;                                                 \
+	case OpCode::OP_##code##_FLOAT_FLOAT:                      \
+		float_compare(index, float_cc, swapped);               \
+		break;                                                 \
+	case OpCode::OP_##code##_JUMP_FALSE:                       \
+	case OpCode::OP_##code##_JUMP_FALSE_INT_INT:               \
+		int_compare_jump(index, cc);                           \
+		break;                                                 \
+	case OpCode::OP_##code##_JUMP_FALSE_FLOAT_FLOAT:           \
+		float_compare_jump(index, float_cc, swapped);          \
+		break;                                                 \
+	case OpCode::OP_##code##_LOCAL_INT:                        \
+		local_int(index, OpCode::OP_##code, cc);               \
+		break;
+// Floats are only compared inline for ordering, == and != go through the
+// Value operators
+#define JIT_EQUALITY(code, cc)                                        \
+	case OpCode::OP_##code:                                           \
+	case OpCode::OP_##code##_INT_INT:                                 \
+		int_compare(index, cc);                                       \
+		break;                                                        \
+	case OpCode::OP_##code##_JUMP_FALSE:                              \
+	case OpCode::OP_##code##_JUMP_FALSE_INT_INT:                      \
+		int_compare_jump(index, cc);                                  \
+		break;                                                        \
+	case OpCode::OP_##code##_JUMP_FALSE_FLOAT_FLOAT:                  \
+		invoke_branch(                                                \
+		    helper(branch_helper(OpCode::OP_##code##_JUMP_FALSE)),    \
+		    index, op.target);                                        \
+		break;                                                        \
+	case OpCode::OP_##code##_LOCAL_INT:                               \
+		local_int(index, OpCode::OP_##code, cc);                      \
+		break;
+
+		switch (op.code)
+		{
+			case OpCode::OP_NOP:
+				break;
+			case OpCode::OP_LOAD_LOCAL:
+				load_local(op);
+				break;
+			case OpCode::OP_STORE_LOCAL:
+				store_local(op, slow_path(index));
+				break;
+			case OpCode::OP_CALL:
+			case OpCode::OP_CALL_SYMBOL:
+				// where the callee returns to if it's compiled too
+				as.emit({ 0x48, 0x8D, 0x05 }); // lea rax, [rip+rel32]
+				as.rel32(labels[index + 1]);
+				as.emit({ 0x49, 0x89, 0x44, 0x24, STATE_RESUME });
+				invoke_transfer(helper(call_helper), op);
+				break;
+			case OpCode::OP_TAIL_CALL:
+			case OpCode::OP_TAIL_CALL_SYMBOL:
+				invoke_transfer(helper(tail_call_helper), op);
+				break;
+			case OpCode::OP_RETURN:
+				invoke_transfer(helper(return_helper), op);
+				break;
+			case OpCode::OP_JUMP:
+				jump(index, op.target);
+				break;
+			case OpCode::OP_JUMP_TRUE:
+				jump_truth(index, true);
+				break;
+			case OpCode::OP_JUMP_FALSE:
+				jump_truth(index, false);
+				break;
+			case OpCode::OP_POP_TOP:
+				drop(1);
+				break;
+			case OpCode::OP_PUSH_NULL:
+				push_value(TValue());
+				break;
+			case OpCode::OP_PUSH_TRUE:
+				push_value(TValue::make_bool(true));
+				break;
+			case OpCode::OP_PUSH_FALSE:
+				push_value(TValue::make_bool(false));
+				break;
+			case OpCode::OP_PUSH_CONST:
+				push_value(op.constant);
+				break;
+			case OpCode::OP_ADD_LOCAL_INT:
+				local_int(index, OpCode::OP_ADD, CC_O);
+				break;
+			case OpCode::OP_SUB_LOCAL_INT:
+				local_int(index, OpCode::OP_SUB, CC_O);
+				break;
+				// clang-format off
+			JIT_ARITH(ADD)
+			JIT_ARITH(SUB)
+			JIT_ARITH(MUL)
+			JIT_EQUALITY(EQ, CC_E)
+			JIT_EQUALITY(NE, CC_NE)
+			JIT_COMPARE(GT, CC_G, CC_A, false)
+			JIT_COMPARE(GE, CC_GE, CC_AE, false)
+			JIT_COMPARE(LT, CC_L, CC_A, true)
+			JIT_COMPARE(LE, CC_LE, CC_AE, true)
+			// clang-format on
+			default:
+				// everything else is done by its helper, if it has one
+				if (auto fn = op_helper(op.code))
+					invoke_checked(helper(fn), op);
+				else
+					exit_at(index);
+				break;
+		}
+
+#undef JIT_ARITH
+#undef JIT_COMPARE
+#undef JIT_EQUALITY
+	}
+};
+
+//
+// Traces
+//
+
+// what's known of the type of a value in a trace
+enum class Kind : Uint8
+{
+	ANY,
+	INT, // immediate only
+	FLOAT,
+	BOOL,
+};
+
+static Kind kind_of(TValue value)
+{
+	if (value.is_small_int())
+		return Kind::INT;
+	if (value.is_float())
+		return Kind::FLOAT;
+	if (value.is_bool())
+		return Kind::BOOL;
+	return Kind::ANY;
+}
+
+// An op run while recording, with the kinds of the operands it was run
+// with, the top of the stack's (or its variable's for *_LOCAL_INT and
+// *_SYMBOL_INT) on the left.
+struct TraceOp
+{
+	CodeAddr index;
+	Kind left;
+	Kind right;
+	bool jumped; // whether a jump went to its target
+};
+
+typedef std::vector<TraceOp> Trace;
+
+// the longest trace recorded, longer iterations are left interpreted
+static constexpr size_t MAX_TRACE = 500;
+
+static bool reads_local(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_LOAD_LOCAL:
+		case OpCode::OP_ADD_LOCAL_INT:
+		case OpCode::OP_SUB_LOCAL_INT:
+		case OpCode::OP_EQ_LOCAL_INT:
+		case OpCode::OP_NE_LOCAL_INT:
+		case OpCode::OP_GT_LOCAL_INT:
+		case OpCode::OP_GE_LOCAL_INT:
+		case OpCode::OP_LT_LOCAL_INT:
+		case OpCode::OP_LE_LOCAL_INT:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool reads_global(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_ADD_SYMBOL_INT:
+		case OpCode::OP_SUB_SYMBOL_INT:
+		case OpCode::OP_EQ_SYMBOL_INT:
+		case OpCode::OP_NE_SYMBOL_INT:
+		case OpCode::OP_GT_SYMBOL_INT:
+		case OpCode::OP_GE_SYMBOL_INT:
+		case OpCode::OP_LT_SYMBOL_INT:
+		case OpCode::OP_LE_SYMBOL_INT:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Ops which can be in a trace, the ones staying in the current function
+// and env
+static bool traceable(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_NOP:
+		case OpCode::OP_LOAD_LOCAL:
+		case OpCode::OP_JUMP:
+		case OpCode::OP_JUMP_TRUE:
+		case OpCode::OP_JUMP_FALSE:
+		case OpCode::OP_POP_TOP:
+		case OpCode::OP_PUSH_NULL:
+		case OpCode::OP_PUSH_TRUE:
+		case OpCode::OP_PUSH_FALSE:
+		case OpCode::OP_PUSH_CONST:
+			return true;
+		case OpCode::OP_OPEN_SCOPE:
+		case OpCode::OP_CLOSE_SCOPE:
+			return false;
+		default:
+			return op_helper(code) || branch_helper(code);
+	}
+}
+
+// Runs the ops of the loop starting at state.ip, recording them, until
+// it's back at the start. Returns false if it stopped before then, at an
+// op which can't be traced, an inner loop, or one outside the loop (the
+// ops up to the latch, its furthest backward jump), leaving state.ip at
+// the op to carry on from. If an op threw, Jit::fail() has been called.
+static bool record_trace(JitState *s, CodeAddr latch, Trace &trace)
+{
+	auto &vm = *s->vm;
+	auto &ops = vm.program->ops;
+	auto header = s->ip;
+	auto i = header;
+	do
+	{
+		auto &op = ops[i];
+		if (i < header || i > latch || trace.size() == MAX_TRACE ||
+		    !traceable(op.code))
+		{
+			s->ip = i;
+			return false;
+		}
+		TraceOp t{ i, Kind::ANY, Kind::ANY, false };
+		auto depth = s->sp - vm.stack.begin();
+		auto global = reads_global(op.code)
+		                  ? vm.globals->lookup(op.name, false)
+		                  : nullptr;
+		if (reads_local(op.code))
+			t.left = kind_of(s->slots[op.slot]);
+		else if (global)
+			t.left = kind_of(*global);
+		else if (depth > 0)
+			t.left = kind_of(s->sp[-1]);
+		if (depth > 1)
+			t.right = kind_of(s->sp[-2]);
+		auto result = 0;
+		switch (op.code)
+		{
+			case OpCode::OP_NOP:
+				break;
+			case OpCode::OP_LOAD_LOCAL:
+				*s->sp++ = s->slots[op.slot];
+				break;
+			case OpCode::OP_JUMP:
+				t.jumped = true;
+				break;
+			case OpCode::OP_JUMP_TRUE:
+			case OpCode::OP_JUMP_FALSE:
+				s->sp--;
+				result = truth_helper(s, &op);
+				t.jumped = (result == (op.code == OpCode::OP_JUMP_TRUE));
+				break;
+			case OpCode::OP_POP_TOP:
+				s->sp--;
+				break;
+			case OpCode::OP_PUSH_NULL:
+				*s->sp++ = TValue();
+				break;
+			case OpCode::OP_PUSH_TRUE:
+				*s->sp++ = TValue::make_bool(true);
+				break;
+			case OpCode::OP_PUSH_FALSE:
+				*s->sp++ = TValue::make_bool(false);
+				break;
+			case OpCode::OP_PUSH_CONST:
+				*s->sp++ = op.constant;
+				break;
+			default:
+				if (auto fn = branch_helper(op.code))
+				{
+					result = fn(s, &op);
+					t.jumped = (result == 1);
+				}
+				else if (!op_helper(op.code)(s, &op))
+					result = -1;
+				break;
+		}
+		if (result < 0)
+			return false;
+		trace.push_back(t);
+		auto next = t.jumped ? op.target : i + 1;
+		if (t.jumped && next <= i && next != header)
+		{
+			s->ip = next;
+			return false;
+		}
+		i = next;
+	} while (i != header);
+	return true;
+}
+
+// Compiles a trace of one iteration of a loop into a loop of its own.
+//
+// The trace is straight-line code specialized for the kinds its operands
+// were recorded with. Where they're not known to be the same, guards check
+// them, and a guard failing is a side exit: the interpreter carries on
+// from the op, which hasn't done anything yet. A branch going the other
+// way than it did when recorded also exits, to where it goes.
+//
+// The kinds of the locals read before they're written are checked once on
+// entry. Going round again skips those checks when the trace leaves them
+// with the same kinds, and when the checks fail the loop is recorded
+// again for what it's doing now.
+class TraceCompiler : public Emitter
+{
+public:
+	TraceCompiler(VM &vm, const Trace &trace)
+	    : Emitter(vm.program->ops), vm(vm), trace(trace), needs_check(false)
+	{
+	}
+
+	std::vector<Uint8> translate()
+	{
+		auto &header = ops[trace.front().index];
+		auto entry = as.label();
+		auto loop = as.label();
+		as.bind(entry);
+		guard_entry(header);
+		as.bind(loop);
+		locals = entry_kinds;
+		for (auto &t : trace)
+			translate(t);
+		// only helpers allocate, loops which don't call any have nothing
+		// to collect
+		if (needs_check)
+			invoke_checked(helper(check_helper), header);
+		auto same = true;
+		for (size_t slot = 0; slot < entry_kinds.size(); slot++)
+		{
+			if (entry_kinds[slot] != Kind::ANY &&
+			    locals[slot] != entry_kinds[slot])
+			{
+				same = false;
+			}
+		}
+		as.jmp(same ? loop : entry);
+		return finish();
+	}
+
+private:
+	VM &vm;
+	const Trace &trace;
+	std::vector<Kind> stack; // of the values pushed by the trace so far
+	std::vector<Kind> locals;
+	std::vector<Kind> entry_kinds; // of the locals, checked on entry
+	std::map<const TValue *, Kind> globals; // the ones stored so far
+	std::map<CodeAddr, Label> exits;
+	bool needs_check;
+
+	Kind pop_kind()
+	{
+		if (stack.empty())
+			return Kind::ANY;
+		auto kind = stack.back();
+		stack.pop_back();
+		return kind;
+	}
+	Kind &local_kind(Uint16 slot)
+	{
+		if (slot >= locals.size())
+			locals.resize(slot + 1, Kind::ANY);
+		return locals[slot];
+	}
+	Kind global_kind(const TValue *global)
+	{
+		auto found = globals.find(global);
+		return (found != globals.end()) ? found->second : Kind::ANY;
+	}
+
+	void guard_entry(const DecodedOp &header)
+	{
+		std::vector<bool> seen;
+		for (auto &t : trace)
+		{
+			auto &op = ops[t.index];
+			if (!reads_local(op.code) && op.code != OpCode::OP_STORE_LOCAL)
+				continue;
+			if (op.slot >= seen.size())
+			{
+				seen.resize(op.slot + 1, false);
+				entry_kinds.resize(op.slot + 1, Kind::ANY);
+			}
+			if (!seen[op.slot] && reads_local(op.code))
+				entry_kinds[op.slot] = t.left;
+			seen[op.slot] = true;
+		}
+		auto failed = as.label();
+		for (size_t slot = 0; slot < entry_kinds.size(); slot++)
+		{
+			if (entry_kinds[slot] == Kind::ANY)
+				continue;
+			load_slot(Uint16(slot));
+			if (entry_kinds[slot] == Kind::FLOAT)
+				check_float(RAX, failed);
+			else if (entry_kinds[slot] == Kind::INT)
+				check_tag(RAX, TValue::TAG_INT, failed);
+			else
+				check_tag(RAX, TValue::TAG_BOOL, failed);
+		}
+		cold.push_back([this, failed, &header]() {
+			as.bind(failed);
+			// mov [r12+ip], imm32
+			as.emit({ 0x41, 0xC7, 0x44, 0x24, STATE_IP });
+			as.imm32(CodeAddr(&header - ops.data()));
+			invoke_transfer(helper(record_helper), header);
+		});
+	}
+
+	// exits to the interpreter at index
+	Label side_exit(CodeAddr index)
+	{
+		auto found = exits.find(index);
+		if (found != exits.end())
+			return found->second;
+		auto exit = as.label();
+		exits[index] = exit;
+		cold.push_back([this, exit, index]() {
+			as.bind(exit);
+			exit_at(index);
+		});
+		return exit;
+	}
+
+	// the op done by its helper, leaving nothing known about its results
+	void generic(const TraceOp &t)
+	{
+		auto &op = ops[t.index];
+		invoke_checked(helper(op_helper(op.code)), op);
+		Uint32 pops, pushes;
+		stack_effect(op, pops, pushes);
+		while (pops--)
+			pop_kind();
+		while (pushes--)
+			stack.push_back(Kind::ANY);
+		if (op.code == OpCode::OP_BIND)
+			globals.clear();
+		needs_check = true;
+	}
+
+	// Stores the top of the stack in a local or global. Only pointers have
+	// to go through the helper, for the write barrier.
+	void store(const TraceOp &t, const TValue *global)
+	{
+		auto &op = ops[t.index];
+		auto kind = pop_kind();
+		if (global)
+			globals[global] = kind;
+		else
+			local_kind(op.slot) = kind;
+		auto slow = as.label();
+		auto done = as.label();
+		as.emit({ 0x48, 0x8B, 0x43, 0xF8 }); // mov rax, [rbx-8]
+		if (kind == Kind::ANY)
+			check_not_ptr(slow);
+		if (global)
+			store_global(global);
+		else
+			store_slot(op.slot);
+		drop(1);
+		as.bind(done);
+		if (kind != Kind::ANY)
+			return;
+		auto fn = global ? helper(store_global_helper)
+		                 : helper(store_local_helper);
+		cold.push_back([this, slow, done, fn, &op]() {
+			as.bind(slow);
+			invoke_checked(fn, op);
+			as.jmp(done);
+		});
+	}
+
+	// the kind both operands were recorded as, if they were the same
+	static Kind operands_kind(const TraceOp &t)
+	{
+		return (t.left == t.right) ? t.left : Kind::ANY;
+	}
+
+	void arith(const TraceOp &t, OpCode code)
+	{
+		auto kind = operands_kind(t);
+		if (kind != Kind::INT && kind != Kind::FLOAT)
+		{
+			generic(t);
+			return;
+		}
+		auto left = pop_kind();
+		auto right = pop_kind();
+		auto exit = side_exit(t.index);
+		if (kind == Kind::INT)
+		{
+			int_operands(exit, left != kind, right != kind);
+			int_arith(code, exit);
+		}
+		else
+		{
+			float_operands(exit, left != kind, right != kind);
+			float_arith(code);
+		}
+		stack.push_back(kind);
+	}
+
+	void compare(const TraceOp &t, Cond cc, Cond float_cc, bool swapped)
+	{
+		auto kind = operands_kind(t);
+		if (kind != Kind::INT && (kind != Kind::FLOAT || float_cc == CC_O))
+		{
+			generic(t);
+			return;
+		}
+		auto left = pop_kind();
+		auto right = pop_kind();
+		auto exit = side_exit(t.index);
+		if (kind == Kind::INT)
+		{
+			int_operands(exit, left != kind, right != kind);
+			int_compare(cc);
+		}
+		else
+		{
+			float_operands(exit, left != kind, right != kind);
+			float_compare(float_cc, swapped);
+		}
+		stack.push_back(Kind::BOOL);
+	}
+
+	// stays on the trace when a compare-and-jump goes the way it was
+	// recorded going
+	void compare_jump(const TraceOp &t, Cond cc, Cond float_cc, bool swapped)
+	{
+		auto &op = ops[t.index];
+		auto kind = operands_kind(t);
+		auto left = pop_kind();
+		auto right = pop_kind();
+		auto other = side_exit(t.jumped ? t.index + 1 : op.target);
+		if (kind == Kind::INT)
+		{
+			int_operands(side_exit(t.index), left != kind, right != kind);
+			drop(2);
+			as.emit({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+			// it jumps when cc doesn't hold
+			as.jcc(t.jumped ? cc : negate(cc), other);
+		}
+		else if (kind == Kind::FLOAT && float_cc != CC_O)
+		{
+			float_operands(side_exit(t.index), left != kind, right != kind);
+			drop(2);
+			compare_floats(swapped);
+			as.jcc(t.jumped ? float_cc : negate(float_cc), other);
+		}
+		else
+		{
+			invoke(helper(branch_helper(op.code)), op);
+			as.emit({ 0x85, 0xC0 }); // test eax, eax
+			as.jcc(CC_L, exit_label);
+			as.jcc(t.jumped ? CC_E : CC_NE, other);
+		}
+	}
+
+	// stays on the trace when the truth of the value popped is what it was
+	// when recorded
+	void jump_truth(const TraceOp &t, bool jump_if)
+	{
+		auto &op = ops[t.index];
+		auto truth = (t.jumped == jump_if);
+		auto other = side_exit(t.jumped ? t.index + 1 : op.target);
+		auto kind = pop_kind();
+		as.emit({ 0x48, 0x8B, 0x43, 0xF8 }); // mov rax, [rbx-8]
+		drop(1);
+		mov_imm64(RDX, TValue::make_bool(truth).bits);
+		as.emit({ 0x48, 0x39, 0xD0 }); // cmp rax, rdx
+		if (kind == Kind::BOOL)
+		{
+			as.jcc(CC_NE, other);
+			return;
+		}
+		auto slow = as.label();
+		auto done = as.label();
+		as.jcc(CC_NE, slow);
+		as.bind(done);
+		cold.push_back([this, slow, done, other, truth, &op]() {
+			as.bind(slow);
+			invoke(helper(truth_helper), op);
+			as.emit({ 0x85, 0xC0 }); // test eax, eax
+			as.jcc(CC_L, exit_label);
+			as.emit({ 0x83, 0xF8, Uint8(truth) }); // cmp eax, truth
+			as.jcc(CC_E, done);
+			as.jmp(other);
+		});
+	}
+
+	// a local or global and an Int constant
+	void variable_int(const TraceOp &t, OpCode code, Cond cc, bool is_global)
+	{
+		auto &op = ops[t.index];
+		auto global = is_global ? global_slot(op) : nullptr;
+		if (t.left != Kind::INT || (is_global && !global) ||
+		    !TValue::make_int(op.int_value).is_small_int())
+		{
+			generic(t);
+			return;
+		}
+		Kind known;
+		if (is_global)
+		{
+			load_global(global);
+			known = global_kind(global);
+		}
+		else
+		{
+			load_slot(op.slot);
+			known = local_kind(op.slot);
+		}
+		int_constant(op, code, cc, side_exit(t.index), known != Kind::INT);
+		auto arith = (code == OpCode::OP_ADD || code == OpCode::OP_SUB);
+		stack.push_back(arith ? Kind::INT : Kind::BOOL);
+	}
+
+	// where the value of the global named by the op is, nullptr if there
+	// isn't one yet
+	const TValue *global_slot(const DecodedOp &op)
+	{
+		return vm.globals->lookup(op.name, false);
+	}
+
+	void translate(const TraceOp &t)
+	{
+		auto &op = ops[t.index];
+
+// generic ops and their quickened forms are specialized for the kinds
+// they were recorded with, not what they were quickened for
+#define JIT_ARITH(code)                   \
+	case OpCode::OP_##code:               \
+	case OpCode::OP_##code##_INT_INT:     \
+	case OpCode::OP_##code##_FLOAT_FLOAT: \
+		arith(t, OpCode::OP_##code);      \
+		break;
+// Floats are only compared inline for ordering (CC_O meaning not at all)
+#define JIT_COMPARE(code, cc, float_cc, swapped)          \
+	case OpCode::OP_##code:                               \
+	case OpCode::OP_##code##_INT_INT:                     \
+	case OpCode::OP_##code##_FLOAT_FLOAT:                 \
+		compare(t, cc, float_cc, swapped);                \
+		break;                                            \
+	case OpCode::OP_##code##_JUMP_FALSE:                  \
+	case OpCode::OP_##code##_JUMP_FALSE_INT_INT:          \
+	case OpCode::OP_##code##_JUMP_FALSE_FLOAT_FLOAT:      \
+		compare_jump(t, cc, float_cc, swapped);           \
+		break;                                            \
+	case OpCode::OP_##code##_SYMBOL_INT:                  \
+		variable_int(t, OpCode::OP_##code, cc, true);     \
+		break;                                            \
+	case OpCode::OP_##code##_LOCAL_INT:                   \
+		variable_int(t, OpCode::OP_##code, cc, false);    \
+		break;
+
+		switch (op.code)
+		{
+			case OpCode::OP_NOP:
+			case OpCode::OP_JUMP: // the trace goes on at the target
+				break;
+			case OpCode::OP_LOAD_LOCAL:
+				load_local(op);
+				stack.push_back(local_kind(op.slot));
+				break;
+			case OpCode::OP_STORE_LOCAL:
+				store(t, nullptr);
+				break;
+			case OpCode::OP_LOAD_GLOBAL:
+				if (auto global = global_slot(op))
+				{
+					load_global(global);
+					push_rax();
+					stack.push_back(global_kind(global));
+				}
+				else
+					generic(t);
+				break;
+			case OpCode::OP_STORE_GLOBAL:
+				if (auto global = global_slot(op))
+					store(t, global);
+				else
+					generic(t);
+				break;
+			case OpCode::OP_JUMP_TRUE:
+				jump_truth(t, true);
+				break;
+			case OpCode::OP_JUMP_FALSE:
+				jump_truth(t, false);
+				break;
+			case OpCode::OP_POP_TOP:
+				drop(1);
+				pop_kind();
+				break;
+			case OpCode::OP_PUSH_NULL:
+				push_value(TValue());
+				stack.push_back(Kind::ANY);
+				break;
+			case OpCode::OP_PUSH_TRUE:
+			case OpCode::OP_PUSH_FALSE:
+				push_value(TValue::make_bool(op.code == OpCode::OP_PUSH_TRUE));
+				stack.push_back(Kind::BOOL);
+				break;
+			case OpCode::OP_PUSH_CONST:
+				push_value(op.constant);
+				stack.push_back(kind_of(op.constant));
+				break;
+			case OpCode::OP_ADD_SYMBOL_INT:
+				variable_int(t, OpCode::OP_ADD, CC_O, true);
+				break;
+			case OpCode::OP_SUB_SYMBOL_INT:
+				variable_int(t, OpCode::OP_SUB, CC_O, true);
+				break;
+			case OpCode::OP_ADD_LOCAL_INT:
+				variable_int(t, OpCode::OP_ADD, CC_O, false);
+				break;
+			case OpCode::OP_SUB_LOCAL_INT:
+				variable_int(t, OpCode::OP_SUB, CC_O, false);
+				break;
+				// clang-format off
+			JIT_ARITH(ADD)
+			JIT_ARITH(SUB)
+			JIT_ARITH(MUL)
+			JIT_COMPARE(EQ, CC_E, CC_O, false)
+			JIT_COMPARE(NE, CC_NE, CC_O, false)
+			JIT_COMPARE(GT, CC_G, CC_A, false)
+			JIT_COMPARE(GE, CC_GE, CC_AE, false)
+			JIT_COMPARE(LT, CC_L, CC_A, true)
+			JIT_COMPARE(LE, CC_LE, CC_AE, true)
+			// clang-format on
+			default:
+				generic(t);
+				break;
+		}
+
+#undef JIT_ARITH
+#undef JIT_COMPARE
+	}
+};
+
+void *Jit::enter(VM &vm, CodeAddr addr)
+{
+	if (!enabled)
+		return nullptr;
+	if (entries.size() != vm.program->ops.size())
+		entries.assign(vm.program->ops.size(), Entry{ 0, nullptr });
+	auto &entry = entries[addr];
+	if (!entry.code && entry.calls < hot_calls && ++entry.calls == hot_calls)
+		entry.code = compile(vm, addr);
+	return entry.code;
+}
+
+void *Jit::loop(VM &vm, CodeAddr header, CodeAddr latch)
+{
+	if (!enabled)
+		return nullptr;
+	if (loops.size() != vm.program->ops.size())
+		loops.assign(vm.program->ops.size(), Loop{ 0, 0, 0, nullptr });
+	auto &loop = loops[header];
+	if (loop.code)
+		return loop.code;
+	if (latch > loop.latch)
+		loop.latch = latch;
+	if (loop.jumps < hot_loops && ++loop.jumps == hot_loops)
+	{
+		try
+		{
+			if (!recorder)
+				recorder.reset(new CodeBlock(recorder_code()));
+			start();
+			return recorder->data();
+		}
+		catch (RuntimeError &)
+		{
+		}
+	}
+	return nullptr;
+}
+
+void *Jit::record(JitState *s)
+{
+	auto &vm = *s->vm;
+	auto &loop = loops[s->ip];
+	loop.code = nullptr;
+	if (loop.recordings == MAX_RECORDINGS)
+		return nullptr;
+	loop.recordings++;
+	Trace trace;
+	if (!record_trace(s, loop.latch, trace))
+		return nullptr;
+	try
+	{
+		TraceCompiler compiler(vm, trace);
+		blocks.emplace_back(new CodeBlock(compiler.translate()));
+		loop.code = blocks.back()->data();
+	}
+	catch (RuntimeError &)
+	{
+	}
+	return loop.code;
+}
+
+bool Jit::run(VM &vm, void *code)
+{
+	JitState state;
+	state.sp = vm.stack.sp;
+	state.slots = vm.env->slots.data();
+	state.resume = nullptr;
+	state.ip = vm.ip;
+	state.vm = &vm;
+	error = nullptr;
+	auto enter = reinterpret_cast<void (*)(JitState *, void *)>(
+	    trampoline->data());
+	enter(&state, code);
+	vm.stack.sp = state.sp;
+	vm.ip = state.ip;
+	return !error;
+}
+
+// the code native code is entered through
+void Jit::start()
+{
+	if (!trampoline)
+		trampoline.reset(new CodeBlock(trampoline_code()));
+}
+
+// functions which can't be compiled are left to the interpreter
+void *Jit::compile(VM &vm, CodeAddr addr)
+{
+	try
+	{
+		start();
+		Translator translator(vm, addr);
+		blocks.emplace_back(new CodeBlock(translator.translate()));
+		return blocks.back()->data();
+	}
+	catch (RuntimeError &)
+	{
+		return nullptr;
+	}
+}
+
+#else // POP_JIT
+
+void *Jit::enter(VM &, CodeAddr)
+{
+	return nullptr;
+}
+
+void *Jit::loop(VM &, CodeAddr, CodeAddr)
+{
+	return nullptr;
+}
+
+void *Jit::record(JitState *)
+{
+	return nullptr;
+}
+
+bool Jit::run(VM &, void *)
+{
+	return true;
+}
+
+void Jit::start()
+{
+}
+
+void *Jit::compile(VM &, CodeAddr)
+{
+	return nullptr;
+}
+
+#endif // POP_JIT
+
+// namespace Pop
+}
@@ -0,0 +1,159 @@
+// jit.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_JIT_HPP
+#define POP_JIT_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/types.hpp>
+#include <pop/value.hpp>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <vector>
+
+// Native code is only generated for x86-64 with the System V calling
+// convention, unless configure was told not to (--disable-jit).
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(POP_NO_JIT)
+#define POP_JIT 1
+#endif
+
+namespace Pop
+{
+
+struct VM;
+
+// What native code shares with the helpers it calls, at fixed offsets
+// the generated code knows. Only the helpers and Jit::run() look at the
+// VM, the code itself keeps to the stack and the current env's slots.
+struct JitState
+{
+	TValue *sp;    // the value stack's top, see ValueStack
+	TValue *slots; // the current env's slots
+	void *resume;  // where a call made by native code returns to
+	CodeAddr ip;   // where the interpreter carries on after an exit
+	VM *vm;
+};
+
+// Memory holding generated code. It's written while it's only writable,
+// then made executable and never written again.
+class CodeBlock
+{
+public:
+	// throws a RuntimeError if the memory can't be mapped
+	CodeBlock(const std::vector<Uint8> &code);
+	~CodeBlock();
+
+	CodeBlock(const CodeBlock &) = delete;
+	CodeBlock &operator=(const CodeBlock &) = delete;
+
+	Uint8 *data() const
+	{
+		return static_cast<Uint8 *>(addr);
+	}
+
+private:
+	void *addr;
+	size_t len;
+};
+
+// A baseline compiler from the ops of a hot function to x86-64 code.
+//
+// Each op is translated on its own into a fixed sequence of machine code,
+// its template, with its operands patched in. The templates of the common
+// ops handle immediate Ints and Floats and locals inline and call the
+// same Value operators the interpreter uses for anything else. Ops without
+// a template end the native code and hand over to the interpreter, which
+// goes on from that op.
+//
+// Native code only runs within run(), in a single C++ frame, with the top
+// of the value stack and the current env's slots in registers. Calls and
+// returns between compiled functions jump straight from one to the other,
+// calls to interpreted functions exit, and returns to compiled functions
+// from the interpreter enter again through run() (see CallFrame::native).
+//
+// Loops are compiled on their own, whichever function they're in, once
+// the backward jumps to their start have made them hot. The next iteration
+// is recorded as a trace of the ops it runs and the kinds of values they
+// see, which is compiled into straight-line code specialized for them and
+// guarded to exit when they change, see TraceCompiler.
+class Jit
+{
+public:
+	// calls to a function before it's compiled
+	static constexpr Uint32 HOT_CALLS = 1000;
+	// backward jumps to the start of a loop before it's recorded
+	static constexpr Uint32 HOT_LOOPS = 100;
+	// times a loop is recorded before it's left to the interpreter
+	static constexpr Uint32 MAX_RECORDINGS = 4;
+
+	bool enabled;
+	Uint32 hot_calls;
+	Uint32 hot_loops;
+
+	Jit();
+	~Jit();
+
+	// Native code for the function starting at the op at addr, or nullptr
+	// if it's still interpreted. Each call counts towards compiling it.
+	void *enter(VM &vm, CodeAddr addr);
+
+	// Native code for the loop starting at the op at header, to be run from
+	// there, or nullptr if it's still interpreted. Each backward jump from
+	// latch counts towards recording it.
+	void *loop(VM &vm, CodeAddr header, CodeAddr latch);
+
+	// Runs native code until it exits, leaving vm.ip at the op the
+	// interpreter should carry on from. Returns false if one of the ops
+	// threw, which rethrow() throws again, with vm.ip at that op.
+	bool run(VM &vm, void *code);
+	[[noreturn]] void rethrow();
+
+	// forgets all the native code, for when the VM loads another program
+	void reset();
+
+	// keeps the current exception to be rethrown, for the helpers
+	void fail()
+	{
+		error = std::current_exception();
+	}
+
+	// records and compiles the loop at state.ip, for the native code which
+	// runs when it's hot or no longer fits its trace
+	void *record(JitState *state);
+
+private:
+	struct Entry
+	{
+		Uint32 calls;
+		void *code;
+	};
+
+	struct Loop
+	{
+		Uint32 jumps;
+		CodeAddr latch; // the furthest op jumping back to the start
+		Uint32 recordings;
+		void *code;
+	};
+
+	std::vector<Entry> entries; // by op index, only functions' are used
+	std::vector<Loop> loops;    // by op index, only loops' are used
+	std::vector<std::unique_ptr<CodeBlock>> blocks;
+	std::unique_ptr<CodeBlock> trampoline;
+	std::unique_ptr<CodeBlock> recorder;
+	std::exception_ptr error;
+
+	void start();
+	void *compile(VM &vm, CodeAddr addr);
+};
+
+// namespace Pop
+}
+
+#endif // POP_JIT_HPP
@@ -8,34 +8,61 @@ DEFINES += POP_COMPILING=1
 SOURCES = \
 	assembler.cpp \
 	ast.cpp \
+	cache.cpp \
+	constants.cpp \
 	disassembler.cpp \
 	format.cpp \
+	fusion.cpp \
+	gc.cpp \
+	image.cpp \
+	jit.cpp \
 	lexer.cpp \
+	linker.cpp \
 	opcodes.cpp \
+	optimizer.cpp \
+	peephole.cpp \
+	program.cpp \
 	parser.cpp \
+	pool.cpp \
+	ssa.cpp \
 	token.cpp \
 	value.cpp \
+	verifier.cpp \
 	vm.cpp
 
 HEADERS = \
 	assembler.hpp \
 	ast.hpp \
+	cache.hpp \
 	codebuffer.hpp \
 	compiler.hpp \
+	constants.hpp \
 	debugvisitor.hpp \
 	decoder.hpp \
 	disassembler.hpp \
+	endian.hpp \
 	error.hpp \
 	format.hpp \
+	fusion.hpp \
+	gc.hpp \
+	image.hpp \
 	instructions.hpp \
+	jit.hpp \
 	lexer.hpp \
+	linker.hpp \
 	location.hpp \
 	opcodes.hpp \
+	optimizer.hpp \
+	peephole.hpp \
 	parser.hpp \
 	pop.hpp \
+	pool.hpp \
+	program.hpp \
+	ssa.hpp \
 	token.hpp \
 	transformer.hpp \
 	types.hpp \
 	value.hpp \
+	verifier.hpp \
 	visitor.hpp \
 	vm.hpp
@@ -0,0 +1,352 @@
+// linker.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/codebuffer.hpp>
+#include <pop/constants.hpp>
+#include <pop/decoder.hpp>
+#include <pop/error.hpp>
+#include <pop/linker.hpp>
+#include <pop/opcodes.hpp>
+#include <algorithm>
+#include <cassert>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace Pop
+{
+
+static Section require(const Image &module, SectionKind kind,
+                       const char *what)
+{
+	auto section = module.section(kind);
+	if (section.size == 0)
+	{
+		std::stringstream ss;
+		ss << "module has no " << what << " section, it can't be linked";
+		throw RuntimeError(ss.str());
+	}
+	return section;
+}
+
+static std::vector<std::string> read_symbols(const Section &section)
+{
+	CodeAddr ip = 0;
+	Decoder dec(&ip, section.data, section.size);
+	std::vector<std::string> names(dec.read_u32());
+	for (auto &name : names)
+		name = dec.read_string();
+	return names;
+}
+
+static std::vector<Uint32> read_indices(const Section &section)
+{
+	CodeAddr ip = 0;
+	Decoder dec(&ip, section.data, section.size);
+	std::vector<Uint32> indices(dec.read_u32());
+	for (auto &index : indices)
+		index = dec.read_u32();
+	return indices;
+}
+
+// adds the module's constants to the pool, returning where each ended up
+static std::vector<Uint32> merge_constants(const Section &section,
+                                           ConstantPool &pool)
+{
+	CodeAddr ip = 0;
+	Decoder dec(&ip, section.data, section.size);
+	std::vector<Uint32> merged(dec.read_u32());
+	for (auto &index : merged)
+	{
+		auto kind = ConstKind(dec.read_u8());
+		switch (kind)
+		{
+			case ConstKind::INT:
+				index = pool.add_int(dec.read_s64());
+				break;
+			case ConstKind::FLOAT:
+				index = pool.add_float(dec.read_f64());
+				break;
+			case ConstKind::STRING:
+				index = pool.add_string(dec.read_string());
+				break;
+			default:
+			{
+				std::stringstream ss;
+				ss << "unknown constant kind '" << unsigned(kind) << "'";
+				throw RuntimeError(ss.str());
+			}
+		}
+	}
+	return merged;
+}
+
+static Uint32 remap(const std::vector<Uint32> &indices, Uint64 index,
+                    const char *what)
+{
+	if (index >= indices.size())
+	{
+		std::stringstream ss;
+		ss << "invalid " << what << " '" << index << "' in relocation";
+		throw RuntimeError(ss.str());
+	}
+	return indices[index];
+}
+
+// An operand the linker fixes up, which it re-encodes since its new value
+// may not take as many bytes as the old one
+struct Operand
+{
+	RelocKind kind;
+	CodeAddr offset; // in the module's code
+	size_t old_width;
+	Int64 value; // the new index, or the target in the module's code
+	size_t width;
+};
+
+// the offset of code in the module once the operands are re-encoded
+static CodeAddr moved(const std::vector<Operand> &operands,
+                      const std::vector<Int64> &shift, CodeAddr addr)
+{
+	auto after = std::lower_bound(
+	    operands.begin(), operands.end(), addr,
+	    [](const Operand &op, CodeAddr addr) { return op.offset < addr; });
+	return CodeAddr(Int64(addr) + shift[after - operands.begin()]);
+}
+
+// sets the width of each target for where the code ends up, returning how
+// much each operand before one moves it, targets start as wide as they can
+// be and shrink as the code between them does, until none can
+static std::vector<Int64> lay_out(std::vector<Operand> &operands)
+{
+	std::vector<Int64> shift(operands.size() + 1);
+	for (bool shrunk = true; shrunk;)
+	{
+		for (size_t i = 0; i < operands.size(); i++)
+			shift[i + 1] = shift[i] + Int64(operands[i].width) -
+			               Int64(operands[i].old_width);
+		shrunk = false;
+		for (auto &op : operands)
+		{
+			if (op.kind != RelocKind::ADDRESS)
+				continue;
+			auto width = sleb_size(Int64(moved(operands, shift, op.value)) -
+			                       Int64(moved(operands, shift, op.offset)));
+			if (width < op.width)
+			{
+				op.width = width;
+				shrunk = true;
+			}
+		}
+	}
+	return shift;
+}
+
+void link(const std::vector<Image> &modules, std::ostream &out)
+{
+	std::string code;
+	ConstantPool pool;
+	std::vector<std::string> symbols;
+	std::unordered_map<std::string, Uint32> symbol_index;
+	std::vector<Relocation> relocations;
+	std::vector<std::pair<CodeAddr, Uint32>> line_starts;
+	std::set<std::string> exports, imports;
+
+	for (size_t m = 0; m < modules.size(); m++)
+	{
+		auto &module = modules[m];
+		auto text = require(module, SectionKind::CODE, "code");
+		auto relocs = require(module, SectionKind::RELOCS, "relocation");
+		auto names = read_symbols(
+		    require(module, SectionKind::SYMBOLS, "symbols"));
+		auto constants = merge_constants(
+		    require(module, SectionKind::CONSTANTS, "constants"), pool);
+
+		std::vector<Uint32> symbol_map;
+		for (auto &name : names)
+		{
+			auto res = symbol_index.emplace(name, symbols.size());
+			if (res.second)
+				symbols.push_back(name);
+			symbol_map.push_back(res.first->second);
+		}
+
+		Uint64 base = code.size();
+		CodeAddr ip = 0;
+		Decoder dec(&ip, relocs.data, relocs.size);
+		std::vector<Operand> operands(dec.read_u32());
+		for (auto &op : operands)
+		{
+			op.kind = RelocKind(dec.read_u8());
+			op.offset = dec.read_u32();
+			if (op.offset >= text.size)
+			{
+				std::stringstream ss;
+				ss << "relocation at '" << std::hex << op.offset
+				   << "' is out of bounds";
+				throw RuntimeError(ss.str());
+			}
+			CodeAddr at = op.offset;
+			Decoder operand(&at, text.data, text.size);
+			switch (op.kind)
+			{
+				case RelocKind::ADDRESS:
+					op.value = Int64(op.offset) + operand.read_sleb();
+					if (op.value < 0 || op.value >= Int64(text.size))
+					{
+						std::stringstream ss;
+						ss << "relocation at '" << std::hex << op.offset
+						   << "' targets outside the module";
+						throw RuntimeError(ss.str());
+					}
+					op.width = MAX_TARGET_SIZE;
+					break;
+				case RelocKind::SYMBOL:
+					op.value = remap(symbol_map, operand.read_uleb(), "symbol");
+					op.width = uleb_size(op.value);
+					break;
+				case RelocKind::CONSTANT:
+					op.value =
+					    remap(constants, operand.read_uleb(), "constant");
+					op.width = uleb_size(op.value);
+					break;
+				default:
+				{
+					std::stringstream ss;
+					ss << "unknown relocation kind '" << unsigned(op.kind)
+					   << "'";
+					throw RuntimeError(ss.str());
+				}
+			}
+			op.old_width = at - op.offset;
+		}
+		std::sort(operands.begin(), operands.end(),
+		          [](const Operand &a, const Operand &b) {
+			          return a.offset < b.offset;
+			      });
+		auto shift = lay_out(operands);
+
+		// copy the code, re-encoding each operand
+		std::stringstream module_text;
+		CodeBuffer buf(module_text);
+		CodeAddr copied = 0;
+		for (auto &op : operands)
+		{
+			if (op.offset < copied)
+				throw RuntimeError("overlapping relocations");
+			for (; copied < op.offset; copied++)
+				buf.put_u8(text.data[copied]);
+			auto at = buf.offset;
+			if (op.kind == RelocKind::ADDRESS)
+				buf.put_sleb(Int64(moved(operands, shift, op.value)) -
+				             Int64(at));
+			else
+				buf.put_uleb(Uint64(op.value));
+			assert(buf.offset - at == op.width);
+			copied += op.old_width;
+			relocations.push_back(Relocation{ op.kind, Uint32(base + at) });
+		}
+		for (; copied < text.size; copied++)
+			buf.put_u8(text.data[copied]);
+		auto module_code = module_text.str();
+		if (base + module_code.size() > CodeAddr(-1))
+			throw RuntimeError("linked code is too big");
+
+		// each module stops at its end, except the last they fall through
+		// into the next one instead
+		if (OpCode(Uint8(module_code.back())) != OpCode::OP_HALT)
+			throw RuntimeError("module code doesn't end with 'HALT'");
+		if (m + 1 < modules.size())
+			module_code.back() = char(OpCode::OP_NOP);
+		code += module_code;
+
+		auto lines = module.section(SectionKind::LINES);
+		if (lines.size != 0)
+		{
+			ip = 0;
+			Decoder line_dec(&ip, lines.data, lines.size);
+			auto count = line_dec.read_u32();
+			for (Uint32 i = 0; i < count; i++)
+			{
+				auto addr = line_dec.read_u32();
+				auto line = line_dec.read_u32();
+				line_starts.emplace_back(
+				    base + moved(operands, shift, addr), line);
+			}
+		}
+
+		auto exported = module.section(SectionKind::EXPORTS);
+		if (exported.size != 0)
+		{
+			for (auto index : read_indices(exported))
+			{
+				auto &name = symbols[remap(symbol_map, index, "symbol")];
+				if (!exports.insert(name).second)
+				{
+					std::stringstream ss;
+					ss << "'" << name << "' is defined by more than one "
+					   << "module";
+					throw RuntimeError(ss.str());
+				}
+			}
+		}
+		auto imported = module.section(SectionKind::IMPORTS);
+		if (imported.size != 0)
+		{
+			for (auto index : read_indices(imported))
+				imports.insert(symbols[remap(symbol_map, index, "symbol")]);
+		}
+	}
+
+	for (auto &name : imports)
+	{
+		if (exports.find(name) == exports.end())
+		{
+			std::stringstream ss;
+			ss << "'" << name << "' is used but no module defines it";
+			throw RuntimeError(ss.str());
+		}
+	}
+
+	std::stringstream constants, symbol_names, relocs, lines, exported;
+	CodeBuffer constbuf(constants), symbuf(symbol_names), relocbuf(relocs),
+	    linebuf(lines), exportbuf(exported);
+	pool.codegen(constbuf);
+	symbuf.put_u32(symbols.size());
+	for (auto &name : symbols)
+		symbuf.put_string(name);
+	relocbuf.put_u32(relocations.size());
+	for (auto &reloc : relocations)
+		relocbuf.put_u8(Uint8(reloc.kind)).put_u32(reloc.offset);
+	linebuf.put_u32(line_starts.size());
+	for (auto &start : line_starts)
+		linebuf.put_u32(start.first).put_u32(start.second);
+	exportbuf.put_u32(exports.size());
+	for (auto &name : exports)
+		exportbuf.put_u32(symbol_index.at(name));
+
+	// everything used is defined now, so nothing is left to import
+	std::stringstream imported;
+	CodeBuffer(imported).put_u32(0);
+
+	ImageWriter image;
+	image.add_section(SectionKind::CODE, code);
+	image.add_section(SectionKind::CONSTANTS, constants.str());
+	image.add_section(SectionKind::SYMBOLS, symbol_names.str());
+	image.add_section(SectionKind::LINES, lines.str());
+	image.add_section(SectionKind::RELOCS, relocs.str());
+	image.add_section(SectionKind::EXPORTS, exported.str());
+	image.add_section(SectionKind::IMPORTS, imported.str());
+	image.write(out);
+}
+
+// namespace Pop
+}
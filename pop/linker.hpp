@@ -0,0 +1,33 @@
+// linker.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_LINKER_HPP
+#define POP_LINKER_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/image.hpp>
+#include <ostream>
+#include <vector>
+
+namespace Pop
+{
+
+// Links separately assembled modules into one image, which runs the
+// top-level code of each module in the order given, so a library has to
+// come before the scripts using it. The code of each module is moved
+// after the previous one's and the operands its RELOCS section lists are
+// fixed up to refer to the merged code, symbols and constants.
+//
+// Throws a RuntimeError if a module can't be relocated, if more than one
+// module defines a global, or if a global is used but none defines it.
+void link(const std::vector<Image> &modules, std::ostream &out);
+
+// namespace Pop
+}
+
+#endif // POP_LINKER_HPP
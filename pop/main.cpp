@@ -12,12 +12,15 @@
 #include <cerrno>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <sys/stat.h>
+#include <vector>
 
 #define str_eq(s1, s2) (std::strcmp(s1, s2) == 0)
 #define str_eqor(s1, s2, s3) (str_eq(s1, s2) || str_eq(s1, s3))
@@ -32,12 +35,26 @@ struct CmdOptions
 	bool do_compile;
 	bool do_disasm;
 	bool do_listing;
+	bool do_opstats;
 	bool do_tokens;
+	bool gc_stats;
+	unsigned int opt_level;
+	bool peephole_stats;
+	Pop::PeepholeStats peephole; // of everything compiled
+	size_t stack_size;
+	bool use_jit;
+	bool use_cache;
+	std::string cache_dir;
 
 	CmdOptions(int argc, char **argv)
 	    : program((argc > 0) ? argv[0] : "popvm"), output_file("-"),
 	      do_astdump(false), do_compile(false), do_disasm(false),
-	      do_listing(false), do_tokens(false)
+	      do_listing(false), do_opstats(false), do_tokens(false),
+	      gc_stats(false), opt_level(Pop::DEFAULT_OPT_LEVEL),
+	      peephole_stats(false),
+	      stack_size(Pop::ValueStack::DEFAULT_SIZE),
+	      use_jit(true), use_cache(true),
+	      cache_dir(Pop::CodeCache::default_dir())
 	{
 		auto slash = program.rfind('/');
 		if (slash != program.npos)
@@ -55,8 +72,55 @@ struct CmdOptions
 				do_disasm = true;
 			else if (str_eqor(argv[i], "-l", "--listing"))
 				do_listing = true;
+			else if (str_eqor(argv[i], "-s", "--opstats"))
+				do_opstats = true;
 			else if (str_eqor(argv[i], "-t", "--tokens"))
 				do_tokens = true;
+			else if (str_eq(argv[i], "--gc-stats"))
+				gc_stats = true;
+			else if (str_eq(argv[i], "--peephole-stats"))
+				peephole_stats = true;
+			else if (std::strncmp(argv[i], "-O", 2) == 0)
+			{
+				// a bare -O is -O1
+				char *end = nullptr;
+				auto level = std::strtoul(argv[i] + 2, &end, 10);
+				if (argv[i][2] == '\0')
+					level = 1;
+				else if (*end != '\0' || level > Pop::MAX_OPT_LEVEL)
+				{
+					print_error("invalid optimization level '%s', expected "
+					            "-O0 to -O%u",
+					            argv[i], Pop::MAX_OPT_LEVEL);
+				}
+				opt_level = level;
+			}
+			else if (str_eq(argv[i], "--stack-size"))
+			{
+				char *end = nullptr;
+				if (i < (argc - 1))
+					stack_size = std::strtoul(argv[++i], &end, 10);
+				if (!end || *end != '\0' || stack_size == 0)
+				{
+					print_error(
+					    "missing or invalid size argument for --stack-size "
+					    "option");
+				}
+			}
+			else if (str_eq(argv[i], "--no-jit"))
+				use_jit = false;
+			else if (str_eq(argv[i], "--no-cache"))
+				use_cache = false;
+			else if (str_eq(argv[i], "--cache-dir"))
+			{
+				if (i < (argc - 1))
+					cache_dir = argv[++i];
+				else
+				{
+					print_error(
+					    "missing directory argument for --cache-dir option");
+				}
+			}
 			else if (str_eqor(argv[i], "-o", "--output"))
 			{
 				if (i < (argc - 1))
@@ -86,12 +150,14 @@ struct CmdOptions
 			cnt++;
 		if (do_listing)
 			cnt++;
+		if (do_opstats)
+			cnt++;
 		if (do_tokens)
 			cnt++;
 		if (cnt > 1)
 		{
-			print_error(
-			    "the -a, -c, -d, -l, and -t options are mutually exclusive");
+			print_error("the -a, -c, -d, -l, -s and -t options are mutually "
+			            "exclusive");
 		}
 	}
 
@@ -106,6 +172,13 @@ struct CmdOptions
 		std::exit(EXIT_FAILURE);
 	}
 
+	// prints what the peephole pass did, if asked to
+	void report_peephole()
+	{
+		if (peephole_stats)
+			peephole.report(std::cerr);
+	}
+
 	void print_help()
 	{
 		std::printf(
@@ -120,18 +193,35 @@ struct CmdOptions
 		    "  -c, --compile   just compile bytecode, don't interpret\n"
 		    "  -d, --disasm    pretty-print a disassembly listing and exit\n"
 		    "  -l, --listing   pretty-print an instruction listing and exit\n"
+		    "  -s, --opstats   print the most common instruction sequences\n"
+		    "                  and exit\n"
 		    "  -t, --tokens    pretty-print lexical tokens and exit\n"
-		    "  -o, --output    for -a, -c, -d, -l, -t, file to print to\n"
+		    "  -o, --output    for -a, -c, -d, -l, -s, -t, file to print to\n"
+		    "  -O<level>       how much to optimize the compiled bytecode,\n"
+		    "                  -O0 not at all, -O1 (as is a bare -O) folds\n"
+		    "                  constant expressions, -O2 (the default)\n"
+		    "                  also simplifies the instructions and -O3\n"
+		    "                  also rewrites functions through an SSA form\n"
+		    "  --peephole-stats\n"
+		    "                  print what -O2 simplified to stderr\n"
+		    "  --gc-stats      print garbage collector statistics to stderr\n"
+		    "                  after running the program\n"
+		    "  --stack-size    number of values the program's stack holds\n"
+		    "  --no-jit        interpret everything, don't compile hot\n"
+		    "                  functions to native code\n"
+		    "  --cache-dir     directory to cache compiled bytecode in\n"
+		    "  --no-cache      always compile, don't use the cache\n"
 		    "  input files...  program to execute or empty for REPL\n"
 		    "                      a .pop file is first compiled\n"
 		    "                      a .pbc files is directly interpreted\n"
+		    "                      several files are linked together and\n"
+		    "                      run in the order given\n"
 		    "  -- args...      arguments forwarded to program being run\n"
 		    "\n"
-		    "If there are .pop and .pbc files in the same directory, and\n"
-		    "the .pbc file is newer than the .pop file, it is executed\n"
-		    "directly, otherwise the .pop file is compiled into a .pbc\n"
-		    "bytecode file and saved in the same directory as the .pop\n"
-		    "file, before it is executed.\n"
+		    "The bytecode compiled from a .pop file is cached, so it isn't\n"
+		    "compiled again until its contents change. The cache is kept\n"
+		    "in $POP_CACHE_DIR if it's set, otherwise in pop under\n"
+		    "$XDG_CACHE_HOME or ~/.cache.\n"
 		    "\n"
 		    "If an -- is encountered in the arguments, all of the rest\n"
 		    "of the arguments are collected and used as the argument\n"
@@ -225,7 +315,8 @@ static void compile_bytecode(CmdOptions &opts)
 
 	if (opts.input_files.empty())
 	{
-		Pop::compile(std::cin, "<stdin>", use_stdout ? std::cout : ofile);
+		Pop::compile(std::cin, "<stdin>", use_stdout ? std::cout : ofile,
+		             opts.opt_level, &opts.peephole);
 		if (std::cin.fail() && !std::cin.eof())
 		{
 			opts.print_error("error reading standard input: %s (%d)",
@@ -234,20 +325,38 @@ static void compile_bytecode(CmdOptions &opts)
 	}
 	else
 	{
+		// several inputs are linked into a single image
+		std::vector<std::string> compiled;
 		for (auto &in_file : opts.input_files)
 		{
 			std::ifstream ifile(in_file);
+			std::stringstream oss;
 			if (!ifile)
 			{
 				opts.print_error("failed to open input file '%s': %s (%d)",
 				                 in_file.c_str(), std::strerror(errno), errno);
 			}
-			Pop::compile(ifile, in_file, use_stdout ? std::cout : ofile);
+			Pop::compile(ifile, in_file, oss, opts.opt_level, &opts.peephole);
 			if (ifile.fail() && !ifile.eof())
 			{
 				opts.print_error("error reading input file '%s': %s (%d)",
 				                 in_file.c_str(), std::strerror(errno), errno);
 			}
+			compiled.push_back(oss.str());
+		}
+		std::vector<Pop::Image> modules;
+		for (auto &bc : compiled)
+			modules.emplace_back((const unsigned char *)bc.data(), bc.size());
+		try
+		{
+			if (modules.size() > 1)
+				Pop::link(modules, use_stdout ? std::cout : ofile);
+			else
+				(use_stdout ? std::cout : ofile) << compiled.front();
+		}
+		catch (Pop::RuntimeError &e)
+		{
+			opts.print_error("linking failed: %s", e.what());
 		}
 	}
 
@@ -262,6 +371,7 @@ static void compile_bytecode(CmdOptions &opts)
 	else
 		ofile.close();
 
+	opts.report_peephole();
 	std::exit(EXIT_SUCCESS);
 }
 
@@ -284,37 +394,52 @@ static void print_disassembly(CmdOptions &opts)
 		use_stdout = true;
 	}
 
+	// each input is its own image, disassembled one after the other
 	Pop::InstructionList ops;
-	std::stringstream sout;
+	auto disassemble = [&opts, &ops](std::istream &inp) {
+		try
+		{
+			Pop::disassemble(inp, ops);
+		}
+		catch (Pop::RuntimeError &e)
+		{
+			opts.print_error("%s", e.what());
+		}
+	};
 	if (opts.input_files.empty())
 	{
-		Pop::compile(std::cin, "<stdin>", sout);
+		std::stringstream sout;
+		Pop::compile(std::cin, "<stdin>", sout, opts.opt_level,
+		             &opts.peephole);
 		if (std::cin.fail() && !std::cin.eof())
 		{
 			opts.print_error("error reading standard input: %s (%d)",
 			                 std::strerror(errno), errno);
 		}
+		disassemble(sout);
 	}
 	else
 	{
 		for (auto &in_file : opts.input_files)
 		{
+			std::stringstream sout;
 			std::ifstream ifile(in_file);
 			if (!ifile)
 			{
 				opts.print_error("failed to open input file '%s': %s (%d)",
 				                 in_file.c_str(), std::strerror(errno), errno);
 			}
-			Pop::compile(ifile, in_file, sout);
+			Pop::compile(ifile, in_file, sout, opts.opt_level,
+			             &opts.peephole);
 			if (ifile.fail() && !ifile.eof())
 			{
 				opts.print_error("error reading input file '%s': %s (%d)",
 				                 in_file.c_str(), std::strerror(errno), errno);
 			}
+			disassemble(sout);
 		}
 	}
 
-	Pop::disassemble(sout, ops);
 	for (auto &op : ops)
 		op->dis(use_stdout ? std::cout : ofile);
 
@@ -329,6 +454,7 @@ static void print_disassembly(CmdOptions &opts)
 	else
 		ofile.close();
 
+	opts.report_peephole();
 	std::exit(EXIT_SUCCESS);
 }
 
@@ -382,7 +508,7 @@ static void print_listing(CmdOptions &opts)
 
 	for (auto &mod : modules)
 	{
-		for (auto &op : Pop::transform(mod))
+		for (auto &op : Pop::compile_ops(mod, opts.opt_level, &opts.peephole))
 			op->list(use_stdout ? std::cout : ofile);
 	}
 
@@ -397,6 +523,75 @@ static void print_listing(CmdOptions &opts)
 	else
 		ofile.close();
 
+	opts.report_peephole();
+	std::exit(EXIT_SUCCESS);
+}
+
+static void print_opstats(CmdOptions &opts)
+{
+	std::ofstream ofile;
+	bool use_stdout = false;
+	if (opts.output_file != "-")
+	{
+		ofile.open(opts.output_file);
+		if (!ofile)
+		{
+			opts.print_error("failed to open output file '%s': %s (%d)",
+			                 opts.output_file.c_str(), std::strerror(errno),
+			                 errno);
+		}
+	}
+	else
+	{
+		use_stdout = true;
+	}
+
+	Pop::SequenceStats stats;
+	if (opts.input_files.empty())
+	{
+		auto mod = Pop::parse(std::cin, "<stdin>");
+		stats.count(Pop::compile_ops(mod, opts.opt_level, &opts.peephole));
+		if (std::cin.fail() && !std::cin.eof())
+		{
+			opts.print_error("error reading standard input: %s (%d)",
+			                 std::strerror(errno), errno);
+		}
+	}
+	else
+	{
+		for (auto &in_file : opts.input_files)
+		{
+			std::ifstream ifile(in_file);
+			if (!ifile)
+			{
+				opts.print_error("failed to open input file '%s': %s (%d)",
+				                 in_file.c_str(), std::strerror(errno), errno);
+			}
+			auto mod = Pop::parse(ifile, in_file.c_str());
+			stats.count(
+			    Pop::compile_ops(mod, opts.opt_level, &opts.peephole));
+			if (ifile.fail() && !ifile.eof())
+			{
+				opts.print_error("error reading input file '%s': %s (%d)",
+				                 in_file.c_str(), std::strerror(errno), errno);
+			}
+		}
+	}
+
+	stats.report(use_stdout ? std::cout : ofile);
+
+	if (ofile.fail())
+	{
+		opts.print_error("error writing output file '%s': %s (%d)",
+		                 opts.output_file.c_str(), std::strerror(errno), errno);
+	}
+
+	if (use_stdout)
+		std::cout.flush();
+	else
+		ofile.close();
+
+	opts.report_peephole();
 	std::exit(EXIT_SUCCESS);
 }
 
@@ -480,65 +675,37 @@ static inline std::string ext(const std::string &fn)
 	return "";
 }
 
-static inline std::string notext(const std::string &fn)
-{
-	auto dot = fn.rfind('.');
-	if (dot != fn.npos)
-		return fn.substr(0, dot);
-	return "";
-}
-
-static inline bool file_exist(const std::string &filename)
-{
-	struct stat buffer;
-	return (::stat(filename.c_str(), &buffer) == 0);
-}
-
-static inline bool is_file_newer(const std::string &file,
-                                 const std::string &than)
-{
-	struct stat st1, st2;
-	if (::stat(file.c_str(), &st1) == 0 && ::stat(than.c_str(), &st2) == 0)
-		return (st1.st_mtime > st2.st_mtime);
-	return false;
-}
-
-static void compile_file(CmdOptions &opts, const std::string &src,
-                         const std::string &dst, std::string &bytecode)
+// the image compiled from the source file, taken from the cache when the
+// source hasn't changed since it was last compiled
+static void compile_file(CmdOptions &opts, const Pop::CodeCache &cache,
+                         const std::string &src, std::string &bytecode,
+                         std::unique_ptr<Pop::MappedFile> &cached)
 {
 	std::ifstream ifile(src);
-	std::ofstream ofile(dst);
-	std::stringstream oss;
-
 	if (!ifile)
 	{
 		opts.print_error("failed to open input source file '%s': %s (%d)",
 		                 src.c_str(), std::strerror(errno), errno);
 	}
-	else if (!ofile)
-	{
-		opts.print_error("failed to open output bytecode file '%s': %s (%d)",
-		                 dst.c_str(), std::strerror(errno), errno);
-	}
-
-	Pop::compile(ifile, src, oss);
-	std::string bc(oss.str());
-	bytecode += bc;
-	ofile << bc;
-
+	std::stringstream source;
+	source << ifile.rdbuf();
 	if (ifile.fail() && !ifile.eof())
 	{
 		opts.print_error("error reading input source file '%s': %s (%d)",
 		                 src.c_str(), std::strerror(errno), errno);
 	}
-	else if (ofile.fail())
-	{
-		opts.print_error("error writing output source file '%s': %s (%d)",
-		                 dst.c_str(), std::strerror(errno), errno);
-	}
-
 	ifile.close();
-	ofile.close();
+
+	auto text = source.str();
+	auto key = Pop::CodeCache::key(text, opts.opt_level);
+	cached = cache.find(key);
+	if (cached)
+		return;
+
+	std::stringstream oss;
+	Pop::compile(source, src, oss, opts.opt_level, &opts.peephole);
+	bytecode = oss.str();
+	cache.store(key, bytecode); // just compiled again next time if it fails
 }
 
 static void run_vm(CmdOptions &opts)
@@ -549,52 +716,73 @@ static void run_vm(CmdOptions &opts)
 	}
 	else // ensure compiled then execute bytecode
 	{
-		std::string bytecode;
-		for (auto &in_file : opts.input_files)
+		Pop::CodeCache cache(opts.use_cache ? opts.cache_dir : "");
+		std::vector<std::string> compiled(opts.input_files.size());
+		std::vector<std::unique_ptr<Pop::MappedFile>> mapped;
+		std::vector<Pop::Image> modules;
+		for (size_t i = 0; i < opts.input_files.size(); i++)
 		{
-			std::string bc_file(notext(in_file) + ".pbc");
-			auto ex = ext(in_file);
-			if (ex != ".pbc")
-			{ // need to pre-compile into a .pbc file
-				compile_file(opts, in_file, bc_file, bytecode);
-			}
-			else if (file_exist(bc_file)) // bytecode is already compiled
+			auto &in_file = opts.input_files[i];
+			try
 			{
-				if (is_file_newer(in_file, bc_file))
-				{ // source has changed, need re-compile
-					compile_file(opts, in_file, bc_file, bytecode);
-				}
-			}
-			else
-			{ // just read the .pbc file directly
-				std::ifstream ifile(in_file);
-				if (!ifile)
+				std::unique_ptr<Pop::MappedFile> file;
+				if (ext(in_file) == "pbc")
+					file.reset(new Pop::MappedFile(in_file));
+				else
+					compile_file(opts, cache, in_file, compiled[i], file);
+				if (file)
 				{
-					opts.print_error("failed to read input file '%s': %s (%d)",
-					                 in_file.c_str(), std::strerror(errno),
-					                 errno);
+					modules.emplace_back(file->data(), file->size());
+					mapped.push_back(std::move(file));
 				}
-				ifile.seekg(ifile.end);
-				auto len = ifile.tellg();
-				ifile.seekg(ifile.beg);
-				auto bc = std::string(size_t(len) + 1, '\0');
-				ifile.read(&bc[0], len);
-				if (!ifile)
+				else
 				{
-					opts.print_error(
-					    "failed to read bytecode file '%s': %s (%d)",
-					    in_file.c_str(), std::strerror(errno), errno);
+					modules.emplace_back(
+					    (const unsigned char *)compiled[i].data(),
+					    compiled[i].size());
 				}
-				ifile.close();
-				bytecode += bc;
 			}
+			catch (Pop::RuntimeError &e)
+			{
+				opts.print_error("%s: %s", in_file.c_str(), e.what());
+			}
+		}
+
+		// a single module runs as it is, several are linked together first
+		std::string linked;
+		if (modules.size() > 1)
+		{
+			std::stringstream out;
+			try
+			{
+				Pop::link(modules, out);
+			}
+			catch (Pop::RuntimeError &e)
+			{
+				opts.print_error("linking failed: %s", e.what());
+			}
+			linked = out.str();
 		}
+		opts.report_peephole();
 		int argc = opts.rest_args.size();
 		auto argv = (char **)opts.rest_args.data();
-		auto code = (const unsigned char *)bytecode.data();
-		unsigned int len = bytecode.size();
-		Pop::VM vm(code, len, argc, argv);
-		std::exit(vm.execute());
+		auto code = linked.empty() ? modules.front().data()
+		                           : (const unsigned char *)linked.data();
+		auto len = linked.empty() ? modules.front().size() : linked.size();
+		try
+		{
+			Pop::VM vm(code, len, argc, argv);
+			vm.stack.resize(opts.stack_size);
+			vm.jit.enabled = opts.use_jit;
+			auto exit_code = vm.execute();
+			if (opts.gc_stats)
+				vm.heap.report(std::cerr);
+			std::exit(exit_code);
+		}
+		catch (Pop::RuntimeError &e)
+		{
+			opts.print_error("%s", e.what());
+		}
 	}
 }
 
@@ -610,6 +798,8 @@ int main(int argc, char **argv)
 		print_disassembly(opts);
 	else if (opts.do_listing)
 		print_listing(opts);
+	else if (opts.do_opstats)
+		print_opstats(opts);
 	else if (opts.do_tokens)
 		print_tokens(opts);
 	else
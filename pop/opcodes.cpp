@@ -30,11 +30,25 @@ const char *opcode_name(OpCode code)
 			return "CLOSE_SCOPE";
 		case OpCode::OP_BIND:
 			return "BIND";
+		case OpCode::OP_LOAD_GLOBAL:
+			return "LOAD_GLOBAL";
+		case OpCode::OP_STORE_GLOBAL:
+			return "STORE_GLOBAL";
+		case OpCode::OP_LOAD_LOCAL:
+			return "LOAD_LOCAL";
+		case OpCode::OP_STORE_LOCAL:
+			return "STORE_LOCAL";
+		case OpCode::OP_LOAD_UPVALUE:
+			return "LOAD_UPVALUE";
+		case OpCode::OP_STORE_UPVALUE:
+			return "STORE_UPVALUE";
 
 		case OpCode::OP_CALL:
 			return "CALL";
 		case OpCode::OP_RETURN:
 			return "RETURN";
+		case OpCode::OP_TAIL_CALL:
+			return "TAIL_CALL";
 		case OpCode::OP_JUMP:
 			return "JUMP";
 		case OpCode::OP_JUMP_TRUE:
@@ -50,14 +64,14 @@ const char *opcode_name(OpCode code)
 			return "PUSH_TRUE";
 		case OpCode::OP_PUSH_FALSE:
 			return "PUSH_FALSE";
+		case OpCode::OP_PUSH_CONST:
+			return "PUSH_CONST";
 		case OpCode::OP_PUSH_INT:
 			return "PUSH_INT";
 		case OpCode::OP_PUSH_FLOAT:
 			return "PUSH_FLOAT";
 		case OpCode::OP_PUSH_STRING:
 			return "PUSH_STRING";
-		case OpCode::OP_PUSH_SYMBOL:
-			return "PUSH_SYMBOL";
 		case OpCode::OP_PUSH_LIST:
 			return "PUSH_LIST";
 		case OpCode::OP_PUSH_DICT:
@@ -154,6 +168,132 @@ const char *opcode_name(OpCode code)
 		case OpCode::OP_LE:
 			return "LE";
 
+		case OpCode::OP_ADD_SYMBOL_INT:
+			return "ADD_SYMBOL_INT";
+		case OpCode::OP_SUB_SYMBOL_INT:
+			return "SUB_SYMBOL_INT";
+		case OpCode::OP_EQ_SYMBOL_INT:
+			return "EQ_SYMBOL_INT";
+		case OpCode::OP_NE_SYMBOL_INT:
+			return "NE_SYMBOL_INT";
+		case OpCode::OP_GT_SYMBOL_INT:
+			return "GT_SYMBOL_INT";
+		case OpCode::OP_GE_SYMBOL_INT:
+			return "GE_SYMBOL_INT";
+		case OpCode::OP_LT_SYMBOL_INT:
+			return "LT_SYMBOL_INT";
+		case OpCode::OP_LE_SYMBOL_INT:
+			return "LE_SYMBOL_INT";
+		case OpCode::OP_ADD_LOCAL_INT:
+			return "ADD_LOCAL_INT";
+		case OpCode::OP_SUB_LOCAL_INT:
+			return "SUB_LOCAL_INT";
+		case OpCode::OP_EQ_LOCAL_INT:
+			return "EQ_LOCAL_INT";
+		case OpCode::OP_NE_LOCAL_INT:
+			return "NE_LOCAL_INT";
+		case OpCode::OP_GT_LOCAL_INT:
+			return "GT_LOCAL_INT";
+		case OpCode::OP_GE_LOCAL_INT:
+			return "GE_LOCAL_INT";
+		case OpCode::OP_LT_LOCAL_INT:
+			return "LT_LOCAL_INT";
+		case OpCode::OP_LE_LOCAL_INT:
+			return "LE_LOCAL_INT";
+		case OpCode::OP_EQ_JUMP_FALSE:
+			return "EQ_JUMP_FALSE";
+		case OpCode::OP_NE_JUMP_FALSE:
+			return "NE_JUMP_FALSE";
+		case OpCode::OP_GT_JUMP_FALSE:
+			return "GT_JUMP_FALSE";
+		case OpCode::OP_GE_JUMP_FALSE:
+			return "GE_JUMP_FALSE";
+		case OpCode::OP_LT_JUMP_FALSE:
+			return "LT_JUMP_FALSE";
+		case OpCode::OP_LE_JUMP_FALSE:
+			return "LE_JUMP_FALSE";
+		case OpCode::OP_CALL_SYMBOL:
+			return "CALL_SYMBOL";
+		case OpCode::OP_TAIL_CALL_SYMBOL:
+			return "TAIL_CALL_SYMBOL";
+		case OpCode::OP_PRINT_POP:
+			return "PRINT_POP";
+
+		case OpCode::OP_ADD_INT_INT:
+			return "ADD_INT_INT";
+		case OpCode::OP_SUB_INT_INT:
+			return "SUB_INT_INT";
+		case OpCode::OP_MUL_INT_INT:
+			return "MUL_INT_INT";
+		case OpCode::OP_EQ_INT_INT:
+			return "EQ_INT_INT";
+		case OpCode::OP_NE_INT_INT:
+			return "NE_INT_INT";
+		case OpCode::OP_GT_INT_INT:
+			return "GT_INT_INT";
+		case OpCode::OP_GE_INT_INT:
+			return "GE_INT_INT";
+		case OpCode::OP_LT_INT_INT:
+			return "LT_INT_INT";
+		case OpCode::OP_LE_INT_INT:
+			return "LE_INT_INT";
+		case OpCode::OP_EQ_JUMP_FALSE_INT_INT:
+			return "EQ_JUMP_FALSE_INT_INT";
+		case OpCode::OP_NE_JUMP_FALSE_INT_INT:
+			return "NE_JUMP_FALSE_INT_INT";
+		case OpCode::OP_GT_JUMP_FALSE_INT_INT:
+			return "GT_JUMP_FALSE_INT_INT";
+		case OpCode::OP_GE_JUMP_FALSE_INT_INT:
+			return "GE_JUMP_FALSE_INT_INT";
+		case OpCode::OP_LT_JUMP_FALSE_INT_INT:
+			return "LT_JUMP_FALSE_INT_INT";
+		case OpCode::OP_LE_JUMP_FALSE_INT_INT:
+			return "LE_JUMP_FALSE_INT_INT";
+		case OpCode::OP_ADD_FLOAT_FLOAT:
+			return "ADD_FLOAT_FLOAT";
+		case OpCode::OP_SUB_FLOAT_FLOAT:
+			return "SUB_FLOAT_FLOAT";
+		case OpCode::OP_MUL_FLOAT_FLOAT:
+			return "MUL_FLOAT_FLOAT";
+		case OpCode::OP_EQ_FLOAT_FLOAT:
+			return "EQ_FLOAT_FLOAT";
+		case OpCode::OP_NE_FLOAT_FLOAT:
+			return "NE_FLOAT_FLOAT";
+		case OpCode::OP_GT_FLOAT_FLOAT:
+			return "GT_FLOAT_FLOAT";
+		case OpCode::OP_GE_FLOAT_FLOAT:
+			return "GE_FLOAT_FLOAT";
+		case OpCode::OP_LT_FLOAT_FLOAT:
+			return "LT_FLOAT_FLOAT";
+		case OpCode::OP_LE_FLOAT_FLOAT:
+			return "LE_FLOAT_FLOAT";
+		case OpCode::OP_EQ_JUMP_FALSE_FLOAT_FLOAT:
+			return "EQ_JUMP_FALSE_FLOAT_FLOAT";
+		case OpCode::OP_NE_JUMP_FALSE_FLOAT_FLOAT:
+			return "NE_JUMP_FALSE_FLOAT_FLOAT";
+		case OpCode::OP_GT_JUMP_FALSE_FLOAT_FLOAT:
+			return "GT_JUMP_FALSE_FLOAT_FLOAT";
+		case OpCode::OP_GE_JUMP_FALSE_FLOAT_FLOAT:
+			return "GE_JUMP_FALSE_FLOAT_FLOAT";
+		case OpCode::OP_LT_JUMP_FALSE_FLOAT_FLOAT:
+			return "LT_JUMP_FALSE_FLOAT_FLOAT";
+		case OpCode::OP_LE_JUMP_FALSE_FLOAT_FLOAT:
+			return "LE_JUMP_FALSE_FLOAT_FLOAT";
+		case OpCode::OP_ADD_STRING_STRING:
+			return "ADD_STRING_STRING";
+		case OpCode::OP_EQ_STRING_STRING:
+			return "EQ_STRING_STRING";
+		case OpCode::OP_NE_STRING_STRING:
+			return "NE_STRING_STRING";
+		case OpCode::OP_GT_STRING_STRING:
+			return "GT_STRING_STRING";
+		case OpCode::OP_GE_STRING_STRING:
+			return "GE_STRING_STRING";
+		case OpCode::OP_LT_STRING_STRING:
+			return "LT_STRING_STRING";
+		case OpCode::OP_LE_STRING_STRING:
+			return "LE_STRING_STRING";
+
 		case OpCode::OP_LABEL:
 			// assert(false);
 			return "~~LABEL~~";
@@ -161,6 +301,59 @@ const char *opcode_name(OpCode code)
 	return "~~UNKNOWN~~";
 }
 
+size_t min_operand_size(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_CALL:
+		case OpCode::OP_TAIL_CALL:
+		case OpCode::OP_OPEN_SCOPE:
+		case OpCode::OP_LOAD_LOCAL:
+		case OpCode::OP_STORE_LOCAL:
+		case OpCode::OP_BIND:
+		case OpCode::OP_LOAD_GLOBAL:
+		case OpCode::OP_STORE_GLOBAL:
+		case OpCode::OP_PUSH_CONST:
+		case OpCode::OP_PUSH_INT:
+		case OpCode::OP_PUSH_LIST:
+		case OpCode::OP_PUSH_DICT:
+		case OpCode::OP_JUMP:
+		case OpCode::OP_JUMP_TRUE:
+		case OpCode::OP_JUMP_FALSE:
+		case OpCode::OP_EQ_JUMP_FALSE:
+		case OpCode::OP_NE_JUMP_FALSE:
+		case OpCode::OP_GT_JUMP_FALSE:
+		case OpCode::OP_GE_JUMP_FALSE:
+		case OpCode::OP_LT_JUMP_FALSE:
+		case OpCode::OP_LE_JUMP_FALSE:
+		case OpCode::OP_PUSH_FUNCTION:
+			return 1;
+		case OpCode::OP_LOAD_UPVALUE:
+		case OpCode::OP_STORE_UPVALUE:
+		case OpCode::OP_CALL_SYMBOL:
+		case OpCode::OP_TAIL_CALL_SYMBOL:
+		case OpCode::OP_ADD_LOCAL_INT:
+		case OpCode::OP_SUB_LOCAL_INT:
+		case OpCode::OP_EQ_LOCAL_INT:
+		case OpCode::OP_NE_LOCAL_INT:
+		case OpCode::OP_GT_LOCAL_INT:
+		case OpCode::OP_GE_LOCAL_INT:
+		case OpCode::OP_LT_LOCAL_INT:
+		case OpCode::OP_LE_LOCAL_INT:
+		case OpCode::OP_ADD_SYMBOL_INT:
+		case OpCode::OP_SUB_SYMBOL_INT:
+		case OpCode::OP_EQ_SYMBOL_INT:
+		case OpCode::OP_NE_SYMBOL_INT:
+		case OpCode::OP_GT_SYMBOL_INT:
+		case OpCode::OP_GE_SYMBOL_INT:
+		case OpCode::OP_LT_SYMBOL_INT:
+		case OpCode::OP_LE_SYMBOL_INT:
+			return 2;
+		default:
+			return 0;
+	}
+}
+
 OpCode opcode_from_token(TokenKind kind)
 {
 	switch (kind)
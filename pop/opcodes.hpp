@@ -12,6 +12,7 @@
 
 #include <pop/token.hpp>
 #include <pop/types.hpp>
+#include <cstddef>
 
 namespace Pop
 {
@@ -25,9 +26,16 @@ enum class OpCode : Uint8
 	OP_OPEN_SCOPE,
 	OP_CLOSE_SCOPE,
 	OP_BIND,
+	OP_LOAD_GLOBAL,
+	OP_STORE_GLOBAL,
+	OP_LOAD_LOCAL,
+	OP_STORE_LOCAL,
+	OP_LOAD_UPVALUE,
+	OP_STORE_UPVALUE,
 
 	OP_CALL,
 	OP_RETURN,
+	OP_TAIL_CALL, // a CALL whose result is returned, reusing the frame
 	OP_JUMP,
 	OP_JUMP_TRUE,
 	OP_JUMP_FALSE,
@@ -36,10 +44,8 @@ enum class OpCode : Uint8
 	OP_PUSH_NULL,
 	OP_PUSH_TRUE,
 	OP_PUSH_FALSE,
-	OP_PUSH_INT,
-	OP_PUSH_FLOAT,
-	OP_PUSH_STRING,
-	OP_PUSH_SYMBOL,
+	OP_PUSH_CONST,
+	OP_PUSH_INT, // an SLEB128 immediate of up to 32 bits
 	OP_PUSH_LIST,
 	OP_PUSH_DICT,
 	OP_PUSH_SLICE,
@@ -92,10 +98,88 @@ enum class OpCode : Uint8
 	OP_LT,
 	OP_LE,
 
+	// superinstructions, see fusion.hpp
+	OP_ADD_SYMBOL_INT,
+	OP_SUB_SYMBOL_INT,
+	OP_EQ_SYMBOL_INT,
+	OP_NE_SYMBOL_INT,
+	OP_GT_SYMBOL_INT,
+	OP_GE_SYMBOL_INT,
+	OP_LT_SYMBOL_INT,
+	OP_LE_SYMBOL_INT,
+	OP_ADD_LOCAL_INT,
+	OP_SUB_LOCAL_INT,
+	OP_EQ_LOCAL_INT,
+	OP_NE_LOCAL_INT,
+	OP_GT_LOCAL_INT,
+	OP_GE_LOCAL_INT,
+	OP_LT_LOCAL_INT,
+	OP_LE_LOCAL_INT,
+	OP_EQ_JUMP_FALSE,
+	OP_NE_JUMP_FALSE,
+	OP_GT_JUMP_FALSE,
+	OP_GE_JUMP_FALSE,
+	OP_LT_JUMP_FALSE,
+	OP_LE_JUMP_FALSE,
+	OP_CALL_SYMBOL,
+	OP_TAIL_CALL_SYMBOL,
+	OP_PRINT_POP,
+
+	// quickened forms which the VM rewrites generic ops into once it has
+	// seen their operand types, never found in bytecode
+	OP_ADD_INT_INT,
+	OP_SUB_INT_INT,
+	OP_MUL_INT_INT,
+	OP_EQ_INT_INT,
+	OP_NE_INT_INT,
+	OP_GT_INT_INT,
+	OP_GE_INT_INT,
+	OP_LT_INT_INT,
+	OP_LE_INT_INT,
+	OP_EQ_JUMP_FALSE_INT_INT,
+	OP_NE_JUMP_FALSE_INT_INT,
+	OP_GT_JUMP_FALSE_INT_INT,
+	OP_GE_JUMP_FALSE_INT_INT,
+	OP_LT_JUMP_FALSE_INT_INT,
+	OP_LE_JUMP_FALSE_INT_INT,
+	OP_ADD_FLOAT_FLOAT,
+	OP_SUB_FLOAT_FLOAT,
+	OP_MUL_FLOAT_FLOAT,
+	OP_EQ_FLOAT_FLOAT,
+	OP_NE_FLOAT_FLOAT,
+	OP_GT_FLOAT_FLOAT,
+	OP_GE_FLOAT_FLOAT,
+	OP_LT_FLOAT_FLOAT,
+	OP_LE_FLOAT_FLOAT,
+	OP_EQ_JUMP_FALSE_FLOAT_FLOAT,
+	OP_NE_JUMP_FALSE_FLOAT_FLOAT,
+	OP_GT_JUMP_FALSE_FLOAT_FLOAT,
+	OP_GE_JUMP_FALSE_FLOAT_FLOAT,
+	OP_LT_JUMP_FALSE_FLOAT_FLOAT,
+	OP_LE_JUMP_FALSE_FLOAT_FLOAT,
+	OP_ADD_STRING_STRING,
+	OP_EQ_STRING_STRING,
+	OP_NE_STRING_STRING,
+	OP_GT_STRING_STRING,
+	OP_GE_STRING_STRING,
+	OP_LT_STRING_STRING,
+	OP_LE_STRING_STRING,
+
+	// other literals only appear in instruction lists, the assembler moves
+	// them into the constant pool and pushes them with PUSH_CONST
+	OP_PUSH_FLOAT = 253,
+	OP_PUSH_STRING,
+
 	OP_LABEL = 255,
 };
 
+// number of opcodes which can appear in bytecode
+static constexpr Uint8 NUM_OPCODES = Uint8(OpCode::OP_PRINT_POP) + 1;
+
 const char *opcode_name(OpCode code);
+// the fewest bytes of operands which can follow the opcode in bytecode,
+// counting each LEB128 operand as a single byte
+size_t min_operand_size(OpCode code);
 OpCode opcode_from_token(TokenKind kind);
 
 // namespace Pop
@@ -0,0 +1,614 @@
+// optimizer.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/optimizer.hpp>
+#include <pop/error.hpp>
+#include <pop/gc.hpp>
+#include <pop/opcodes.hpp>
+#include <pop/value.hpp>
+
+namespace Pop
+{
+using namespace Ast;
+
+// What's known of the type of an expression's value without running it
+enum class Kind
+{
+	ANY,
+	BOOL,
+	INT,
+	FLOAT,
+	NUMBER, // an Int or a Float
+	STRING,
+};
+
+static bool is_number(Kind kind)
+{
+	return (kind == Kind::INT || kind == Kind::FLOAT || kind == Kind::NUMBER);
+}
+
+// the kind of an arithmetic operator's result, if it doesn't throw
+static Kind arith_kind(Kind left, Kind right)
+{
+	if (left == Kind::INT && right == Kind::INT)
+		return Kind::INT;
+	else if (left == Kind::FLOAT || right == Kind::FLOAT)
+		return Kind::FLOAT;
+	return Kind::NUMBER;
+}
+
+static Kind kind_of(const Expr &expr)
+{
+	switch (expr.kind)
+	{
+		case NodeKind::BOOL_LITERAL:
+			return Kind::BOOL;
+		case NodeKind::INT_LITERAL:
+			return Kind::INT;
+		case NodeKind::FLOAT_LITERAL:
+			return Kind::FLOAT;
+		case NodeKind::STRING_LITERAL:
+			return Kind::STRING;
+		case NodeKind::UNARY_EXPR:
+		{
+			auto &n = static_cast<const UnaryExpr &>(expr);
+			auto operand = kind_of(*n.operand);
+			switch (opcode_from_token(n.op))
+			{
+				case OpCode::OP_POS:
+				case OpCode::OP_NEG:
+					return is_number(operand) ? operand : Kind::NUMBER;
+				case OpCode::OP_LOG_NOT:
+					return Kind::BOOL;
+				case OpCode::OP_BIT_NOT:
+					return Kind::INT;
+				default:
+					return Kind::ANY;
+			}
+		}
+		case NodeKind::BINARY_EXPR:
+		{
+			auto &n = static_cast<const BinaryExpr &>(expr);
+			auto left = kind_of(*n.left);
+			auto right = kind_of(*n.right);
+			switch (opcode_from_token(n.op))
+			{
+				case OpCode::OP_ADD:
+					// Strings add up too
+					if (left == Kind::STRING && right == Kind::STRING)
+						return Kind::STRING;
+					else if (!is_number(left) || !is_number(right))
+						return Kind::ANY;
+					return arith_kind(left, right);
+				case OpCode::OP_SUB:
+				case OpCode::OP_MUL:
+				case OpCode::OP_DIV:
+				case OpCode::OP_MOD:
+				case OpCode::OP_POW:
+					return arith_kind(left, right);
+				case OpCode::OP_BIT_AND:
+				case OpCode::OP_BIT_OR:
+				case OpCode::OP_BIT_XOR:
+				case OpCode::OP_LEFT_SHIFT:
+				case OpCode::OP_RIGHT_SHIFT:
+					return Kind::INT;
+				case OpCode::OP_LOG_AND:
+				case OpCode::OP_LOG_OR:
+				case OpCode::OP_EQ:
+				case OpCode::OP_NE:
+				case OpCode::OP_GT:
+				case OpCode::OP_GE:
+				case OpCode::OP_LT:
+				case OpCode::OP_LE:
+					return Kind::BOOL;
+				default:
+					return Kind::ANY;
+			}
+		}
+		case NodeKind::IF_EXPR:
+		{
+			auto &n = static_cast<const IfExpr &>(expr);
+			auto consequence = kind_of(*n.consequence);
+			auto alternative = kind_of(*n.alternative);
+			return (consequence == alternative) ? consequence : Kind::ANY;
+		}
+		default:
+			return Kind::ANY;
+	}
+}
+
+static bool is_int_literal(const Expr &expr, long long int value)
+{
+	return (expr.kind == NodeKind::INT_LITERAL &&
+	        static_cast<const IntLiteral &>(expr).value == value);
+}
+
+// whether multiplying or dividing the other operand by expr leaves it be
+static bool is_one(const Expr &expr, Kind other)
+{
+	if (is_int_literal(expr, 1))
+		return is_number(other);
+	return (expr.kind == NodeKind::FLOAT_LITERAL &&
+	        static_cast<const FloatLiteral &>(expr).value == 1.0 &&
+	        other == Kind::FLOAT);
+}
+
+// whether adding expr to the other operand or subtracting it leaves it be,
+// only for Ints since a Float -0.0 plus 0 is 0.0
+static bool is_zero(const Expr &expr, Kind other)
+{
+	return (is_int_literal(expr, 0) && other == Kind::INT);
+}
+
+// Finds labels among a statement and the statements in it, which can be
+// jumped to from anywhere else.
+struct LabelFinder : public Visitor
+{
+	bool found;
+
+	LabelFinder() : found(false)
+	{
+	}
+
+	void find(Stmt *stmt)
+	{
+		if (stmt)
+			stmt->accept(*this);
+	}
+
+	virtual void visit(LabelDecl &)
+	{
+		found = true;
+	}
+
+	virtual void visit(CompoundStmt &n)
+	{
+		for (auto &stmt : n.stmts)
+			find(stmt.get());
+	}
+
+	virtual void visit(IfStmt &n)
+	{
+		find(n.consequence.get());
+		find(n.alternative.get());
+	}
+
+	virtual void visit(UnlessStmt &n)
+	{
+		find(n.consequence.get());
+		find(n.alternative.get());
+	}
+
+	virtual void visit(DoWhileStmt &n)
+	{
+		find(n.stmt.get());
+	}
+
+	virtual void visit(DoUntilStmt &n)
+	{
+		find(n.stmt.get());
+	}
+
+	virtual void visit(WhileStmt &n)
+	{
+		find(n.stmt.get());
+	}
+
+	virtual void visit(UntilStmt &n)
+	{
+		find(n.stmt.get());
+	}
+};
+
+static bool has_label(Stmt *stmt)
+{
+	LabelFinder finder;
+	finder.find(stmt);
+	return finder.found;
+}
+
+// Folds the constants in every expression of a module, innermost first,
+// each visit() leaving what its node is to be replaced with, if anything,
+// in expr_result or stmt_result.
+struct ConstantFolder : public Visitor
+{
+	Heap heap; // holds the values folded while the folder exists
+	Heap::Scope scope;
+	ExprPtr expr_result;
+	StmtPtr stmt_result;
+
+	ConstantFolder() : heap(0), scope(heap)
+	{
+	}
+
+	void fold(ExprPtr &expr)
+	{
+		if (!expr)
+			return;
+		expr->accept(*this);
+		if (expr_result)
+			expr = std::move(expr_result);
+	}
+
+	void fold(StmtPtr &stmt)
+	{
+		if (!stmt)
+			return;
+		stmt->accept(*this);
+		if (stmt_result)
+			stmt = std::move(stmt_result);
+	}
+
+	void fold(ExprList &exprs)
+	{
+		for (auto &expr : exprs)
+			fold(expr);
+	}
+
+	void fold(StmtList &stmts)
+	{
+		for (auto &stmt : stmts)
+			fold(stmt);
+	}
+
+	// the value of a literal, false if the expression isn't one
+	static bool constant(const Expr &expr, TValue &value)
+	{
+		switch (expr.kind)
+		{
+			case NodeKind::NULL_LITERAL:
+				value = TValue();
+				return true;
+			case NodeKind::BOOL_LITERAL:
+				value = TValue::make_bool(
+				    static_cast<const BoolLiteral &>(expr).value);
+				return true;
+			case NodeKind::INT_LITERAL:
+				value = TValue::make_int(
+				    static_cast<const IntLiteral &>(expr).value);
+				return true;
+			case NodeKind::FLOAT_LITERAL:
+				value = TValue::make_float(
+				    static_cast<const FloatLiteral &>(expr).value);
+				return true;
+			case NodeKind::STRING_LITERAL:
+				value = TValue(new Pop::String(
+				    static_cast<const StringLiteral &>(expr).value));
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// the literal of a value over the source of the expression it replaces,
+	// or null if the value has no literal
+	static ExprPtr literal(TValue value, const SourceRange &range)
+	{
+		auto &start = range.start;
+		auto &end = range.end;
+		switch (value.type())
+		{
+			case ValueType::NUL:
+				return ExprPtr(new NullLiteral(start, end));
+			case ValueType::BOOL:
+				return ExprPtr(new BoolLiteral(value.as_bool(), start, end));
+			case ValueType::INT:
+				return ExprPtr(new IntLiteral(value.as_int(), start, end));
+			case ValueType::FLOAT:
+				return ExprPtr(new FloatLiteral(value.as_float(), start, end));
+			case ValueType::STRING:
+				return ExprPtr(new StringLiteral(
+				    static_cast<const Pop::String *>(value.as_ptr())->value,
+				    start, end));
+			default:
+				return nullptr;
+		}
+	}
+
+	// Applies an operator the way the VM does. Returns false for anything
+	// but the plain operators, and when the operator throws, leaving the
+	// error to be raised by the VM if the expression is ever run.
+	static bool apply(OpCode code, TValue operand, TValue &result)
+	{
+		try
+		{
+			switch (code)
+			{
+				case OpCode::OP_POS:
+					result = operand._pos_();
+					return true;
+				case OpCode::OP_NEG:
+					result = operand._neg_();
+					return true;
+				case OpCode::OP_LOG_NOT:
+					result = operand._log_not_();
+					return true;
+				case OpCode::OP_BIT_NOT:
+					result = operand._bit_not_();
+					return true;
+				default:
+					return false;
+			}
+		}
+		catch (RuntimeError &)
+		{
+			return false;
+		}
+	}
+
+	static bool apply(OpCode code, TValue left, TValue right, TValue &result)
+	{
+#define POP_FOLD_BINARY(code, fnc)       \
+	case OpCode::OP_##code:              \
+		result = left._##fnc##_(right);  \
+		return true;
+
+		try
+		{
+			switch (code)
+			{
+				POP_FOLD_BINARY(ADD, add)
+				POP_FOLD_BINARY(SUB, sub)
+				POP_FOLD_BINARY(MUL, mul)
+				POP_FOLD_BINARY(DIV, div)
+				POP_FOLD_BINARY(MOD, mod)
+				POP_FOLD_BINARY(POW, pow)
+				POP_FOLD_BINARY(LOG_AND, log_and)
+				POP_FOLD_BINARY(LOG_OR, log_or)
+				POP_FOLD_BINARY(BIT_AND, bit_and)
+				POP_FOLD_BINARY(BIT_OR, bit_or)
+				POP_FOLD_BINARY(BIT_XOR, bit_xor)
+				POP_FOLD_BINARY(LEFT_SHIFT, lshift)
+				POP_FOLD_BINARY(RIGHT_SHIFT, rshift)
+				POP_FOLD_BINARY(EQ, eq)
+				POP_FOLD_BINARY(NE, ne)
+				POP_FOLD_BINARY(GT, gt)
+				POP_FOLD_BINARY(GE, ge)
+				POP_FOLD_BINARY(LT, lt)
+				POP_FOLD_BINARY(LE, le)
+				default:
+					return false;
+			}
+		}
+		catch (RuntimeError &)
+		{
+			return false;
+		}
+
+#undef POP_FOLD_BINARY
+	}
+
+	// whether the predicate is a literal, and if so whether it's true
+	static bool truth(const Expr &predicate, bool &value)
+	{
+		TValue constant_value;
+		if (!constant(predicate, constant_value))
+			return false;
+		value = !constant_value._not_();
+		return true;
+	}
+
+	// what's left of an if or unless statement which always takes one of
+	// its branches, or null if the other can't be dropped
+	StmtPtr branch(Node &n, bool taken, StmtPtr &consequence,
+	               StmtPtr &alternative)
+	{
+		auto &kept = taken ? consequence : alternative;
+		auto &dropped = taken ? alternative : consequence;
+		if (has_label(dropped.get()))
+			return nullptr;
+		if (kept)
+			return std::move(kept);
+		return StmtPtr(new EmptyStmt(n.range.start, n.range.end));
+	}
+
+	virtual void visit(Module &n)
+	{
+		fold(n.stmts);
+	}
+
+	virtual void visit(ListLiteral &n)
+	{
+		fold(n.elements);
+	}
+
+	virtual void visit(FunctionLiteral &n)
+	{
+		fold(n.default_arguments);
+		fold(n.stmts);
+	}
+
+	virtual void visit(ObjectLiteral &n)
+	{
+		fold(n.member_values);
+	}
+
+	virtual void visit(UnaryExpr &n)
+	{
+		fold(n.operand);
+		auto code = opcode_from_token(n.op);
+		TValue operand, result;
+		if (constant(*n.operand, operand) && apply(code, operand, result))
+		{
+			expr_result = literal(result, n.range);
+		}
+		else if (code == OpCode::OP_LOG_NOT &&
+		         n.operand->kind == NodeKind::UNARY_EXPR)
+		{
+			auto &inner = static_cast<UnaryExpr &>(*n.operand);
+			if (opcode_from_token(inner.op) == OpCode::OP_LOG_NOT &&
+			    kind_of(*inner.operand) == Kind::BOOL)
+			{
+				expr_result = std::move(inner.operand);
+			}
+		}
+	}
+
+	virtual void visit(BinaryExpr &n)
+	{
+		fold(n.right);
+		fold(n.left);
+		auto code = opcode_from_token(n.op);
+		TValue left, right, result;
+		if (constant(*n.left, left) && constant(*n.right, right))
+		{
+			if (apply(code, left, right, result))
+				expr_result = literal(result, n.range);
+			return;
+		}
+		auto left_kind = kind_of(*n.left);
+		auto right_kind = kind_of(*n.right);
+		switch (code)
+		{
+			case OpCode::OP_MUL:
+				if (is_one(*n.right, left_kind))
+					expr_result = std::move(n.left);
+				else if (is_one(*n.left, right_kind))
+					expr_result = std::move(n.right);
+				break;
+			case OpCode::OP_DIV:
+				if (is_one(*n.right, left_kind))
+					expr_result = std::move(n.left);
+				break;
+			case OpCode::OP_ADD:
+				if (is_zero(*n.right, left_kind))
+					expr_result = std::move(n.left);
+				else if (is_zero(*n.left, right_kind))
+					expr_result = std::move(n.right);
+				break;
+			case OpCode::OP_SUB:
+				if (is_zero(*n.right, left_kind))
+					expr_result = std::move(n.left);
+				break;
+			default:
+				break;
+		}
+	}
+
+	virtual void visit(SliceExpr &n)
+	{
+		fold(n.start);
+		fold(n.stop);
+		fold(n.step);
+	}
+
+	virtual void visit(IndexExpr &n)
+	{
+		fold(n.object);
+		fold(n.index);
+	}
+
+	virtual void visit(MemberExpr &n)
+	{
+		fold(n.object);
+	}
+
+	virtual void visit(CallExpr &n)
+	{
+		fold(n.arguments);
+		fold(n.callee);
+	}
+
+	virtual void visit(IfExpr &n)
+	{
+		fold(n.predicate);
+		fold(n.consequence);
+		fold(n.alternative);
+		bool taken;
+		if (truth(*n.predicate, taken))
+		{
+			expr_result = std::move(taken ? n.consequence : n.alternative);
+		}
+	}
+
+	virtual void visit(ForExpr &n)
+	{
+		fold(n.sequence);
+	}
+
+	virtual void visit(LetBinding &n)
+	{
+		fold(n.value);
+	}
+
+	virtual void visit(ExprStmt &n)
+	{
+		fold(n.expr);
+	}
+
+	virtual void visit(CompoundStmt &n)
+	{
+		fold(n.stmts);
+	}
+
+	virtual void visit(ReturnStmt &n)
+	{
+		fold(n.expr);
+	}
+
+	virtual void visit(IfStmt &n)
+	{
+		fold(n.predicate);
+		fold(n.consequence);
+		fold(n.alternative);
+		bool taken;
+		if (truth(*n.predicate, taken))
+			stmt_result = branch(n, taken, n.consequence, n.alternative);
+	}
+
+	virtual void visit(UnlessStmt &n)
+	{
+		fold(n.predicate);
+		fold(n.consequence);
+		fold(n.alternative);
+		bool taken;
+		if (truth(*n.predicate, taken))
+			stmt_result = branch(n, !taken, n.consequence, n.alternative);
+	}
+
+	virtual void visit(DoWhileStmt &n)
+	{
+		fold(n.stmt);
+		fold(n.expr);
+	}
+
+	virtual void visit(DoUntilStmt &n)
+	{
+		fold(n.stmt);
+		fold(n.expr);
+	}
+
+	virtual void visit(WhileStmt &n)
+	{
+		fold(n.expr);
+		fold(n.stmt);
+	}
+
+	virtual void visit(UntilStmt &n)
+	{
+		fold(n.expr);
+		fold(n.stmt);
+	}
+
+	virtual void visit(ForStmt &n)
+	{
+		fold(n.sequence);
+	}
+};
+
+void optimize(ModulePtr &mod, unsigned int level)
+{
+	if (level == 0)
+		return;
+	ConstantFolder folder;
+	mod->accept(folder);
+}
+
+// namespace Pop
+}
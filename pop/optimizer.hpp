@@ -0,0 +1,40 @@
+// optimizer.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_OPTIMIZER_HPP
+#define POP_OPTIMIZER_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/ast.hpp>
+
+namespace Pop
+{
+
+// how much is optimized by default (-O2) and at most, see compile_ops()
+static constexpr unsigned int DEFAULT_OPT_LEVEL = 2;
+static constexpr unsigned int MAX_OPT_LEVEL = 3;
+
+// Rewrites the AST of a module into a simpler one which does the same,
+// before it's transformed into ops. Level 0 leaves it as it is, level 1
+// and up:
+//
+//   - fold operators whose operands are all Null, Bool, Int, Float or
+//     String literals into the literal of their result, computed by the
+//     same Value operators the VM uses, except where the operator would
+//     throw, which is left for the VM to do when it's run
+//   - drop the identities x * 1, x / 1, x + 0, x - 0 and !!x where what's
+//     known of x's type says they don't change its value
+//   - replace if and unless statements and if expressions whose predicate
+//     is a literal by the branch that would be taken, unless the other
+//     branch has a label in it
+void optimize(Ast::ModulePtr &mod, unsigned int level = DEFAULT_OPT_LEVEL);
+
+// namespace Pop
+}
+
+#endif // POP_OPTIMIZER_HPP
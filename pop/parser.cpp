@@ -167,20 +167,7 @@ Uint64 Parser::parse_int(const std::string &s)
 
 double Parser::parse_float(const std::string &s)
 {
-	auto dot_pos = s.find('.');
-	if (dot_pos != s.npos)
-	{
-		std::string whole(s.substr(0, dot_pos));
-		std::string fract(s.substr(dot_pos + 1));
-		auto iwhole = parse_int(s);
-		auto ifract = parse_int(s);
-		std::string num(std::to_string(iwhole) + "." + std::to_string(ifract));
-		return std::stod(num);
-	}
-	else
-	{
-		return std::stod(s);
-	}
+	return std::stod(s);
 }
 
 ModulePtr Parser::parse()
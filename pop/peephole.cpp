@@ -0,0 +1,519 @@
+// peephole.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/error.hpp>
+#include <pop/peephole.hpp>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Pop
+{
+
+template <class T>
+static inline T &as(InstructionPtr &op)
+{
+	return *static_cast<T *>(op.get());
+}
+
+static bool is_compare_jump(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_EQ_JUMP_FALSE:
+		case OpCode::OP_NE_JUMP_FALSE:
+		case OpCode::OP_GT_JUMP_FALSE:
+		case OpCode::OP_GE_JUMP_FALSE:
+		case OpCode::OP_LT_JUMP_FALSE:
+		case OpCode::OP_LE_JUMP_FALSE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// the label an op jumps to or pushes the function at, null if it has none
+static std::string *target_of(InstructionPtr &op)
+{
+	switch (op->code)
+	{
+		case OpCode::OP_JUMP:
+			return &as<Jump>(op).label;
+		case OpCode::OP_JUMP_TRUE:
+			return &as<JumpTrue>(op).label;
+		case OpCode::OP_JUMP_FALSE:
+			return &as<JumpFalse>(op).label;
+		case OpCode::OP_PUSH_FUNCTION:
+			return &as<PushFunction>(op).name;
+		default:
+			if (is_compare_jump(op->code))
+				return &as<CompareJump>(op).label;
+			return nullptr;
+	}
+}
+
+// whether an op only pushes a value, which nothing misses if it's popped
+// right away
+static bool is_pure_push(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_PUSH_NULL:
+		case OpCode::OP_PUSH_TRUE:
+		case OpCode::OP_PUSH_FALSE:
+		case OpCode::OP_PUSH_INT:
+		case OpCode::OP_PUSH_FLOAT:
+		case OpCode::OP_PUSH_STRING:
+		case OpCode::OP_PUSH_CONST:
+		case OpCode::OP_PUSH_FUNCTION:
+		case OpCode::OP_LOAD_LOCAL:
+		case OpCode::OP_LOAD_UPVALUE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// the slot an op reads from the current function's frame, if any
+static bool reads_local(InstructionPtr &op, Uint16 &slot)
+{
+	switch (op->code)
+	{
+		case OpCode::OP_LOAD_LOCAL:
+			slot = as<LocalOp>(op).slot;
+			return true;
+		case OpCode::OP_ADD_LOCAL_INT:
+		case OpCode::OP_SUB_LOCAL_INT:
+		case OpCode::OP_EQ_LOCAL_INT:
+		case OpCode::OP_NE_LOCAL_INT:
+		case OpCode::OP_GT_LOCAL_INT:
+		case OpCode::OP_GE_LOCAL_INT:
+		case OpCode::OP_LT_LOCAL_INT:
+		case OpCode::OP_LE_LOCAL_INT:
+			slot = as<LocalIntOp>(op).slot;
+			return true;
+		default:
+			return false;
+	}
+}
+
+// whether a constant pushed for a JUMP_TRUE or JUMP_FALSE is true, false
+// if it's not a constant whose truth is known
+static bool constant_truth(InstructionPtr &op, bool &truth)
+{
+	switch (op->code)
+	{
+		case OpCode::OP_PUSH_NULL:
+		case OpCode::OP_PUSH_FALSE:
+			truth = false;
+			return true;
+		case OpCode::OP_PUSH_TRUE:
+			truth = true;
+			return true;
+		case OpCode::OP_PUSH_INT:
+			truth = (as<PushInt>(op).value != 0);
+			return true;
+		case OpCode::OP_PUSH_FLOAT:
+			truth = (as<PushFloat>(op).value != 0.0);
+			return true;
+		default:
+			return false;
+	}
+}
+
+class Peephole
+{
+public:
+	PeepholeStats stats;
+
+	Peephole(InstructionList &ops, const PeepholeRules &rules)
+	    : ops(ops), rules(rules)
+	{
+	}
+
+	void run()
+	{
+		for (bool changed = true; changed;)
+		{
+			changed = false;
+			if (rules.constant_branches)
+				changed |= constant_branches();
+			if (rules.thread_jumps)
+				changed |= thread_jumps();
+			if (rules.jumps_to_next)
+				changed |= jumps_to_next();
+			if (rules.unreachable_code)
+				changed |= unreachable_code();
+			if (rules.dead_stores)
+				changed |= dead_stores();
+			if (rules.dead_pushes)
+				changed |= dead_pushes();
+			if (rules.unused_labels)
+				changed |= unused_labels();
+		}
+	}
+
+private:
+	InstructionList &ops;
+	const PeepholeRules &rules;
+	std::unordered_map<std::string, size_t> labels; // the index of each
+
+	void find_labels()
+	{
+		labels.clear();
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			if (ops[i]->code != OpCode::OP_LABEL)
+				continue;
+			auto &name = as<Label>(ops[i]).name;
+			// jumps to either would be threaded to the wrong one otherwise
+			if (!labels.emplace(name, i).second)
+			{
+				std::stringstream ss;
+				ss << "multiple labels named '" << name << "'";
+				throw RuntimeError(ss.str());
+			}
+		}
+	}
+
+	// the index of the first op from index on which isn't a label, where
+	// control goes on from a label
+	size_t landing(size_t index) const
+	{
+		while (index < ops.size() && ops[index]->code == OpCode::OP_LABEL)
+			index++;
+		return index;
+	}
+
+	// the index of a label, or past the end if there's no such label
+	size_t label_index(const std::string &name) const
+	{
+		auto found = labels.find(name);
+		return (found != labels.end()) ? found->second : ops.size();
+	}
+
+	// drops the ops the rules have reset
+	void compact()
+	{
+		ops.erase(std::remove(ops.begin(), ops.end(), nullptr), ops.end());
+	}
+
+	// Marks the ops control can reach from the one at start without
+	// leaving its function, adding the labels of the functions they push
+	// to entries.
+	void walk(size_t start, std::vector<bool> &reached,
+	          std::vector<size_t> &entries) const
+	{
+		std::vector<size_t> work;
+		auto reach = [&](size_t index) {
+			if (index < ops.size() && !reached[index])
+			{
+				reached[index] = true;
+				work.push_back(index);
+			}
+		};
+		reach(start);
+		while (!work.empty())
+		{
+			auto index = work.back();
+			work.pop_back();
+			auto &op = ops[index];
+			switch (op->code)
+			{
+				case OpCode::OP_HALT:
+				case OpCode::OP_RETURN:
+				case OpCode::OP_TAIL_CALL:
+				case OpCode::OP_TAIL_CALL_SYMBOL:
+					break;
+				case OpCode::OP_JUMP:
+					reach(label_index(as<Jump>(op).label));
+					break;
+				case OpCode::OP_PUSH_FUNCTION:
+					entries.push_back(label_index(as<PushFunction>(op).name));
+					reach(index + 1);
+					break;
+				default:
+					if (auto target = target_of(op))
+						reach(label_index(*target));
+					reach(index + 1);
+					break;
+			}
+		}
+	}
+
+	bool constant_branches()
+	{
+		bool changed = false;
+		for (size_t i = 0; i + 1 < ops.size(); i++)
+		{
+			auto code = ops[i + 1]->code;
+			bool truth;
+			if ((code != OpCode::OP_JUMP_TRUE &&
+			     code != OpCode::OP_JUMP_FALSE) ||
+			    !constant_truth(ops[i], truth))
+			{
+				continue;
+			}
+			if (truth == (code == OpCode::OP_JUMP_TRUE))
+			{
+				auto line = ops[i + 1]->line;
+				ops[i + 1] = mkop<Jump>(*target_of(ops[i + 1]));
+				ops[i + 1]->line = line;
+				stats.constant_branches += 1;
+			}
+			else
+			{
+				ops[i + 1] = nullptr;
+				stats.constant_branches += 2;
+			}
+			ops[i] = nullptr;
+			changed = true;
+			i++;
+		}
+		compact();
+		return changed;
+	}
+
+	bool thread_jumps()
+	{
+		bool changed = false;
+		find_labels();
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			auto target = target_of(ops[i]);
+			if (!target || ops[i]->code == OpCode::OP_PUSH_FUNCTION)
+				continue;
+			// follows a chain of JUMPs until it ends or goes round in a loop
+			std::unordered_set<std::string> seen{*target};
+			auto label = *target;
+			for (;;)
+			{
+				auto next = landing(label_index(label));
+				if (next >= ops.size() || next == i ||
+				    ops[next]->code != OpCode::OP_JUMP)
+				{
+					break;
+				}
+				auto &to = as<Jump>(ops[next]).label;
+				if (!seen.insert(to).second)
+					break;
+				label = to;
+			}
+			if (label != *target)
+			{
+				*target = label;
+				stats.threaded_jumps++;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	bool jumps_to_next()
+	{
+		bool changed = false;
+		find_labels();
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			auto code = ops[i]->code;
+			if (code != OpCode::OP_JUMP && code != OpCode::OP_JUMP_TRUE &&
+			    code != OpCode::OP_JUMP_FALSE)
+			{
+				continue;
+			}
+			auto label = label_index(*target_of(ops[i]));
+			if (label <= i || label >= landing(i + 1))
+				continue;
+			if (code == OpCode::OP_JUMP)
+			{
+				ops[i] = nullptr;
+			}
+			else
+			{
+				// the condition still has to be popped
+				auto line = ops[i]->line;
+				ops[i] = mkop<PopTop>();
+				ops[i]->line = line;
+			}
+			stats.jumps_to_next++;
+			changed = true;
+		}
+		compact();
+		return changed;
+	}
+
+	bool unreachable_code()
+	{
+		find_labels();
+		std::vector<bool> reached(ops.size());
+		std::vector<size_t> entries{0};
+		while (!entries.empty())
+		{
+			auto entry = entries.back();
+			entries.pop_back();
+			if (entry < ops.size() && !reached[entry])
+				walk(entry, reached, entries);
+		}
+		bool changed = false;
+		for (size_t i = 0; i < ops.size(); i++)
+		{
+			// labels are left for unused_labels(), and the last HALT has
+			// to stay for the linker
+			auto code = ops[i]->code;
+			if (reached[i] || code == OpCode::OP_LABEL ||
+			    code == OpCode::OP_HALT)
+			{
+				continue;
+			}
+			ops[i] = nullptr;
+			stats.unreachable_code++;
+			changed = true;
+		}
+		compact();
+		return changed;
+	}
+
+	bool dead_stores()
+	{
+		find_labels();
+		std::set<size_t> functions;
+		for (auto &op : ops)
+		{
+			if (op->code == OpCode::OP_PUSH_FUNCTION)
+				functions.insert(label_index(as<PushFunction>(op).name));
+		}
+		bool changed = false;
+		for (auto entry : functions)
+		{
+			auto open_scope = landing(entry);
+			if (open_scope >= ops.size() ||
+			    ops[open_scope]->code != OpCode::OP_OPEN_SCOPE)
+			{
+				continue;
+			}
+			// closures it makes could load any of its slots
+			std::vector<bool> body(ops.size());
+			std::vector<size_t> closures;
+			walk(open_scope, body, closures);
+			if (!closures.empty())
+				continue;
+			std::vector<bool> loaded;
+			for (size_t i = 0; i < ops.size(); i++)
+			{
+				Uint16 slot;
+				if (!body[i] || !reads_local(ops[i], slot))
+					continue;
+				if (slot >= loaded.size())
+					loaded.resize(slot + 1);
+				loaded[slot] = true;
+			}
+			// the stores of the arguments give the function its arity, see
+			// verify()
+			auto i = open_scope + 1;
+			while (i < ops.size() && ops[i]->code == OpCode::OP_STORE_LOCAL)
+				i++;
+			for (; i < ops.size(); i++)
+			{
+				if (!body[i] || ops[i]->code != OpCode::OP_STORE_LOCAL)
+					continue;
+				auto slot = as<LocalOp>(ops[i]).slot;
+				if (slot < loaded.size() && loaded[slot])
+					continue;
+				auto line = ops[i]->line;
+				ops[i] = mkop<PopTop>();
+				ops[i]->line = line;
+				stats.dead_stores++;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	bool dead_pushes()
+	{
+		bool changed = false;
+		for (size_t i = 0; i + 1 < ops.size(); i++)
+		{
+			if (is_pure_push(ops[i]->code) &&
+			    ops[i + 1]->code == OpCode::OP_POP_TOP)
+			{
+				ops[i] = nullptr;
+				ops[i + 1] = nullptr;
+				stats.dead_pushes += 2;
+				changed = true;
+				i++;
+			}
+		}
+		compact();
+		return changed;
+	}
+
+	bool unused_labels()
+	{
+		std::unordered_set<std::string> used;
+		for (auto &op : ops)
+		{
+			if (auto target = target_of(op))
+				used.insert(*target);
+		}
+		bool changed = false;
+		for (auto &op : ops)
+		{
+			if (op->code == OpCode::OP_LABEL &&
+			    !used.count(static_cast<Label *>(op.get())->name))
+			{
+				op = nullptr;
+				stats.unused_labels++;
+				changed = true;
+			}
+		}
+		compact();
+		return changed;
+	}
+};
+
+PeepholeStats &PeepholeStats::operator+=(const PeepholeStats &other)
+{
+	threaded_jumps += other.threaded_jumps;
+	constant_branches += other.constant_branches;
+	jumps_to_next += other.jumps_to_next;
+	unreachable_code += other.unreachable_code;
+	dead_stores += other.dead_stores;
+	dead_pushes += other.dead_pushes;
+	unused_labels += other.unused_labels;
+	return *this;
+}
+
+void PeepholeStats::report(std::ostream &out) const
+{
+	out << "peephole:\n"
+	    << format("%8zu  jumps threaded\n", threaded_jumps)
+	    << format("%8zu  ops removed by constant branches\n",
+	              constant_branches)
+	    << format("%8zu  jumps to the next op removed\n", jumps_to_next)
+	    << format("%8zu  unreachable ops removed\n", unreachable_code)
+	    << format("%8zu  dead stores replaced by pops\n", dead_stores)
+	    << format("%8zu  dead pushes and pops removed\n", dead_pushes)
+	    << format("%8zu  unused labels removed\n", unused_labels);
+}
+
+PeepholeStats optimize_peephole(InstructionList &ops,
+                                const PeepholeRules &rules)
+{
+	Peephole peephole(ops, rules);
+	peephole.run();
+	return peephole.stats;
+}
+
+// namespace Pop
+}
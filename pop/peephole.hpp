@@ -0,0 +1,87 @@
+// peephole.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_PEEPHOLE_HPP
+#define POP_PEEPHOLE_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/instructions.hpp>
+#include <ostream>
+
+namespace Pop
+{
+
+// Which rules optimize_peephole() applies, all of them by default:
+//
+//   thread_jumps      a jump to a JUMP goes straight to where that goes
+//   constant_branches PUSH_TRUE; JUMP_FALSE l (and the like) is dropped,
+//                     or becomes JUMP l when the branch is always taken
+//   jumps_to_next     a jump to the op right after it is dropped, leaving
+//                     a POP_TOP of a conditional jump's value
+//   unreachable_code  ops no control flow reaches are dropped
+//   dead_stores       a STORE_LOCAL to a slot its function never loads is
+//                     a POP_TOP instead, unless it stores an argument or
+//                     the function makes closures which might load it
+//   dead_pushes       a PUSH_* or LOAD_LOCAL right before a POP_TOP is
+//                     dropped along with it
+//   unused_labels     labels nothing jumps to are dropped, which lets
+//                     fuse_instructions() fuse the ops around them
+struct PeepholeRules
+{
+	bool thread_jumps;
+	bool constant_branches;
+	bool jumps_to_next;
+	bool unreachable_code;
+	bool dead_stores;
+	bool dead_pushes;
+	bool unused_labels;
+
+	PeepholeRules(bool all = true)
+	    : thread_jumps(all), constant_branches(all), jumps_to_next(all),
+	      unreachable_code(all), dead_stores(all), dead_pushes(all),
+	      unused_labels(all)
+	{
+	}
+};
+
+// How many ops each rule removed, how many jumps were retargeted and how
+// many dead stores were replaced
+struct PeepholeStats
+{
+	size_t threaded_jumps;
+	size_t constant_branches;
+	size_t jumps_to_next;
+	size_t unreachable_code;
+	size_t dead_stores;
+	size_t dead_pushes;
+	size_t unused_labels;
+
+	PeepholeStats()
+	    : threaded_jumps(0), constant_branches(0), jumps_to_next(0),
+	      unreachable_code(0), dead_stores(0), dead_pushes(0),
+	      unused_labels(0)
+	{
+	}
+
+	PeepholeStats &operator+=(const PeepholeStats &other);
+	void report(std::ostream &out) const;
+};
+
+// Simplifies the ops generated by the Transformer before they're fused and
+// assembled, applying the rules over and over until none of them changes
+// anything. The ops must be laid out as transform() lays them out, with
+// every function starting with a label and an OPEN_SCOPE, and they still
+// end with the same HALT. Throws a RuntimeError if two labels have the
+// same name, as assemble() would.
+PeepholeStats optimize_peephole(InstructionList &ops,
+                                const PeepholeRules &rules = PeepholeRules());
+
+// namespace Pop
+}
+
+#endif // POP_PEEPHOLE_HPP
@@ -0,0 +1,94 @@
+// pool.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/format.hpp>
+#include <pop/pool.hpp>
+#include <functional>
+#include <new>
+
+namespace Pop
+{
+
+Pool::Pool() : disabled(false)
+{
+	for (auto &size_class : classes)
+	{
+		size_class.free = nullptr;
+		size_class.slabs = 0;
+		size_class.used = 0;
+	}
+}
+
+Pool::~Pool()
+{
+	for (auto slab : slabs)
+		::operator delete(slab);
+}
+
+void Pool::refill(SizeClass &size_class, size_t cell_size)
+{
+	auto slab = static_cast<char *>(::operator new(SLAB_SIZE));
+	slabs.push_back(slab);
+	size_class.slabs++;
+	// thread the cells together in address order so they're handed out
+	// that way
+	auto count = SLAB_SIZE / cell_size;
+	for (size_t i = count; i > 0; i--)
+	{
+		auto cell = reinterpret_cast<Cell *>(slab + (i - 1) * cell_size);
+		cell->next = size_class.free;
+		size_class.free = cell;
+	}
+}
+
+// only asked once the pool is disabled, when there are no more slabs than
+// there were before
+bool Pool::owns(const void *ptr) const
+{
+	std::less<const void *> before;
+	for (auto slab : slabs)
+	{
+		auto begin = static_cast<const char *>(slab);
+		if (!before(ptr, begin) && before(ptr, begin + SLAB_SIZE))
+			return true;
+	}
+	return false;
+}
+
+std::vector<PoolStats> Pool::stats() const
+{
+	std::vector<PoolStats> result;
+	for (size_t i = 0; i < NUM_CLASSES; i++)
+	{
+		auto &size_class = classes[i];
+		if (size_class.slabs == 0)
+			continue;
+		PoolStats stats;
+		stats.size = class_size(i);
+		stats.slabs = size_class.slabs;
+		stats.used = size_class.used;
+		stats.capacity = size_class.slabs * (SLAB_SIZE / stats.size);
+		result.push_back(stats);
+	}
+	return result;
+}
+
+void Pool::report(std::ostream &out) const
+{
+	for (auto &stats : this->stats())
+	{
+		out << format("pool: %3zu byte cells: %zu slabs, %zu/%zu used "
+		              "(%.1f%%)\n",
+		              stats.size, stats.slabs, stats.used, stats.capacity,
+		              100.0 * stats.used / stats.capacity);
+	}
+}
+
+// namespace Pop
+}
@@ -0,0 +1,120 @@
+// pool.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_POOL_HPP
+#define POP_POOL_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+namespace Pop
+{
+
+struct PoolStats
+{
+	size_t size;     // of the cells in the class
+	size_t slabs;    // slabs carved into cells of this size
+	size_t used;     // cells currently allocated
+	size_t capacity; // cells in all of the slabs
+};
+
+// A small object allocator with a free list per size class, the cells of
+// which are carved out of fixed size slabs. Every Value type has a fixed
+// size (their variable parts live in separately allocated buffers) so
+// they all fit a class, anything bigger goes straight to operator new.
+// Slabs are only released when the pool is destroyed.
+class Pool
+{
+public:
+	static constexpr size_t GRANULE = 16; // size class spacing
+	static constexpr size_t MAX_SIZE = 128;
+	static constexpr size_t SLAB_SIZE = 8192;
+
+	Pool();
+	~Pool();
+
+	Pool(const Pool &) = delete;
+	Pool &operator=(const Pool &) = delete;
+
+	void *allocate(size_t size)
+	{
+		if (size > MAX_SIZE || disabled)
+			return ::operator new(size);
+		auto &size_class = classes[class_index(size)];
+		if (!size_class.free)
+			refill(size_class, class_size(class_index(size)));
+		auto cell = size_class.free;
+		size_class.free = cell->next;
+		size_class.used++;
+		return cell;
+	}
+
+	// size must be what the memory was allocated with
+	void deallocate(void *ptr, size_t size)
+	{
+		if (size > MAX_SIZE || (disabled && !owns(ptr)))
+		{
+			::operator delete(ptr);
+			return;
+		}
+		auto &size_class = classes[class_index(size)];
+		auto cell = static_cast<Cell *>(ptr);
+		cell->next = size_class.free;
+		size_class.free = cell;
+		size_class.used--;
+	}
+
+	// from now on allocates everything with plain operator new, to be
+	// compared against. Cells already handed out go back to their slabs.
+	void disable()
+	{
+		disabled = true;
+	}
+
+	// one entry for each size class which has any slabs
+	std::vector<PoolStats> stats() const;
+	void report(std::ostream &out) const;
+
+private:
+	static constexpr size_t NUM_CLASSES = MAX_SIZE / GRANULE;
+
+	struct Cell
+	{
+		Cell *next;
+	};
+
+	struct SizeClass
+	{
+		Cell *free;
+		size_t slabs;
+		size_t used;
+	};
+
+	static size_t class_index(size_t size)
+	{
+		return (size > 0) ? (size - 1) / GRANULE : 0;
+	}
+	static size_t class_size(size_t index)
+	{
+		return (index + 1) * GRANULE;
+	}
+
+	void refill(SizeClass &size_class, size_t cell_size);
+	bool owns(const void *ptr) const;
+
+	SizeClass classes[NUM_CLASSES];
+	std::vector<void *> slabs;
+	bool disabled;
+};
+
+// namespace Pop
+}
+
+#endif // POP_POOL_HPP
@@ -9,21 +9,35 @@
 #define POP_HPP_INCLUDED 1
 #include <pop/assembler.hpp>
 #include <pop/ast.hpp>
+#include <pop/cache.hpp>
 #include <pop/codebuffer.hpp>
 #include <pop/compiler.hpp>
+#include <pop/constants.hpp>
 #include <pop/debugvisitor.hpp>
 #include <pop/decoder.hpp>
 #include <pop/disassembler.hpp>
+#include <pop/endian.hpp>
 #include <pop/error.hpp>
 #include <pop/format.hpp>
+#include <pop/fusion.hpp>
+#include <pop/gc.hpp>
+#include <pop/image.hpp>
 #include <pop/instructions.hpp>
+#include <pop/jit.hpp>
 #include <pop/lexer.hpp>
+#include <pop/linker.hpp>
 #include <pop/location.hpp>
 #include <pop/opcodes.hpp>
+#include <pop/optimizer.hpp>
 #include <pop/parser.hpp>
+#include <pop/peephole.hpp>
+#include <pop/pool.hpp>
+#include <pop/program.hpp>
+#include <pop/ssa.hpp>
 #include <pop/token.hpp>
 #include <pop/transformer.hpp>
 #include <pop/types.hpp>
+#include <pop/verifier.hpp>
 #include <pop/visitor.hpp>
 #include <pop/vm.hpp>
 #undef POP_HPP_INCLUDED
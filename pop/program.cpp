@@ -0,0 +1,307 @@
+// program.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/constants.hpp>
+#include <pop/decoder.hpp>
+#include <pop/error.hpp>
+#include <pop/image.hpp>
+#include <pop/program.hpp>
+#include <pop/verifier.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+
+namespace Pop
+{
+
+static const CodeAddr NO_INDEX = CodeAddr(-1);
+
+Program::Program(const Uint8 *data, size_t size, SymbolTable &symbols)
+    : threaded(false), max_stack(0)
+{
+	Image image(data, size);
+	load_constants(image.section(SectionKind::CONSTANTS));
+	auto names = load_symbols(image.section(SectionKind::SYMBOLS), symbols);
+	auto name_at = [&names](Uint64 index) {
+		if (index >= names.size())
+		{
+			std::stringstream ss;
+			ss << "invalid symbol '" << index << "'";
+			throw RuntimeError(ss.str());
+		}
+		return names[index];
+	};
+
+	auto section = image.section(SectionKind::CODE);
+	if (section.size == 0)
+		throw RuntimeError("bytecode image has no code");
+	auto code = section.data;
+	CodeAddr len = section.size;
+
+	// maps byte offsets of instruction starts to their index in ops
+	std::vector<CodeAddr> index_of(len + 1, NO_INDEX);
+	std::vector<CodeAddr> addr_ops;
+
+	CodeAddr ip = 0;
+	Decoder dec(&ip, code, len);
+	CodeAddr op_addr = 0;
+	// an unsigned operand which has to fit in max
+	auto read_uleb = [&dec, &op_addr](Uint64 max) {
+		auto v = dec.read_uleb();
+		if (v > max)
+		{
+			std::stringstream ss;
+			ss << "operand '" << v << "' out of range at '" << std::hex
+			   << op_addr << "'";
+			throw RuntimeError(ss.str());
+		}
+		return v;
+	};
+	while (ip < len)
+	{
+		op_addr = ip;
+		index_of[op_addr] = ops.size();
+		auto opcode = dec.read_op();
+		if (Uint8(opcode) >= NUM_OPCODES)
+		{
+			std::stringstream ss;
+			ss << "unknown instruction '" << unsigned(opcode) << "' at '"
+			   << std::hex << op_addr << "'";
+			throw RuntimeError(ss.str());
+		}
+		// the Decoder checks each operand too, but this says which op it was
+		if (min_operand_size(opcode) > len - ip)
+		{
+			std::stringstream ss;
+			ss << "truncated '" << opcode_name(opcode) << "' at '" << std::hex
+			   << op_addr << "'";
+			throw RuntimeError(ss.str());
+		}
+		ops.emplace_back(opcode);
+		auto &op = ops.back();
+		switch (opcode)
+		{
+			case OpCode::OP_BIND:
+			case OpCode::OP_LOAD_GLOBAL:
+			case OpCode::OP_STORE_GLOBAL:
+				op.name = name_at(dec.read_uleb());
+				break;
+			case OpCode::OP_OPEN_SCOPE:
+			case OpCode::OP_LOAD_LOCAL:
+			case OpCode::OP_STORE_LOCAL:
+				op.slot = read_uleb(Uint16(-1));
+				break;
+			case OpCode::OP_LOAD_UPVALUE:
+			case OpCode::OP_STORE_UPVALUE:
+				op.depth = dec.read_u8();
+				op.slot = read_uleb(Uint16(-1));
+				break;
+			case OpCode::OP_CALL:
+			case OpCode::OP_TAIL_CALL:
+				op.count = dec.read_u8();
+				break;
+			case OpCode::OP_CALL_SYMBOL:
+			case OpCode::OP_TAIL_CALL_SYMBOL:
+				op.name = name_at(dec.read_uleb());
+				op.count = dec.read_u8();
+				break;
+			case OpCode::OP_ADD_SYMBOL_INT:
+			case OpCode::OP_SUB_SYMBOL_INT:
+			case OpCode::OP_EQ_SYMBOL_INT:
+			case OpCode::OP_NE_SYMBOL_INT:
+			case OpCode::OP_GT_SYMBOL_INT:
+			case OpCode::OP_GE_SYMBOL_INT:
+			case OpCode::OP_LT_SYMBOL_INT:
+			case OpCode::OP_LE_SYMBOL_INT:
+				op.name = name_at(dec.read_uleb());
+				op.int_value = dec.read_sleb();
+				break;
+			case OpCode::OP_ADD_LOCAL_INT:
+			case OpCode::OP_SUB_LOCAL_INT:
+			case OpCode::OP_EQ_LOCAL_INT:
+			case OpCode::OP_NE_LOCAL_INT:
+			case OpCode::OP_GT_LOCAL_INT:
+			case OpCode::OP_GE_LOCAL_INT:
+			case OpCode::OP_LT_LOCAL_INT:
+			case OpCode::OP_LE_LOCAL_INT:
+				op.slot = read_uleb(Uint16(-1));
+				op.int_value = dec.read_sleb();
+				break;
+			case OpCode::OP_JUMP:
+			case OpCode::OP_JUMP_TRUE:
+			case OpCode::OP_JUMP_FALSE:
+			case OpCode::OP_EQ_JUMP_FALSE:
+			case OpCode::OP_NE_JUMP_FALSE:
+			case OpCode::OP_GT_JUMP_FALSE:
+			case OpCode::OP_GE_JUMP_FALSE:
+			case OpCode::OP_LT_JUMP_FALSE:
+			case OpCode::OP_LE_JUMP_FALSE:
+			case OpCode::OP_PUSH_FUNCTION:
+			{
+				// relative to the operand, so it's only known to be in the
+				// code once it's been added up
+				auto from = Int64(ip);
+				auto target = from + dec.read_sleb();
+				if (target < 0 || target >= Int64(len))
+				{
+					std::stringstream ss;
+					ss << "invalid target address '" << std::hex << target
+					   << "' for '" << opcode_name(opcode) << "'";
+					throw RuntimeError(ss.str());
+				}
+				op.target = CodeAddr(target);
+				addr_ops.push_back(ops.size() - 1);
+				break;
+			}
+			case OpCode::OP_PUSH_INT:
+			{
+				// small ints are immediate in the bytecode, but are pushed
+				// like any other constant. Only up to 32 bits, so they're
+				// never boxed into a Value which nothing would trace.
+				auto v = dec.read_sleb();
+				if (v < INT32_MIN || v > INT32_MAX)
+				{
+					std::stringstream ss;
+					ss << "operand '" << v << "' out of range at '"
+					   << std::hex << op_addr << "'";
+					throw RuntimeError(ss.str());
+				}
+				op.code = OpCode::OP_PUSH_CONST;
+				op.constant = TValue::make_int(v);
+				break;
+			}
+			case OpCode::OP_PUSH_CONST:
+			{
+				auto index = dec.read_uleb();
+				if (index >= constants.size())
+				{
+					std::stringstream ss;
+					ss << "invalid constant '" << index << "' at '"
+					   << std::hex << op_addr << "'";
+					throw RuntimeError(ss.str());
+				}
+				op.constant = constants[index];
+				break;
+			}
+			case OpCode::OP_PUSH_LIST:
+			case OpCode::OP_PUSH_DICT:
+				op.count = read_uleb(Uint32(-1));
+				break;
+			default:
+				break;
+		}
+	}
+
+	// so running off the end of the code can't run off the end of ops
+	ops.emplace_back(OpCode::OP_HALT);
+
+	// turn byte addresses into op indices now that they're all known
+	for (auto i : addr_ops)
+	{
+		auto &op = ops[i];
+		if (op.target >= len || index_of[op.target] == NO_INDEX)
+		{
+			std::stringstream ss;
+			ss << "invalid target address '" << std::hex << op.target
+			   << "' for '" << opcode_name(op.code) << "'";
+			throw RuntimeError(ss.str());
+		}
+		op.target = index_of[op.target];
+	}
+
+	load_lines(image.section(SectionKind::LINES), index_of);
+	verify(*this);
+}
+
+void Program::load_constants(const Section &section)
+{
+	if (section.size == 0)
+		return;
+	CodeAddr ip = 0;
+	Decoder dec(&ip, section.data, section.size);
+	auto count = dec.read_u32();
+	constants.reserve(count);
+	for (Uint32 i = 0; i < count; i++)
+	{
+		auto kind = ConstKind(dec.read_u8());
+		switch (kind)
+		{
+			case ConstKind::INT:
+				constants.push_back(TValue::make_int(dec.read_s64()));
+				break;
+			case ConstKind::FLOAT:
+				constants.push_back(TValue::make_float(dec.read_f64()));
+				break;
+			case ConstKind::STRING:
+				// strings are immutable, so every push can share one
+				constants.push_back(new Pop::String(dec.read_string()));
+				break;
+			default:
+			{
+				std::stringstream ss;
+				ss << "unknown constant kind '" << unsigned(kind) << "'";
+				throw RuntimeError(ss.str());
+			}
+		}
+	}
+}
+
+std::vector<Symbol *> Program::load_symbols(const Section &section,
+                                            SymbolTable &symbols)
+{
+	std::vector<Symbol *> names;
+	if (section.size == 0)
+		return names;
+	CodeAddr ip = 0;
+	Decoder dec(&ip, section.data, section.size);
+	auto count = dec.read_u32();
+	names.reserve(count);
+	for (Uint32 i = 0; i < count; i++)
+		names.push_back(symbols.intern(dec.read_string()));
+	return names;
+}
+
+void Program::load_lines(const Section &section,
+                         const std::vector<CodeAddr> &index_of)
+{
+	if (section.size == 0)
+		return;
+	CodeAddr ip = 0;
+	Decoder dec(&ip, section.data, section.size);
+	auto count = dec.read_u32();
+	lines.reserve(count);
+	for (Uint32 i = 0; i < count; i++)
+	{
+		auto addr = dec.read_u32();
+		auto line = dec.read_u32();
+		if (addr < index_of.size() && index_of[addr] != NO_INDEX)
+			lines.emplace_back(index_of[addr], line);
+	}
+}
+
+Uint32 Program::line_of(CodeAddr index) const
+{
+	auto after = std::upper_bound(
+	    lines.begin(), lines.end(), index,
+	    [](CodeAddr index, const std::pair<CodeAddr, Uint32> &start) {
+		    return index < start.first;
+		});
+	if (after == lines.begin())
+		return 0;
+	return (after - 1)->second;
+}
+
+void Program::trace() const
+{
+	for (auto value : constants)
+		value.trace();
+}
+
+// namespace Pop
+}
@@ -0,0 +1,94 @@
+// program.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_PROGRAM_HPP
+#define POP_PROGRAM_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/image.hpp>
+#include <pop/opcodes.hpp>
+#include <pop/types.hpp>
+#include <pop/value.hpp>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace Pop
+{
+
+// A fixed-width instruction decoded ahead of time from the bytecode, with
+// its operands already resolved so the VM never has to look at the raw
+// bytes again while it's running.
+struct DecodedOp
+{
+	// the VM's handler for this op, filled in by VM::execute() when it's
+	// using threaded dispatch
+	const void *handler;
+	OpCode code;
+	Uint8 depth;  // *_UPVALUE
+	Uint16 slot;  // OPEN_SCOPE (frame size), *_LOCAL*, *_UPVALUE
+	Uint32 count; // CALL*, PUSH_LIST, PUSH_DICT, times quickening failed,
+	              // OPEN_SCOPE starting a function (its parameters)
+	Symbol *name; // BIND, *_GLOBAL, *_SYMBOL_INT, CALL_SYMBOL
+	union
+	{
+		Int64 int_value;   // *_SYMBOL_INT, *_LOCAL_INT constant
+		CodeAddr target;   // JUMP*, PUSH_FUNCTION (index into ops)
+		TValue constant;   // PUSH_CONST
+		Uint32 max_stack;  // OPEN_SCOPE starting a function, see verify()
+	};
+
+	DecodedOp(OpCode code)
+	    : handler(nullptr), code(code), depth(0), slot(0), count(0),
+	      name(nullptr), int_value(0)
+	{
+	}
+};
+
+typedef std::vector<DecodedOp> DecodedOpList;
+
+// The loaded form of a bytecode image which the VM executes. Jump and
+// function addresses are turned into indices into the ops list, names are
+// interned into the given SymbolTable and the constant pool is turned into
+// Values once. The constants belong to the Heap which is current when the
+// program is loaded, so whoever runs it has to keep them alive with
+// trace(), along with the symbols.
+class Program
+{
+public:
+	DecodedOpList ops;
+	bool threaded;    // whether the handler fields have been filled in
+	Uint32 max_stack; // the most values the top-level code pushes
+
+	// loads and verifies a bytecode image, see Image and verify()
+	Program(const Uint8 *data, size_t size, SymbolTable &symbols);
+
+	Program(const Program &) = delete;
+	Program &operator=(const Program &) = delete;
+
+	// the source line the op at index was generated from, 0 if unknown
+	Uint32 line_of(CodeAddr index) const;
+
+	// marks the constants as reachable
+	void trace() const;
+
+private:
+	ValueList constants;
+	std::vector<std::pair<CodeAddr, Uint32>> lines; // (op index, line)
+
+	void load_constants(const Section &section);
+	std::vector<Symbol *> load_symbols(const Section &section,
+	                                   SymbolTable &symbols);
+	void load_lines(const Section &section,
+	                const std::vector<CodeAddr> &index_of);
+};
+
+// namespace Pop
+}
+
+#endif // POP_PROGRAM_HPP
@@ -0,0 +1,1611 @@
+// ssa.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/ssa.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Pop
+{
+
+namespace Ssa
+{
+
+template <class T>
+static inline T &as(const InstructionPtr &op)
+{
+	return *static_cast<T *>(op.get());
+}
+
+static bool is_literal(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_PUSH_NULL:
+		case OpCode::OP_PUSH_TRUE:
+		case OpCode::OP_PUSH_FALSE:
+		case OpCode::OP_PUSH_INT:
+		case OpCode::OP_PUSH_FLOAT:
+		case OpCode::OP_PUSH_STRING:
+		case OpCode::OP_PUSH_CONST:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_unary(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_POS:
+		case OpCode::OP_NEG:
+		case OpCode::OP_LOG_NOT:
+		case OpCode::OP_BIT_NOT:
+		case OpCode::OP_IP_PREINC:
+		case OpCode::OP_IP_PREDEC:
+		case OpCode::OP_IP_POSTINC:
+		case OpCode::OP_IP_POSTDEC:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// the operators, from ADD to LE
+static bool is_operator(OpCode code)
+{
+	return (code >= OpCode::OP_ADD && code <= OpCode::OP_LE);
+}
+
+// whether an op's value only depends on its args, and it throws for the
+// same args every time if it throws at all, so it doesn't need computing
+// twice
+static bool is_pure(OpCode code)
+{
+	if (is_literal(code))
+		return true;
+	if (!is_operator(code))
+		return false;
+	// the assigning operators which aren't compiled to stores only check
+	// their operands or throw
+	return !(code >= OpCode::OP_IP_ADD && code <= OpCode::OP_IP_ASSIGN) &&
+	       code != OpCode::OP_IP_POSTINC && code != OpCode::OP_IP_POSTDEC;
+}
+
+static bool is_terminator(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_JUMP:
+		case OpCode::OP_JUMP_TRUE:
+		case OpCode::OP_JUMP_FALSE:
+		case OpCode::OP_RETURN:
+		case OpCode::OP_TAIL_CALL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_branch(OpCode code)
+{
+	return (code == OpCode::OP_JUMP_TRUE || code == OpCode::OP_JUMP_FALSE);
+}
+
+static std::string &label_of(InstructionPtr &op)
+{
+	switch (op->code)
+	{
+		case OpCode::OP_JUMP_TRUE:
+			return as<JumpTrue>(op).label;
+		case OpCode::OP_JUMP_FALSE:
+			return as<JumpFalse>(op).label;
+		default:
+			return as<Jump>(op).label;
+	}
+}
+
+// How many values an op of the IR pops and pushes, false if it's not one.
+// Loads and stores of locals aren't, they become the values themselves.
+static bool stack_effect(const InstructionPtr &op, size_t &pops,
+                         size_t &pushes)
+{
+	pops = 0;
+	pushes = 0;
+	if (is_literal(op->code))
+	{
+		pushes = 1;
+		return true;
+	}
+	if (is_operator(op->code))
+	{
+		pops = is_unary(op->code) ? 1 : 2;
+		pushes = 1;
+		return true;
+	}
+	switch (op->code)
+	{
+		case OpCode::OP_LOAD_GLOBAL:
+		case OpCode::OP_LOAD_UPVALUE:
+			pushes = 1;
+			return true;
+		case OpCode::OP_BIND:
+		case OpCode::OP_STORE_GLOBAL:
+		case OpCode::OP_STORE_UPVALUE:
+		case OpCode::OP_JUMP_TRUE:
+		case OpCode::OP_JUMP_FALSE:
+		case OpCode::OP_RETURN:
+			pops = 1;
+			return true;
+		case OpCode::OP_PRINT:
+			pops = 1;
+			pushes = 1;
+			return true;
+		case OpCode::OP_CALL:
+			pops = as<Call>(op).nargs + 1; // the arguments and the callee
+			pushes = 1;
+			return true;
+		case OpCode::OP_TAIL_CALL:
+			pops = as<Call>(op).nargs + 1;
+			return true;
+		case OpCode::OP_PUSH_LIST:
+			pops = as<PushList>(op).len;
+			pushes = 1;
+			return true;
+		case OpCode::OP_PUSH_DICT:
+			pops = as<PushDict>(op).len * 2;
+			pushes = 1;
+			return true;
+		case OpCode::OP_PUSH_SLICE:
+			pops = 3;
+			pushes = 1;
+			return true;
+		case OpCode::OP_INDEX:
+		case OpCode::OP_MEMBER:
+			pops = 2;
+			pushes = 1;
+			return true;
+		default:
+			return false;
+	}
+}
+
+static InstructionPtr clone_literal(const InstructionPtr &op, Uint32 line)
+{
+	InstructionPtr copy;
+	switch (op->code)
+	{
+		case OpCode::OP_PUSH_NULL:
+			copy = mkop<PushNull>();
+			break;
+		case OpCode::OP_PUSH_TRUE:
+			copy = mkop<PushTrue>();
+			break;
+		case OpCode::OP_PUSH_FALSE:
+			copy = mkop<PushFalse>();
+			break;
+		case OpCode::OP_PUSH_INT:
+			copy = mkop<PushInt>(as<PushInt>(op).value);
+			break;
+		case OpCode::OP_PUSH_FLOAT:
+			copy = mkop<PushFloat>(as<PushFloat>(op).value);
+			break;
+		case OpCode::OP_PUSH_STRING:
+			copy = mkop<PushString>(as<PushString>(op).value);
+			break;
+		default:
+			copy = mkop<PushConst>(as<PushConst>(op).index,
+			                       as<PushConst>(op).value);
+			break;
+	}
+	copy->line = line;
+	return copy;
+}
+
+// the op as it's listed, without its indentation
+static std::string listing(const InstructionPtr &op)
+{
+	std::stringstream ss;
+	op->list(ss);
+	auto text = ss.str();
+	auto begin = text.find_first_not_of('\t');
+	auto end = text.find_last_not_of('\n');
+	return text.substr(begin, end + 1 - begin);
+}
+
+static void erase(std::vector<Inst *> &insts, Inst *v)
+{
+	insts.erase(std::remove(insts.begin(), insts.end(), v), insts.end());
+}
+
+bool Inst::is_constant() const
+{
+	return (kind == OP && op && is_literal(op->code));
+}
+
+std::vector<Block *> Block::succs() const
+{
+	std::vector<Block *> blocks;
+	if (target)
+		blocks.push_back(target);
+	if (next)
+		blocks.push_back(next);
+	return blocks;
+}
+
+size_t Block::pred_index(const Block *pred) const
+{
+	return std::find(preds.begin(), preds.end(), pred) - preds.begin();
+}
+
+Inst *Function::add_inst(Inst::Kind kind, Block *block)
+{
+	values.emplace_back(new Inst(kind, values.size(), block));
+	return values.back().get();
+}
+
+Block *Function::add_block(const std::string &label)
+{
+	blocks.emplace_back(new Block(blocks.size(), label));
+	return blocks.back().get();
+}
+
+Inst *Function::find(Inst *v)
+{
+	while (v->replacement)
+		v = v->replacement;
+	return v;
+}
+
+void Function::replace(Inst *v, Inst *with)
+{
+	with = find(with);
+	if (with != v)
+		v->replacement = with;
+}
+
+void Function::resolve()
+{
+	for (auto &block : blocks)
+	{
+		for (auto phi : block->phis)
+		{
+			for (auto &arg : phi->args)
+				arg = find(arg);
+		}
+		for (auto inst : block->insts)
+		{
+			for (auto &arg : inst->args)
+				arg = find(arg);
+		}
+	}
+}
+
+// the blocks in reverse postorder from the entry, so each comes after all
+// of the blocks which dominate it
+static std::vector<Block *> reverse_postorder(Function &fn)
+{
+	std::vector<Block *> order;
+	std::vector<bool> seen(fn.blocks.size());
+	std::vector<std::pair<Block *, size_t>> work{{fn.blocks[0].get(), 0}};
+	seen[0] = true;
+	while (!work.empty())
+	{
+		auto &top = work.back();
+		auto succs = top.first->succs();
+		if (top.second < succs.size())
+		{
+			auto succ = succs[top.second++];
+			if (!seen[succ->id])
+			{
+				seen[succ->id] = true;
+				work.push_back({succ, 0});
+			}
+			continue;
+		}
+		order.push_back(top.first);
+		work.pop_back();
+	}
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+// see "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy
+void Function::find_dominators()
+{
+	auto order = reverse_postorder(*this);
+	std::vector<size_t> number(blocks.size());
+	for (size_t i = 0; i < order.size(); i++)
+		number[order[i]->id] = i;
+	auto entry = blocks[0].get();
+	for (auto &block : blocks)
+		block->idom = nullptr;
+	entry->idom = entry;
+	auto intersect = [&](Block *a, Block *b) {
+		while (a != b)
+		{
+			while (number[a->id] > number[b->id])
+				a = a->idom;
+			while (number[b->id] > number[a->id])
+				b = b->idom;
+		}
+		return a;
+	};
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+		for (auto block : order)
+		{
+			if (block == entry)
+				continue;
+			Block *idom = nullptr;
+			for (auto pred : block->preds)
+			{
+				if (pred->idom)
+					idom = idom ? intersect(pred, idom) : pred;
+			}
+			if (idom != block->idom)
+			{
+				block->idom = idom;
+				changed = true;
+			}
+		}
+	}
+	entry->idom = nullptr;
+}
+
+void Function::list(std::ostream &out) const
+{
+	auto value = [](const Inst *v) { return "%" + std::to_string(v->id); };
+	out << name << ":\n";
+	for (auto param : params)
+		out << "\t" << value(param) << " = PARAM " << param->slot << "\n";
+	for (auto &block : blocks)
+	{
+		if (!block->label.empty())
+			out << block->label << ":";
+		else
+			out << "entry:";
+		for (size_t i = 0; i < block->preds.size(); i++)
+		{
+			out << (i == 0 ? "\t; from " : ", ")
+			    << (block->preds[i]->label.empty() ? "entry"
+			                                       : block->preds[i]->label);
+		}
+		out << "\n";
+		for (auto phi : block->phis)
+		{
+			out << "\t" << value(phi) << " = PHI";
+			for (auto arg : phi->args)
+				out << " " << value(find(arg));
+			out << "\n";
+		}
+		for (auto inst : block->insts)
+		{
+			out << "\t";
+			if (inst->has_value)
+				out << value(inst) << " = ";
+			out << listing(inst->op);
+			for (auto arg : inst->args)
+				out << " " << value(find(arg));
+			out << "\n";
+		}
+		bool branches =
+		    !block->insts.empty() && is_branch(block->insts.back()->op->code);
+		if (block->target && !branches)
+			out << "\tJUMP " << block->target->label << "\n";
+	}
+}
+
+//
+// Building
+//
+
+class Builder
+{
+public:
+	Builder(InstructionList &ops, size_t begin, size_t end)
+	    : ops(ops), begin(begin), end(end), fn(new Function()), nslots(0)
+	{
+	}
+
+	std::unique_ptr<Function> run()
+	{
+		if (!prologue() || !split() || !link())
+			return nullptr;
+		drop_unreachable();
+		if (!rename())
+			return nullptr;
+		// nothing fails from here on, so the ops can be taken
+		for (auto i = begin; i < body; i++)
+			fn->prologue.emplace_back(ops[i].release());
+		for (auto &taken : owners)
+			taken.first->op = std::move(ops[taken.second]);
+		return std::move(fn);
+	}
+
+private:
+	struct State
+	{
+		std::vector<Inst *> slots;
+		std::vector<Inst *> stack;
+	};
+
+	InstructionList &ops;
+	size_t begin, end, body;
+	std::unique_ptr<Function> fn;
+	Uint16 nslots;
+	std::vector<Uint16> param_slots;
+	std::unordered_map<std::string, Block *> labels;
+	std::unordered_map<Block *, std::vector<size_t>> block_ops;
+	std::vector<std::pair<Inst *, size_t>> owners; // which op each OP runs
+
+	bool prologue()
+	{
+		if (end - begin < 2 || ops[begin]->code != OpCode::OP_LABEL ||
+		    ops[begin + 1]->code != OpCode::OP_OPEN_SCOPE)
+		{
+			return false;
+		}
+		fn->name = as<Label>(ops[begin]).name;
+		nslots = as<OpenScope>(ops[begin + 1]).nslots;
+		body = begin + 2;
+		while (body < end && ops[body]->code == OpCode::OP_STORE_LOCAL)
+			param_slots.push_back(as<LocalOp>(ops[body++]).slot);
+		return true;
+	}
+
+	std::string block_label()
+	{
+		return fn->name + "ssa" + std::to_string(fn->blocks.size()) + "_";
+	}
+
+	// splits the body into blocks, each starting at a label or after a
+	// jump, without anything that can't go in the IR
+	bool split()
+	{
+		fn->add_block(""); // the entry
+		Block *current = nullptr;
+		for (auto i = body; i < end; i++)
+		{
+			auto &op = ops[i];
+			size_t pops, pushes;
+			switch (op->code)
+			{
+				case OpCode::OP_LABEL:
+					if (!current || !block_ops[current].empty())
+						current = fn->add_block(as<Label>(op).name);
+					labels[as<Label>(op).name] = current;
+					continue;
+				case OpCode::OP_NOP:
+					continue;
+				case OpCode::OP_LOAD_LOCAL:
+				case OpCode::OP_STORE_LOCAL:
+					if (as<LocalOp>(op).slot >= nslots)
+						return false;
+					break;
+				case OpCode::OP_POP_TOP:
+				case OpCode::OP_JUMP:
+					break;
+				default:
+					// which includes making closures, which could reach the
+					// locals, so they have to stay in their slots
+					if (!stack_effect(op, pops, pushes))
+						return false;
+					break;
+			}
+			if (!current)
+				current = fn->add_block(block_label());
+			block_ops[current].push_back(i);
+			if (is_terminator(op->code))
+				current = nullptr;
+		}
+		return true;
+	}
+
+	// finds where each block goes on to
+	bool link()
+	{
+		auto &blocks = fn->blocks;
+		if (blocks.size() < 2)
+			return false;
+		blocks[0]->next = blocks[1].get();
+		for (size_t i = 1; i < blocks.size(); i++)
+		{
+			auto block = blocks[i].get();
+			auto &indices = block_ops[block];
+			auto last = indices.empty() ? OpCode::OP_NOP
+			                            : ops[indices.back()]->code;
+			if (last == OpCode::OP_JUMP || is_branch(last))
+			{
+				auto found = labels.find(label_of(ops[indices.back()]));
+				if (found == labels.end())
+					return false; // out of the function
+				block->target = found->second;
+			}
+			if (last != OpCode::OP_JUMP && last != OpCode::OP_RETURN &&
+			    last != OpCode::OP_TAIL_CALL)
+			{
+				// falling off the end of the function
+				if (i + 1 >= blocks.size())
+					return false;
+				block->next = blocks[i + 1].get();
+			}
+			if (block->target && block->target == block->next)
+				return false;
+		}
+		return true;
+	}
+
+	void drop_unreachable()
+	{
+		auto order = reverse_postorder(*fn);
+		std::vector<bool> reached(fn->blocks.size());
+		for (auto block : order)
+			reached[block->id] = true;
+		auto &blocks = fn->blocks;
+		size_t kept = 0;
+		for (size_t i = 0; i < blocks.size(); i++)
+		{
+			if (!reached[i])
+				continue;
+			blocks[kept] = std::move(blocks[i]);
+			blocks[kept]->id = kept;
+			kept++;
+		}
+		blocks.resize(kept);
+		for (auto &block : blocks)
+		{
+			for (auto succ : block->succs())
+				succ->preds.push_back(block.get());
+		}
+	}
+
+	Inst *add_phi(Block *block)
+	{
+		auto phi = fn->add_inst(Inst::PHI, block);
+		block->phis.push_back(phi);
+		return phi;
+	}
+
+	// Renames the locals and the values on the stack into SSA values. Each
+	// block with more than one way in gets a phi for every local and stack
+	// value, the ones which turn out to be copies are left for
+	// propagate_copies().
+	bool rename()
+	{
+		auto entry = fn->blocks[0].get();
+		auto null = fn->add_inst(Inst::OP, entry);
+		null->op = mkop<PushNull>();
+		entry->insts.push_back(null);
+		std::unordered_map<Block *, State> states;
+		auto &start = states[entry];
+		start.slots.assign(nslots, null);
+		for (auto slot : param_slots)
+		{
+			auto param = fn->add_inst(Inst::PARAM, nullptr);
+			param->slot = slot;
+			fn->params.push_back(param);
+			start.slots[slot] = param;
+		}
+
+		std::unordered_map<Block *, size_t> depths;
+		for (auto block : reverse_postorder(*fn))
+		{
+			if (block == entry)
+				continue;
+			State state;
+			if (block->preds.size() == 1)
+			{
+				auto found = states.find(block->preds[0]);
+				if (found == states.end())
+					return false;
+				state = found->second;
+			}
+			else
+			{
+				// the stack is as deep whichever way control comes in
+				size_t depth = 0;
+				for (auto pred : block->preds)
+				{
+					auto found = states.find(pred);
+					if (found != states.end())
+						depth = found->second.stack.size();
+				}
+				depths[block] = depth;
+				for (size_t i = 0; i < nslots; i++)
+					state.slots.push_back(add_phi(block));
+				for (size_t i = 0; i < depth; i++)
+					state.stack.push_back(add_phi(block));
+			}
+			if (!run(block, state))
+				return false;
+			states[block] = std::move(state);
+		}
+
+		for (auto &block : fn->blocks)
+		{
+			if (block->phis.empty())
+				continue;
+			for (auto pred : block->preds)
+			{
+				auto &state = states[pred];
+				if (state.stack.size() != depths[block.get()])
+					return false;
+				for (size_t i = 0; i < block->phis.size(); i++)
+				{
+					block->phis[i]->args.push_back(
+					    (i < nslots) ? state.slots[i]
+					                 : state.stack[i - nslots]);
+				}
+			}
+		}
+		return true;
+	}
+
+	bool run(Block *block, State &state)
+	{
+		auto &stack = state.stack;
+		for (auto index : block_ops[block])
+		{
+			auto &op = ops[index];
+			switch (op->code)
+			{
+				case OpCode::OP_LOAD_LOCAL:
+					stack.push_back(state.slots[as<LocalOp>(op).slot]);
+					continue;
+				case OpCode::OP_STORE_LOCAL:
+					if (stack.empty())
+						return false;
+					state.slots[as<LocalOp>(op).slot] = stack.back();
+					stack.pop_back();
+					continue;
+				case OpCode::OP_POP_TOP:
+					if (stack.empty())
+						return false;
+					stack.pop_back();
+					continue;
+				case OpCode::OP_JUMP:
+					continue;
+				default:
+					break;
+			}
+			size_t pops, pushes;
+			stack_effect(op, pops, pushes);
+			if (stack.size() < pops)
+				return false;
+			auto inst = fn->add_inst(Inst::OP, block);
+			inst->args.assign(stack.end() - pops, stack.end());
+			stack.resize(stack.size() - pops);
+			inst->has_value = (pushes != 0);
+			if (inst->has_value)
+				stack.push_back(inst);
+			if (is_branch(op->code))
+				label_of(op) = block->target->label;
+			block->insts.push_back(inst);
+			owners.emplace_back(inst, index);
+		}
+		// a function leaves nothing else on the stack when it returns
+		auto last = block_ops[block].empty()
+		                ? OpCode::OP_NOP
+		                : ops[block_ops[block].back()]->code;
+		if ((last == OpCode::OP_RETURN || last == OpCode::OP_TAIL_CALL) &&
+		    !stack.empty())
+		{
+			return false;
+		}
+		return true;
+	}
+};
+
+std::unique_ptr<Function> build_function(InstructionList &ops, size_t begin,
+                                         size_t end)
+{
+	Builder builder(ops, begin, end);
+	return builder.run();
+}
+
+//
+// Passes
+//
+
+size_t propagate_copies(Function &fn)
+{
+	size_t count = 0;
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+		for (auto &block : fn.blocks)
+		{
+			auto phis = block->phis;
+			for (auto phi : phis)
+			{
+				Inst *same = nullptr;
+				bool copy = true;
+				for (auto arg : phi->args)
+				{
+					arg = Function::find(arg);
+					if (arg == phi || arg == same)
+						continue;
+					if (same)
+					{
+						copy = false;
+						break;
+					}
+					same = arg;
+				}
+				if (!copy || !same)
+					continue;
+				fn.replace(phi, same);
+				erase(block->phis, phi);
+				count++;
+				changed = true;
+			}
+		}
+	}
+	fn.resolve();
+	return count;
+}
+
+// what an op with the same value would look like, its opcode, literal or
+// the block of a phi, and args
+static std::string value_key(const Inst &v)
+{
+	std::stringstream ss;
+	if (v.kind == Inst::PHI)
+	{
+		ss << "phi " << v.block->id;
+	}
+	else
+	{
+		ss << unsigned(v.op->code);
+		switch (v.op->code)
+		{
+			case OpCode::OP_PUSH_INT:
+				ss << " " << as<PushInt>(v.op).value;
+				break;
+			case OpCode::OP_PUSH_FLOAT:
+			{
+				Uint64 bits;
+				auto value = as<PushFloat>(v.op).value;
+				std::memcpy(&bits, &value, sizeof(bits));
+				ss << " " << bits;
+				break;
+			}
+			case OpCode::OP_PUSH_STRING:
+			{
+				auto &value = as<PushString>(v.op).value;
+				ss << " " << value.size() << ":" << value;
+				break;
+			}
+			case OpCode::OP_PUSH_CONST:
+				ss << " " << as<PushConst>(v.op).index;
+				break;
+			default:
+				break;
+		}
+	}
+	for (auto arg : v.args)
+		ss << " %" << Function::find(arg)->id;
+	return ss.str();
+}
+
+// Replaces the pure ops which have the same key as one before them by that
+// one, looking in the blocks which dominate their own if global is set and
+// in their own block otherwise.
+static size_t number(Function &fn, bool global)
+{
+	fn.resolve();
+	size_t count = 0;
+	std::unordered_map<std::string, Inst *> table;
+	std::vector<std::string> added;
+	auto visit = [&](Block *block) {
+		if (global)
+		{
+			auto phis = block->phis;
+			for (auto phi : phis)
+			{
+				auto key = value_key(*phi);
+				auto found = table.find(key);
+				if (found == table.end())
+				{
+					table.emplace(key, phi);
+					added.push_back(key);
+					continue;
+				}
+				fn.replace(phi, found->second);
+				erase(block->phis, phi);
+				count++;
+			}
+		}
+		auto insts = block->insts;
+		for (auto inst : insts)
+		{
+			if (!is_pure(inst->op->code))
+				continue;
+			auto key = value_key(*inst);
+			auto found = table.find(key);
+			if (found == table.end())
+			{
+				table.emplace(key, inst);
+				added.push_back(key);
+				continue;
+			}
+			fn.replace(inst, found->second);
+			erase(block->insts, inst);
+			count++;
+		}
+	};
+
+	if (!global)
+	{
+		for (auto &block : fn.blocks)
+		{
+			table.clear();
+			visit(block.get());
+		}
+		fn.resolve();
+		return count;
+	}
+
+	// walks down the dominator tree, forgetting the values of each block's
+	// ops once all of the blocks it dominates are done
+	fn.find_dominators();
+	std::vector<std::vector<Block *>> children(fn.blocks.size());
+	for (auto &block : fn.blocks)
+	{
+		if (block->idom)
+			children[block->idom->id].push_back(block.get());
+	}
+	std::vector<std::pair<Block *, bool>> work{{fn.blocks[0].get(), true}};
+	std::vector<size_t> marks;
+	while (!work.empty())
+	{
+		auto item = work.back();
+		work.pop_back();
+		if (!item.second)
+		{
+			while (added.size() > marks.back())
+			{
+				table.erase(added.back());
+				added.pop_back();
+			}
+			marks.pop_back();
+			continue;
+		}
+		marks.push_back(added.size());
+		work.push_back({item.first, false});
+		visit(item.first);
+		for (auto child : children[item.first->id])
+			work.push_back({child, true});
+	}
+	fn.resolve();
+	return count;
+}
+
+size_t eliminate_common_subexpressions(Function &fn)
+{
+	return number(fn, false);
+}
+
+size_t number_values(Function &fn)
+{
+	return number(fn, true);
+}
+
+// whether an op computes a number from numbers without throwing
+static bool keeps_numbers(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_ADD:
+		case OpCode::OP_SUB:
+		case OpCode::OP_MUL:
+		case OpCode::OP_POS:
+		case OpCode::OP_NEG:
+		case OpCode::OP_IP_PREINC:
+		case OpCode::OP_IP_PREDEC:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// The values which are always ints or floats, assuming they all are to
+// begin with and dropping those with an arg which might not be until
+// nothing changes, so that loops counting up still are.
+static std::unordered_set<Inst *> known_numbers(Function &fn)
+{
+	std::unordered_set<Inst *> numbers;
+	for (auto &block : fn.blocks)
+	{
+		for (auto phi : block->phis)
+			numbers.insert(phi);
+		for (auto inst : block->insts)
+		{
+			auto code = inst->op->code;
+			if (code == OpCode::OP_PUSH_INT || code == OpCode::OP_PUSH_FLOAT ||
+			    keeps_numbers(code))
+			{
+				numbers.insert(inst);
+			}
+		}
+	}
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+		for (auto it = numbers.begin(); it != numbers.end();)
+		{
+			auto v = *it;
+			bool number = true;
+			for (auto arg : v->args)
+				number = number && numbers.count(arg);
+			if (number)
+			{
+				++it;
+				continue;
+			}
+			it = numbers.erase(it);
+			changed = true;
+		}
+	}
+	return numbers;
+}
+
+// whether nothing misses a value which isn't used if it's not computed
+static bool removable(Inst *v, const std::unordered_set<Inst *> &numbers)
+{
+	if (v->kind == Inst::PHI)
+		return true;
+	auto code = v->op->code;
+	switch (code)
+	{
+		case OpCode::OP_LOAD_UPVALUE:
+		case OpCode::OP_LOG_AND:
+		case OpCode::OP_LOG_OR:
+		case OpCode::OP_LOG_NOT:
+			return true;
+		case OpCode::OP_EQ:
+		case OpCode::OP_NE:
+		case OpCode::OP_GT:
+		case OpCode::OP_GE:
+		case OpCode::OP_LT:
+		case OpCode::OP_LE:
+			break;
+		default:
+			if (is_literal(code))
+				return true;
+			if (!keeps_numbers(code))
+				return false;
+			break;
+	}
+	for (auto arg : v->args)
+	{
+		if (!numbers.count(arg))
+			return false;
+	}
+	return true;
+}
+
+size_t eliminate_dead_code(Function &fn)
+{
+	fn.resolve();
+	auto numbers = known_numbers(fn);
+	std::unordered_set<Inst *> live;
+	std::vector<Inst *> work;
+	auto use = [&](Inst *v) {
+		if (live.insert(v).second)
+			work.push_back(v);
+	};
+	for (auto &block : fn.blocks)
+	{
+		for (auto inst : block->insts)
+		{
+			if (!removable(inst, numbers))
+				use(inst);
+		}
+	}
+	while (!work.empty())
+	{
+		auto v = work.back();
+		work.pop_back();
+		for (auto arg : v->args)
+			use(arg);
+	}
+	size_t count = 0;
+	auto dead = [&](Inst *v) {
+		if (v->kind == Inst::PARAM || live.count(v))
+			return false;
+		count++;
+		return true;
+	};
+	for (auto &block : fn.blocks)
+	{
+		auto &phis = block->phis;
+		phis.erase(std::remove_if(phis.begin(), phis.end(), dead), phis.end());
+		auto &insts = block->insts;
+		insts.erase(std::remove_if(insts.begin(), insts.end(), dead),
+		            insts.end());
+	}
+	return count;
+}
+
+void PassManager::add(const std::string &name, Pass pass)
+{
+	passes.push_back({ name, pass, 0 });
+}
+
+void PassManager::run(Function &fn)
+{
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+		for (auto &entry : passes)
+		{
+			auto changes = entry.pass(fn);
+			entry.changes += changes;
+			changed = changed || (changes != 0);
+		}
+	}
+}
+
+void PassManager::report(std::ostream &out) const
+{
+	out << "ssa passes:\n";
+	for (auto &entry : passes)
+		out << format("%8zu  %s\n", entry.changes, entry.name.c_str());
+}
+
+PassManager PassManager::standard()
+{
+	PassManager passes;
+	passes.add("copy propagation", propagate_copies);
+	passes.add("common subexpression elimination",
+	           eliminate_common_subexpressions);
+	passes.add("global value numbering", number_values);
+	passes.add("dead code elimination", eliminate_dead_code);
+	return passes;
+}
+
+//
+// Lowering
+//
+
+class Lowering
+{
+public:
+	Lowering(Function &fn) : fn(fn)
+	{
+	}
+
+	InstructionList run()
+	{
+		fn.resolve();
+		count_uses();
+		for (auto &block : fn.blocks)
+			stackify(block.get());
+		find_slots();
+		live_ranges();
+		coalesce();
+		color();
+		emit();
+		return std::move(out);
+	}
+
+private:
+	Function &fn;
+	InstructionList out;
+	InstructionList tail; // the blocks made to split edges
+	std::unordered_map<Inst *, size_t> uses;
+	std::unordered_map<Inst *, Inst *> user;
+	std::unordered_set<Inst *> demoted;
+	std::unordered_map<Inst *, size_t> index; // of the values with a slot
+	std::vector<Inst *> slotted;
+	std::vector<std::unordered_set<size_t>> interferes;
+	std::vector<size_t> classes; // each value's representative
+	std::vector<std::vector<size_t>> members; // of each representative
+	std::vector<int> colors;     // of each representative, -1 if none yet
+	size_t nlabels = 0;
+
+	void count_uses()
+	{
+		for (auto &block : fn.blocks)
+		{
+			for (auto phi : block->phis)
+			{
+				for (auto arg : phi->args)
+				{
+					uses[arg]++;
+					user[arg] = phi;
+				}
+			}
+			for (auto inst : block->insts)
+			{
+				for (auto arg : inst->args)
+				{
+					uses[arg]++;
+					user[arg] = inst;
+				}
+			}
+		}
+	}
+
+	// whether a value stays on the stack for the op using it, which
+	// generates it as part of its own args
+	bool on_stack(Inst *v)
+	{
+		if (v->kind != Inst::OP || v->is_constant() || !v->has_value ||
+		    uses[v] != 1 || demoted.count(v))
+		{
+			return false;
+		}
+		auto by = user[v];
+		return (by->kind == Inst::OP && by->block == v->block);
+	}
+
+	void generated(Inst *inst, std::vector<Inst *> &order)
+	{
+		for (auto arg : inst->args)
+		{
+			if (on_stack(arg))
+				generated(arg, order);
+		}
+		order.push_back(inst);
+	}
+
+	// Leaves values on the stack only where generating each op with its
+	// args runs the ops in the same order as the block does, giving the
+	// others a slot until that's so.
+	void stackify(Block *block)
+	{
+		std::vector<Inst *> expected;
+		for (auto inst : block->insts)
+		{
+			if (!inst->is_constant())
+				expected.push_back(inst);
+		}
+		for (;;)
+		{
+			std::vector<Inst *> order;
+			for (auto inst : expected)
+			{
+				if (!on_stack(inst))
+					generated(inst, order);
+			}
+			auto differ =
+			    std::mismatch(expected.begin(), expected.end(), order.begin());
+			if (differ.first == expected.end())
+				break;
+			// the op which should come next was left for later, or one from
+			// later was brought forward
+			auto v = on_stack(*differ.first) ? *differ.first : *differ.second;
+			assert(on_stack(v));
+			demoted.insert(v);
+		}
+	}
+
+	bool has_slot(Inst *v)
+	{
+		return index.count(v) != 0;
+	}
+
+	void find_slots()
+	{
+		auto add = [&](Inst *v) {
+			if (uses[v] == 0 || has_slot(v))
+				return;
+			index[v] = slotted.size();
+			slotted.push_back(v);
+		};
+		for (auto param : fn.params)
+			add(param);
+		for (auto &block : fn.blocks)
+		{
+			for (auto phi : block->phis)
+				add(phi);
+			for (auto inst : block->insts)
+			{
+				if (inst->has_value && !inst->is_constant() && !on_stack(inst))
+					add(inst);
+			}
+		}
+		interferes.resize(slotted.size());
+	}
+
+	// the slot values the block's phis take from pred
+	void phi_uses(Block *block, Block *pred, std::set<size_t> &live)
+	{
+		auto i = block->pred_index(pred);
+		for (auto phi : block->phis)
+		{
+			auto arg = phi->args[i];
+			if (has_slot(phi) && has_slot(arg))
+				live.insert(index[arg]);
+		}
+	}
+
+	// Goes back through the block from what's live at its end, to what's
+	// live at its start, noting which values are live where each one gets
+	// its value if interfere is set.
+	std::set<size_t> live_in(Block *block, std::set<size_t> live,
+	                         bool interfere)
+	{
+		auto defined = [&](Inst *v) {
+			if (!has_slot(v))
+				return;
+			auto i = index[v];
+			live.erase(i);
+			if (!interfere)
+				return;
+			for (auto other : live)
+			{
+				interferes[i].insert(other);
+				interferes[other].insert(i);
+			}
+		};
+		for (auto it = block->insts.rbegin(); it != block->insts.rend(); ++it)
+		{
+			defined(*it);
+			for (auto arg : (*it)->args)
+			{
+				if (has_slot(arg))
+					live.insert(index[arg]);
+			}
+		}
+		// the phis all get their values at once
+		auto phis = block->phis;
+		if (block == fn.blocks[0].get())
+			phis = fn.params;
+		for (auto phi : phis)
+		{
+			if (has_slot(phi))
+				live.insert(index[phi]);
+		}
+		for (auto phi : phis)
+			defined(phi);
+		return live;
+	}
+
+	// Finds which values with a slot are live at once, counting the args
+	// of phis as live at the end of the blocks they come from and phis as
+	// live from the start of their block.
+	void live_ranges()
+	{
+		auto &blocks = fn.blocks;
+		std::vector<std::set<size_t>> ins(blocks.size()), outs(blocks.size());
+		auto live_out = [&](Block *block) {
+			std::set<size_t> live;
+			for (auto succ : block->succs())
+			{
+				for (auto i : ins[succ->id])
+				{
+					auto v = slotted[i];
+					if (v->kind != Inst::PHI || v->block != succ)
+						live.insert(i);
+				}
+				phi_uses(succ, block, live);
+			}
+			return live;
+		};
+		for (bool changed = true; changed;)
+		{
+			changed = false;
+			for (auto it = blocks.rbegin(); it != blocks.rend(); ++it)
+			{
+				auto block = it->get();
+				outs[block->id] = live_out(block);
+				auto live = live_in(block, outs[block->id], false);
+				if (live != ins[block->id])
+				{
+					ins[block->id] = std::move(live);
+					changed = true;
+				}
+			}
+		}
+		for (auto &block : blocks)
+			live_in(block.get(), outs[block->id], true);
+	}
+
+	size_t representative(size_t i)
+	{
+		while (classes[i] != i)
+			i = classes[i] = classes[classes[i]];
+		return i;
+	}
+
+	bool classes_interfere(size_t a, size_t b)
+	{
+		if (members[a].size() > members[b].size())
+			std::swap(a, b);
+		for (auto i : members[a])
+		{
+			for (auto other : interferes[i])
+			{
+				if (representative(other) == b)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// Gives each phi the same slot as its args where they're never live at
+	// the same time, so they need no stores.
+	void coalesce()
+	{
+		classes.resize(slotted.size());
+		members.resize(slotted.size());
+		colors.assign(slotted.size(), -1);
+		for (size_t i = 0; i < slotted.size(); i++)
+		{
+			classes[i] = i;
+			members[i].push_back(i);
+			if (slotted[i]->kind == Inst::PARAM)
+				colors[i] = slotted[i]->slot;
+		}
+		for (auto &block : fn.blocks)
+		{
+			for (auto phi : block->phis)
+			{
+				if (!has_slot(phi))
+					continue;
+				for (auto arg : phi->args)
+				{
+					if (!has_slot(arg))
+						continue;
+					auto a = representative(index[phi]);
+					auto b = representative(index[arg]);
+					if (a == b || (colors[a] >= 0 && colors[b] >= 0) ||
+					    classes_interfere(a, b))
+					{
+						continue;
+					}
+					classes[b] = a;
+					colors[a] = std::max(colors[a], colors[b]);
+					members[a].insert(members[a].end(), members[b].begin(),
+					                  members[b].end());
+					members[b].clear();
+				}
+			}
+		}
+	}
+
+	void color()
+	{
+		for (size_t i = 0; i < slotted.size(); i++)
+		{
+			auto a = representative(i);
+			if (colors[a] >= 0)
+				continue;
+			std::set<int> taken;
+			for (auto j : members[a])
+			{
+				for (auto other : interferes[j])
+					taken.insert(colors[representative(other)]);
+			}
+			int slot = 0;
+			while (taken.count(slot))
+				slot++;
+			colors[a] = slot;
+		}
+	}
+
+	Uint16 slot_of(Inst *v)
+	{
+		return Uint16(colors[representative(index[v])]);
+	}
+
+	std::string new_label()
+	{
+		return fn.name + "ssa_edge" + std::to_string(nlabels++) + "_";
+	}
+
+	void load(Inst *v, InstructionList &ops, Uint32 line)
+	{
+		if (v->is_constant())
+			ops.push_back(clone_literal(v->op, line));
+		else
+		{
+			ops.push_back(mkop<LocalOp>(OpCode::OP_LOAD_LOCAL, slot_of(v)));
+			ops.back()->line = line;
+		}
+	}
+
+	void generate(Inst *inst)
+	{
+		auto line = inst->op->line;
+		for (auto arg : inst->args)
+		{
+			if (on_stack(arg))
+				generate(arg);
+			else
+				load(arg, out, line);
+		}
+		out.push_back(std::move(inst->op));
+	}
+
+	// the stores giving the phis of block their values when control comes
+	// from pred, all of the values being pushed before any is stored so
+	// that none is overwritten before it's read
+	bool copies(Block *pred, Block *block, InstructionList &ops)
+	{
+		auto i = block->pred_index(pred);
+		std::vector<Inst *> phis;
+		for (auto phi : block->phis)
+		{
+			auto arg = phi->args[i];
+			if (has_slot(phi) &&
+			    !(has_slot(arg) && slot_of(arg) == slot_of(phi)))
+			{
+				load(arg, ops, 0);
+				phis.push_back(phi);
+			}
+		}
+		for (auto it = phis.rbegin(); it != phis.rend(); ++it)
+			ops.push_back(mkop<LocalOp>(OpCode::OP_STORE_LOCAL, slot_of(*it)));
+		return !phis.empty();
+	}
+
+	void emit()
+	{
+		Uint16 nslots = 0;
+		for (size_t i = 0; i < slotted.size(); i++)
+			nslots = std::max(nslots, Uint16(slot_of(slotted[i]) + 1));
+		for (auto param : fn.params)
+			nslots = std::max(nslots, Uint16(param->slot + 1));
+		for (auto &op : fn.prologue)
+		{
+			if (op->code == OpCode::OP_OPEN_SCOPE)
+				as<OpenScope>(op).nslots = nslots;
+			out.push_back(std::move(op));
+		}
+
+		auto &blocks = fn.blocks;
+		for (size_t i = 0; i < blocks.size(); i++)
+		{
+			auto block = blocks[i].get();
+			auto after =
+			    (i + 1 < blocks.size()) ? blocks[i + 1].get() : nullptr;
+			if (i > 0)
+				out.push_back(mkop<Label>(block->label));
+			Inst *last = nullptr;
+			if (!block->insts.empty() &&
+			    is_terminator(block->insts.back()->op->code))
+			{
+				last = block->insts.back();
+			}
+			for (auto inst : block->insts)
+			{
+				if (inst == last || inst->is_constant() || on_stack(inst))
+					continue;
+				auto line = inst->op->line;
+				generate(inst);
+				if (!inst->has_value)
+					continue;
+				if (has_slot(inst))
+					out.push_back(
+					    mkop<LocalOp>(OpCode::OP_STORE_LOCAL, slot_of(inst)));
+				else
+					out.push_back(mkop<PopTop>());
+				out.back()->line = line;
+			}
+
+			Block *to = block->target ? block->target : block->next;
+			if (last && is_branch(last->op->code))
+			{
+				// the stores for the jump go in a block of their own
+				InstructionList stores;
+				if (copies(block, block->target, stores))
+				{
+					auto label = new_label();
+					label_of(last->op) = label;
+					tail.push_back(mkop<Label>(label));
+					for (auto &op : stores)
+						tail.push_back(std::move(op));
+					tail.push_back(mkop<Jump>(block->target->label));
+				}
+				generate(last);
+				to = block->next;
+			}
+			else if (last)
+			{
+				generate(last);
+				continue;
+			}
+			copies(block, to, out);
+			if (to != after)
+				out.push_back(mkop<Jump>(to->label));
+		}
+		for (auto &op : tail)
+			out.push_back(std::move(op));
+	}
+};
+
+InstructionList lower_function(Function &fn)
+{
+	Lowering lowering(fn);
+	return lowering.run();
+}
+
+// namespace Ssa
+}
+
+typedef std::unordered_map<std::string, size_t> LabelIndex;
+
+// the index after the last op of the function starting at start, which
+// control can reach from its start
+static size_t function_end(InstructionList &ops, size_t start,
+                           const LabelIndex &labels)
+{
+	size_t last = start;
+	std::vector<bool> reached(ops.size());
+	std::vector<size_t> work{start};
+	while (!work.empty())
+	{
+		auto i = work.back();
+		work.pop_back();
+		if (i >= ops.size() || reached[i])
+			continue;
+		reached[i] = true;
+		last = std::max(last, i);
+		auto code = ops[i]->code;
+		if (code == OpCode::OP_RETURN || code == OpCode::OP_TAIL_CALL ||
+		    code == OpCode::OP_HALT)
+		{
+			continue;
+		}
+		if (code == OpCode::OP_JUMP || Ssa::is_branch(code))
+		{
+			auto found = labels.find(Ssa::label_of(ops[i]));
+			// anywhere before the start isn't part of it
+			if (found != labels.end() && found->second > start)
+				work.push_back(found->second);
+		}
+		if (code != OpCode::OP_JUMP)
+			work.push_back(i + 1);
+	}
+	return last + 1;
+}
+
+void optimize_ssa(InstructionList &ops, Ssa::PassManager &passes)
+{
+	LabelIndex labels;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		if (ops[i]->code == OpCode::OP_LABEL)
+			labels.emplace(static_cast<Label *>(ops[i].get())->name, i);
+	}
+	InstructionList rewritten;
+	for (size_t i = 0; i < ops.size();)
+	{
+		if (ops[i]->code == OpCode::OP_LABEL && i + 1 < ops.size() &&
+		    ops[i + 1]->code == OpCode::OP_OPEN_SCOPE)
+		{
+			auto end = function_end(ops, i, labels);
+			if (auto fn = Ssa::build_function(ops, i, end))
+			{
+				passes.run(*fn);
+				for (auto &op : Ssa::lower_function(*fn))
+					rewritten.push_back(std::move(op));
+				i = end;
+				continue;
+			}
+		}
+		rewritten.push_back(std::move(ops[i++]));
+	}
+	ops = std::move(rewritten);
+}
+
+// namespace Pop
+}
@@ -0,0 +1,179 @@
+// ssa.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_SSA_HPP
+#define POP_SSA_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/instructions.hpp>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Pop
+{
+
+namespace Ssa
+{
+
+struct Block;
+
+// An op of a function in SSA form. It pops the values in args, which are
+// in the order they were pushed, and it stands for the value it pushes, if
+// it has one. A PHI takes the value of args[i] when control comes from
+// preds[i] of its block, and a PARAM is an argument as the function gets
+// it, in the slot it was stored to.
+struct Inst
+{
+	enum Kind
+	{
+		OP,
+		PHI,
+		PARAM,
+	};
+
+	Kind kind;
+	size_t id;
+	InstructionPtr op; // what an OP runs, moved out when it's lowered
+	std::vector<Inst *> args;
+	Block *block; // null for PARAMs
+	Uint16 slot;  // of a PARAM
+	bool has_value;
+	Inst *replacement; // the value it stands for since it was removed
+
+	Inst(Kind kind, size_t id, Block *block)
+	    : kind(kind), id(id), block(block), slot(0), has_value(true),
+	      replacement(nullptr)
+	{
+	}
+
+	// whether it pushes a literal, which is pushed again wherever it's
+	// used rather than kept around
+	bool is_constant() const;
+};
+
+// A basic block, whose insts run one after the other, the last of which
+// may be a conditional jump, a RETURN or a TAIL_CALL. Control goes on to
+// the target of its jump, if it ends in one, and to next unless it always
+// jumps or returns.
+struct Block
+{
+	size_t id;
+	std::string label;
+	std::vector<Inst *> phis;
+	std::vector<Inst *> insts;
+	std::vector<Block *> preds;
+	Block *target;
+	Block *next;
+	Block *idom; // immediate dominator, null for the entry
+
+	Block(size_t id, const std::string &label)
+	    : id(id), label(label), target(nullptr), next(nullptr), idom(nullptr)
+	{
+	}
+
+	std::vector<Block *> succs() const;
+	// the index of pred in preds, which is where its phi args are
+	size_t pred_index(const Block *pred) const;
+};
+
+// The body of a function as a control flow graph in SSA form, with each
+// store to a local making a new value rather than changing a slot. The
+// first block is the entry, which runs nothing and falls through to the
+// first op after the prologue; the locals which aren't arguments start out
+// as null there.
+struct Function
+{
+	std::string name;
+	InstructionList prologue; // the label, OPEN_SCOPE and argument stores
+	std::vector<std::unique_ptr<Inst>> values;
+	std::vector<std::unique_ptr<Block>> blocks; // in the order of the ops
+	std::vector<Inst *> params;
+
+	Inst *add_inst(Inst::Kind kind, Block *block);
+	Block *add_block(const std::string &label);
+
+	// the value v stands for, following what it's been replaced by
+	static Inst *find(Inst *v);
+	// makes every use of v a use of with instead, leaving v in its block
+	void replace(Inst *v, Inst *with);
+	// resolves the args of the insts in the blocks to what they stand for
+	void resolve();
+	// finds the immediate dominator of each block
+	void find_dominators();
+	void list(std::ostream &out) const;
+};
+
+// Builds the function whose ops go from begin up to end in ops, starting
+// with the label, OPEN_SCOPE and argument stores transform() generates.
+// Returns null for a function whose locals aren't only its own, because it
+// makes closures which can reach them, or which does anything else the IR
+// can't express.
+std::unique_ptr<Function> build_function(InstructionList &ops, size_t begin,
+                                         size_t end);
+
+// Generates the ops of a function again. Values used once, right where
+// the stack has them, stay on the stack, literals are pushed again where
+// they're used and the rest get a slot, sharing slots where they're never
+// live at the same time. Phis get their values by stores at the end of the
+// blocks before them.
+InstructionList lower_function(Function &fn);
+
+// A pass over a function, returning how many values it replaced or removed
+typedef size_t (*Pass)(Function &fn);
+
+// replaces phis which only ever get one value by that value
+size_t propagate_copies(Function &fn);
+// replaces ops which compute what an op before them in their block already
+// has by that op's value
+size_t eliminate_common_subexpressions(Function &fn);
+// the same as eliminate_common_subexpressions(), looking for the earlier op
+// in all of the blocks which dominate the one it's in, and for phis in the
+// same block with the same args
+size_t number_values(Function &fn);
+// removes values nothing uses, which have no other effect and can't throw
+size_t eliminate_dead_code(Function &fn);
+
+// Runs passes in the order they were added, over and over until none of
+// them changes anything, counting how much each of them did.
+class PassManager
+{
+public:
+	void add(const std::string &name, Pass pass);
+	void run(Function &fn);
+	void report(std::ostream &out) const;
+
+	// copy propagation, common subexpression elimination, global value
+	// numbering and dead code elimination, in that order
+	static PassManager standard();
+
+private:
+	struct Entry
+	{
+		std::string name;
+		Pass pass;
+		size_t changes;
+	};
+	std::vector<Entry> passes;
+};
+
+// namespace Ssa
+}
+
+// Rewrites the body of each function in ops, laid out as transform() lays
+// them out, by building it in SSA form, running the passes over it and
+// lowering it again. The top-level code is left as it is since there's no
+// frame to keep values in there, as are functions build_function() can't
+// build.
+void optimize_ssa(InstructionList &ops, Ssa::PassManager &passes);
+
+// namespace Pop
+}
+
+#endif // POP_SSA_HPP
@@ -14,6 +14,7 @@
 #include <pop/instructions.hpp>
 #include <pop/opcodes.hpp>
 #include <cassert>
+#include <map>
 #include <stack>
 #include <vector>
 
@@ -21,17 +22,32 @@ namespace Pop
 {
 using namespace Ast;
 
+// Names are resolved while the code is generated. Each call to a function
+// gets one Env with a slot for every argument and let in its body, blocks
+// just reuse the function's slots, and names from enclosing functions are
+// reached by walking out that many Envs. Anything else, including every
+// let outside of a function, is a global looked up by name. Since this is a
+// single pass a local must be declared before it's used, otherwise the name
+// refers to a global.
+struct FunctionScope
+{
+	std::vector<std::map<std::string, Uint16>> blocks;
+	Uint16 nslots;
+	OpenScope *open_scope; // patched with nslots once the body is done
+};
+
 struct Transformer : public Visitor
 {
 	InstructionList decl_ops;
 	InstructionList code_ops;
-	std::vector<unsigned int> depth_stack;
+	unsigned int name_count; // of auto_name()s, so they're all unique
 	std::stack<InstructionList *> ops_stack;
 	std::stack<std::string> control_stack;
+	std::vector<FunctionScope> functions;
+	Uint32 line; // of the statement being generated
 
-	Transformer()
+	Transformer() : name_count(0), line(0)
 	{
-		depth_stack.emplace_back(0);
 		begin_code();
 	}
 
@@ -42,66 +58,109 @@ struct Transformer : public Visitor
 		for (auto &op : decl_ops)
 			combined.emplace_back(op.release());
 		combined.emplace_back(new Label("_pop_start_"));
-		combined.emplace_back(new OpenScope());
 		for (auto &op : code_ops)
 			combined.emplace_back(op.release());
-		combined.emplace_back(new CloseScope());
 		combined.emplace_back(new Halt());
 		return combined;
 	}
 
 	template <class T, class... Args>
-	void add_op(Args &&... args)
+	T *add_op(Args &&... args)
 	{
-		ops_stack.top()->emplace_back(new T(std::forward<Args>(args)...));
+		auto op = new T(std::forward<Args>(args)...);
+		op->line = line;
+		ops_stack.top()->emplace_back(op);
+		return op;
 	}
 
-	void enter()
+	void statement(Stmt &stmt)
 	{
-		depth_stack.emplace_back(0);
+		auto outer_line = line;
+		line = stmt.range.start.line;
+		stmt.accept(*this);
+		line = outer_line;
 	}
 
-	void leave()
+	void begin_code()
 	{
-		depth_stack.pop_back();
+		ops_stack.push(&code_ops);
 	}
 
-	void begin_decls()
+	void end_code()
 	{
-		ops_stack.push(&decl_ops);
+		assert(ops_stack.top() == &code_ops);
+		ops_stack.pop();
 	}
 
-	void end_decls()
+	// returns false for a global, which is bound by name instead
+	bool declare(const std::string &name, Uint16 &slot)
 	{
-		assert(ops_stack.top() == &decl_ops);
-		ops_stack.pop();
+		if (functions.empty())
+			return false;
+		auto &function = functions.back();
+		slot = function.nslots++;
+		function.blocks.back()[name] = slot;
+		return true;
 	}
 
-	void begin_code()
+	// the innermost declaration of the name, depth is how many functions
+	// out it was found, returns false if it's a global
+	bool resolve(const std::string &name, unsigned int &depth, Uint16 &slot)
 	{
-		ops_stack.push(&code_ops);
+		depth = 0;
+		for (auto fit = functions.rbegin(); fit != functions.rend(); ++fit)
+		{
+			for (auto bit = fit->blocks.rbegin(); bit != fit->blocks.rend();
+			     ++bit)
+			{
+				auto found = bit->find(name);
+				if (found != bit->end())
+				{
+					slot = found->second;
+					return true;
+				}
+			}
+			depth++;
+		}
+		return false;
 	}
 
-	void end_code()
+	void load(const std::string &name)
 	{
-		assert(ops_stack.top() == &code_ops);
-		ops_stack.pop();
+		unsigned int depth;
+		Uint16 slot;
+		if (!resolve(name, depth, slot))
+			add_op<LoadGlobal>(name);
+		else if (depth == 0)
+			add_op<LocalOp>(OpCode::OP_LOAD_LOCAL, slot);
+		else
+			add_op<UpvalueOp>(OpCode::OP_LOAD_UPVALUE, depth, slot);
+	}
+
+	// pops the value into the variable
+	void store(const std::string &name)
+	{
+		unsigned int depth;
+		Uint16 slot;
+		if (!resolve(name, depth, slot))
+			add_op<StoreGlobal>(name);
+		else if (depth == 0)
+			add_op<LocalOp>(OpCode::OP_STORE_LOCAL, slot);
+		else
+			add_op<UpvalueOp>(OpCode::OP_STORE_UPVALUE, depth, slot);
 	}
 
+	// numbered through the whole module rather than by nesting, which
+	// the constant folder changes by dropping whole statements
 	std::string auto_name()
 	{
-		std::string name("_pop_");
-		for (auto cnt : depth_stack)
-			name += std::to_string(cnt) + "_";
-		auto &cnt = depth_stack.back();
-		cnt++;
-		return name;
+		return "_pop_" + std::to_string(name_count++) + "_";
 	}
 
 	virtual void visit(Module &n)
 	{
 		for (auto &stmt : n.stmts)
-			stmt->accept(*this);
+			statement(*stmt);
 	}
 
 	virtual void visit(NullLiteral &)
@@ -134,7 +193,7 @@ struct Transformer : public Visitor
 
 	virtual void visit(Identifier &n)
 	{
-		add_op<PushSymbol>(n.name);
+		load(n.name);
 	}
 
 	virtual void visit(ListLiteral &n)
@@ -150,18 +209,31 @@ struct Transformer : public Visitor
 	virtual void visit(FunctionLiteral &n)
 	{
 		auto name = auto_name();
-		// the function definition code
-		enter();
-		begin_decls();
+		// the function definition code, generated separately so that the
+		// functions nested in it don't end up in the middle of it
+		InstructionList function_ops;
+		ops_stack.push(&function_ops);
+		functions.emplace_back();
+		functions.back().blocks.emplace_back();
+		functions.back().nslots = 0;
 		add_op<Label>(name);
-		add_op<OpenScope>();
+		functions.back().open_scope = add_op<OpenScope>(0);
+		// the arguments are pushed with the first one on top
 		for (auto &argument : n.arguments)
-			add_op<Bind>(argument);
+		{
+			Uint16 slot;
+			declare(argument, slot);
+			add_op<LocalOp>(OpCode::OP_STORE_LOCAL, slot);
+		}
 		for (auto &stmt : n.stmts)
-			stmt->accept(*this);
-		add_op<CloseScope>();
-		end_decls();
-		leave();
+			statement(*stmt);
+		add_op<PushNull>();
+		add_op<Return>();
+		functions.back().open_scope->nslots = functions.back().nslots;
+		functions.pop_back();
+		ops_stack.pop();
+		for (auto &op : function_ops)
+			decl_ops.emplace_back(op.release());
 		// the function expression code
 		add_op<PushFunction>(name);
 	}
@@ -170,18 +242,113 @@ struct Transformer : public Visitor
 	{
 	}
 
+	// Values are immutable so assigning operators on names compute the new
+	// value with the plain operator and store it back to the name.
+	static OpCode assign_op_code(OpCode code)
+	{
+		switch (code)
+		{
+			case OpCode::OP_IP_ADD:
+				return OpCode::OP_ADD;
+			case OpCode::OP_IP_SUB:
+				return OpCode::OP_SUB;
+			case OpCode::OP_IP_MUL:
+				return OpCode::OP_MUL;
+			case OpCode::OP_IP_DIV:
+				return OpCode::OP_DIV;
+			case OpCode::OP_IP_MOD:
+				return OpCode::OP_MOD;
+			case OpCode::OP_IP_POW:
+				return OpCode::OP_POW;
+			case OpCode::OP_IP_AND:
+				return OpCode::OP_BIT_AND;
+			case OpCode::OP_IP_OR:
+				return OpCode::OP_BIT_OR;
+			case OpCode::OP_IP_XOR:
+				return OpCode::OP_BIT_XOR;
+			case OpCode::OP_IP_LEFT:
+				return OpCode::OP_LEFT_SHIFT;
+			case OpCode::OP_IP_RIGHT:
+				return OpCode::OP_RIGHT_SHIFT;
+			default:
+				return code;
+		}
+	}
+
+	// Generates an assignment to a name, leaving its result on the stack
+	// only when it's used. Returns false if the expression isn't one.
+	bool assignment(Expr &expr, bool used)
+	{
+		if (expr.kind == NodeKind::UNARY_EXPR)
+		{
+			auto &n = static_cast<UnaryExpr &>(expr);
+			auto code = opcode_from_token(n.op);
+			if (n.operand->kind != NodeKind::IDENTIFIER ||
+			    (code != OpCode::OP_IP_PREINC &&
+			     code != OpCode::OP_IP_PREDEC &&
+			     code != OpCode::OP_IP_POSTINC &&
+			     code != OpCode::OP_IP_POSTDEC))
+			{
+				return false;
+			}
+			auto &name = static_cast<Identifier *>(n.operand.get())->name;
+			bool post = (code == OpCode::OP_IP_POSTINC ||
+			             code == OpCode::OP_IP_POSTDEC);
+			// post-increments leave the old value under the new one
+			load(name);
+			if (used && post)
+				load(name);
+			if (code == OpCode::OP_IP_PREINC || code == OpCode::OP_IP_POSTINC)
+				add_op<UnOp>(OpCode::OP_IP_PREINC);
+			else
+				add_op<UnOp>(OpCode::OP_IP_PREDEC);
+			store(name);
+			if (used && !post)
+				load(name);
+			return true;
+		}
+		if (expr.kind == NodeKind::BINARY_EXPR)
+		{
+			auto &n = static_cast<BinaryExpr &>(expr);
+			auto code = opcode_from_token(n.op);
+			auto op_code = assign_op_code(code);
+			if (n.left->kind != NodeKind::IDENTIFIER ||
+			    (code != OpCode::OP_IP_ASSIGN && op_code == code))
+			{
+				return false;
+			}
+			auto &name = static_cast<Identifier *>(n.left.get())->name;
+			n.right->accept(*this);
+			if (code != OpCode::OP_IP_ASSIGN)
+			{
+				load(name);
+				add_op<BinOp>(op_code);
+			}
+			store(name);
+			if (used)
+				load(name);
+			return true;
+		}
+		return false;
+	}
+
 	virtual void visit(UnaryExpr &n)
 	{
+		if (assignment(n, true))
+			return;
 		n.operand->accept(*this);
 		add_op<UnOp>(opcode_from_token(n.op));
 	}
 
 	virtual void visit(BinaryExpr &n)
 	{
+		if (assignment(n, true))
+			return;
+		auto code = opcode_from_token(n.op);
 		// reverse order
 		n.right->accept(*this);
 		n.left->accept(*this);
-		add_op<BinOp>(opcode_from_token(n.op));
+		add_op<BinOp>(code);
 	}
 
 	virtual void visit(SliceExpr &n)
@@ -216,6 +383,13 @@ struct Transformer : public Visitor
 	}
 
 	virtual void visit(CallExpr &n)
+	{
+		call(n, false);
+	}
+
+	// a call whose result is returned (in tail position) runs in the
+	// caller's frame, so recursing that way doesn't use up call frames
+	void call(CallExpr &n, bool tail)
 	{
 		// push args in reverse order
 		for (auto it = n.arguments.rbegin(); it != n.arguments.rend(); ++it)
@@ -228,11 +402,14 @@ struct Transformer : public Visitor
 		    static_cast<Identifier *>(n.callee.get())->name == "print")
 		{
 			add_op<Print>();
+			if (tail)
+				add_op<Return>();
 		}
 		else
 		{
 			n.callee->accept(*this);
-			add_op<Call>(n.arguments.size());
+			add_op<Call>(tail ? OpCode::OP_TAIL_CALL : OpCode::OP_CALL,
+			             n.arguments.size());
 		}
 	}
 
@@ -254,11 +431,24 @@ struct Transformer : public Visitor
 
 	virtual void visit(LetBinding &n)
 	{
+		// functions can refer to themselves, other values can refer to
+		// whatever the name meant before
+		Uint16 slot;
+		bool local = false;
+		bool recursive =
+		    (n.value && n.value->kind == NodeKind::FUNCTION_LITERAL);
+		if (recursive)
+			local = declare(n.name, slot);
 		if (n.value)
 			n.value->accept(*this);
 		else
 			add_op<PushNull>();
-		add_op<Bind>(n.name);
+		if (!recursive)
+			local = declare(n.name, slot);
+		if (local)
+			add_op<LocalOp>(OpCode::OP_STORE_LOCAL, slot);
+		else
+			add_op<Bind>(n.name);
 	}
 
 	virtual void visit(LabelDecl &n)
@@ -273,18 +463,20 @@ struct Transformer : public Visitor
 
 	virtual void visit(ExprStmt &n)
 	{
+		if (assignment(*n.expr, false))
+			return;
 		n.expr->accept(*this);
 		add_op<PopTop>();
 	}
 
 	virtual void visit(CompoundStmt &n)
 	{
-		enter();
-		// add_op<OpenScope>();
+		if (!functions.empty())
+			functions.back().blocks.emplace_back();
 		for (auto &stmt : n.stmts)
-			stmt->accept(*this);
-		// add_op<CloseScope>();
-		leave();
+			statement(*stmt);
+		if (!functions.empty())
+			functions.back().blocks.pop_back();
 	}
 
 	virtual void visit(BreakStmt &)
@@ -304,11 +496,16 @@ struct Transformer : public Visitor
 
 	virtual void visit(ReturnStmt &n)
 	{
+		if (n.expr && n.expr->kind == NodeKind::CALL_EXPR &&
+		    !functions.empty())
+		{
+			call(static_cast<CallExpr &>(*n.expr), true);
+			return;
+		}
 		if (n.expr)
 			n.expr->accept(*this);
 		else
 			add_op<PushNull>();
-		add_op<CloseScope>();
 		add_op<Return>();
 	}
 
@@ -317,11 +514,11 @@ struct Transformer : public Visitor
 		auto name = auto_name();
 		n.predicate->accept(*this);
 		add_op<JumpFalse>(name + "else_");
-		n.consequence->accept(*this);
+		statement(*n.consequence);
 		add_op<Jump>(name + "endif_");
 		add_op<Label>(name + "else_");
 		if (n.alternative)
-			n.alternative->accept(*this);
+			statement(*n.alternative);
 		add_op<Label>(name + "endif_");
 	}
 
@@ -330,11 +527,11 @@ struct Transformer : public Visitor
 		auto name = auto_name();
 		n.predicate->accept(*this);
 		add_op<JumpTrue>(name + "else_");
-		n.consequence->accept(*this);
+		statement(*n.consequence);
 		add_op<Jump>(name + "endif_");
 		add_op<Label>(name + "else_");
 		if (n.alternative)
-			n.alternative->accept(*this);
+			statement(*n.alternative);
 		add_op<Label>(name + "endif_");
 	}
 
@@ -343,7 +540,7 @@ struct Transformer : public Visitor
 		auto name = auto_name();
 		add_op<Label>(name + "begin_");
 		control_stack.push(name);
-		n.stmt->accept(*this);
+		statement(*n.stmt);
 		control_stack.pop();
 		n.expr->accept(*this);
 		add_op<JumpTrue>(name + "begin_");
@@ -355,7 +552,7 @@ struct Transformer : public Visitor
 		auto name = auto_name();
 		add_op<Label>(name + "begin_");
 		control_stack.push(name);
-		n.stmt->accept(*this);
+		statement(*n.stmt);
 		control_stack.pop();
 		n.expr->accept(*this);
 		add_op<JumpFalse>(name + "begin_");
@@ -368,8 +565,8 @@ struct Transformer : public Visitor
 		add_op<Label>(name + "begin_");
 		n.expr->accept(*this);
 		control_stack.push(name);
-		add_op<JumpTrue>(name + "end_");
-		n.stmt->accept(*this);
+		add_op<JumpFalse>(name + "end_");
+		statement(*n.stmt);
 		add_op<Jump>(name + "begin_");
 		control_stack.pop();
 		add_op<Label>(name + "end_");
@@ -381,8 +578,8 @@ struct Transformer : public Visitor
 		add_op<Label>(name + "begin_");
 		n.expr->accept(*this);
 		control_stack.push(name);
-		add_op<JumpFalse>(name + "end_");
-		n.stmt->accept(*this);
+		add_op<JumpTrue>(name + "end_");
+		statement(*n.stmt);
 		add_op<Jump>(name + "begin_");
 		control_stack.pop();
 		add_op<Label>(name + "end_");
@@ -10,6 +10,7 @@
 #include <pop/value.hpp>
 #include <cassert>
 #include <cmath>
+#include <functional>
 #include <iostream>
 #include <sstream>
 
@@ -48,812 +49,525 @@ const char *value_type_name(ValueType type)
 	return "Unknown";
 }
 
-bool Value::_equal_(const Value *right) const
+TValue TValue::make_int(Int64 value)
 {
-	if (type == ValueType::NUL && right->type == ValueType::NUL)
+	if (value >= SMALL_INT_MIN && value <= SMALL_INT_MAX)
+		return from_bits(TAG_INT | (Uint64(value) & PAYLOAD_MASK));
+	return TValue(new Int(value));
+}
+
+Int64 TValue::as_int() const
+{
+	if (is_small_int())
+		return small_int();
+	return static_cast<const Int *>(as_ptr())->value;
+}
+
+std::string TValue::_repr_() const
+{
+	switch (type())
 	{
-		return true;
+		case ValueType::NUL:
+			return "Null";
+		case ValueType::BOOL:
+			return as_bool() ? "True" : "False";
+		case ValueType::INT:
+			return std::to_string(as_int());
+		case ValueType::FLOAT:
+			return std::to_string(as_float());
+		default:
+			return as_ptr()->_repr_();
 	}
-	else if (type == ValueType::BOOL && right->type == ValueType::BOOL)
+}
+
+size_t TValue::_hash_() const
+{
+	switch (type())
 	{
-		return (static_cast<const Bool*>(this)->value ==
-				static_cast<const Bool*>(right)->value);
+		case ValueType::NUL:
+		case ValueType::BOOL:
+			return std::hash<Uint64>()(bits);
+		case ValueType::INT:
+			return std::hash<Int64>()(as_int());
+		case ValueType::FLOAT:
+			return std::hash<Float64>()(as_float());
+		default:
+			return as_ptr()->_hash_();
 	}
-	else if (type == ValueType::INT && right->type == ValueType::INT)
+}
+
+bool TValue::_not_() const
+{
+	switch (type())
 	{
-		return (static_cast<const Int*>(this)->value ==
-				static_cast<const Int*>(right)->value);
+		case ValueType::NUL:
+			return true;
+		case ValueType::BOOL:
+			return !as_bool();
+		case ValueType::INT:
+			return (as_int() == 0);
+		case ValueType::FLOAT:
+			return (as_float() == 0.0);
+		default:
+			return as_ptr()->_not_();
 	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
+}
+
+bool TValue::_equal_(TValue right) const
+{
+	auto ltype = type();
+	auto rtype = right.type();
+	if (ltype == ValueType::NUL && rtype == ValueType::NUL)
+	{
+		return true;
+	}
+	else if (ltype == ValueType::BOOL && rtype == ValueType::BOOL)
+	{
+		return (as_bool() == right.as_bool());
+	}
+	else if (ltype == ValueType::INT && rtype == ValueType::INT)
 	{
-		return (static_cast<const Int*>(this)->value ==
-				static_cast<const Float*>(right)->value);
+		return (as_int() == right.as_int());
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
+	else if ((ltype == ValueType::INT || ltype == ValueType::FLOAT) &&
+	         (rtype == ValueType::INT || rtype == ValueType::FLOAT))
 	{
-		return (static_cast<const Float*>(this)->value ==
-				static_cast<const Int*>(right)->value);
+		return (to_float() == right.to_float());
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
+	else if (ltype == ValueType::STRING && rtype == ValueType::STRING)
 	{
-		return (static_cast<const Float*>(this)->value ==
-				static_cast<const Float*>(right)->value);
+		return (static_cast<const String *>(as_ptr())->value ==
+		        static_cast<const String *>(right.as_ptr())->value);
 	}
-	else if (type == ValueType::STRING && right->type == ValueType::STRING)
+	else if (ltype == ValueType::SYMBOL && rtype == ValueType::SYMBOL)
 	{
-		return (static_cast<const String*>(this)->value ==
-				static_cast<const String*>(right)->value);
+		return is(right);
 	}
-	else if (type == ValueType::FUNC && right->type == ValueType::FUNC)
+	else if (ltype == ValueType::FUNC && rtype == ValueType::FUNC)
 	{
-		return (static_cast<const Function*>(this)->addr ==
-				static_cast<const Function*>(right)->addr);
+		return (static_cast<const Function *>(as_ptr())->addr ==
+		        static_cast<const Function *>(right.as_ptr())->addr);
 	}
-	else if (type == ValueType::OBJECT && right->type == ValueType::OBJECT)
+	else if (ltype == ValueType::OBJECT && rtype == ValueType::OBJECT)
 	{
-		return (static_cast<const void*>(this) == static_cast<const void*>(right));
+		return is(right);
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot test equality of types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
+		   << right.type_name() << "'";
 		throw RuntimeError(ss.str());
 	}
 	return false;
 }
 
-Value *Value::_add_(Value *right) const
+static void check_divisor(TValue right)
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
+	if (right.as_int() == 0)
+		throw RuntimeError("integer division by zero");
+}
+
+// Int powers by squaring, so overflow wraps like the other Int operators.
+// Negative exponents truncate towards zero as integer division does.
+static Int64 int_pow(Int64 base, Int64 exponent)
+{
+	if (exponent < 0)
 	{
-		return new Int(static_cast<const Int *>(this)->value +
-		               static_cast<const Int *>(right)->value);
+		if (base == 0)
+			throw RuntimeError("integer division by zero");
+		else if (base == 1)
+			return 1;
+		else if (base == -1)
+			return (exponent & 1) ? -1 : 1;
+		return 0;
 	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
+	Int64 result = 1;
+	while (exponent > 0)
 	{
-		return new Float(static_cast<const Int *>(this)->value +
-		                 static_cast<const Float *>(right)->value);
+		if (exponent & 1)
+			result = wrapping_mul(result, base);
+		base = wrapping_mul(base, base);
+		exponent >>= 1;
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
+	return result;
+}
+
+TValue TValue::_add_(TValue right) const
+{
+	if (is_int() && right.is_int())
 	{
-		return new Float(static_cast<const Float *>(this)->value +
-		                 static_cast<const Int *>(right)->value);
+		return make_int(wrapping_add(as_int(), right.as_int()));
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
+	else if (is_number() && right.is_number())
 	{
-		return new Float(static_cast<const Float *>(this)->value +
-		                 static_cast<const Float *>(right)->value);
+		return make_float(to_float() + right.to_float());
 	}
-	else if (type == ValueType::STRING && right->type == ValueType::STRING)
+	else if (type() == ValueType::STRING && right.type() == ValueType::STRING)
 	{
-		return new String(static_cast<const String *>(this)->value +
-		                  static_cast<const String *>(right)->value);
+		auto &lstr = static_cast<const String *>(as_ptr())->value;
+		auto &rstr = static_cast<const String *>(right.as_ptr())->value;
+		return TValue(new String(lstr + rstr));
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot add types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_sub_(Value *right) const
+TValue TValue::_sub_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		return new Int(static_cast<const Int *>(this)->value -
-		               static_cast<const Int *>(right)->value);
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
+	if (is_int() && right.is_int())
 	{
-		return new Float(static_cast<const Int *>(this)->value -
-		                 static_cast<const Float *>(right)->value);
+		return make_int(wrapping_sub(as_int(), right.as_int()));
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
+	else if (is_number() && right.is_number())
 	{
-		return new Float(static_cast<const Float *>(this)->value -
-		                 static_cast<const Int *>(right)->value);
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		return new Float(static_cast<const Float *>(this)->value -
-		                 static_cast<const Float *>(right)->value);
+		return make_float(to_float() - right.to_float());
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot subtract types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_mul_(Value *right) const
+TValue TValue::_mul_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
+	if (is_int() && right.is_int())
 	{
-		return new Int(static_cast<const Int *>(this)->value *
-		               static_cast<const Int *>(right)->value);
+		return make_int(wrapping_mul(as_int(), right.as_int()));
 	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
+	else if (is_number() && right.is_number())
 	{
-		return new Float(static_cast<const Int *>(this)->value *
-		                 static_cast<const Float *>(right)->value);
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
-	{
-		return new Float(static_cast<const Float *>(this)->value *
-		                 static_cast<const Int *>(right)->value);
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		return new Float(static_cast<const Float *>(this)->value *
-		                 static_cast<const Float *>(right)->value);
+		return make_float(to_float() * right.to_float());
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot multiply types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_div_(Value *right) const
+TValue TValue::_div_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		return new Int(static_cast<const Int *>(this)->value /
-		               static_cast<const Int *>(right)->value);
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
+	if (is_int() && right.is_int())
 	{
-		return new Float(static_cast<const Int *>(this)->value /
-		                 static_cast<const Float *>(right)->value);
+		check_divisor(right);
+		// INT64_MIN / -1 overflows, and traps on x86-64
+		if (right.as_int() == -1)
+			return make_int(wrapping_sub(0, as_int()));
+		return make_int(as_int() / right.as_int());
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
+	else if (is_number() && right.is_number())
 	{
-		return new Float(static_cast<const Float *>(this)->value /
-		                 static_cast<const Int *>(right)->value);
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		return new Float(static_cast<const Float *>(this)->value /
-		                 static_cast<const Float *>(right)->value);
+		return make_float(to_float() / right.to_float());
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot divide types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_mod_(Value *right) const
+TValue TValue::_mod_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		return new Int(static_cast<const Int *>(this)->value %
-		               static_cast<const Int *>(right)->value);
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
-	{
-		return new Float(std::fmod(static_cast<const Int *>(this)->value,
-		                           static_cast<const Float *>(right)->value));
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
+	if (is_int() && right.is_int())
 	{
-		return new Float(std::fmod(static_cast<const Float *>(this)->value,
-		                           static_cast<const Int *>(right)->value));
+		check_divisor(right);
+		if (right.as_int() == -1)
+			return make_int(0);
+		return make_int(as_int() % right.as_int());
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
+	else if (is_number() && right.is_number())
 	{
-		return new Float(std::fmod(static_cast<const Float *>(this)->value,
-		                           static_cast<const Float *>(right)->value));
+		return make_float(std::fmod(to_float(), right.to_float()));
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot modulo types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_pow_(Value *right) const
+TValue TValue::_pow_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		return new Int(std::pow(static_cast<const Int *>(this)->value,
-		                        static_cast<const Int *>(right)->value));
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
+	if (is_int() && right.is_int())
 	{
-		return new Float(std::pow(static_cast<const Int *>(this)->value,
-		                          static_cast<const Float *>(right)->value));
+		return make_int(int_pow(as_int(), right.as_int()));
 	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
+	else if (is_number() && right.is_number())
 	{
-		return new Float(std::pow(static_cast<const Float *>(this)->value,
-		                          static_cast<const Int *>(right)->value));
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		return new Float(std::pow(static_cast<const Float *>(this)->value,
-		                          static_cast<const Float *>(right)->value));
+		return make_float(std::pow(to_float(), right.to_float()));
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot raise type '" << type_name() << "' to power of type '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_pos_() const
+TValue TValue::_pos_() const
 {
-	if (type == ValueType::INT)
-		return new Int(+(static_cast<const Int *>(this)->value));
-	else if (type == ValueType::FLOAT)
-		return new Float(+(static_cast<const Float *>(this)->value));
+	if (is_number())
+		return *this;
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot make type '" << type_name() << "' positive";
-		new RuntimeError(ss.str());
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_neg_() const
+TValue TValue::_neg_() const
 {
-	if (type == ValueType::INT)
-		return new Int(-(static_cast<const Int *>(this)->value));
-	else if (type == ValueType::FLOAT)
-		return new Float(-(static_cast<const Float *>(this)->value));
+	if (is_int())
+		return make_int(wrapping_sub(0, as_int()));
+	else if (is_float())
+		return make_float(-as_float());
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot make type '" << type_name() << "' negative";
-		new RuntimeError(ss.str());
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_log_and_(Value *right) const
+TValue TValue::_log_and_(TValue right) const
 {
-	auto left_true = !this->_not_();
-	auto right_true = !right->_not_();
-	return new Bool(left_true && right_true);
+	auto left_true = !_not_();
+	auto right_true = !right._not_();
+	return make_bool(left_true && right_true);
 }
 
-Value *Value::_log_or_(Value *right) const
+TValue TValue::_log_or_(TValue right) const
 {
 	auto left_true = !_not_();
-	auto right_true = !right->_not_();
-	return new Bool(left_true || right_true);
+	auto right_true = !right._not_();
+	return make_bool(left_true || right_true);
 }
 
-Value *Value::_log_not_() const
+TValue TValue::_log_not_() const
 {
-	return new Bool(_not_());
+	return make_bool(_not_());
 }
 
-Value *Value::_bit_and_(Value *right) const
+TValue TValue::_bit_and_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
+	if (is_int() && right.is_int())
 	{
-		return new Int(static_cast<const Int *>(this)->value &
-		               static_cast<const Int *>(right)->value);
+		return make_int(as_int() & right.as_int());
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot perform bitwise-and on types '" << type_name()
-		   << "' and '" << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << "' and '" << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_bit_or_(Value *right) const
+TValue TValue::_bit_or_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
+	if (is_int() && right.is_int())
 	{
-		return new Int(static_cast<const Int *>(this)->value |
-		               static_cast<const Int *>(right)->value);
+		return make_int(as_int() | right.as_int());
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot perform bitwise-or on types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_bit_xor_(Value *right) const
+TValue TValue::_bit_xor_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
+	if (is_int() && right.is_int())
 	{
-		return new Int(static_cast<const Int *>(this)->value ^
-		               static_cast<const Int *>(right)->value);
+		return make_int(as_int() ^ right.as_int());
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot perform bitwise-xor on types '" << type_name()
-		   << "' and '" << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << "' and '" << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_bit_not_() const
+TValue TValue::_bit_not_() const
 {
-	if (type == ValueType::INT)
-		return new Int(~(static_cast<const Int *>(this)->value));
+	if (is_int())
+		return make_int(~as_int());
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot perform bitwise-not on type '" << type_name() << "'";
-		new RuntimeError(ss.str());
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_lshift_(Value *right) const
+TValue TValue::_lshift_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
+	if (is_int() && right.is_int())
 	{
-		return new Int(static_cast<const Int *>(this)->value
-		               << static_cast<const Int *>(right)->value);
+		return make_int(Int64(Uint64(as_int()) << (right.as_int() & 63)));
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot perform left-shift on types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_rshift_(Value *right) const
+TValue TValue::_rshift_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
+	if (is_int() && right.is_int())
 	{
-		return new Int(static_cast<const Int *>(this)->value >>
-		               static_cast<const Int *>(right)->value);
+		return make_int(as_int() >> (right.as_int() & 63));
 	}
 	else
 	{
 		std::stringstream ss;
 		ss << "cannot perform right-shift on types '" << type_name()
-		   << "' and '" << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
-}
-
-Value *Value::_ip_add_(Value *right)
-{
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value +=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Int *>(this)->value +=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
-	{
-		static_cast<Float *>(this)->value +=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Float *>(this)->value +=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::STRING && right->type == ValueType::STRING)
-	{
-		static_cast<String *>(this)->value +=
-		    static_cast<const String *>(right)->value;
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place add types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
-}
-
-Value *Value::_ip_sub_(Value *right)
-{
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value -=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Int *>(this)->value -=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
-	{
-		static_cast<Float *>(this)->value -=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Float *>(this)->value -=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place subtract types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
-}
-
-Value *Value::_ip_mul_(Value *right)
-{
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value *=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Int *>(this)->value *=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
-	{
-		static_cast<Float *>(this)->value *=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Float *>(this)->value *=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place multiply types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
-}
-
-Value *Value::_ip_div_(Value *right)
-{
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value /=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Int *>(this)->value /=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
-	{
-		static_cast<Float *>(this)->value /=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Float *>(this)->value /=
-		    static_cast<const Float *>(right)->value;
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place divide types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
-}
-
-Value *Value::_ip_mod_(Value *right)
-{
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value %=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Int *>(this)->value =
-		    std::fmod(static_cast<const Int *>(this)->value,
-		              static_cast<const Float *>(right)->value);
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
-	{
-		static_cast<Float *>(this)->value =
-		    std::fmod(static_cast<const Float *>(this)->value,
-		              static_cast<const Int *>(right)->value);
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Float *>(this)->value =
-		    std::fmod(static_cast<const Float *>(this)->value,
-		              static_cast<const Float *>(right)->value);
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place modulo types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
-}
-
-Value *Value::_ip_pow_(Value *right)
-{
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value =
-		    std::pow(static_cast<const Int *>(this)->value,
-		             static_cast<const Int *>(right)->value);
-		return this;
-	}
-	else if (type == ValueType::INT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Int *>(this)->value =
-		    std::pow(static_cast<const Int *>(this)->value,
-		             static_cast<const Float *>(right)->value);
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::INT)
-	{
-		static_cast<Float *>(this)->value =
-		    std::pow(static_cast<const Float *>(this)->value,
-		             static_cast<const Int *>(right)->value);
-		return this;
-	}
-	else if (type == ValueType::FLOAT && right->type == ValueType::FLOAT)
-	{
-		static_cast<Float *>(this)->value =
-		    std::pow(static_cast<const Float *>(this)->value,
-		             static_cast<const Float *>(right)->value);
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place raise type '" << type_name()
-		   << "' to power of type '" << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
-}
-
-Value *Value::_ip_and_(Value *right)
-{
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value &=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place bitwise-and types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		   << "' and '" << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_ip_or_(Value *right)
+TValue TValue::_preinc_() const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value |=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
+	if (is_int())
+		return make_int(wrapping_add(as_int(), 1));
+	else if (is_float())
+		return make_float(as_float() + 1);
 	else
 	{
 		std::stringstream ss;
-		ss << "cannot in-place bitwise-or types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		ss << "cannot increment type '" << type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_ip_xor_(Value *right)
+TValue TValue::_predec_() const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value ^=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
+	if (is_int())
+		return make_int(wrapping_sub(as_int(), 1));
+	else if (is_float())
+		return make_float(as_float() - 1);
 	else
 	{
 		std::stringstream ss;
-		ss << "cannot in-place bitwise-xor types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
+		ss << "cannot decrement type '" << type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return TValue();
 }
 
-Value *Value::_ip_lshift_(Value *right)
+TValue TValue::_eq_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value <<=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place left-shift types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
+	return make_bool(_equal_(right));
 }
 
-Value *Value::_ip_rshift_(Value *right)
+TValue TValue::_ne_(TValue right) const
 {
-	if (type == ValueType::INT && right->type == ValueType::INT)
-	{
-		static_cast<Int *>(this)->value >>=
-		    static_cast<const Int *>(right)->value;
-		return this;
-	}
-	else
-	{
-		std::stringstream ss;
-		ss << "cannot in-place right-shift types '" << type_name() << "' and '"
-		   << right->type_name() << "'";
-		new RuntimeError(ss.str());
-	}
-	return nullptr;
+	return make_bool(!_equal_(right));
 }
 
-Value *Value::_preinc_()
+// Applies the ordering cmp to two numbers or two strings
+template <class Compare>
+static bool compare_values(TValue left, TValue right, Compare cmp)
 {
-	if (type == ValueType::INT)
-		return new Int(++(static_cast<Int *>(this)->value));
-	else if (type == ValueType::FLOAT)
-		return new Float(++(static_cast<Float *>(this)->value));
-	else
+	if (left.is_int() && right.is_int())
 	{
-		std::stringstream ss;
-		ss << "cannot pre-increment type '" << type_name() << "'";
-		new RuntimeError(ss.str());
+		return cmp(left.as_int(), right.as_int());
 	}
-	return nullptr;
-}
-
-Value *Value::_predec_()
-{
-	if (type == ValueType::INT)
-		return new Int(--(static_cast<Int *>(this)->value));
-	else if (type == ValueType::FLOAT)
-		return new Float(--(static_cast<Float *>(this)->value));
-	else
+	else if (left.is_number() && right.is_number())
 	{
-		std::stringstream ss;
-		ss << "cannot pre-decrement type '" << type_name() << "'";
-		new RuntimeError(ss.str());
+		return cmp(left.to_float(), right.to_float());
 	}
-	return nullptr;
-}
-
-Value *Value::_postinc_()
-{
-	if (type == ValueType::INT)
-		return new Int((static_cast<Int *>(this)->value)++);
-	else if (type == ValueType::FLOAT)
-		return new Float((static_cast<Float *>(this)->value)++);
-	else
+	else if (left.type() == ValueType::STRING &&
+	         right.type() == ValueType::STRING)
 	{
-		std::stringstream ss;
-		ss << "cannot post-increment type '" << type_name() << "'";
-		new RuntimeError(ss.str());
+		return cmp(static_cast<const String *>(left.as_ptr())->value,
+		           static_cast<const String *>(right.as_ptr())->value);
 	}
-	return nullptr;
-}
-
-Value *Value::_postdec_()
-{
-	if (type == ValueType::INT)
-		return new Int((static_cast<Int *>(this)->value)--);
-	else if (type == ValueType::FLOAT)
-		return new Float((static_cast<Float *>(this)->value)--);
 	else
 	{
 		std::stringstream ss;
-		ss << "cannot post-decrement type '" << type_name() << "'";
-		new RuntimeError(ss.str());
+		ss << "cannot compare types '" << left.type_name() << "' and '"
+		   << right.type_name() << "'";
+		throw RuntimeError(ss.str());
 	}
-	return nullptr;
+	return false;
 }
 
-Value *Value::_eq_(const Value *right) const
+TValue TValue::_gt_(TValue right) const
 {
-	return new Bool(_equal_(right));
+	return make_bool(compare_values(*this, right, std::greater<>()));
 }
 
-Value *Value::_ne_(const Value *right) const
+TValue TValue::_ge_(TValue right) const
 {
-	return nullptr;
+	return make_bool(compare_values(*this, right, std::greater_equal<>()));
 }
 
-Value *Value::_gt_(const Value *right) const
+TValue TValue::_lt_(TValue right) const
 {
-	return nullptr;
+	return make_bool(compare_values(*this, right, std::less<>()));
 }
 
-Value *Value::_ge_(const Value *right) const
+TValue TValue::_le_(TValue right) const
 {
-	return nullptr;
+	return make_bool(compare_values(*this, right, std::less_equal<>()));
 }
 
-Value *Value::_lt_(const Value *right) const
+Symbol *SymbolTable::intern(const std::string &name)
 {
-	return nullptr;
+	auto found = symbols.find(name);
+	if (found != symbols.end())
+		return found->second;
+	auto symbol = new Symbol(name);
+	symbols.emplace(name, symbol);
+	return symbol;
 }
 
-Value *Value::_le_(const Value *right) const
+void SymbolTable::trace() const
 {
-	return nullptr;
+	for (auto &pair : symbols)
+		pair.second->trace();
 }
 
 // namespace Pop
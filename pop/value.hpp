@@ -12,10 +12,12 @@
 
 #include <pop/error.hpp>
 #include <pop/types.hpp>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace Pop
@@ -41,165 +43,305 @@ enum class ValueFlag : Uint8
 {
 	NONE = 0,
 	MARK = (1 << 0),
+	YOUNG = (1 << 1),      // lives in a Heap's nursery
+	REMEMBERED = (1 << 2), // old, in the remembered set of its Heap
 };
 
 const char *value_type_name(ValueType type);
 
-struct Value
+// Int arithmetic wraps around on overflow rather than being undefined
+inline Int64 wrapping_add(Int64 left, Int64 right)
 {
-	ValueType type;
-	ValueFlag flags;
-	Value(ValueType type, ValueFlag flags = ValueFlag::NONE)
-	    : type(type), flags(flags)
+	return Int64(Uint64(left) + Uint64(right));
+}
+
+inline Int64 wrapping_sub(Int64 left, Int64 right)
+{
+	return Int64(Uint64(left) - Uint64(right));
+}
+
+inline Int64 wrapping_mul(Int64 left, Int64 right)
+{
+	return Int64(Uint64(left) * Uint64(right));
+}
+
+class Heap;
+struct Value;
+
+// A 64-bit value word. Floats are stored as themselves and everything else
+// is packed into the payload of a NaN which no arithmetic produces: null,
+// bools and 48-bit ints are immediate, all other values (including larger
+// ints) are pointers to a heap Value.
+struct TValue
+{
+	static constexpr Uint64 TAG_MASK = 0xFFFF000000000000ull;
+	static constexpr Uint64 PAYLOAD_MASK = 0x0000FFFFFFFFFFFFull;
+	static constexpr Uint64 TAG_NULL = 0xFFF9000000000000ull;
+	static constexpr Uint64 TAG_BOOL = 0xFFFA000000000000ull;
+	static constexpr Uint64 TAG_INT = 0xFFFB000000000000ull;
+	static constexpr Uint64 TAG_PTR = 0xFFFC000000000000ull;
+	static constexpr Uint64 CANONICAL_NAN = 0x7FF8000000000000ull;
+	static constexpr Int64 SMALL_INT_MIN = -(Int64(1) << 47);
+	static constexpr Int64 SMALL_INT_MAX = (Int64(1) << 47) - 1;
+
+	Uint64 bits;
+
+	TValue() : bits(TAG_NULL)
 	{
 	}
-	virtual ~Value()
+	TValue(Value *ptr)
+	    : bits(ptr ? (TAG_PTR | reinterpret_cast<std::uintptr_t>(ptr))
+	               : TAG_NULL)
 	{
 	}
-	const char *type_name() const
+
+	static TValue make_bool(bool value)
 	{
-		return value_type_name(type);
+		return from_bits(TAG_BOOL | Uint64(value));
 	}
-	void set_mark()
+	static TValue make_int(Int64 value);
+	static TValue make_float(Float64 value)
 	{
-		flags = ValueFlag(Uint8(flags) | Uint8(ValueFlag::MARK));
+		Uint64 bits;
+		if (value != value)
+			bits = CANONICAL_NAN;
+		else
+			std::memcpy(&bits, &value, sizeof(bits));
+		return from_bits(bits);
 	}
-	void clear_mark()
+	static TValue from_bits(Uint64 bits)
 	{
-		flags = ValueFlag(Uint8(flags) & ~(Uint8(ValueFlag::MARK)));
+		TValue value;
+		value.bits = bits;
+		return value;
 	}
-	virtual void trace()
+
+	bool is_null() const
 	{
-		set_mark();
+		return bits == TAG_NULL;
 	}
-	virtual std::string _repr_() const = 0;
-	virtual size_t _hash_() const
+	bool is_bool() const
 	{
-		// identity
-		return std::hash<std::uintptr_t>()(
-		    reinterpret_cast<std::uintptr_t>(this));
+		return (bits & TAG_MASK) == TAG_BOOL;
+	}
+	bool is_small_int() const
+	{
+		return (bits & TAG_MASK) == TAG_INT;
+	}
+	bool is_float() const
+	{
+		return bits < TAG_NULL;
+	}
+	bool is_ptr() const
+	{
+		return (bits & TAG_MASK) == TAG_PTR;
+	}
+	bool is_int() const
+	{
+		return is_small_int() || (is_ptr() && type() == ValueType::INT);
+	}
+	bool is_symbol() const;
+	bool is_number() const
+	{
+		return is_float() || is_int();
 	}
-	virtual bool _equal_(const Value *right) const;
-	virtual bool _not_() const = 0;
-	Value *_add_(Value *right) const;
-	Value *_sub_(Value *right) const;
-	Value *_mul_(Value *right) const;
-	Value *_div_(Value *right) const;
-	Value *_mod_(Value *right) const;
-	Value *_pow_(Value *right) const;
-	Value *_pos_() const;
-	Value *_neg_() const;
-	Value *_log_and_(Value *right) const;
-	Value *_log_or_(Value *right) const;
-	Value *_log_not_() const;
-	Value *_bit_and_(Value *right) const;
-	Value *_bit_or_(Value *right) const;
-	Value *_bit_xor_(Value *right) const;
-	Value *_bit_not_() const;
-	Value *_lshift_(Value *right) const;
-	Value *_rshift_(Value *right) const;
-	Value *_ip_add_(Value *right);
-	Value *_ip_sub_(Value *right);
-	Value *_ip_mul_(Value *right);
-	Value *_ip_div_(Value *right);
-	Value *_ip_mod_(Value *right);
-	Value *_ip_pow_(Value *right);
-	Value *_ip_and_(Value *right);
-	Value *_ip_or_(Value *right);
-	Value *_ip_xor_(Value *right);
-	Value *_ip_lshift_(Value *right);
-	Value *_ip_rshift_(Value *right);
-	Value *_preinc_();
-	Value *_predec_();
-	Value *_postinc_();
-	Value *_postdec_();
-	Value *_eq_(const Value *right) const;
-	Value *_ne_(const Value *right) const;
-	Value *_gt_(const Value *right) const;
-	Value *_ge_(const Value *right) const;
-	Value *_lt_(const Value *right) const;
-	Value *_le_(const Value *right) const;
-};
 
-struct ValueHasher
-{
-	size_t operator()(const Value *value) const
+	bool as_bool() const
 	{
-		return value->_hash_();
+		return (bits & 1);
+	}
+	Int64 small_int() const
+	{
+		return Int64(bits << 16) >> 16;
+	}
+	Int64 as_int() const;
+	Float64 as_float() const
+	{
+		Float64 value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+	Value *as_ptr() const
+	{
+		return reinterpret_cast<Value *>(std::uintptr_t(bits & PAYLOAD_MASK));
+	}
+	// the number as a Float64, only for ints and floats
+	Float64 to_float() const
+	{
+		return is_float() ? as_float() : Float64(as_int());
 	}
-};
 
-struct ValueEqualer
-{
-	size_t operator()(const Value *left, const Value *right) const
+	ValueType type() const;
+	const char *type_name() const
 	{
-		auto result = left->_eq_(right);
-		if (result && !result->_not_())
-			return true;
-		return false;
+		return value_type_name(type());
 	}
+
+	// whether this is the very same value (same immediate or same object)
+	bool is(TValue other) const
+	{
+		return bits == other.bits;
+	}
+
+	bool is_young() const;
+	void trace() const;
+	std::string _repr_() const;
+	size_t _hash_() const;
+	bool _equal_(TValue right) const;
+	bool _not_() const;
+	TValue _add_(TValue right) const;
+	TValue _sub_(TValue right) const;
+	TValue _mul_(TValue right) const;
+	TValue _div_(TValue right) const;
+	TValue _mod_(TValue right) const;
+	TValue _pow_(TValue right) const;
+	TValue _pos_() const;
+	TValue _neg_() const;
+	TValue _log_and_(TValue right) const;
+	TValue _log_or_(TValue right) const;
+	TValue _log_not_() const;
+	TValue _bit_and_(TValue right) const;
+	TValue _bit_or_(TValue right) const;
+	TValue _bit_xor_(TValue right) const;
+	TValue _bit_not_() const;
+	TValue _lshift_(TValue right) const;
+	TValue _rshift_(TValue right) const;
+	TValue _preinc_() const;
+	TValue _predec_() const;
+	TValue _eq_(TValue right) const;
+	TValue _ne_(TValue right) const;
+	TValue _gt_(TValue right) const;
+	TValue _ge_(TValue right) const;
+	TValue _lt_(TValue right) const;
+	TValue _le_(TValue right) const;
 };
 
-typedef std::unordered_map<Value *, Value *, ValueHasher, ValueEqualer>
-    ValueMap;
-typedef std::vector<Value *> ValueList;
+static_assert(sizeof(TValue) == 8, "TValue must be a single 64-bit word");
 
-struct Null final : public Value
+// The base of all heap allocated values. Values created while a Heap is
+// current belong to it and are freed when it finds them unreachable. Young
+// ones live in the heap's nursery and are moved out with relocate() if they
+// survive a minor collection, so any store of a value into an existing one
+// has to go through write_barrier().
+struct Value
 {
-	Null() : Value(ValueType::NUL)
+	ValueType type;
+	ValueFlag flags;
+	Value(ValueType type, ValueFlag flags = ValueFlag::NONE);
+	Value(const Value &other);
+	virtual ~Value()
 	{
 	}
-	virtual std::string _repr_() const override final
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
+	const char *type_name() const
 	{
-		return "Null";
+		return value_type_name(type);
 	}
-	virtual bool _not_() const override final
+	void set_flag(ValueFlag flag)
 	{
-		return true;
+		flags = ValueFlag(Uint8(flags) | Uint8(flag));
 	}
-};
-
-struct Bool final : public Value
-{
-	bool value;
-	Bool(bool value = false) : Value(ValueType::BOOL), value(value)
+	void clear_flag(ValueFlag flag)
 	{
+		flags = ValueFlag(Uint8(flags) & ~(Uint8(flag)));
 	}
-	virtual std::string _repr_() const override final
+	bool has_flag(ValueFlag flag) const
 	{
-		return value ? "True" : "False";
+		return (Uint8(flags) & Uint8(flag));
 	}
-	virtual bool _not_() const override final
+	void set_mark()
 	{
-		return !value;
+		set_flag(ValueFlag::MARK);
 	}
-};
-
-struct Int final : public Value
-{
-	long long int value;
-	Int(long long int value = 0) : Value(ValueType::INT), value(value)
+	void clear_mark()
 	{
+		clear_flag(ValueFlag::MARK);
 	}
-	virtual std::string _repr_() const override final
+	bool is_marked() const
 	{
-		return std::to_string(value);
+		return has_flag(ValueFlag::MARK);
 	}
-	virtual size_t _hash_() const override final
+	bool is_young() const
 	{
-		return std::hash<long long int>()(value);
+		return has_flag(ValueFlag::YOUNG);
 	}
-	virtual bool _not_() const override final
+	// must be called before storing value anywhere inside this, so an old
+	// value referring to a young one is found by the next minor collection
+	void write_barrier(TValue value)
+	{
+		if (!has_flag(ValueFlag::YOUNG) && !has_flag(ValueFlag::REMEMBERED) &&
+		    value.is_young())
+			remember();
+	}
+	// marks this and everything reachable from it, values which can refer
+	// to others stop at ones already marked since there may be cycles
+	virtual void trace()
+	{
+		set_mark();
+	}
+	// updates every reference to a young value with Heap::forward()
+	virtual void scavenge(Heap &)
 	{
-		return (value == 0);
 	}
+	// moves this into a newly allocated value, leaving it to be destroyed
+	virtual Value *relocate() = 0;
+	virtual std::string _repr_() const = 0;
+	virtual size_t _hash_() const
+	{
+		// identity
+		return std::hash<std::uintptr_t>()(
+		    reinterpret_cast<std::uintptr_t>(this));
+	}
+	virtual bool _not_() const = 0;
+
+private:
+	void remember();
 };
 
-struct Float final : public Value
+inline ValueType TValue::type() const
 {
-	Float64 value;
-	Float(Float64 value = 0.0) : Value(ValueType::FLOAT), value(value)
+	if (is_float())
+		return ValueType::FLOAT;
+	switch (bits & TAG_MASK)
+	{
+		case TAG_NULL:
+			return ValueType::NUL;
+		case TAG_BOOL:
+			return ValueType::BOOL;
+		case TAG_INT:
+			return ValueType::INT;
+		default:
+			return as_ptr()->type;
+	}
+}
+
+inline bool TValue::is_young() const
+{
+	return is_ptr() && as_ptr()->is_young();
+}
+
+inline bool TValue::is_symbol() const
+{
+	return is_ptr() && as_ptr()->type == ValueType::SYMBOL;
+}
+
+inline void TValue::trace() const
+{
+	if (is_ptr())
+		as_ptr()->trace();
+}
+
+// An int too big to be stored in a TValue, see TValue::make_int()
+struct Int final : public Value
+{
+	Int64 value;
+	Int(Int64 value = 0) : Value(ValueType::INT), value(value)
+	{
+	}
+	virtual Value *relocate() override final
 	{
+		return new Int(std::move(*this));
 	}
 	virtual std::string _repr_() const override final
 	{
@@ -207,21 +349,26 @@ struct Float final : public Value
 	}
 	virtual size_t _hash_() const override final
 	{
-		return std::hash<Float64>()(value);
+		return std::hash<Int64>()(value);
 	}
 	virtual bool _not_() const override final
 	{
-		return (value == 0.0);
+		return (value == 0);
 	}
 };
 
+// Strings are immutable once created, so literals can be shared
 struct String final : public Value
 {
-	std::string value;
+	const std::string value;
 	String(const std::string &value = std::string())
 	    : Value(ValueType::STRING), value(value)
 	{
 	}
+	virtual Value *relocate() override final
+	{
+		return new String(std::move(*this));
+	}
 	virtual std::string _repr_() const override final
 	{
 		return "'" + value + "'";
@@ -236,12 +383,21 @@ struct String final : public Value
 	}
 };
 
+// A name, interned in a SymbolTable so there's only ever one Symbol for
+// each name and they can be compared by identity. The hash is worked out
+// once up front since they're mostly used as keys.
 struct Symbol final : public Value
 {
-	std::string name;
-	Symbol(const std::string &name = std::string())
-	    : Value(ValueType::SYMBOL), name(name)
+	const std::string name;
+	const size_t hash;
+	Symbol(const std::string &name)
+	    : Value(ValueType::SYMBOL), name(name),
+	      hash(std::hash<std::string>()(name))
+	{
+	}
+	virtual Value *relocate() override final
 	{
+		return new Symbol(std::move(*this));
 	}
 	virtual std::string _repr_() const override final
 	{
@@ -249,7 +405,7 @@ struct Symbol final : public Value
 	}
 	virtual size_t _hash_() const override final
 	{
-		return std::hash<std::string>()(name);
+		return hash;
 	}
 	virtual bool _not_() const override final
 	{
@@ -257,6 +413,47 @@ struct Symbol final : public Value
 	}
 };
 
+// The unique Symbol for each name. Symbols have to be interned while an
+// old generation Heap::Scope is current so they never move.
+class SymbolTable
+{
+public:
+	Symbol *intern(const std::string &name);
+	// marks every symbol as reachable, symbols are never freed
+	void trace() const;
+
+private:
+	std::unordered_map<std::string, Symbol *> symbols;
+};
+
+// Symbols are unique, so when one is involved it's only equal to itself
+// and its hash doesn't need a virtual call.
+struct ValueHasher
+{
+	size_t operator()(TValue value) const
+	{
+		if (value.is_symbol())
+			return static_cast<const Symbol *>(value.as_ptr())->hash;
+		return value._hash_();
+	}
+};
+
+struct ValueEqualer
+{
+	bool operator()(TValue left, TValue right) const
+	{
+		if (left.is(right))
+			return true;
+		if (left.is_symbol() || right.is_symbol())
+			return false;
+		return (left.type() == right.type() && left._equal_(right));
+	}
+};
+
+typedef std::unordered_map<TValue, TValue, ValueHasher, ValueEqualer>
+    ValueMap;
+typedef std::vector<TValue> ValueList;
+
 struct List final : public Value
 {
 	ValueList elements;
@@ -265,9 +462,16 @@ struct List final : public Value
 	}
 	virtual void trace() override final
 	{
+		if (is_marked())
+			return;
 		set_mark();
 		for (auto elem : elements)
-			elem->trace();
+			elem.trace();
+	}
+	virtual void scavenge(Heap &heap) override final;
+	virtual Value *relocate() override final
+	{
+		return new List(std::move(*this));
 	}
 	virtual std::string _repr_() const override final
 	{
@@ -275,7 +479,7 @@ struct List final : public Value
 		ss << "[";
 		for (size_t i = 0; i < elements.size(); i++)
 		{
-			ss << elements[i]->_repr_();
+			ss << elements[i]._repr_();
 			if (i < (elements.size() - 1))
 				ss << ", ";
 		}
@@ -287,8 +491,9 @@ struct List final : public Value
 	{
 		return elements.empty();
 	}
-	void append(Value *val)
+	void append(TValue val)
 	{
+		write_barrier(val);
 		elements.emplace_back(val);
 	}
 };
@@ -301,20 +506,27 @@ struct Dict final : public Value
 	}
 	virtual void trace() override final
 	{
+		if (is_marked())
+			return;
 		set_mark();
 		for (auto &pair : table)
 		{
-			pair.first->trace();
-			pair.second->trace();
+			pair.first.trace();
+			pair.second.trace();
 		}
 	}
+	virtual void scavenge(Heap &heap) override final;
+	virtual Value *relocate() override final
+	{
+		return new Dict(std::move(*this));
+	}
 	virtual std::string _repr_() const override final
 	{
 		std::stringstream ss;
 		ss << "{";
 		for (auto &pair : table)
 		{
-			ss << pair.first->_repr_() << ": " << pair.second->_repr_() << ",";
+			ss << pair.first._repr_() << ": " << pair.second._repr_() << ",";
 		}
 		ss << "}";
 		return ss.str();
@@ -324,59 +536,83 @@ struct Dict final : public Value
 	{
 		return table.empty();
 	}
-	void insert(Value *key, Value *value)
+	void insert(TValue key, TValue value)
 	{
+		write_barrier(key);
+		write_barrier(value);
 		table.emplace(key, value);
 	}
 };
 
 struct Slice final : public Value
 {
-	Value *start;
-	Value *stop;
-	Value *step;
-	Slice(Value *start, Value *stop, Value *step)
+	TValue start;
+	TValue stop;
+	TValue step;
+	Slice(TValue start, TValue stop, TValue step)
 	    : Value(ValueType::SLICE), start(start), stop(stop), step(step)
 	{
 	}
 	virtual void trace() override final
 	{
+		if (is_marked())
+			return;
 		set_mark();
-		if (start)
-			start->trace();
-		if (stop)
-			stop->trace();
-		if (step)
-			step->trace();
+		start.trace();
+		stop.trace();
+		step.trace();
+	}
+	virtual void scavenge(Heap &heap) override final;
+	virtual Value *relocate() override final
+	{
+		return new Slice(std::move(*this));
 	}
 	virtual std::string _repr_() const override final
 	{
 		std::stringstream ss;
-		ss << "<Slice start='" << start->_repr_() << "' stop='"
-		   << stop->_repr_() << "' step='" << step->_repr_() << "'>";
+		ss << "<Slice start='" << start._repr_() << "' stop='"
+		   << stop._repr_() << "' step='" << step._repr_() << "'>";
 		return ss.str();
 	}
 	virtual bool _not_() const override final
 	{
-		return (!start && !stop && !step);
+		return (start.is_null() && stop.is_null() && step.is_null());
 	}
 };
 
+// Function frames keep their locals in slots, which the compiler has
+// already resolved names to. The table is for the globals and anything
+// else that's looked up by name at runtime, keyed by interned Symbols.
 struct Env final : public Value
 {
 	Env *parent;
 	ValueMap table;
-	Env(Env *parent = nullptr) : Value(ValueType::ENV), parent(parent)
+	ValueList slots;
+	bool captured; // by a Function, so its slots can't be reused
+	Env(Env *parent = nullptr, size_t nslots = 0)
+	    : Value(ValueType::ENV), parent(parent), slots(nslots),
+	      captured(false)
 	{
 	}
 	virtual void trace() override final
 	{
+		if (is_marked())
+			return;
 		set_mark();
 		for (auto &pair : table)
 		{
-			pair.first->trace();
-			pair.second->trace();
+			pair.first.trace();
+			pair.second.trace();
 		}
+		for (auto slot : slots)
+			slot.trace();
+		if (parent)
+			parent->trace();
+	}
+	virtual void scavenge(Heap &heap) override final;
+	virtual Value *relocate() override final
+	{
+		return new Env(std::move(*this));
 	}
 	virtual std::string _repr_() const override final
 	{
@@ -388,35 +624,58 @@ struct Env final : public Value
 	{
 		return table.empty();
 	}
-	void define(Value *name, Value *value)
+	// the env the given number of frames out from this one
+	Env *outer(unsigned int depth)
 	{
-		table.emplace(name, value);
+		auto env = this;
+		while (depth--)
+			env = env->parent;
+		return env;
 	}
-	void define(const std::string &name, Value *value)
+	void set_slot(size_t slot, TValue value)
 	{
-		define(new Pop::String(name), value);
+		write_barrier(value);
+		slots[slot] = value;
 	}
-	Value *lookup(Value *key, bool search_parent = true)
+	// binds name to value, replacing any existing binding of it
+	void define(TValue name, TValue value)
+	{
+		write_barrier(name);
+		write_barrier(value);
+		auto result = table.emplace(name, value);
+		if (!result.second)
+			result.first->second = value;
+	}
+	// returns the slot the key is bound to, or nullptr if it isn't
+	TValue *lookup(TValue key, bool search_parent = true)
 	{
 		auto found = table.find(key);
 		if (found != table.end())
-			return found->second;
+			return &found->second;
 		if (search_parent && parent)
 			return parent->lookup(key, search_parent);
 		return nullptr;
 	}
-	Value *lookup(const std::string &key, bool search_parent = true)
+	// rebinds the nearest definition of key, returning false if there isn't
+	// one
+	bool assign(TValue key, TValue value)
 	{
-		return lookup(new Pop::String(key), search_parent);
+		for (auto env = this; env; env = env->parent)
+		{
+			auto found = env->table.find(key);
+			if (found != env->table.end())
+			{
+				env->write_barrier(value);
+				found->second = value;
+				return true;
+			}
+		}
+		return false;
 	}
-	bool is_defined(Value *key, bool search_parent = true)
+	bool is_defined(TValue key, bool search_parent = true)
 	{
 		return (lookup(key, search_parent) != nullptr);
 	}
-	bool is_defined(const std::string &key, bool search_parent = true)
-	{
-		return is_defined(new Pop::String(key), search_parent);
-	}
 };
 
 struct Object final : public Value
@@ -428,31 +687,34 @@ struct Object final : public Value
 	}
 	virtual void trace() override final
 	{
+		if (is_marked())
+			return;
 		set_mark();
 		for (auto &pair : members)
 		{
-			pair.first->trace();
-			pair.second->trace();
+			pair.first.trace();
+			pair.second.trace();
 		}
 		env->trace();
 	}
+	virtual void scavenge(Heap &heap) override final;
+	virtual Value *relocate() override final
+	{
+		return new Object(std::move(*this));
+	}
 	virtual std::string _repr_() const override final
 	{
 		std::stringstream ss;
 		ss << "<Object at='" << static_cast<const void *>(this) << "'>";
 		return ss.str();
 	}
-	Value *getattr(Value *name) const
+	const TValue *getattr(TValue name) const
 	{
 		auto found = members.find(name);
 		if (found != members.end())
-			return found->second;
+			return &found->second;
 		return nullptr;
 	}
-	Value *getattr(const std::string &name) const
-	{
-		return getattr(new Pop::String(name));
-	}
 	virtual bool _not_() const override final
 	{
 		return false; // TODO: _not_() should look in members for special
@@ -467,12 +729,21 @@ struct Function final : public Value
 	Function(CodeAddr addr, Env *env)
 	    : Value(ValueType::FUNC), addr(addr), env(env)
 	{
+		if (env)
+			env->captured = true;
 	}
 	virtual void trace() override final
 	{
+		if (is_marked())
+			return;
 		set_mark();
 		env->trace();
 	}
+	virtual void scavenge(Heap &heap) override final;
+	virtual Value *relocate() override final
+	{
+		return new Function(std::move(*this));
+	}
 	virtual std::string _repr_() const override final
 	{
 		std::stringstream ss;
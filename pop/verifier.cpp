@@ -0,0 +1,392 @@
+// verifier.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/error.hpp>
+#include <pop/verifier.hpp>
+#include <sstream>
+#include <vector>
+
+namespace Pop
+{
+
+static const CodeAddr TOP_LEVEL = CodeAddr(-1); // owner of the top-level code
+static const CodeAddr UNSEEN = CodeAddr(-2);    // owner of unreached ops
+static const Uint32 NO_SCOPE = Uint32(-1);      // parent of the globals
+
+void stack_effect(const DecodedOp &op, Uint32 &pops, Uint32 &pushes)
+{
+	pops = 0;
+	pushes = 0;
+	switch (op.code)
+	{
+		case OpCode::OP_HALT:
+		case OpCode::OP_NOP:
+		case OpCode::OP_OPEN_SCOPE:
+		case OpCode::OP_CLOSE_SCOPE:
+		case OpCode::OP_JUMP:
+		case OpCode::OP_RETURN:
+			break;
+		case OpCode::OP_LOAD_GLOBAL:
+		case OpCode::OP_LOAD_LOCAL:
+		case OpCode::OP_LOAD_UPVALUE:
+		case OpCode::OP_PUSH_NULL:
+		case OpCode::OP_PUSH_TRUE:
+		case OpCode::OP_PUSH_FALSE:
+		case OpCode::OP_PUSH_CONST:
+		case OpCode::OP_PUSH_FUNCTION:
+		case OpCode::OP_ADD_SYMBOL_INT:
+		case OpCode::OP_SUB_SYMBOL_INT:
+		case OpCode::OP_EQ_SYMBOL_INT:
+		case OpCode::OP_NE_SYMBOL_INT:
+		case OpCode::OP_GT_SYMBOL_INT:
+		case OpCode::OP_GE_SYMBOL_INT:
+		case OpCode::OP_LT_SYMBOL_INT:
+		case OpCode::OP_LE_SYMBOL_INT:
+		case OpCode::OP_ADD_LOCAL_INT:
+		case OpCode::OP_SUB_LOCAL_INT:
+		case OpCode::OP_EQ_LOCAL_INT:
+		case OpCode::OP_NE_LOCAL_INT:
+		case OpCode::OP_GT_LOCAL_INT:
+		case OpCode::OP_GE_LOCAL_INT:
+		case OpCode::OP_LT_LOCAL_INT:
+		case OpCode::OP_LE_LOCAL_INT:
+			pushes = 1;
+			break;
+		case OpCode::OP_BIND:
+		case OpCode::OP_STORE_GLOBAL:
+		case OpCode::OP_STORE_LOCAL:
+		case OpCode::OP_STORE_UPVALUE:
+		case OpCode::OP_JUMP_TRUE:
+		case OpCode::OP_JUMP_FALSE:
+		case OpCode::OP_POP_TOP:
+		case OpCode::OP_PRINT_POP:
+			pops = 1;
+			break;
+		case OpCode::OP_EQ_JUMP_FALSE:
+		case OpCode::OP_NE_JUMP_FALSE:
+		case OpCode::OP_GT_JUMP_FALSE:
+		case OpCode::OP_GE_JUMP_FALSE:
+		case OpCode::OP_LT_JUMP_FALSE:
+		case OpCode::OP_LE_JUMP_FALSE:
+		case OpCode::OP_EQ_JUMP_FALSE_INT_INT:
+		case OpCode::OP_NE_JUMP_FALSE_INT_INT:
+		case OpCode::OP_GT_JUMP_FALSE_INT_INT:
+		case OpCode::OP_GE_JUMP_FALSE_INT_INT:
+		case OpCode::OP_LT_JUMP_FALSE_INT_INT:
+		case OpCode::OP_LE_JUMP_FALSE_INT_INT:
+		case OpCode::OP_EQ_JUMP_FALSE_FLOAT_FLOAT:
+		case OpCode::OP_NE_JUMP_FALSE_FLOAT_FLOAT:
+		case OpCode::OP_GT_JUMP_FALSE_FLOAT_FLOAT:
+		case OpCode::OP_GE_JUMP_FALSE_FLOAT_FLOAT:
+		case OpCode::OP_LT_JUMP_FALSE_FLOAT_FLOAT:
+		case OpCode::OP_LE_JUMP_FALSE_FLOAT_FLOAT:
+			pops = 2;
+			break;
+		case OpCode::OP_CALL:
+			pops = op.count + 1; // the arguments and the callee
+			pushes = 1;
+			break;
+		case OpCode::OP_CALL_SYMBOL:
+			pops = op.count;
+			pushes = 1;
+			break;
+		case OpCode::OP_PUSH_LIST:
+			pops = op.count;
+			pushes = 1;
+			break;
+		case OpCode::OP_PUSH_DICT:
+			pops = op.count * 2;
+			pushes = 1;
+			break;
+		case OpCode::OP_PUSH_SLICE:
+			pops = 3;
+			pushes = 1;
+			break;
+		case OpCode::OP_PRINT:
+		case OpCode::OP_POS:
+		case OpCode::OP_NEG:
+		case OpCode::OP_LOG_NOT:
+		case OpCode::OP_BIT_NOT:
+		case OpCode::OP_IP_PREINC:
+		case OpCode::OP_IP_PREDEC:
+		case OpCode::OP_IP_POSTINC:
+		case OpCode::OP_IP_POSTDEC:
+			pops = 1;
+			pushes = 1;
+			break;
+		default: // the binary operators
+			pops = 2;
+			pushes = 1;
+			break;
+	}
+}
+
+static bool is_jump(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_JUMP:
+		case OpCode::OP_JUMP_TRUE:
+		case OpCode::OP_JUMP_FALSE:
+		case OpCode::OP_EQ_JUMP_FALSE:
+		case OpCode::OP_NE_JUMP_FALSE:
+		case OpCode::OP_GT_JUMP_FALSE:
+		case OpCode::OP_GE_JUMP_FALSE:
+		case OpCode::OP_LT_JUMP_FALSE:
+		case OpCode::OP_LE_JUMP_FALSE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_local(OpCode code)
+{
+	switch (code)
+	{
+		case OpCode::OP_LOAD_LOCAL:
+		case OpCode::OP_STORE_LOCAL:
+		case OpCode::OP_ADD_LOCAL_INT:
+		case OpCode::OP_SUB_LOCAL_INT:
+		case OpCode::OP_EQ_LOCAL_INT:
+		case OpCode::OP_NE_LOCAL_INT:
+		case OpCode::OP_GT_LOCAL_INT:
+		case OpCode::OP_GE_LOCAL_INT:
+		case OpCode::OP_LT_LOCAL_INT:
+		case OpCode::OP_LE_LOCAL_INT:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// an Env the code runs in, from an OPEN_SCOPE or the globals
+struct Scope
+{
+	Uint32 parent; // index into Verifier::scopes
+	Uint16 nslots;
+};
+
+struct Verifier
+{
+	Program &program;
+	DecodedOpList &ops;
+	std::vector<CodeAddr> owners; // the function entry each op is part of
+	std::vector<Uint32> depths;   // the stack depth each op runs at
+	std::vector<Uint32> op_scopes; // the innermost scope each op runs in
+	std::vector<Scope> scopes;
+	std::vector<CodeAddr> entries;
+	std::vector<Uint32> entry_scopes; // where each entry's function is made
+	std::vector<CodeAddr> work;
+
+	Verifier(Program &program)
+	    : program(program), ops(program.ops), owners(ops.size(), UNSEEN),
+	      depths(ops.size(), 0), op_scopes(ops.size(), 0)
+	{
+		// the top-level code runs in the globals, which have no slots
+		scopes.push_back(Scope{ NO_SCOPE, 0 });
+	}
+
+	[[noreturn]] void fail(CodeAddr index, const std::string &what)
+	{
+		std::stringstream ss;
+		ss << "invalid bytecode, " << what << " at '"
+		   << opcode_name(ops[index].code) << "' (instruction " << index;
+		auto line = program.line_of(index);
+		if (line != 0)
+			ss << ", line " << line;
+		ss << ")";
+		throw RuntimeError(ss.str());
+	}
+
+	// whether two scopes have the same number of slots all the way out,
+	// even if they were opened by different ops
+	bool same_scopes(Uint32 a, Uint32 b) const
+	{
+		while (a != b)
+		{
+			if (a == NO_SCOPE || b == NO_SCOPE ||
+			    scopes[a].nslots != scopes[b].nslots)
+				return false;
+			a = scopes[a].parent;
+			b = scopes[b].parent;
+		}
+		return true;
+	}
+
+	// the scope the given number of Env::outer() steps out, failing if
+	// that's past the globals
+	Uint32 outer(CodeAddr index, Uint32 scope, unsigned int depth)
+	{
+		while (depth--)
+		{
+			scope = scopes[scope].parent;
+			if (scope == NO_SCOPE)
+				fail(index, "upvalue outside of the open scopes");
+		}
+		return scope;
+	}
+
+	void check_slot(CodeAddr index, Uint32 scope)
+	{
+		if (ops[index].slot >= scopes[scope].nslots)
+		{
+			std::stringstream ss;
+			ss << "slot " << ops[index].slot << " out of range for a scope of "
+			   << scopes[scope].nslots;
+			fail(index, ss.str());
+		}
+	}
+
+	void reach(CodeAddr from, CodeAddr index, CodeAddr owner, Uint32 depth,
+	           Uint32 scope)
+	{
+		if (owners[index] == UNSEEN)
+		{
+			owners[index] = owner;
+			depths[index] = depth;
+			op_scopes[index] = scope;
+			work.push_back(index);
+		}
+		else if (owners[index] != owner)
+		{
+			fail(from, "control passes into another function");
+		}
+		else if (depths[index] != depth)
+		{
+			std::stringstream ss;
+			ss << "stack depth " << depth << " differs from "
+			   << depths[index] << " where control flow meets";
+			fail(from, ss.str());
+		}
+		else if (!same_scopes(op_scopes[index], scope))
+		{
+			fail(from, "open scopes differ where control flow meets");
+		}
+	}
+
+	// visits the ops reachable from the start, returning the deepest the
+	// stack gets
+	Uint32 walk(CodeAddr start, CodeAddr owner, Uint32 depth, Uint32 scope)
+	{
+		Uint32 max_depth = depth;
+		reach(start, start, owner, depth, scope);
+		while (!work.empty())
+		{
+			auto index = work.back();
+			work.pop_back();
+			auto &op = ops[index];
+			auto depth = depths[index];
+			auto scope = op_scopes[index];
+
+			// the VM indexes slots and walks out through scopes unchecked
+			if (op.code == OpCode::OP_OPEN_SCOPE)
+			{
+				scopes.push_back(Scope{ scope, op.slot });
+				scope = Uint32(scopes.size() - 1);
+			}
+			else if (op.code == OpCode::OP_CLOSE_SCOPE)
+			{
+				if (scopes[scope].parent == NO_SCOPE)
+					fail(index, "no scope open to close");
+				scope = scopes[scope].parent;
+			}
+			else if (is_local(op.code))
+			{
+				check_slot(index, scope);
+			}
+			else if (op.code == OpCode::OP_LOAD_UPVALUE ||
+			         op.code == OpCode::OP_STORE_UPVALUE)
+			{
+				check_slot(index, outer(index, scope, op.depth));
+			}
+
+			if (op.code == OpCode::OP_HALT)
+				continue;
+			if (op.code == OpCode::OP_RETURN)
+			{
+				if (owner == TOP_LEVEL)
+					fail(index, "return outside of a function");
+				if (depth != 1)
+					fail(index, "return without exactly one value");
+				continue;
+			}
+			// the callee takes over the frame, so nothing else can be left
+			// on the stack for it
+			if (op.code == OpCode::OP_TAIL_CALL ||
+			    op.code == OpCode::OP_TAIL_CALL_SYMBOL)
+			{
+				if (owner == TOP_LEVEL)
+					fail(index, "tail call outside of a function");
+				auto args = op.count;
+				if (op.code == OpCode::OP_TAIL_CALL)
+					args++; // and the callee
+				if (depth != args)
+					fail(index, "tail call with values left on the stack");
+				continue;
+			}
+
+			Uint32 pops, pushes;
+			stack_effect(op, pops, pushes);
+			if (pops > depth)
+				fail(index, "stack underflow");
+			depth = depth - pops + pushes;
+			if (depth > max_depth)
+				max_depth = depth;
+
+			// the function's Env is made inside the one it's pushed in
+			if (op.code == OpCode::OP_PUSH_FUNCTION)
+			{
+				entries.push_back(op.target);
+				entry_scopes.push_back(scope);
+			}
+			if (is_jump(op.code))
+				reach(index, op.target, owner, depth, scope);
+			// the loader ends the ops with a HALT, so there's always a next
+			if (op.code != OpCode::OP_JUMP)
+				reach(index, index + 1, owner, depth, scope);
+		}
+		return max_depth;
+	}
+
+	void run()
+	{
+		program.max_stack = walk(0, TOP_LEVEL, 0, 0);
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			auto entry = entries[i];
+			if (owners[entry] == entry)
+			{
+				// already verified, but only for the scopes it was made in
+				if (!same_scopes(op_scopes[entry], entry_scopes[i]))
+					fail(entry, "function is made in different scopes");
+				continue;
+			}
+			if (owners[entry] != UNSEEN)
+				fail(entry, "function entry is also reached as code");
+			if (ops[entry].code != OpCode::OP_OPEN_SCOPE)
+				fail(entry, "function doesn't start with 'OPEN_SCOPE'");
+			Uint32 nparams = 0;
+			while (entry + 1 + nparams < ops.size() &&
+			       ops[entry + 1 + nparams].code == OpCode::OP_STORE_LOCAL)
+				nparams++;
+			ops[entry].count = nparams;
+			ops[entry].max_stack =
+			    walk(entry, entry, nparams, entry_scopes[i]);
+		}
+	}
+};
+
+void verify(Program &program)
+{
+	Verifier(program).run();
+}
+
+// namespace Pop
+}
@@ -0,0 +1,52 @@
+// verifier.hpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifndef POP_VERIFIER_HPP
+#define POP_VERIFIER_HPP
+
+#if !defined(POP_COMPILING) && !defined(POP_HPP_INCLUDED)
+#error "Invalid individual include, include only the <pop/pop.hpp> header"
+#endif
+
+#include <pop/program.hpp>
+
+namespace Pop
+{
+
+// Checks that a loaded program's stack and scope use is consistent, so the
+// VM can run it without checking for underflow or for slots which aren't
+// there. Starting from the top-level code, which runs in the globals (an
+// Env without slots), and from every function PUSH_FUNCTION refers to,
+// which runs inside the scopes it's pushed in, each reachable op is given
+// the stack depth and scopes it runs in, and it's an error if:
+//
+//   - an op pops more values than its function has pushed
+//   - paths that meet at an op get there with different depths
+//   - code is reachable from more than one function
+//   - a function doesn't start with OPEN_SCOPE
+//   - a RETURN doesn't leave exactly the return value, or is top-level
+//   - a *_LOCAL* or *_UPVALUE slot is past the end of its scope, an
+//     *_UPVALUE's depth is past the globals, or a CLOSE_SCOPE has no
+//     scope to close
+//   - paths that meet at an op get there with different scopes open, or
+//     a function is made in different scopes
+//
+// A function's parameters are the STORE_LOCALs right after its
+// OPEN_SCOPE, which pop the arguments its caller pushed. Their number is
+// stored in the OPEN_SCOPE's count, for calls to be checked against, and
+// the most values the function has on the stack at once in its
+// max_stack, along with the program's for its top-level code.
+//
+// Throws a RuntimeError describing the first problem found.
+void verify(Program &program);
+
+// how many values the op pops and then pushes, for the quickened forms of
+// ops too
+void stack_effect(const DecodedOp &op, Uint32 &pops, Uint32 &pushes);
+
+// namespace Pop
+}
+
+#endif // POP_VERIFIER_HPP
@@ -44,6 +44,7 @@ size_t VMTrace::ind_level = 0;
 
 #define VM_TRACE_ENTER(op)                        \
 	{                                             \
+		ip = CodeAddr(pc - base);                 \
 		VMTrace _trace_##__COUNTER__##_(#op, ip); \
 		{
 
@@ -56,273 +57,956 @@ size_t VMTrace::ind_level = 0;
 #define VM_TRACE_LEAVE() }
 #endif
 
+// Use GCC/Clang labels-as-values for the dispatch loop unless configure
+// was told to stick with the portable switch (--disable-computed-goto).
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(POP_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+// Every opcode which has a handler in VM::execute()
+#define VM_OPCODE_LIST(X)        \
+	X(HALT)                      \
+	X(NOP)                       \
+	X(PRINT)                     \
+	X(OPEN_SCOPE)                \
+	X(CLOSE_SCOPE)               \
+	X(BIND)                      \
+	X(LOAD_GLOBAL)               \
+	X(STORE_GLOBAL)              \
+	X(LOAD_LOCAL)                \
+	X(STORE_LOCAL)               \
+	X(LOAD_UPVALUE)              \
+	X(STORE_UPVALUE)             \
+	X(CALL)                      \
+	X(RETURN)                    \
+	X(TAIL_CALL)                 \
+	X(JUMP)                      \
+	X(JUMP_TRUE)                 \
+	X(JUMP_FALSE)                \
+	X(POP_TOP)                   \
+	X(PUSH_NULL)                 \
+	X(PUSH_TRUE)                 \
+	X(PUSH_FALSE)                \
+	X(PUSH_CONST)                \
+	X(PUSH_LIST)                 \
+	X(PUSH_DICT)                 \
+	X(PUSH_SLICE)                \
+	X(PUSH_FUNCTION)             \
+	X(IP_ASSIGN)                 \
+	X(ADD)                       \
+	X(SUB)                       \
+	X(MUL)                       \
+	X(DIV)                       \
+	X(MOD)                       \
+	X(POW)                       \
+	X(POS)                       \
+	X(NEG)                       \
+	X(LOG_AND)                   \
+	X(LOG_OR)                    \
+	X(LOG_NOT)                   \
+	X(BIT_AND)                   \
+	X(BIT_OR)                    \
+	X(BIT_XOR)                   \
+	X(BIT_NOT)                   \
+	X(LEFT_SHIFT)                \
+	X(RIGHT_SHIFT)               \
+	X(IP_ADD)                    \
+	X(IP_SUB)                    \
+	X(IP_MUL)                    \
+	X(IP_DIV)                    \
+	X(IP_MOD)                    \
+	X(IP_POW)                    \
+	X(IP_AND)                    \
+	X(IP_OR)                     \
+	X(IP_XOR)                    \
+	X(IP_LEFT)                   \
+	X(IP_RIGHT)                  \
+	X(IP_PREINC)                 \
+	X(IP_PREDEC)                 \
+	X(IP_POSTINC)                \
+	X(IP_POSTDEC)                \
+	X(EQ)                        \
+	X(NE)                        \
+	X(GT)                        \
+	X(GE)                        \
+	X(LT)                        \
+	X(LE)                        \
+	X(ADD_SYMBOL_INT)            \
+	X(SUB_SYMBOL_INT)            \
+	X(EQ_SYMBOL_INT)             \
+	X(NE_SYMBOL_INT)             \
+	X(GT_SYMBOL_INT)             \
+	X(GE_SYMBOL_INT)             \
+	X(LT_SYMBOL_INT)             \
+	X(LE_SYMBOL_INT)             \
+	X(ADD_LOCAL_INT)             \
+	X(SUB_LOCAL_INT)             \
+	X(EQ_LOCAL_INT)              \
+	X(NE_LOCAL_INT)              \
+	X(GT_LOCAL_INT)              \
+	X(GE_LOCAL_INT)              \
+	X(LT_LOCAL_INT)              \
+	X(LE_LOCAL_INT)              \
+	X(EQ_JUMP_FALSE)             \
+	X(NE_JUMP_FALSE)             \
+	X(GT_JUMP_FALSE)             \
+	X(GE_JUMP_FALSE)             \
+	X(LT_JUMP_FALSE)             \
+	X(LE_JUMP_FALSE)             \
+	X(CALL_SYMBOL)               \
+	X(TAIL_CALL_SYMBOL)          \
+	X(PRINT_POP)                 \
+	X(ADD_INT_INT)               \
+	X(SUB_INT_INT)               \
+	X(MUL_INT_INT)               \
+	X(EQ_INT_INT)                \
+	X(NE_INT_INT)                \
+	X(GT_INT_INT)                \
+	X(GE_INT_INT)                \
+	X(LT_INT_INT)                \
+	X(LE_INT_INT)                \
+	X(EQ_JUMP_FALSE_INT_INT)     \
+	X(NE_JUMP_FALSE_INT_INT)     \
+	X(GT_JUMP_FALSE_INT_INT)     \
+	X(GE_JUMP_FALSE_INT_INT)     \
+	X(LT_JUMP_FALSE_INT_INT)     \
+	X(LE_JUMP_FALSE_INT_INT)     \
+	X(ADD_FLOAT_FLOAT)           \
+	X(SUB_FLOAT_FLOAT)           \
+	X(MUL_FLOAT_FLOAT)           \
+	X(EQ_FLOAT_FLOAT)            \
+	X(NE_FLOAT_FLOAT)            \
+	X(GT_FLOAT_FLOAT)            \
+	X(GE_FLOAT_FLOAT)            \
+	X(LT_FLOAT_FLOAT)            \
+	X(LE_FLOAT_FLOAT)            \
+	X(EQ_JUMP_FALSE_FLOAT_FLOAT) \
+	X(NE_JUMP_FALSE_FLOAT_FLOAT) \
+	X(GT_JUMP_FALSE_FLOAT_FLOAT) \
+	X(GE_JUMP_FALSE_FLOAT_FLOAT) \
+	X(LT_JUMP_FALSE_FLOAT_FLOAT) \
+	X(LE_JUMP_FALSE_FLOAT_FLOAT) \
+	X(ADD_STRING_STRING)         \
+	X(EQ_STRING_STRING)          \
+	X(NE_STRING_STRING)          \
+	X(GT_STRING_STRING)          \
+	X(GE_STRING_STRING)          \
+	X(LT_STRING_STRING)          \
+	X(LE_STRING_STRING)
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_CASE(op) op_##op:
+#define VM_DEFAULT() op_UNKNOWN:
+#define VM_DISPATCH() goto *pc->handler
+#define VM_DISPATCH_BEGIN() \
+	try                     \
+	{                       \
+		VM_DISPATCH();
+#define VM_DISPATCH_END() \
+	}                     \
+	VM_CATCH()
+#define VM_SET_HANDLER(op) (op)->handler = dispatch_table[Uint8((op)->code)]
+#else
+#define VM_CASE(op) case OpCode::OP_##op:
+#define VM_DEFAULT() default:
+#define VM_DISPATCH() continue
+#define VM_DISPATCH_BEGIN()   \
+	try                       \
+	{                         \
+		for (;;)              \
+		{                     \
+			switch (pc->code) \
+			{
+#define VM_DISPATCH_END() \
+	}                     \
+	}                     \
+	}                     \
+	VM_CATCH()
+#define VM_SET_HANDLER(op)
+#endif
+
+// Errors are rethrown with the source line of the op which raised them,
+// when the program knows it, and leave ip at that op.
+#define VM_CATCH()                                  \
+	catch (RuntimeError & e)                        \
+	{                                               \
+		stack.sp = sp;                              \
+		ip = CodeAddr(pc - base);                   \
+		auto line = program->line_of(ip);           \
+		if (line == 0)                              \
+			throw;                                  \
+		std::stringstream ss;                       \
+		ss << e.what() << " (line " << line << ")"; \
+		throw RuntimeError(ss.str());               \
+	}
+
+// Replaces the current op with another form of itself, the next dispatch
+// of it runs the new handler.
+#define VM_REWRITE(new_code) \
+	pc->code = (new_code);   \
+	VM_SET_HANDLER(pc)
+
+// Generic ops give up on quickening once their operand types have proven
+// to be this unstable, so polymorphic code doesn't keep flip-flopping.
+#define VM_QUICKEN_LIMIT 4
+
+// The handlers work on the stack through execute()'s local sp. Nothing
+// checks for room when pushing, execute() and callable() reserved the
+// most a function can push when it was entered.
+#define VM_PUSH(value) (*sp++ = (value))
+#define VM_POP() (*--sp)
+#define VM_TOP() (sp[-1])
+
+#define VM_NEXT() \
+	++pc;         \
+	VM_DISPATCH()
+
+// Only control transfers can leave the machine halted or paused (by way
+// of a host calling exit() or pause()), so only they check for it. Every
+// loop and call goes through one, so they're also where the garbage is
+// collected, at which point all live values are on the stack or in an Env.
+#define VM_CHECK_STATE()          \
+	if (heap.should_collect())    \
+	{                             \
+		stack.sp = sp;            \
+		collect_garbage();        \
+	}                             \
+	if (!running || paused)       \
+	{                             \
+		stack.sp = sp;            \
+		ip = CodeAddr(pc - base); \
+		return exit_code;         \
+	}
+
+#ifdef POP_JIT
+// Runs native code, then carries on interpreting from wherever it exits.
+// Errors are rethrown from the op which raised them.
+#define VM_RUN_NATIVE(code)      \
+	stack.sp = sp;               \
+	if (!jit.run(*this, (code))) \
+	{                            \
+		sp = stack.sp;           \
+		pc = base + ip;          \
+		jit.rethrow();           \
+	}                            \
+	sp = stack.sp;               \
+	pc = base + ip;              \
+	VM_CHECK_STATE()
+
+// Switches to native code at the entry of the function just called, once
+// it's been called enough to be compiled, see Jit::enter()
+#define VM_ENTER_FUNCTION()               \
+	if (auto code = jit.enter(*this, ip)) \
+	{                                     \
+		VM_RUN_NATIVE(code);              \
+	}
+
+// Switches back to native code when returning to a compiled function
+#define VM_RETURN_NATIVE(code) \
+	if (code)                  \
+	{                          \
+		VM_RUN_NATIVE(code);   \
+	}
+
+// Switches to native code at the start of the loop the current op jumps
+// back to, once it's been jumped to enough to be compiled, see Jit::loop()
+#define VM_ENTER_LOOP()                                           \
+	if (pc->target <= CodeAddr(pc - base))                        \
+	{                                                             \
+		ip = pc->target;                                          \
+		if (auto code = jit.loop(*this, ip, CodeAddr(pc - base))) \
+		{                                                         \
+			VM_RUN_NATIVE(code);                                  \
+			VM_DISPATCH();                                        \
+		}                                                         \
+	}
+#else
+#define VM_ENTER_FUNCTION()
+#define VM_RETURN_NATIVE(code)
+#define VM_ENTER_LOOP()
+#endif
+
+// Generic ops with quickened forms for two Ints or two Floats
+#define VM_QUICK_NUMERIC_LIST(X, kind) \
+	X(ADD, kind)                       \
+	X(SUB, kind)                       \
+	X(MUL, kind)                       \
+	X(EQ, kind)                        \
+	X(NE, kind)                        \
+	X(GT, kind)                        \
+	X(GE, kind)                        \
+	X(LT, kind)                        \
+	X(LE, kind)                        \
+	X(EQ_JUMP_FALSE, kind)             \
+	X(NE_JUMP_FALSE, kind)             \
+	X(GT_JUMP_FALSE, kind)             \
+	X(GE_JUMP_FALSE, kind)             \
+	X(LT_JUMP_FALSE, kind)             \
+	X(LE_JUMP_FALSE, kind)
+
+// Generic ops with quickened forms for two Strings
+#define VM_QUICK_STRING_LIST(X, kind) \
+	X(ADD, kind)                      \
+	X(EQ, kind)                       \
+	X(NE, kind)                       \
+	X(GT, kind)                       \
+	X(GE, kind)                       \
+	X(LT, kind)                       \
+	X(LE, kind)
+
+// Returns the form of the generic op code specialized for the types of
+// the given operands, or the code itself if there isn't one. The Int forms
+// only handle ints small enough to be immediate.
+static OpCode quicken(OpCode code, TValue left, TValue right)
+{
+	ValueType kind;
+	if (left.is_small_int() && right.is_small_int())
+		kind = ValueType::INT;
+	else if (left.is_float() && right.is_float())
+		kind = ValueType::FLOAT;
+	else if (left.type() == ValueType::STRING &&
+	         right.type() == ValueType::STRING)
+		kind = ValueType::STRING;
+	else
+		return code;
+
+#define VM_QUICKEN_CASE(op, kind) \
+	case OpCode::OP_##op:         \
+		return OpCode::OP_##op##_##kind##_##kind;
+
+	switch (kind)
+	{
+		case ValueType::INT:
+			switch (code)
+			{
+				VM_QUICK_NUMERIC_LIST(VM_QUICKEN_CASE, INT)
+				default:
+					break;
+			}
+			break;
+		case ValueType::FLOAT:
+			switch (code)
+			{
+				VM_QUICK_NUMERIC_LIST(VM_QUICKEN_CASE, FLOAT)
+				default:
+					break;
+			}
+			break;
+		case ValueType::STRING:
+			switch (code)
+			{
+				VM_QUICK_STRING_LIST(VM_QUICKEN_CASE, STRING)
+				default:
+					break;
+			}
+			break;
+		default:
+			break;
+	}
+
+#undef VM_QUICKEN_CASE
+
+	return code;
+}
+
 VM::VM() : VM(0, nullptr)
 {
 }
 
-VM::VM(int argc, char **argv) : VM(nullptr, 0, 0, nullptr)
+VM::VM(int argc, char **argv) : VM(nullptr, 0, argc, argv)
 {
 }
 
-VM::VM(const Uint8 *code, CodeAddr len, int argc, char **argv)
-    : ip(0), dec(&ip, code, len), env(new Env(nullptr)), running(false),
-      paused(false), exit_code(0), argc(argc), argv(argv)
+VM::VM(const Uint8 *image, size_t size, int argc, char **argv)
+    : ip(0), globals(nullptr), env(nullptr), running(false), paused(false),
+      exit_code(0),
+      argc(argc), argv(argv)
 {
+	Heap::Scope scope(heap);
+	globals = env = new Env(nullptr);
+	if (image)
+		program.reset(new Program(image, size, symbols));
+}
+
+int VM::execute(const Uint8 *image, size_t size)
+{
+	{
+		Heap::Scope scope(heap);
+		program.reset(new Program(image, size, symbols));
+	}
+	jit.reset();
+	ip = 0;
+	return execute();
 }
 
-int VM::execute(const Uint8 *code, CodeAddr len)
+int VM::execute()
 {
-	dec = Decoder(&ip, code, len);
+	if (!program)
+		return EXIT_FAILURE;
+
+	// the program's own values were allocated old when it was loaded, the
+	// ones made by running it start out in the nursery
+	Heap::Scope scope(heap, Heap::Generation::YOUNG);
+
 	running = true;
 	paused = false;
 	exit_code = 0;
+	stack.reserve(program->max_stack);
 
-	while (running && !paused)
+#ifdef VM_COMPUTED_GOTO
+	// Each handler jumps straight to the next one through the address
+	// stored in the op, so every opcode gets its own indirect branch for
+	// the CPU to predict.
+	// The table is kept around for quickening to rewrite handlers with.
+	void *dispatch_table[256];
+	for (auto &target : dispatch_table)
+		target = &&op_UNKNOWN;
+#define VM_TABLE_ENTRY(op) dispatch_table[Uint8(OpCode::OP_##op)] = &&op_##op;
+	VM_OPCODE_LIST(VM_TABLE_ENTRY)
+#undef VM_TABLE_ENTRY
+	if (!program->threaded)
 	{
-		auto op = dec.read_op();
-		// std::cerr << ".";
-		switch (op)
+		for (auto &op : program->ops)
+			VM_SET_HANDLER(&op);
+		program->threaded = true;
+	}
+#endif
+
+	DecodedOp *const base = program->ops.data();
+	DecodedOp *pc = base + ip;
+	// the top of the stack, stack.sp is only brought up to date when
+	// something besides the handlers looks at it
+	TValue *sp = stack.sp;
+	// whether the last tail call went on in the frame's own Env, past the
+	// prologue where compiled code starts
+	bool kept_env = false;
+
+	VM_DISPATCH_BEGIN()
+
+	VM_CASE(HALT)
+		VM_TRACE_ENTER(HALT)
+		running = false;
+		VM_TRACE_LEAVE()
+		stack.sp = sp;
+		ip = CodeAddr(pc - base);
+		return exit_code;
+
+	VM_CASE(NOP)
+		VM_TRACE_ENTER(NOP)
+		// do nothing
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PRINT)
+		VM_TRACE_ENTER(PRINT)
+		std::cout << VM_POP()._repr_() << std::endl;
+		VM_PUSH(TValue()); // print() is an expression
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(OPEN_SCOPE)
+		VM_TRACE_ENTER(OPEN_SCOPE)
+		env = new Env(env, pc->slot);
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(CLOSE_SCOPE)
+		VM_TRACE_ENTER(CLOSE_SCOPE)
+		env = env->parent;
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(BIND)
+		VM_TRACE_ENTER(BIND)
+		globals->define(pc->name, VM_POP());
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(CALL)
+		VM_TRACE_ENTER(CALL)
+		ip = CodeAddr(pc - base) + 1;
+		auto callee = VM_POP();
+		stack.sp = sp;
+		call(callee, pc->count);
+		pc = base + ip;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		VM_ENTER_FUNCTION();
+		VM_DISPATCH();
+
+	VM_CASE(RETURN)
+		VM_TRACE_ENTER(RETURN)
+		auto &frame = frames.pop();
+		// the arguments were all bound, so only the result is left
+		assert(size_t(sp - stack.begin()) == frame.base + 1);
+		pc = base + frame.ip;
+		env = frame.env;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		VM_RETURN_NATIVE(frames.top->native); // the frame just popped
+		VM_DISPATCH();
+
+	VM_CASE(TAIL_CALL)
+		VM_TRACE_ENTER(TAIL_CALL)
+		ip = CodeAddr(pc - base);
+		auto callee = VM_POP();
+		stack.sp = sp;
+		kept_env = tail_call(callee, pc->count);
+		pc = base + ip;
+		sp = stack.sp;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		if (!kept_env)
+		{
+			VM_ENTER_FUNCTION();
+		}
+		VM_DISPATCH();
+
+	VM_CASE(JUMP)
+		VM_TRACE_ENTER(JUMP)
+		VM_ENTER_LOOP();
+		pc = base + pc->target;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		VM_DISPATCH();
+
+	VM_CASE(JUMP_TRUE)
+		VM_TRACE_ENTER(JUMP_TRUE)
+		if (!VM_POP()._not_())
+		{
+			VM_ENTER_LOOP();
+			pc = base + pc->target;
+		}
+		else
+			++pc;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		VM_DISPATCH();
+
+	VM_CASE(JUMP_FALSE)
+		VM_TRACE_ENTER(JUMP_FALSE)
+		if (VM_POP()._not_())
 		{
-			case OpCode::OP_HALT:
-				VM_TRACE_ENTER(HALT)
-				running = false;
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_NOP:
-				VM_TRACE_ENTER(NOP)
-				// do nothing
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PRINT:
-				VM_TRACE_ENTER(PRINT)
-				std::cout << pop()->_repr_() << std::endl;
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_OPEN_SCOPE:
-				VM_TRACE_ENTER(OPEN_SCOPE)
-				env = new Env(env);
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_CLOSE_SCOPE:
-				VM_TRACE_ENTER(CLOSE_SCOPE)
-				env = env->parent;
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_BIND:
-				VM_TRACE_ENTER(BIND)
-				auto name = dec.read_name();
-				auto value = pop();
-				env->define(name, value);
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_CALL:
-				VM_TRACE_ENTER(CALL)
-				call(dec.read_u8());
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_RETURN:
-				VM_TRACE_ENTER(RETURN)
-				auto addr = return_stack.top();
-				return_stack.pop();
-				ip = addr;
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_JUMP:
-				VM_TRACE_ENTER(JUMP)
-				auto addr = dec.read_addr();
-				assert(addr < dec.len);
-				ip = addr;
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_JUMP_TRUE:
-				VM_TRACE_ENTER(JUMP_TRUE)
-				auto addr = dec.read_addr();
-				assert(addr < dec.len);
-				auto value = pop();
-				if (!value->_not_())
-					ip = addr;
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_JUMP_FALSE:
-				VM_TRACE_ENTER(JUMP_FALSE)
-				auto addr = dec.read_addr();
-				assert(addr < dec.len);
-				auto value = pop();
-				if (value->_not_())
-					ip = addr;
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_POP_TOP:
-				VM_TRACE_ENTER(POP_TOP)
-				stack.pop();
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_NULL:
-				VM_TRACE_ENTER(PUSH_NULL)
-				push_new<Null>();
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_TRUE:
-				VM_TRACE_ENTER(PUSH_TRUE)
-				push_new<Bool>(true);
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_FALSE:
-				VM_TRACE_ENTER(PUSH_FALSE)
-				push_new<Bool>(false);
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_INT:
-				VM_TRACE_ENTER(PUSH_INT)
-				push_new<Int>(dec.read_s64());
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_FLOAT:
-				VM_TRACE_ENTER(PUSH_FLOAT)
-				push_new<Float>(dec.read_f64());
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_STRING:
-				VM_TRACE_ENTER(PUSH_STRING)
-				push_new<String>(dec.read_string());
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_SYMBOL:
-				VM_TRACE_ENTER(PUSH_SYMBOL)
-				auto name = dec.read_name();
-				if (auto value = env->lookup(name, true))
-					push(value);
-				else
-				{
-					std::stringstream ss;
-					ss << "undefined symbol '" << name << "'";
-					throw RuntimeError(ss.str());
-				}
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_LIST:
-				VM_TRACE_ENTER(PUSH_LIST)
-				auto len = dec.read_u32();
-				auto list = new List();
-				for (auto i = 0u; i < len; i++)
-					list->append(pop());
-				push(list);
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_DICT:
-				VM_TRACE_ENTER(PUSH_DICT)
-				auto len = dec.read_u32();
-				auto dict = new Dict();
-				for (auto i = 0u; i < len; i++)
-				{
-					auto key = pop();
-					auto value = pop();
-					dict->insert(key, value);
-				}
-				push(dict);
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_SLICE:
-				VM_TRACE_ENTER(PUSH_SLICE)
-				auto start = pop();
-				auto stop = pop();
-				auto step = pop();
-				push_new<Slice>(start, stop, step);
-				break;
-				VM_TRACE_LEAVE()
-			case OpCode::OP_PUSH_FUNCTION:
-				VM_TRACE_ENTER(PUSH_FUNCTION)
-				auto closure = new Env(env);
-				push_new<Function>(dec.read_addr(), closure);
-				break;
-				VM_TRACE_LEAVE()
-
-			case OpCode::OP_IP_ASSIGN:
-				VM_TRACE_ENTER(IP_ASSIGN)
-				// TODO: look in current scope to make sure its defined
-				// then re-bind it with the new value
-				break;
-				VM_TRACE_LEAVE()
+			VM_ENTER_LOOP();
+			pc = base + pc->target;
+		}
+		else
+			++pc;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		VM_DISPATCH();
+
+	VM_CASE(POP_TOP)
+		VM_TRACE_ENTER(POP_TOP)
+		--sp;
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_NULL)
+		VM_TRACE_ENTER(PUSH_NULL)
+		VM_PUSH(TValue());
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_TRUE)
+		VM_TRACE_ENTER(PUSH_TRUE)
+		VM_PUSH(TValue::make_bool(true));
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_FALSE)
+		VM_TRACE_ENTER(PUSH_FALSE)
+		VM_PUSH(TValue::make_bool(false));
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_CONST)
+		VM_TRACE_ENTER(PUSH_CONST)
+		VM_PUSH(pc->constant); // constants are immutable, share them
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(LOAD_GLOBAL)
+		VM_TRACE_ENTER(LOAD_GLOBAL)
+		VM_PUSH(lookup(pc->name));
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(STORE_GLOBAL)
+		VM_TRACE_ENTER(STORE_GLOBAL)
+		store(pc->name, VM_POP());
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(LOAD_LOCAL)
+		VM_TRACE_ENTER(LOAD_LOCAL)
+		VM_PUSH(env->slots[pc->slot]);
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(STORE_LOCAL)
+		VM_TRACE_ENTER(STORE_LOCAL)
+		env->set_slot(pc->slot, VM_POP());
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(LOAD_UPVALUE)
+		VM_TRACE_ENTER(LOAD_UPVALUE)
+		VM_PUSH(env->outer(pc->depth)->slots[pc->slot]);
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(STORE_UPVALUE)
+		VM_TRACE_ENTER(STORE_UPVALUE)
+		env->outer(pc->depth)->set_slot(pc->slot, VM_POP());
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_LIST)
+		VM_TRACE_ENTER(PUSH_LIST)
+		auto len = pc->count;
+		auto list = new List();
+		for (auto i = 0u; i < len; i++)
+			list->append(VM_POP());
+		VM_PUSH(list);
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_DICT)
+		VM_TRACE_ENTER(PUSH_DICT)
+		auto len = pc->count;
+		auto dict = new Dict();
+		for (auto i = 0u; i < len; i++)
+		{
+			auto key = VM_POP();
+			auto value = VM_POP();
+			dict->insert(key, value);
+		}
+		VM_PUSH(dict);
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_SLICE)
+		VM_TRACE_ENTER(PUSH_SLICE)
+		auto start = VM_POP();
+		auto stop = VM_POP();
+		auto step = VM_POP();
+		VM_PUSH(new Slice(start, stop, step));
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(PUSH_FUNCTION)
+		VM_TRACE_ENTER(PUSH_FUNCTION)
+		VM_PUSH(new Function(pc->target, env));
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(IP_ASSIGN)
+		VM_TRACE_ENTER(IP_ASSIGN)
+		// assignments to names are compiled to stores, nothing else can be
+		// assigned to yet
+		throw RuntimeError("invalid assignment target");
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	// Only names can be incremented (see IP_ASSIGN), otherwise the operand is
+	// just checked and left as it is.
+	VM_CASE(IP_POSTINC)
+		VM_TRACE_ENTER(IP_POSTINC)
+		VM_TOP()._preinc_();
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	VM_CASE(IP_POSTDEC)
+		VM_TRACE_ENTER(IP_POSTDEC)
+		VM_TOP()._predec_();
+		VM_TRACE_LEAVE()
+		VM_NEXT();
 
 //
 // Builtin operators
 //
-#define VM_BINOP_CASE(op, fnc)        \
-	case OpCode::OP_##op:             \
-		VM_TRACE_ENTER(op)            \
-		auto left = pop();            \
-		auto right = pop();           \
-		push(left->_##fnc##_(right)); \
-		break;                        \
-		VM_TRACE_LEAVE()
-
-#define VM_UNOP_CASE(op, fnc)    \
-	case OpCode::OP_##op:        \
-		VM_TRACE_ENTER(op)       \
-		auto left = pop();       \
-		push(left->_##fnc##_()); \
-		break;                   \
-		VM_TRACE_LEAVE()
-
-				// clang-format off
-			VM_BINOP_CASE(ADD, add)
-			VM_BINOP_CASE(SUB, sub)
-			VM_BINOP_CASE(MUL, mul)
-			VM_BINOP_CASE(DIV, div)
-			VM_BINOP_CASE(MOD, mod)
-			VM_BINOP_CASE(POW, pow)
-			VM_UNOP_CASE(POS, pos)
-			VM_UNOP_CASE(NEG, neg)
-			VM_BINOP_CASE(LOG_AND, log_and)
-			VM_BINOP_CASE(LOG_OR, log_or)
-			VM_UNOP_CASE(LOG_NOT, log_not)
-			VM_BINOP_CASE(BIT_AND, bit_and)
-			VM_BINOP_CASE(BIT_OR, bit_or)
-			VM_BINOP_CASE(BIT_XOR, bit_xor)
-			VM_UNOP_CASE(BIT_NOT, bit_not)
-			VM_BINOP_CASE(LEFT_SHIFT, lshift)
-			VM_BINOP_CASE(RIGHT_SHIFT, rshift)
-			VM_BINOP_CASE(IP_ADD, ip_add)
-			VM_BINOP_CASE(IP_SUB, ip_sub)
-			VM_BINOP_CASE(IP_MUL, ip_mul)
-			VM_BINOP_CASE(IP_DIV, ip_div)
-			VM_BINOP_CASE(IP_MOD, ip_mod)
-			VM_BINOP_CASE(IP_POW, ip_pow)
-			VM_BINOP_CASE(IP_AND, ip_and)
-			VM_BINOP_CASE(IP_OR, ip_or)
-			VM_BINOP_CASE(IP_XOR, ip_xor)
-			VM_BINOP_CASE(IP_LEFT, ip_lshift)
-			VM_BINOP_CASE(IP_RIGHT, ip_rshift)
-			VM_UNOP_CASE(IP_PREINC, preinc)
-			VM_UNOP_CASE(IP_PREDEC, predec)
-			VM_UNOP_CASE(IP_POSTINC, postinc)
-			VM_UNOP_CASE(IP_POSTDEC, postdec)
-			VM_BINOP_CASE(EQ, eq)
-			VM_BINOP_CASE(NE, ne)
-			VM_BINOP_CASE(GT, gt)
-			VM_BINOP_CASE(GE, ge)
-			VM_BINOP_CASE(LT, lt)
-			VM_BINOP_CASE(LE, le)
-			// clang-format on
-			default:
-			{
-				std::stringstream ss;
-				ss << "unknown instruction '" << Uint8(op) << "'";
-				throw RuntimeError(ss.str());
-				break;
-			}
+#define VM_BINOP_CASE(op, fnc)          \
+	VM_CASE(op)                         \
+		VM_TRACE_ENTER(op)              \
+		auto left = VM_POP();           \
+		auto right = VM_POP();          \
+		VM_PUSH(left._##fnc##_(right)); \
+		VM_TRACE_LEAVE()                \
+		VM_NEXT();
+
+// Generic form of an op with quickened forms, after the first run it's
+// rewritten into the one matching its operand types (if any)
+#define VM_QUICKEN(left, right)                          \
+	if (pc->count < VM_QUICKEN_LIMIT)                    \
+	{                                                    \
+		auto quick = quicken(pc->code, (left), (right)); \
+		if (quick != pc->code)                           \
+		{                                                \
+			VM_REWRITE(quick);                           \
+		}                                                \
+		else                                             \
+		{                                                \
+			pc->count++;                                 \
+		}                                                \
+	}
+
+#define VM_QUICKENING_BINOP_CASE(op, fnc) \
+	VM_CASE(op)                           \
+		VM_TRACE_ENTER(op)                \
+		auto left = VM_POP();             \
+		auto right = VM_POP();            \
+		VM_QUICKEN(left, right);          \
+		VM_PUSH(left._##fnc##_(right));   \
+		VM_TRACE_LEAVE()                  \
+		VM_NEXT();
+
+#define VM_UNOP_CASE(op, fnc)      \
+	VM_CASE(op)                    \
+		VM_TRACE_ENTER(op)         \
+		auto left = VM_POP();      \
+		VM_PUSH(left._##fnc##_()); \
+		VM_TRACE_LEAVE()           \
+		VM_NEXT();
+
+//
+// Superinstructions
+//
+// The constant is always an Int, so only the variable's type needs
+// checking before doing the operation directly.
+#define VM_VARIABLE_INT_CASE(op, kind, fetch, fnc, result)            \
+	VM_CASE(op##_##kind##_INT)                                        \
+		VM_TRACE_ENTER(op##_##kind##_INT)                             \
+		auto left = (fetch);                                          \
+		if (left.is_small_int())                                      \
+		{                                                             \
+			auto a = left.small_int();                                \
+			auto b = pc->int_value;                                   \
+			VM_PUSH(result);                                          \
+		}                                                             \
+		else                                                          \
+		{                                                             \
+			VM_PUSH(left._##fnc##_(TValue::make_int(pc->int_value))); \
+		}                                                             \
+		VM_TRACE_LEAVE()                                              \
+		VM_NEXT();
+
+#define VM_SYMBOL_INT_CASE(op, fnc, result) \
+	VM_VARIABLE_INT_CASE(op, SYMBOL, lookup(pc->name), fnc, result)
+#define VM_LOCAL_INT_CASE(op, fnc, result) \
+	VM_VARIABLE_INT_CASE(op, LOCAL, env->slots[pc->slot], fnc, result)
+
+#define VM_COMPARE_JUMP_CASE(op, fnc)      \
+	VM_CASE(op##_JUMP_FALSE)               \
+		VM_TRACE_ENTER(op##_JUMP_FALSE)    \
+		auto left = VM_POP();              \
+		auto right = VM_POP();             \
+		VM_QUICKEN(left, right);           \
+		if (left._##fnc##_(right)._not_()) \
+		{                                  \
+			VM_ENTER_LOOP();               \
+			pc = base + pc->target;        \
+		}                                  \
+		else                               \
+			++pc;                          \
+		VM_TRACE_LEAVE()                   \
+		VM_CHECK_STATE();                  \
+		VM_DISPATCH();
+
+//
+// Quickened ops
+//
+// These peek at their operands first, when they aren't of the expected
+// type the op is turned back into its generic form and dispatched again.
+#define VM_IS_INT(v) (v).is_small_int()
+#define VM_IS_FLOAT(v) (v).is_float()
+#define VM_IS_STRING(v) ((v).type() == ValueType::STRING)
+#define VM_AS_INT(v) (v).small_int()
+#define VM_AS_FLOAT(v) (v).as_float()
+#define VM_AS_STRING(v) static_cast<Pop::String *>((v).as_ptr())->value
+
+#define VM_QUICK_OPERANDS(op, kind)                  \
+	auto left = sp[-1];                              \
+	auto right = sp[-2];                             \
+	if (!VM_IS_##kind(left) || !VM_IS_##kind(right)) \
+	{                                                \
+		pc->count++;                                 \
+		VM_REWRITE(OpCode::OP_##op);                 \
+		VM_DISPATCH();                               \
+	}                                                \
+	sp -= 2;                                         \
+	const auto &a = VM_AS_##kind(left);              \
+	const auto &b = VM_AS_##kind(right);
+
+#define VM_QUICK_BINOP_CASE(op, kind, result) \
+	VM_CASE(op##_##kind##_##kind)             \
+		VM_TRACE_ENTER(op##_##kind##_##kind)  \
+		VM_QUICK_OPERANDS(op, kind)           \
+		VM_PUSH(result);                      \
+		VM_TRACE_LEAVE()                      \
+		VM_NEXT();
+
+#define VM_QUICK_COMPARE_JUMP_CASE(op, kind, expr)      \
+	VM_CASE(op##_JUMP_FALSE_##kind##_##kind)            \
+		VM_TRACE_ENTER(op##_JUMP_FALSE_##kind##_##kind) \
+		VM_QUICK_OPERANDS(op##_JUMP_FALSE, kind)        \
+		if (!(expr))                                    \
+		{                                               \
+			VM_ENTER_LOOP();                            \
+			pc = base + pc->target;                     \
+		}                                               \
+		else                                            \
+			++pc;                                       \
+		VM_TRACE_LEAVE()                                \
+		VM_CHECK_STATE();                               \
+		VM_DISPATCH();
+
+	VM_CASE(CALL_SYMBOL)
+		VM_TRACE_ENTER(CALL_SYMBOL)
+		ip = CodeAddr(pc - base) + 1;
+		stack.sp = sp;
+		call(lookup(pc->name), pc->count);
+		pc = base + ip;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		VM_ENTER_FUNCTION();
+		VM_DISPATCH();
+
+	VM_CASE(TAIL_CALL_SYMBOL)
+		VM_TRACE_ENTER(TAIL_CALL_SYMBOL)
+		ip = CodeAddr(pc - base);
+		stack.sp = sp;
+		kept_env = tail_call(lookup(pc->name), pc->count);
+		pc = base + ip;
+		sp = stack.sp;
+		VM_TRACE_LEAVE()
+		VM_CHECK_STATE();
+		if (!kept_env)
+		{
+			VM_ENTER_FUNCTION();
 		}
+		VM_DISPATCH();
+
+	VM_CASE(PRINT_POP)
+		VM_TRACE_ENTER(PRINT_POP)
+		std::cout << VM_POP()._repr_() << std::endl;
+		VM_TRACE_LEAVE()
+		VM_NEXT();
+
+	// clang-format off
+	VM_SYMBOL_INT_CASE(ADD, add, TValue::make_int(wrapping_add(a, b)))
+	VM_SYMBOL_INT_CASE(SUB, sub, TValue::make_int(wrapping_sub(a, b)))
+	VM_SYMBOL_INT_CASE(EQ, eq, TValue::make_bool(a == b))
+	VM_SYMBOL_INT_CASE(NE, ne, TValue::make_bool(a != b))
+	VM_SYMBOL_INT_CASE(GT, gt, TValue::make_bool(a > b))
+	VM_SYMBOL_INT_CASE(GE, ge, TValue::make_bool(a >= b))
+	VM_SYMBOL_INT_CASE(LT, lt, TValue::make_bool(a < b))
+	VM_SYMBOL_INT_CASE(LE, le, TValue::make_bool(a <= b))
+	VM_LOCAL_INT_CASE(ADD, add, TValue::make_int(wrapping_add(a, b)))
+	VM_LOCAL_INT_CASE(SUB, sub, TValue::make_int(wrapping_sub(a, b)))
+	VM_LOCAL_INT_CASE(EQ, eq, TValue::make_bool(a == b))
+	VM_LOCAL_INT_CASE(NE, ne, TValue::make_bool(a != b))
+	VM_LOCAL_INT_CASE(GT, gt, TValue::make_bool(a > b))
+	VM_LOCAL_INT_CASE(GE, ge, TValue::make_bool(a >= b))
+	VM_LOCAL_INT_CASE(LT, lt, TValue::make_bool(a < b))
+	VM_LOCAL_INT_CASE(LE, le, TValue::make_bool(a <= b))
+	VM_COMPARE_JUMP_CASE(EQ, eq)
+	VM_COMPARE_JUMP_CASE(NE, ne)
+	VM_COMPARE_JUMP_CASE(GT, gt)
+	VM_COMPARE_JUMP_CASE(GE, ge)
+	VM_COMPARE_JUMP_CASE(LT, lt)
+	VM_COMPARE_JUMP_CASE(LE, le)
+	// clang-format on
+
+	// clang-format off
+	VM_QUICKENING_BINOP_CASE(ADD, add)
+	VM_QUICKENING_BINOP_CASE(SUB, sub)
+	VM_QUICKENING_BINOP_CASE(MUL, mul)
+	VM_BINOP_CASE(DIV, div)
+	VM_BINOP_CASE(MOD, mod)
+	VM_BINOP_CASE(POW, pow)
+	VM_UNOP_CASE(POS, pos)
+	VM_UNOP_CASE(NEG, neg)
+	VM_BINOP_CASE(LOG_AND, log_and)
+	VM_BINOP_CASE(LOG_OR, log_or)
+	VM_UNOP_CASE(LOG_NOT, log_not)
+	VM_BINOP_CASE(BIT_AND, bit_and)
+	VM_BINOP_CASE(BIT_OR, bit_or)
+	VM_BINOP_CASE(BIT_XOR, bit_xor)
+	VM_UNOP_CASE(BIT_NOT, bit_not)
+	VM_BINOP_CASE(LEFT_SHIFT, lshift)
+	VM_BINOP_CASE(RIGHT_SHIFT, rshift)
+	VM_BINOP_CASE(IP_ADD, add)
+	VM_BINOP_CASE(IP_SUB, sub)
+	VM_BINOP_CASE(IP_MUL, mul)
+	VM_BINOP_CASE(IP_DIV, div)
+	VM_BINOP_CASE(IP_MOD, mod)
+	VM_BINOP_CASE(IP_POW, pow)
+	VM_BINOP_CASE(IP_AND, bit_and)
+	VM_BINOP_CASE(IP_OR, bit_or)
+	VM_BINOP_CASE(IP_XOR, bit_xor)
+	VM_BINOP_CASE(IP_LEFT, lshift)
+	VM_BINOP_CASE(IP_RIGHT, rshift)
+	VM_UNOP_CASE(IP_PREINC, preinc)
+	VM_UNOP_CASE(IP_PREDEC, predec)
+	VM_QUICKENING_BINOP_CASE(EQ, eq)
+	VM_QUICKENING_BINOP_CASE(NE, ne)
+	VM_QUICKENING_BINOP_CASE(GT, gt)
+	VM_QUICKENING_BINOP_CASE(GE, ge)
+	VM_QUICKENING_BINOP_CASE(LT, lt)
+	VM_QUICKENING_BINOP_CASE(LE, le)
+	// clang-format on
+
+	// clang-format off
+	VM_QUICK_BINOP_CASE(ADD, INT, TValue::make_int(wrapping_add(a, b)))
+	VM_QUICK_BINOP_CASE(SUB, INT, TValue::make_int(wrapping_sub(a, b)))
+	VM_QUICK_BINOP_CASE(MUL, INT, TValue::make_int(wrapping_mul(a, b)))
+	VM_QUICK_BINOP_CASE(EQ, INT, TValue::make_bool(a == b))
+	VM_QUICK_BINOP_CASE(NE, INT, TValue::make_bool(a != b))
+	VM_QUICK_BINOP_CASE(GT, INT, TValue::make_bool(a > b))
+	VM_QUICK_BINOP_CASE(GE, INT, TValue::make_bool(a >= b))
+	VM_QUICK_BINOP_CASE(LT, INT, TValue::make_bool(a < b))
+	VM_QUICK_BINOP_CASE(LE, INT, TValue::make_bool(a <= b))
+	VM_QUICK_COMPARE_JUMP_CASE(EQ, INT, a == b)
+	VM_QUICK_COMPARE_JUMP_CASE(NE, INT, a != b)
+	VM_QUICK_COMPARE_JUMP_CASE(GT, INT, a > b)
+	VM_QUICK_COMPARE_JUMP_CASE(GE, INT, a >= b)
+	VM_QUICK_COMPARE_JUMP_CASE(LT, INT, a < b)
+	VM_QUICK_COMPARE_JUMP_CASE(LE, INT, a <= b)
+	VM_QUICK_BINOP_CASE(ADD, FLOAT, TValue::make_float(a + b))
+	VM_QUICK_BINOP_CASE(SUB, FLOAT, TValue::make_float(a - b))
+	VM_QUICK_BINOP_CASE(MUL, FLOAT, TValue::make_float(a * b))
+	VM_QUICK_BINOP_CASE(EQ, FLOAT, TValue::make_bool(a == b))
+	VM_QUICK_BINOP_CASE(NE, FLOAT, TValue::make_bool(a != b))
+	VM_QUICK_BINOP_CASE(GT, FLOAT, TValue::make_bool(a > b))
+	VM_QUICK_BINOP_CASE(GE, FLOAT, TValue::make_bool(a >= b))
+	VM_QUICK_BINOP_CASE(LT, FLOAT, TValue::make_bool(a < b))
+	VM_QUICK_BINOP_CASE(LE, FLOAT, TValue::make_bool(a <= b))
+	VM_QUICK_COMPARE_JUMP_CASE(EQ, FLOAT, a == b)
+	VM_QUICK_COMPARE_JUMP_CASE(NE, FLOAT, a != b)
+	VM_QUICK_COMPARE_JUMP_CASE(GT, FLOAT, a > b)
+	VM_QUICK_COMPARE_JUMP_CASE(GE, FLOAT, a >= b)
+	VM_QUICK_COMPARE_JUMP_CASE(LT, FLOAT, a < b)
+	VM_QUICK_COMPARE_JUMP_CASE(LE, FLOAT, a <= b)
+	VM_QUICK_BINOP_CASE(ADD, STRING, new Pop::String(a + b))
+	VM_QUICK_BINOP_CASE(EQ, STRING, TValue::make_bool(a == b))
+	VM_QUICK_BINOP_CASE(NE, STRING, TValue::make_bool(a != b))
+	VM_QUICK_BINOP_CASE(GT, STRING, TValue::make_bool(a > b))
+	VM_QUICK_BINOP_CASE(GE, STRING, TValue::make_bool(a >= b))
+	VM_QUICK_BINOP_CASE(LT, STRING, TValue::make_bool(a < b))
+	VM_QUICK_BINOP_CASE(LE, STRING, TValue::make_bool(a <= b))
+	// clang-format on
+
+	VM_DEFAULT()
+	{
+		std::stringstream ss;
+		ss << "unknown instruction '" << opcode_name(pc->code) << "'";
+		throw RuntimeError(ss.str());
 	}
 
-	return exit_code;
-}
+	VM_DISPATCH_END()
 
-int VM::execute()
-{
-	if (dec.code)
-		return execute(dec.code, dec.len);
-	else
-		return EXIT_FAILURE;
+	return exit_code;
 }
 
 void VM::pause()
@@ -348,17 +1032,41 @@ void VM::exit(int exit_code_)
 	}
 }
 
+void VM::collect_garbage()
+{
+	// the globals are never young, nor are the symbols or the program's
+	// constants, so they don't need forwarding
+	heap.collect(
+	    [this]() {
+		    for (auto &value : stack)
+			    heap.forward(value);
+		    for (auto &frame : frames)
+			    heap.forward(frame.env);
+		    heap.forward(env);
+		},
+	    [this]() {
+		    for (auto value : stack)
+			    value.trace();
+		    for (auto &frame : frames)
+			    frame.env->trace();
+		    globals->trace();
+		    env->trace();
+		    symbols.trace();
+		    program->trace();
+		});
+}
+
 void VM::dump_stack()
 {
-	if (stack.values.empty())
+	if (stack.empty())
 	{
 		std::cerr << "StackEmpty;\n";
 	}
 	else
 	{
-		for (size_t i = 0; i < stack.values.size(); i++)
+		for (size_t i = 0; i < stack.size(); i++)
 		{
-			std::cerr << "stack[" << i << "]=" << stack.values[i]->_repr_()
+			std::cerr << "stack[" << i << "]=" << stack.begin()[i]._repr_()
 			          << std::endl;
 		}
 	}
@@ -10,34 +10,149 @@
 #error "Invalid individual include, include only the <pop/pop.hpp> header"
 #endif
 
-#include <pop/decoder.hpp>
+#include <pop/gc.hpp>
+#include <pop/jit.hpp>
 #include <pop/opcodes.hpp>
+#include <pop/program.hpp>
 #include <pop/types.hpp>
 #include <pop/value.hpp>
 #include <cassert>
 #include <memory>
-#include <stack>
+#include <sstream>
 #include <type_traits>
+#include <vector>
 
 namespace Pop
 {
 
+// The operand stack, allocated once at a fixed size. The interpreter
+// checks there's room for the most values a function can push (see
+// verify()) when it's called, then pushes them through a local copy of sp
+// without any more checks.
 struct ValueStack
 {
-	ValueList values;
-	Value *pop()
+	static constexpr size_t DEFAULT_SIZE = 1 << 18;
+
+	std::unique_ptr<TValue[]> values;
+	TValue *sp;    // one past the top value
+	TValue *limit; // one past the last value there's room for
+
+	ValueStack(size_t size = DEFAULT_SIZE)
+	{
+		resize(size);
+	}
+
+	// makes room for size values, dropping any on the stack
+	void resize(size_t size)
+	{
+		values.reset(new TValue[size]);
+		sp = values.get();
+		limit = values.get() + size;
+	}
+
+	TValue pop()
+	{
+		assert(!empty());
+		return *--sp;
+	}
+	void push(TValue val)
+	{
+		reserve(1);
+		*sp++ = val;
+	}
+	TValue top() const
+	{
+		assert(!empty());
+		return sp[-1];
+	}
+	// makes sure there's room for n more values
+	void reserve(size_t n)
+	{
+		if (size_t(limit - sp) < n)
+		{
+			std::stringstream ss;
+			ss << "value stack overflow, more than " << capacity()
+			   << " values";
+			throw RuntimeError(ss.str());
+		}
+	}
+
+	bool empty() const
+	{
+		return sp == values.get();
+	}
+	size_t size() const
+	{
+		return sp - values.get();
+	}
+	size_t capacity() const
+	{
+		return limit - values.get();
+	}
+	TValue *begin()
+	{
+		return values.get();
+	}
+	TValue *end()
+	{
+		return sp;
+	}
+};
+
+// where a call returns to and the environment it was made from
+struct CallFrame
+{
+	CodeAddr ip;
+	Env *env;
+	size_t base;  // size of the value stack below the call's arguments
+	void *native; // the compiled code at ip, if the caller is compiled
+};
+
+// The frames of the calls being made, allocated up front so a call and
+// return just move the top, and running out of them is a single compare
+// instead of the recursion eating all the memory it can.
+struct CallStack
+{
+	static constexpr size_t MAX_DEPTH = 1 << 16;
+
+	std::unique_ptr<CallFrame[]> frames;
+	CallFrame *top;   // one past the innermost frame
+	CallFrame *limit; // one past the last frame
+
+	CallStack()
+	    : frames(new CallFrame[MAX_DEPTH]), top(frames.get()),
+	      limit(frames.get() + MAX_DEPTH)
+	{
+	}
+
+	void push(const CallFrame &frame)
+	{
+		if (top == limit)
+		{
+			std::stringstream ss;
+			ss << "call stack overflow, calls nested more than "
+			   << MAX_DEPTH << " deep";
+			throw RuntimeError(ss.str());
+		}
+		*top++ = frame;
+	}
+	CallFrame &pop()
 	{
-		auto val = values.back();
-		values.pop_back();
-		return val;
+		assert(top != frames.get());
+		return *--top;
 	}
-	void push(Value *val)
+	bool empty() const
 	{
-		values.emplace_back(val);
+		return top == frames.get();
 	}
-	Value *top() const
+
+	CallFrame *begin()
 	{
-		return values.back();
+		return frames.get();
+	}
+	CallFrame *end()
+	{
+		return top;
 	}
 };
 
@@ -45,11 +160,15 @@ struct VM
 {
 	static constexpr int EXIT_PAUSED = -1;
 
-	CodeAddr ip;
-	Decoder dec;
+	Heap heap; // first, so it outlives everything referring to its Values
+	CodeAddr ip; // index of the next op in program
+	SymbolTable symbols; // shared by every program the VM loads
+	std::unique_ptr<Program> program;
 	ValueStack stack;
-	std::stack<CodeAddr> return_stack;
-	Env *env;
+	CallStack frames;
+	Jit jit;
+	Env *globals; // the outermost env, names not resolved to slots
+	Env *env;     // the current function's frame, or the globals
 	bool running;
 	bool paused;
 	int exit_code;
@@ -58,10 +177,12 @@ struct VM
 
 	VM();
 	VM(int argc, char **argv);
-	VM(const Uint8 *code, CodeAddr len, int argc = 0, char **argv = nullptr);
+	// image is a bytecode image (see Image), which is only needed until
+	// the VM's been constructed
+	VM(const Uint8 *image, size_t size, int argc = 0, char **argv = nullptr);
 
 	// Machine control
-	int execute(const Uint8 *code, CodeAddr len);
+	int execute(const Uint8 *image, size_t size);
 	int execute();
 	void pause();
 	void resume();
@@ -69,34 +190,109 @@ struct VM
 
 	void dump_stack();
 
-	void call(unsigned int)
+	// Moves the young Values still reachable from the stack or the
+	// environment out of the nursery, then frees every old Value that's no
+	// longer reachable from them or the program if it's time to. Only safe
+	// between instructions, since it moves values.
+	void collect_garbage();
+
+	// the unique Symbol for name, which globals are keyed by
+	Symbol *intern(const std::string &name)
+	{
+		Heap::Scope scope(heap);
+		return symbols.intern(name);
+	}
+
+	void define(const std::string &name, TValue value)
 	{
-		auto callee = pop();
-		if (callee->type == ValueType::FUNC)
+		globals->define(intern(name), value);
+	}
+
+	TValue lookup(Symbol *name)
+	{
+		if (auto slot = globals->lookup(name, false))
+			return *slot;
+		std::stringstream ss;
+		ss << "undefined symbol '" << name->name << "'";
+		throw RuntimeError(ss.str());
+	}
+
+	// rebinds the global definition of name to value
+	void store(Symbol *name, TValue value)
+	{
+		if (globals->assign(name, value))
+			return;
+		std::stringstream ss;
+		ss << "assignment to undefined symbol '" << name->name << "'";
+		throw RuntimeError(ss.str());
+	}
+
+	// the callee's OPEN_SCOPE starts its frame inside the env it closed
+	// over, RETURN goes back to the caller's
+	void call(TValue callee, unsigned int nargs)
+	{
+		auto function = callable(callee, nargs);
+		frames.push({ ip, env, stack.size() - nargs, nullptr });
+		env = function->env;
+		ip = function->addr;
+	}
+
+	// a call from a function which returns its result, so the callee
+	// returns straight to the caller's caller and the caller's frame can
+	// be dropped. A function calling itself keeps its Env too, unless a
+	// closure has captured it: the arguments are stored straight into
+	// their slots and ip is left past the OPEN_SCOPE and parameter stores
+	// instead of at the entry, which is what the result says.
+	bool tail_call(TValue callee, unsigned int nargs)
+	{
+		auto function = callable(callee, nargs);
+		auto &entry = program->ops[function->addr];
+		if (function->env == env->parent && !env->captured &&
+		    env->slots.size() == entry.slot)
 		{
-			auto addr = static_cast<Function *>(callee)->addr;
-			return_stack.push(ip);
-			ip = addr;
+			// verify() vouches for the parameter stores following it
+			auto params = &entry + 1;
+			for (unsigned int i = 0; i < nargs; i++)
+				env->set_slot(params[i].slot, stack.pop());
+			ip = function->addr + 1 + nargs;
+			return true;
 		}
-		else
+		env = function->env;
+		ip = function->addr;
+		return false;
+	}
+
+	// the function to call, making sure it can be with nargs arguments
+	Function *callable(TValue callee, unsigned int nargs)
+	{
+		if (callee.type() != ValueType::FUNC)
 		{
 			dump_stack();
 			std::stringstream ss;
-			ss << "value type '" << callee->type_name()
+			ss << "value type '" << callee.type_name()
 			   << "' is not callable at '" << std::hex << ip << "'";
 			throw RuntimeError(ss.str());
 		}
+		auto function = static_cast<Function *>(callee.as_ptr());
+		// the verifier only vouches for calls with the right arguments
+		auto &entry = program->ops[function->addr];
+		if (nargs != entry.count)
+		{
+			std::stringstream ss;
+			ss << "function takes " << entry.count << " arguments, " << nargs
+			   << " given";
+			throw RuntimeError(ss.str());
+		}
+		stack.reserve(entry.max_stack);
+		return function;
 	}
 
-	Value *pop()
+	TValue pop()
 	{
-		assert(!stack.values.empty());
-		auto top = stack.top();
-		stack.pop();
-		return top;
+		return stack.pop();
 	}
 
-	void push(Value *value)
+	void push(TValue value)
 	{
 		stack.push(value);
 	}
@@ -0,0 +1,126 @@
+// bench_decode.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+// Compares reading the fixed size numbers of a large synthetic image a
+// byte at a time, the way the Decoder used to, against the Decoder's
+// single loads, then times loading a large program.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/pop.hpp>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+using namespace Pop;
+
+static const size_t NUM_VALUES = 1 << 23;
+static const int NUM_RUNS = 5;
+
+// the old Decoder, which built each number out of separate byte reads
+struct ByteDecoder
+{
+	CodeAddr *ip;
+	const Uint8 *code;
+	CodeAddr len;
+
+	ByteDecoder(CodeAddr *ip, const Uint8 *code, CodeAddr len)
+	    : ip(ip), code(code), len(len)
+	{
+	}
+
+	template <class T>
+	inline T read_byte_as()
+	{
+		assert(*ip < len);
+		return static_cast<T>(code[(*ip)++]);
+	}
+
+	Uint32 read_u32()
+	{
+		return read_byte_as<Uint32>() | (read_byte_as<Uint32>() << 8) |
+		       (read_byte_as<Uint32>() << 16) | (read_byte_as<Uint32>() << 24);
+	}
+
+	Uint64 read_u64()
+	{
+		Uint64 lo = read_u32();
+		return lo | (Uint64(read_u32()) << 32);
+	}
+};
+
+template <class D, class T>
+static double throughput(const std::string &data, T (D::*read)())
+{
+	auto bytes = reinterpret_cast<const Uint8 *>(data.data());
+	double best = 0;
+	Uint64 sum = 0;
+	for (int run = 0; run < NUM_RUNS; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		CodeAddr ip = 0;
+		D dec(&ip, bytes, data.size());
+		while (ip < data.size())
+			sum += (dec.*read)();
+		std::chrono::duration<double> elapsed =
+		    std::chrono::steady_clock::now() - start;
+		auto rate = data.size() / elapsed.count() / (1 << 20);
+		if (rate > best)
+			best = rate;
+	}
+	// so the reads can't be left out
+	volatile Uint64 sink = sum;
+	(void)sink;
+	return best;
+}
+
+template <class T>
+static std::string synthetic(CodeBuffer &(CodeBuffer::*put)(T))
+{
+	std::stringstream ss;
+	CodeBuffer buf(ss);
+	for (size_t i = 0; i < NUM_VALUES; i++)
+		(buf.*put)(T(i * 2654435761u));
+	return ss.str();
+}
+
+int main()
+{
+	std::printf("%-10s %13s %13s\n", "numbers", "bytes (MiB/s)",
+	            "loads (MiB/s)");
+	auto u32s = synthetic(&CodeBuffer::put_u32);
+	std::printf("%-10s %13.1f %13.1f\n", "u32",
+	            throughput(u32s, &ByteDecoder::read_u32),
+	            throughput(u32s, &Decoder::read_u32));
+	auto u64s = synthetic(&CodeBuffer::put_u64);
+	std::printf("%-10s %13.1f %13.1f\n", "u64",
+	            throughput(u64s, &ByteDecoder::read_u64),
+	            throughput(u64s, &Decoder::read_u64));
+
+	// lots of globals and literals, so every kind of operand is decoded
+	std::stringstream src, bc;
+	for (int i = 0; i < 20000; i++)
+		src << "let v" << i << " = " << Int64(i) * 1000003 << " + 'x" << i
+		    << "'; if (v" << i << " == 0) print(" << i << ".5);\n";
+	compile(src, "<bench>", bc);
+	auto image = bc.str();
+	double best = 0;
+	for (int run = 0; run < NUM_RUNS; run++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		VM vm(reinterpret_cast<const Uint8 *>(image.data()), image.size());
+		std::chrono::duration<double> elapsed =
+		    std::chrono::steady_clock::now() - start;
+		auto rate = image.size() / elapsed.count() / (1 << 20);
+		if (rate > best)
+			best = rate;
+	}
+	std::printf("%-10s %27.1f\n", "program", best);
+	return 0;
+}
@@ -0,0 +1,117 @@
+// bench_gc.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+// Compares allocating every value with plain new against allocating them
+// from the heap's Pool, and against the nursery in front of the Pool, by
+// running some allocation heavy programs each way. Every run happens in its
+// own process so that its peak RSS can be measured.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/pop.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Pop;
+
+struct Benchmark
+{
+	const char *name;
+	std::string code;
+};
+
+// clang-format off
+
+static const Benchmark benchmarks[] =
+{
+	{ "strings",
+	  "let i = 0; let s = null;\n"
+	  "while (i < 1000000) { s = 'a' + 'b'; i += 1; }" },
+	{ "lists",
+	  "let i = 0; let l = null;\n"
+	  "while (i < 300000) { l = [i, [i, 'x' + 'y']]; i += 1; }" },
+	{ "calls",
+	  "function fib(n) {\n"
+	  "  if (n < 2) return n;\n"
+	  "  return fib(n - 1) + fib(n - 2);\n"
+	  "}\n"
+	  "fib(24);" },
+	{ "deep",
+	  "function d(n) { if (n == 0) return 0; return d(n - 1) + 1; }\n"
+	  "let i = 0; while (i < 200) { d(500); i += 1; }" },
+};
+
+// clang-format on
+
+struct Result
+{
+	double seconds;
+	long max_rss_kb;
+};
+
+static void run_child(const std::string &code, size_t nursery_size,
+                      bool pooled)
+{
+	std::stringstream src(code), bc, out;
+	compile(src, "<bench>", bc);
+	auto bytes = bc.str();
+	std::cout.rdbuf(out.rdbuf());
+	VM vm(reinterpret_cast<const Uint8 *>(bytes.data()), bytes.size());
+	vm.heap.resize_nursery(nursery_size);
+	if (!pooled)
+		vm.heap.disable_pool();
+	std::_Exit(vm.execute());
+}
+
+static bool run(const std::string &code, size_t nursery_size, bool pooled,
+                Result &result)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0)
+		run_child(code, nursery_size, pooled);
+	int status = 0;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) != pid)
+		return false;
+	std::chrono::duration<double> elapsed =
+	    std::chrono::steady_clock::now() - start;
+	result.seconds = elapsed.count();
+	result.max_rss_kb = usage.ru_maxrss;
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main()
+{
+	std::printf("%-10s %13s %13s %13s %13s %13s %13s\n", "benchmark",
+	            "new (s)", "pool (s)", "nursery (s)", "new (KiB)",
+	            "pool (KiB)", "nursery (KiB)");
+	for (auto &bench : benchmarks)
+	{
+		Result plain, pooled, young;
+		if (!run(bench.code, 0, false, plain) ||
+		    !run(bench.code, 0, true, pooled) ||
+		    !run(bench.code, Heap::NURSERY_SIZE, true, young))
+		{
+			std::fprintf(stderr, "benchmark '%s' failed\n", bench.name);
+			return 1;
+		}
+		std::printf("%-10s %13.3f %13.3f %13.3f %13ld %13ld %13ld\n",
+		            bench.name, plain.seconds, pooled.seconds, young.seconds,
+		            plain.max_rss_kb, pooled.max_rss_kb, young.max_rss_kb);
+	}
+	return 0;
+}
@@ -0,0 +1,561 @@
+// test_vm.cpp - This file is part of Pop
+// Copyright (c) 2016, Matthew Brush <mbrush@codebrainz.ca>
+// All rights reserved.
+// Licensed under the 2-clause BSD license, see LICENSE file.
+
+#ifdef HAVE_CONFIG_H
+#include <pop/config.h>
+#endif
+
+#include <pop/pop.hpp>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Pop;
+
+struct TestProgram
+{
+	std::string code;
+	std::string output;
+};
+
+// clang-format off
+
+static const TestProgram test_programs[] =
+{
+	{ "print(1);", "1\n" },
+	{ "print(1-3);", "-2\n" },
+	{ "print(2*3+1);", "7\n" },
+	{ "print('a'+'b');", "'ab'\n" },
+	{ "print(1); print(2);", "1\n2\n" },
+	{ "let l = [1,2,'a']; print(l);", "[1, 2, 'a']\n" },
+	{ "let x = 5; print(x);", "5\n" },
+	{ "if (1 == 1) print('yes'); else print('no');", "'yes'\n" },
+	{ "if (1 == 2) print('yes'); else print('no');", "'no'\n" },
+	{ "function sum(a, b) { return a + b; } print(sum(2,1));", "3\n" },
+	{ "function fib(n) {\n"
+	  "  if (n == 0) return 0;\n"
+	  "  else if (n == 1) return 1;\n"
+	  "  else return (fib(n-1) + fib(n-2));\n"
+	  "}\n"
+	  "print(fib(16));", "987\n" },
+	{ "let n = 4; if (n == 4) print(n + 1); print(n - 2);", "5\n2\n" },
+	{ "function f(x) { print(x); return x; } f(3); print(f(4) * 2);",
+	  "3\n4\n8\n" },
+	{ "print(1.5 + 2.0); print('b' > 'a'); print(2 != 2);",
+	  "3.500000\nTrue\nFalse\n" },
+	{ "function add(a, b) { return a + b; }\n"
+	  "print(add(1, 2)); print(add(0.5, 0.25)); print(add('a', 'b'));\n"
+	  "print(add(1, 0.5)); print(add(3, 4));",
+	  "3\n0.750000\n'ab'\n1.500000\n7\n" },
+	{ "function lt(a, b) { if (a < b) return 1; return 0; }\n"
+	  "print(lt(1, 2)); print(lt(2.5, 1.5)); print(lt('a', 'b'));",
+	  "1\n0\n1\n" },
+	{ "let i = 0; while (i < 5) i += 1; print(i);", "5\n" },
+	{ "let i = 3; until (i == 0) i -= 1; print(i);", "0\n" },
+	{ "let i = 1; let j = i; i += 1; print(i); print(j);", "2\n1\n" },
+	{ "let i = 1; let k = i++; print(k); print(i); print(--i); i = 7; "
+	  "print(i);", "1\n2\n1\n7\n" },
+	{ "let s = 'a'; let t = s; s += 'b'; print(s); print(t);",
+	  "'ab'\n'a'\n" },
+	{ "let big = 140737488355327; print(big + 1); print(big + 1 - 1);",
+	  "140737488355328\n140737488355327\n" },
+	// Int arithmetic wraps instead of trapping, powers included
+	{ "let m = -9223372036854775807 - 1; let d = -1; print(m / d);\n"
+	  "print(m % d); print(2**64); print(3**41); print(2**-1);",
+	  "-9223372036854775808\n0\n0\n-420491770248316829\n0\n" },
+	{ "print(0.0 / 0.0 == 0.0 / 0.0); print(-3 * 2.5);",
+	  "False\n-7.500000\n" },
+	// enough garbage for several collections, the live values must survive
+	{ "let keep = [1, 'a']; function f(n) { return [n, 'x' + 'y']; }\n"
+	  "let i = 0; let l = null;\n"
+	  "while (i < 30000) { l = f(i); i += 1; }\n"
+	  "print(keep); print(l); print(f(1));",
+	  "[1, 'a']\n[29999, 'xy']\n[1, 'xy']\n" },
+	// deep enough to fill the nursery with live environments mid-call
+	{ "let keep = [[1], 'x' + 'y'];\n"
+	  "function d(n) {\n"
+	  "  if (n == 0) return 0;\n"
+	  "  let l = [n, 'a' + 'b'];\n"
+	  "  return d(n - 1) + n;\n"
+	  "}\n"
+	  "print(d(3000)); print(keep);",
+	  "4501500\n[[1], 'xy']\n" },
+	// locals, names from enclosing functions and globals
+	{ "let g = 5;\n"
+	  "function outer(a) {\n"
+	  "  let b = 10;\n"
+	  "  function inner(c) { b += c; g = g + c; return a + b + c; }\n"
+	  "  print(inner(1)); print(inner(2));\n"
+	  "  return b;\n"
+	  "}\n"
+	  "print(outer(100)); print(g);",
+	  "112\n115\n13\n8\n" },
+	{ "function f(n) { let r = 0; if (n > 0) { let r = n; print(r); }\n"
+	  "  return r; }\n"
+	  "function counter() { let n = 0; function inc() { n++; return n; }\n"
+	  "  return inc; }\n"
+	  "print(f(7)); let c = counter(); c(); print(c());",
+	  "7\n0\n2\n" },
+	// literals are pooled and shared, pushing them mustn't alias anything
+	{ "function f() { return 'x'; } let s = f(); s += f(); print(s);\n"
+	  "print(f()); print(2.5 + 2.5); print(2 + 140737488355327);",
+	  "'xx'\n'x'\n5.000000\n140737488355329\n" },
+	// tail calls reuse the frame, so they can go deeper than the call stack
+	{ "function sum(n, acc) {\n"
+	  "  if (n == 0) return acc;\n"
+	  "  return sum(n - 1, acc + n);\n"
+	  "}\n"
+	  "function outer() {\n"
+	  "  function loop(n) { if (n == 0) return 'done'; return loop(n - 1); }\n"
+	  "  return loop(70000);\n"
+	  "}\n"
+	  "function p(x) { return print(x); }\n"
+	  "print(sum(100000, 0)); print(outer()); p(3);",
+	  "5000050000\n'done'\n3\n" },
+	// but not the scope of one a closure has captured
+	{ "function f(n, g) { function h() { return n; }\n"
+	  "  if (n == 0) return g; return f(n - 1, h); }\n"
+	  "let h = f(3, null); print(h());",
+	  "1\n" },
+	// ints either side of where their immediates need another byte
+	{ "print(63); print(64); print(-64); print(-65); print(2147483647);\n"
+	  "print(-2147483648); print(2147483648); print(-2147483649);",
+	  "63\n64\n-64\n-65\n2147483647\n-2147483648\n2147483648\n"
+	  "-2147483649\n" },
+	// loops whose branches, types and ints change from one time round to
+	// the next
+	{ "function f(n) {\n"
+	  "  let s = 0; let x = 0; let i = 0;\n"
+	  "  while (i < n) {\n"
+	  "    if (i % 2 == 0) s += i; else s -= 1;\n"
+	  "    if (i == 50) x = x + 0.5;\n"
+	  "    x = x + 1; i = i + 1;\n"
+	  "  }\n"
+	  "  print(s); return x;\n"
+	  "}\n"
+	  "print(f(100)); print(f(3));\n"
+	  "function g() { let x = 1; let i = 0;\n"
+	  "  do { x = x * 2; i = i + 1; } while (i < 60); return x; }\n"
+	  "print(g());",
+	  "2400\n100.500000\n1\n3\n1152921504606846976\n" },
+	{ "function t() { let t = 0; let i = 0;\n"
+	  "  do { let j = 0; while (j < i) { t += j; j += 1; } i += 1; }\n"
+	  "  while (i < 10);\n"
+	  "  let k = 0; while (true) { k += 1; if (k > 5) break; }\n"
+	  "  return t + k; }\n"
+	  "print(t());",
+	  "126\n" },
+	{ "print(-(2**3) + 7 % 4 * 1.5); print(~5 & 15); print(2**62);\n"
+	  "print('a' + 'b' == 'ab'); print(!!(1 < 2)); print(5 if 0 else 6);\n"
+	  "if (!1) print(1 / 0); else print(2); unless (null) print(3);\n"
+	  "let x = 4; print(x * 1 + 0); print(x - 0.0); print(!!(x - 4));",
+	  "-3.500000\n10\n4611686018427387904\nTrue\nTrue\n6\n2\n3\n4\n"
+	  "4.000000\nFalse\n" },
+	{ "function f(x) { let y = x * 2; if (x > 1) return x; else return 0;\n"
+	  "  print(y); }\n"
+	  "let i = 0; while (true) { i += 1; if (i > 3) break; } print(f(i));\n"
+	  "until (false) { i -= 1; if (i < 0) break; } print(i);",
+	  "4\n-1\n" },
+	{ "function f(a, b) { let x = a * b; let i = 0; let s = 0;\n"
+	  "  while (i < 4) { let t = a; a = b; b = t; s += a * b + x; i++; }\n"
+	  "  print(a - b); return s + (x if s > 0 else -x); }\n"
+	  "print(f(2, 5));\n"
+	  "function g(x) { let y = 0; print((y = x + 1) + y); let z = y++;\n"
+	  "  print(z * y); return (1 if x > 2 else (2 if x > 1 else 3)) + y; }\n"
+	  "print(g(1)); print(g(3));",
+	  "-3\n90\n2\n6\n6\n4\n20\n6\n" },
+	// folding away an if mustn't give the ifs left the same labels
+	{ "let x = 1; if (x) { if (x) print(1); } if (true) { if (x) print(2); }\n"
+	  "{ if (x) print(3); } { if (x) print(4); }",
+	  "1\n2\n3\n4\n" },
+	// nor can folding trap where running wouldn't
+	{ "function never() { return (-9223372036854775807 - 1) / -1; }\n"
+	  "print((-9223372036854775807 - 1) % -1);",
+	  "0\n" },
+};
+
+// clang-format on
+
+static std::string
+run_program(const std::string &code,
+            size_t stack_size = ValueStack::DEFAULT_SIZE,
+            Uint32 hot_calls = Jit::HOT_CALLS,
+            Uint32 hot_loops = Jit::HOT_LOOPS,
+            unsigned int opt_level = DEFAULT_OPT_LEVEL)
+{
+	std::stringstream src(code), bc, out;
+	compile(src, "<test>", bc, opt_level);
+	auto bytes = bc.str();
+	auto old_buf = std::cout.rdbuf(out.rdbuf());
+	try
+	{
+		VM vm(reinterpret_cast<const Uint8 *>(bytes.data()), bytes.size());
+		vm.stack.resize(stack_size);
+		vm.jit.hot_calls = hot_calls;
+		vm.jit.hot_loops = hot_loops;
+		vm.execute();
+	}
+	catch (...)
+	{
+		std::cout.rdbuf(old_buf);
+		throw;
+	}
+	std::cout.rdbuf(old_buf);
+	return out.str();
+}
+
+// whether the image is rejected when it's loaded
+static bool rejected(const std::string &bytes)
+{
+	try
+	{
+		VM vm(reinterpret_cast<const Uint8 *>(bytes.data()), bytes.size());
+	}
+	catch (RuntimeError &)
+	{
+		return true;
+	}
+	return false;
+}
+
+static bool rejected(InstructionList &ops)
+{
+	std::stringstream bc;
+	assemble(ops, bc);
+	return rejected(bc.str());
+}
+
+int main()
+{
+	int failures = 0;
+	// each is run again with every function compiled when it's first
+	// called, and again with every loop recorded the first time round, all
+	// of it optimized as much as it is by default and as much as it can be
+	const Uint32 thresholds[][3] = {
+		{ Jit::HOT_CALLS, Jit::HOT_LOOPS, DEFAULT_OPT_LEVEL },
+		{ 1, Jit::HOT_LOOPS, DEFAULT_OPT_LEVEL },
+		{ Jit::HOT_CALLS, 1, DEFAULT_OPT_LEVEL },
+		{ Jit::HOT_CALLS, Jit::HOT_LOOPS, MAX_OPT_LEVEL },
+		{ 1, Jit::HOT_LOOPS, MAX_OPT_LEVEL },
+		{ Jit::HOT_CALLS, 1, MAX_OPT_LEVEL }
+	};
+	for (auto &hot : thresholds)
+	{
+		for (auto &test : test_programs)
+		{
+			try
+			{
+				auto output = run_program(test.code, ValueStack::DEFAULT_SIZE,
+				                          hot[0], hot[1], hot[2]);
+				if (output != test.output)
+				{
+					std::cerr << "wrong output for '" << test.code
+					          << "'. Expected '" << test.output << "' got '"
+					          << output << "'" << std::endl;
+					failures++;
+				}
+			}
+			catch (Error &e)
+			{
+				std::cerr << "error running '" << test.code
+				          << "': " << e.what() << std::endl;
+				failures++;
+			}
+		}
+	}
+
+	// separately compiled modules, linked to share their globals
+	std::stringstream lib_src("let n = 3; function twice(x) { return x * 2; }"),
+	    main_src("print(twice(n + 0.5)); if (n > 2) print('big');"), lib, main;
+	compile(lib_src, "<lib>", lib);
+	compile(main_src, "<main>", main);
+	auto lib_bc = lib.str(), main_bc = main.str();
+	std::vector<Image> modules;
+	modules.emplace_back(reinterpret_cast<const Uint8 *>(lib_bc.data()),
+	                     lib_bc.size());
+	modules.emplace_back(reinterpret_cast<const Uint8 *>(main_bc.data()),
+	                     main_bc.size());
+	std::stringstream linked, out;
+	link(modules, linked);
+	auto linked_bc = linked.str();
+	auto old_buf = std::cout.rdbuf(out.rdbuf());
+	VM(reinterpret_cast<const Uint8 *>(linked_bc.data()), linked_bc.size())
+	    .execute();
+	std::cout.rdbuf(old_buf);
+	if (out.str() != "7.000000\n'big'\n")
+	{
+		std::cerr << "wrong output for linked modules, got '" << out.str()
+		          << "'" << std::endl;
+		failures++;
+	}
+
+	// cached images are found by their source's contents only
+	char cache_dir[] = "/tmp/pop-test-cache-XXXXXX";
+	if (mkdtemp(cache_dir))
+	{
+		CodeCache cache(std::string(cache_dir) + "/images");
+		auto key = CodeCache::key("print(1);");
+		auto found = cache.store(key, lib_bc) && cache.find(key) &&
+		             !cache.find(CodeCache::key("print(2);"));
+		std::remove((std::string(cache_dir) + "/images/" + key + ".pbc")
+		                .c_str());
+		std::remove((std::string(cache_dir) + "/images").c_str());
+		std::remove(cache_dir);
+		if (!found)
+		{
+			std::cerr << "cached image wasn't found" << std::endl;
+			failures++;
+		}
+	}
+
+	// constant expressions are folded before they're compiled, except for
+	// those which throw, which still do when they're run
+	std::stringstream folded_src("print(1 - 3); print(2 * (4 + 1.5));");
+	auto folded = parse(folded_src, "<test>");
+	optimize(folded);
+	for (auto &op : transform(folded))
+	{
+		if (op->code == OpCode::OP_SUB || op->code == OpCode::OP_MUL ||
+		    op->code == OpCode::OP_ADD)
+		{
+			std::cerr << "constant expression wasn't folded" << std::endl;
+			failures++;
+		}
+	}
+	try
+	{
+		run_program("print(1 / 0);");
+		std::cerr << "folded division by zero didn't throw" << std::endl;
+		failures++;
+	}
+	catch (RuntimeError &)
+	{
+	}
+
+	// the peephole pass drops code which can't run and stores which aren't
+	// used, still ending with the HALT the linker looks for
+	std::stringstream peephole_src("function f(x) { let y = x; return x; "
+	                               "print(y); } while (true) { f(1); break; }");
+	auto peephole_mod = parse(peephole_src, "<test>");
+	PeepholeStats peephole;
+	auto peephole_ops = compile_ops(peephole_mod, DEFAULT_OPT_LEVEL, &peephole);
+	if (peephole.unreachable_code == 0 || peephole.dead_stores != 1 ||
+	    peephole.constant_branches == 0 ||
+	    peephole_ops.back()->code != OpCode::OP_HALT)
+	{
+		std::cerr << "peephole pass didn't simplify the ops" << std::endl;
+		peephole.report(std::cerr);
+		failures++;
+	}
+
+	// a conditional jump to the next op still pops its condition, and is
+	// counted like any other jump to the next op
+	InstructionList to_next;
+	to_next.push_back(mkop<LoadGlobal>("x"));
+	to_next.push_back(mkop<JumpFalse>("next"));
+	to_next.push_back(mkop<Label>("next"));
+	to_next.push_back(mkop<Halt>());
+	if (optimize_peephole(to_next).jumps_to_next != 1)
+	{
+		std::cerr << "conditional jump to the next op wasn't counted"
+		          << std::endl;
+		failures++;
+	}
+
+	// it can't tell which of two labels with the same name a jump is to
+	InstructionList twice_labelled;
+	twice_labelled.push_back(mkop<Jump>("l"));
+	twice_labelled.push_back(mkop<Label>("l"));
+	twice_labelled.push_back(mkop<Label>("l"));
+	twice_labelled.push_back(mkop<Halt>());
+	try
+	{
+		optimize_peephole(twice_labelled);
+		std::cerr << "duplicate labels were optimized" << std::endl;
+		failures++;
+	}
+	catch (RuntimeError &)
+	{
+	}
+
+	// in SSA form the product computed again, and again in the loop, is
+	// only computed once, and the unused one not at all
+	std::stringstream ssa_src("function f(a, b) { let x = a * b; let y = 0;\n"
+	                          "  while (y < 9) y += a * b; let z = a * b;\n"
+	                          "  return x + y; }");
+	auto ssa_mod = parse(ssa_src, "<test>");
+	size_t products = 0;
+	for (auto &op : compile_ops(ssa_mod, MAX_OPT_LEVEL))
+		products += (op->code == OpCode::OP_MUL);
+	if (products != 1)
+	{
+		std::cerr << "SSA passes left " << products << " products"
+		          << std::endl;
+		failures++;
+	}
+
+	// code which would underflow the stack is rejected when it's loaded
+	InstructionList ops;
+	ops.push_back(mkop<PushInt>(1));
+	ops.push_back(mkop<BinOp>(OpCode::OP_ADD));
+	ops.push_back(mkop<Halt>());
+	std::stringstream unbalanced;
+	assemble(ops, unbalanced);
+	auto unbalanced_bc = unbalanced.str();
+	try
+	{
+		VM vm(reinterpret_cast<const Uint8 *>(unbalanced_bc.data()),
+		      unbalanced_bc.size());
+		std::cerr << "unbalanced stack was verified" << std::endl;
+		failures++;
+	}
+	catch (RuntimeError &)
+	{
+	}
+
+	// and so is code using slots and scopes which aren't there, since the
+	// VM doesn't check them
+	InstructionList in_scope, past_slot, past_int_slot, past_depth, unopened;
+	in_scope.push_back(mkop<OpenScope>(1));
+	in_scope.push_back(mkop<PushInt>(1));
+	in_scope.push_back(mkop<LocalOp>(OpCode::OP_STORE_LOCAL, 0));
+	in_scope.push_back(mkop<LocalOp>(OpCode::OP_LOAD_LOCAL, 0));
+	in_scope.push_back(mkop<PopTop>());
+	in_scope.push_back(mkop<CloseScope>());
+	in_scope.push_back(mkop<Halt>());
+	past_slot.push_back(mkop<OpenScope>(1));
+	past_slot.push_back(mkop<LocalOp>(OpCode::OP_LOAD_LOCAL, 1));
+	past_slot.push_back(mkop<PopTop>());
+	past_slot.push_back(mkop<Halt>());
+	past_int_slot.push_back(mkop<LocalIntOp>(OpCode::OP_ADD_LOCAL_INT, 0, 1));
+	past_int_slot.push_back(mkop<PopTop>());
+	past_int_slot.push_back(mkop<Halt>());
+	past_depth.push_back(mkop<OpenScope>(1));
+	past_depth.push_back(mkop<UpvalueOp>(OpCode::OP_LOAD_UPVALUE, 2, 0));
+	past_depth.push_back(mkop<PopTop>());
+	past_depth.push_back(mkop<Halt>());
+	unopened.push_back(mkop<CloseScope>());
+	unopened.push_back(mkop<Halt>());
+	if (rejected(in_scope) || !rejected(past_slot) ||
+	    !rejected(past_int_slot) || !rejected(past_depth) ||
+	    !rejected(unopened))
+	{
+		std::cerr << "slots or scopes weren't verified" << std::endl;
+		failures++;
+	}
+
+	// as are operands cut off by the end of their section
+	std::stringstream truncated_code, truncated_const;
+	ImageWriter code_writer, const_writer;
+	code_writer.add_section(SectionKind::CODE,
+	                        std::string{ char(OpCode::OP_CALL_SYMBOL),
+	                                     char(0x80), char(0x00) });
+	code_writer.add_section(SectionKind::SYMBOLS,
+	                        std::string("\x01\x00\x00\x00\x01" "f", 6));
+	code_writer.write(truncated_code);
+	const_writer.add_section(SectionKind::CODE,
+	                         std::string(1, char(OpCode::OP_HALT)));
+	const_writer.add_section(SectionKind::CONSTANTS,
+	                         std::string("\x01\x00\x00\x00\x00\x01\x02", 7));
+	const_writer.write(truncated_const);
+	if (!rejected(truncated_code.str()) || !rejected(truncated_const.str()))
+	{
+		std::cerr << "truncated operand was loaded" << std::endl;
+		failures++;
+	}
+
+	// and PUSH_INT immediates too big for 32 bits, which would be boxed
+	// into Values that nothing traces
+	std::stringstream wide_int, widest_int;
+	ImageWriter wide_writer, widest_writer;
+	wide_writer.add_section(
+	    SectionKind::CODE,
+	    std::string{ char(OpCode::OP_PUSH_INT), char(0x87), char(0x80),
+	                 char(0x80), char(0x80), char(0x80), char(0x80),
+	                 char(0x80), char(0x02), char(OpCode::OP_POP_TOP) });
+	wide_writer.write(wide_int);
+	widest_writer.add_section(
+	    SectionKind::CODE,
+	    std::string{ char(OpCode::OP_PUSH_INT), char(0xFF), char(0xFF),
+	                 char(0xFF), char(0xFF), char(0x07),
+	                 char(OpCode::OP_POP_TOP) });
+	widest_writer.write(widest_int);
+	if (!rejected(wide_int.str()) || rejected(widest_int.str()))
+	{
+		std::cerr << "PUSH_INT immediates weren't range checked" << std::endl;
+		failures++;
+	}
+
+	// a function calling itself in tail position reuses its scope rather
+	// than allocating another each time round
+	std::stringstream self_src("function sum(n, acc) {\n"
+	                           "  if (n == 0) return acc;\n"
+	                           "  return sum(n - 1, acc + n);\n"
+	                           "}\n"
+	                           "sum(100000, 0);"),
+	    self_bc;
+	compile(self_src, "<test>", self_bc);
+	auto self_bytes = self_bc.str();
+	VM self_vm(reinterpret_cast<const Uint8 *>(self_bytes.data()),
+	           self_bytes.size());
+	self_vm.execute();
+	if (self_vm.heap.stats().allocated > 100)
+	{
+		std::cerr << "self tail calls allocated "
+		          << self_vm.heap.stats().allocated << " values" << std::endl;
+		failures++;
+	}
+
+	// runaway recursion stops at the call stack's limit
+	try
+	{
+		run_program("function r(n) { return 1 + r(n + 1); } r(0);");
+		std::cerr << "runaway recursion didn't overflow" << std::endl;
+		failures++;
+	}
+	catch (RuntimeError &)
+	{
+	}
+
+	// and so do values piling up on a stack too small to hold them
+	const char *deep = "function d(n) { if (n == 0) return 0; "
+	                   "return d(n - 1) + n; } print(d(50));";
+	if (run_program(deep, 200) != "1275\n")
+	{
+		std::cerr << "wrong output for a deep call on a small stack"
+		          << std::endl;
+		failures++;
+	}
+	try
+	{
+		run_program(deep, 20);
+		std::cerr << "small value stack didn't overflow" << std::endl;
+		failures++;
+	}
+	catch (RuntimeError &)
+	{
+	}
+
+	// a damaged image must be rejected before anything runs
+	std::stringstream src("print(1);"), bc;
+	compile(src, "<test>", bc);
+	auto bytes = bc.str();
+	bytes.back() ^= 1;
+	try
+	{
+		VM vm(reinterpret_cast<const Uint8 *>(bytes.data()), bytes.size());
+		std::cerr << "corrupt image was loaded" << std::endl;
+		failures++;
+	}
+	catch (RuntimeError &)
+	{
+	}
+
+	return (failures == 0) ? 0 : 1;
+}